@@ -0,0 +1,837 @@
+/*
+ * Mobi Protocol - Benchmarks
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ *
+ * Usage: bench_mobi [keys] [search_max]
+ *
+ * search_max caps the sorted-search sizes (1M to 1B mobis, default 100M).
+ *
+ * Throughput per ISA level. Each level is forced with mobi_cpu_restrict()
+ * and skipped when the host does not support it; single-key latency is
+ * measured once more with every detected feature, as callers get it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "mobi.h"
+#include "mobi_internal.h"
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Deterministic pseudo-random pubkeys (xorshift64) */
+static void fill_pubkeys(uint8_t *out, size_t count, uint64_t seed) {
+    size_t i;
+    for (i = 0; i < count * 32; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        out[i] = (uint8_t)(seed >> 24);
+    }
+}
+
+static void report(const char *what, const char *isa, size_t n, double secs) {
+    printf("  %-22s %-8s %8.3f M/s  %7.1f ns/op\n",
+           what, isa, (double)n / secs / 1e6, secs * 1e9 / (double)n);
+}
+
+/* ============================================================================
+ * DERIVATION
+ * ============================================================================ */
+
+static const struct {
+    const char *name;
+    unsigned mask;
+} isa_levels[] = {
+    { "scalar", 0 },
+    { "sha-ni", MOBI_CPU_SHANI },
+    { "avx2",   MOBI_CPU_AVX2 },
+    { "avx512", MOBI_CPU_AVX512 },
+};
+
+/* Single-key latency, sequential against speculative, at the current dispatch */
+static void bench_latency(const uint8_t *keys, size_t n, mobi_t *out, const char *isa) {
+    size_t i;
+    double t;
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        mobi_derive_bytes(keys + i * 32, &out[i]);
+    }
+    report("mobi_derive_bytes", isa, n, now_sec() - t);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        mobi_derive_bytes_speculative(keys + i * 32, &out[i]);
+    }
+    report("speculative (latency)", isa, n, now_sec() - t);
+}
+
+static void bench_derive(const uint8_t *keys, size_t n, mobi_t *out, mobi_bin_t *bins) {
+    unsigned detected = mobi_cpu_features();
+    size_t l;
+    double t;
+
+    printf("Derivation (%zu keys):\n", n);
+    for (l = 0; l < sizeof(isa_levels) / sizeof(isa_levels[0]); l++) {
+        if ((isa_levels[l].mask & detected) != isa_levels[l].mask) {
+            continue;
+        }
+        mobi_cpu_restrict(isa_levels[l].mask);
+
+        bench_latency(keys, n, out, isa_levels[l].name);
+
+        t = now_sec();
+        mobi_derive_batch(keys, n, out);
+        report("mobi_derive_batch", isa_levels[l].name, n, now_sec() - t);
+
+        t = now_sec();
+        mobi_derive_batch_bin(keys, n, bins);
+        report("mobi_derive_batch_bin", isa_levels[l].name, n, now_sec() - t);
+    }
+    mobi_cpu_restrict(~0u);
+
+    /* Every detected feature at once, as callers get it */
+    bench_latency(keys, n, out, "default");
+}
+
+/*
+ * Thread scaling of mobi_derive_batch_bin_mt at the widest ISA: doubling
+ * worker counts up to the online CPU count, plus one oversubscribed run.
+ */
+static void bench_threads(const uint8_t *keys, size_t n, mobi_bin_t *bins) {
+    int cpus = mobi_pool_threads(0);
+    char label[32];
+    double t, base = 0.0;
+    int threads;
+
+    printf("\nThread scaling (%zu keys, %d online CPUs):\n", n, cpus);
+    for (threads = 1; ; threads *= 2) {
+        double secs;
+
+        if (threads > cpus) {
+            threads = cpus * 2;
+        }
+        t = now_sec();
+        mobi_derive_batch_bin_mt(keys, n, bins, threads);
+        secs = now_sec() - t;
+        if (threads == 1) {
+            base = secs;
+        }
+        snprintf(label, sizeof(label), "batch_bin_mt x%d", threads);
+        report(label, "best", n, secs);
+        printf("  %-22s %-8s %8.2fx\n", "", "speedup", base / secs);
+        if (threads >= cpus * 2) {
+            break;
+        }
+    }
+}
+
+/* ============================================================================
+ * SHA-256 KERNELS
+ * ============================================================================ */
+
+/* Raw one-block compressions per second, independent of rejection logic */
+static void bench_kernels(void) {
+    static uint32_t w[16 * 16];
+    static uint32_t digest[3 * 16];
+    const size_t passes = 200000;
+    uint32_t block[16];
+    uint32_t out[3] = {0, 0, 0};
+    size_t i;
+    double t;
+
+    for (i = 0; i < 16 * 16; i++) {
+        w[i] = (uint32_t)(i * 0x9e3779b9u);
+    }
+    for (i = 0; i < 16; i++) {
+        block[i] = (uint32_t)(i * 0x5a5a5a5au);
+    }
+
+    printf("SHA-256 one-block kernels:\n");
+
+#if MOBI_X86
+    if (mobi_cpu_features() & MOBI_CPU_SHANI) {
+        t = now_sec();
+        for (i = 0; i < passes; i++) {
+            block[0] += out[0];
+            mobi_sha256_block_shani(block, out);
+        }
+        report("compress x1", "sha-ni", passes, now_sec() - t);
+    }
+    if (mobi_cpu_features() & MOBI_CPU_AVX2) {
+        t = now_sec();
+        for (i = 0; i < passes; i++) {
+            w[0] += digest[0];
+            mobi_sha256_x8_avx2(w, digest);
+        }
+        report("compress x8", "avx2", passes * 8, now_sec() - t);
+    }
+    if (mobi_cpu_features() & MOBI_CPU_AVX512) {
+        t = now_sec();
+        for (i = 0; i < passes; i++) {
+            w[0] += digest[0];
+            mobi_sha256_x16_avx512(w, digest);
+        }
+        report("compress x16", "avx512", passes * 16, now_sec() - t);
+    }
+#else
+    (void)block; (void)out; (void)passes; (void)t;
+    printf("  (no accelerated kernels on this platform)\n");
+#endif
+    printf("\n");
+}
+
+/* ============================================================================
+ * FORMATTING
+ * ============================================================================ */
+
+static void bench_format(const mobi_t *mobis, const mobi_bin_t *bins, size_t n) {
+    char buf[MOBI_FULL_FMT_LEN + 1];
+    char *batch = malloc(n * (MOBI_FULL_FMT_LEN + 1));
+    size_t i, sink = 0;
+    double t;
+
+    printf("\nFormatting (%zu mobis, 21-digit hyphenated):\n", n);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        mobi_format_full(&mobis[i], buf);
+        sink += (size_t)buf[4];
+    }
+    report("mobi_format_full", "-", n, now_sec() - t);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        mobi_bin_format(&bins[i], 21, buf);
+        sink += (size_t)buf[4];
+    }
+    report("mobi_bin_format", "-", n, now_sec() - t);
+
+    if (batch != NULL) {
+        memset(batch, 0, n * (MOBI_FULL_FMT_LEN + 1));   /* fault pages in first */
+        t = now_sec();
+        sink += mobi_bin_format_batch(bins, n, 21, 1, '\n', batch);
+        report("mobi_bin_format_batch", "-", n, now_sec() - t);
+        free(batch);
+    }
+
+    if (sink == 0) {
+        printf("  (unreachable)\n");
+    }
+}
+
+/* ============================================================================
+ * HEX DECODING
+ * ============================================================================ */
+
+static void bench_hex(const uint8_t *keys, size_t n) {
+    static const struct {
+        const char *name;
+        unsigned mask;
+    } levels[] = {
+        { "scalar", 0 },
+        { "sse4.1", MOBI_CPU_SSE41 },
+        { "avx2",   MOBI_CPU_AVX2 },
+    };
+    static const char digits[] = "0123456789abcdef";
+    unsigned detected = mobi_cpu_features();
+    char *text = malloc(n * 65);
+    uint8_t *decoded = malloc(n * 32);
+    size_t i, j, l;
+    double t;
+
+    if (text == NULL || decoded == NULL) {
+        free(text);
+        free(decoded);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < 32; j++) {
+            text[i * 65 + j * 2] = digits[keys[i * 32 + j] >> 4];
+            text[i * 65 + j * 2 + 1] = digits[keys[i * 32 + j] & 0xF];
+        }
+        text[i * 65 + 64] = '\n';
+    }
+    memset(decoded, 0, n * 32);
+
+    printf("\nHex decoding (%zu keys, newline-separated):\n", n);
+    for (l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        if ((levels[l].mask & detected) != levels[l].mask) {
+            continue;
+        }
+        mobi_cpu_restrict(levels[l].mask);
+        t = now_sec();
+        mobi_hex_decode_batch(text, n, 65, decoded);
+        report("mobi_hex_decode_batch", levels[l].name, n, now_sec() - t);
+    }
+    mobi_cpu_restrict(~0u);
+
+    free(text);
+    free(decoded);
+}
+
+/* ============================================================================
+ * FILE INGEST
+ * ============================================================================ */
+
+static int ingest_sink(void *ctx, const uint8_t *keys, const mobi_bin_t *mobis,
+                       size_t count, uint64_t first) {
+    (void)keys;
+    (void)first;
+    *(uint64_t *)ctx += count > 0 ? mobis[count - 1].lo : 0;
+    return 0;
+}
+
+/*
+ * End-to-end file ingest. The file was just written, so it is read from
+ * the page cache: this measures the pipeline, not the disk.
+ */
+static void bench_ingest(const uint8_t *keys, size_t n) {
+    const char *path = "bench_ingest.tmp";
+    mobi_ingest_opts_t opts;
+    uint64_t sink = 0;
+    FILE *f = fopen(path, "wb");
+    double t;
+
+    if (f == NULL || fwrite(keys, 32, n, f) != n) {
+        if (f != NULL) {
+            fclose(f);
+        }
+        return;
+    }
+    fclose(f);
+
+    printf("\nFile ingest (%zu keys, page cache):\n", n);
+    memset(&opts, 0, sizeof(opts));
+    if (mobi_ingest_uring_available()) {
+        t = now_sec();
+        mobi_ingest(path, &opts, ingest_sink, &sink);
+        report("mobi_ingest", "io_uring", n, now_sec() - t);
+    }
+    opts.flags = MOBI_INGEST_PREAD;
+    t = now_sec();
+    mobi_ingest(path, &opts, ingest_sink, &sink);
+    report("mobi_ingest", "pread", n, now_sec() - t);
+
+    remove(path);
+    if (sink == 0) {
+        printf("  (unreachable)\n");
+    }
+}
+
+/* ============================================================================
+ * DIRECTORY
+ * ============================================================================ */
+
+static int entry_order(const void *a, const void *b) {
+    const mobi_entry_t *x = (const mobi_entry_t *)a;
+    const mobi_entry_t *y = (const mobi_entry_t *)b;
+
+    if (x->hi != y->hi) {
+        return x->hi < y->hi ? -1 : 1;
+    }
+    if (x->lo != y->lo) {
+        return x->lo < y->lo ? -1 : 1;
+    }
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static void bench_dir(const mobi_bin_t *bins, size_t n) {
+    uint8_t *levels = malloc(n);
+    mobi_entry_t *e = malloc(n * sizeof(mobi_entry_t));
+    mobi_entry_t *scratch = malloc(n * sizeof(mobi_entry_t));
+    mobi_dir_t dir;
+    double t;
+    size_t i;
+
+    if (levels == NULL || e == NULL || scratch == NULL) {
+        free(levels);
+        free(e);
+        free(scratch);
+        return;
+    }
+    printf("\nDirectory (%zu mobis):\n", n);
+
+    for (i = 0; i < n; i++) {
+        e[i].hi = bins[i].hi;
+        e[i].lo = bins[i].lo;
+        e[i].id = (uint32_t)i;
+    }
+    t = now_sec();
+    qsort(e, n, sizeof(mobi_entry_t), entry_order);
+    report("sort", "qsort", n, now_sec() - t);
+
+    for (i = 0; i < n; i++) {
+        e[i].hi = bins[i].hi;
+        e[i].lo = bins[i].lo;
+        e[i].id = (uint32_t)i;
+    }
+    memset(scratch, 0, n * sizeof(mobi_entry_t));     /* fault it in first */
+    t = now_sec();
+    mobi_sort_entries(e, scratch, n, 0);
+    report("mobi_sort_entries", "radix", n, now_sec() - t);
+
+    t = now_sec();
+    if (mobi_dir_build_mt(&dir, bins, n, 0) == MOBI_OK) {
+        report("mobi_dir_build_mt", "radix", n, now_sec() - t);
+        mobi_dir_free(&dir);
+    }
+
+    t = now_sec();
+    if (mobi_resolve_levels(bins, n, levels, 0) == MOBI_OK) {
+        report("mobi_resolve_levels", "radix", n, now_sec() - t);
+    }
+    free(levels);
+    free(e);
+    free(scratch);
+}
+
+/* Lookups of 12-digit displays of members; returns total matches */
+static size_t lookup_displays(const mobi_dir_t *dir, const char *digits, size_t q) {
+    size_t i, first, count, total = 0;
+
+    for (i = 0; i < q; i++) {
+        if (mobi_lookup(dir, digits + i * MOBI_DISPLAY_LEN, MOBI_DISPLAY_LEN, &first,
+                        &count) == MOBI_OK) {
+            total += count;
+        }
+    }
+    return total;
+}
+
+/*
+ * Directory file: time from open to the first answers, then steady-state
+ * lookups against the mapping and the heap copy. The file was just
+ * written, so "cold" means no pages mapped yet, not an uncached disk.
+ */
+static void bench_dir_file(const uint8_t *keys, const mobi_bin_t *bins, size_t n) {
+    const char *path = "bench_dir.tmp";
+    size_t q = n < 100000 ? n : 100000;
+    char *digits = malloc(q * MOBI_DISPLAY_LEN);
+    char full[MOBI_FULL_LEN + 1];
+    mobi_dir_t dir, mapped;
+    size_t i, sink = 0;
+    double t;
+
+    if (digits == NULL || n == 0 || mobi_dir_build_mt(&dir, bins, n, 0) != MOBI_OK) {
+        free(digits);
+        return;
+    }
+    for (i = 0; i < q; i++) {
+        mobi_bin_to_string(&bins[(i * 7919) % n], MOBI_FULL_LEN, full);
+        memcpy(digits + i * MOBI_DISPLAY_LEN, full, MOBI_DISPLAY_LEN);
+    }
+    printf("\nDirectory file (%zu entries, page cache):\n", n);
+
+    t = now_sec();
+    if (mobi_dir_write(&dir, keys, path) != MOBI_OK) {
+        mobi_dir_free(&dir);
+        free(digits);
+        return;
+    }
+    report("mobi_dir_write", "", n, now_sec() - t);
+
+    t = now_sec();
+    if (mobi_dir_open(&mapped, path, 0) == MOBI_OK) {
+        sink += lookup_displays(&mapped, digits, 1000);
+        printf("  %-31s %8.1f us\n", "open + first 1000 lookups", (now_sec() - t) * 1e6);
+        t = now_sec();
+        sink += lookup_displays(&mapped, digits, q);
+        report("mobi_lookup", "mapped", q, now_sec() - t);
+        mobi_dir_free(&mapped);
+    }
+    t = now_sec();
+    sink += lookup_displays(&dir, digits, q);
+    report("mobi_lookup", "heap", q, now_sec() - t);
+
+    mobi_dir_free(&dir);
+    free(digits);
+    remove(path);
+    if (sink == 0) {
+        printf("  (unreachable)\n");
+    }
+}
+
+/* Registration traffic: every user in, queried, and out again */
+static void bench_registry(const mobi_bin_t *bins, size_t n) {
+    mobi_registry_t reg;
+    size_t i, sink = 0;
+    uint8_t level;
+    double t;
+
+    if (mobi_registry_init(&reg) != MOBI_OK) {
+        return;
+    }
+    printf("\nRegistry (%zu users):\n", n);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        mobi_registry_insert(&reg, &bins[i], (uint32_t)i, NULL, NULL);
+    }
+    report("mobi_registry_insert", "", n, now_sec() - t);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        if (mobi_registry_level(&reg, &bins[i], (uint32_t)i, &level) == MOBI_OK) {
+            sink += level;
+        }
+    }
+    report("mobi_registry_level", "", n, now_sec() - t);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        mobi_registry_remove(&reg, &bins[i], (uint32_t)i, NULL, NULL);
+    }
+    report("mobi_registry_remove", "", n, now_sec() - t);
+
+    mobi_registry_free(&reg);
+    if (sink == 0) {
+        printf("  (unreachable)\n");
+    }
+}
+
+/* Display table: fill, then look every user up by display */
+static void bench_table(const mobi_bin_t *bins, size_t n) {
+    mobi_entry_t out[4];
+    mobi_table_t t;
+    size_t i, sink = 0;
+    double t0;
+
+    if (mobi_table_init(&t, n) != MOBI_OK) {
+        return;
+    }
+    printf("\nDisplay table (%zu users):\n", n);
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        mobi_table_insert(&t, &bins[i], (uint32_t)i);
+    }
+    report("mobi_table_insert", "", n, now_sec() - t0);
+
+    t0 = now_sec();
+    for (i = 0; i < n; i++) {
+        sink += mobi_table_find(&t, bins[(i * 7919) % n].hi, out, 4);
+    }
+    report("mobi_table_find", "", n, now_sec() - t0);
+
+    mobi_table_free(&t);
+    if (sink == 0) {
+        printf("  (unreachable)\n");
+    }
+}
+
+/* Display filter: build, member queries, and the false-positive rate measured */
+static void bench_filter(const mobi_bin_t *bins, size_t n) {
+    uint64_t *displays = malloc(n * sizeof(uint64_t));
+    mobi_filter_t f;
+    size_t i, hits = 0, positives = 0;
+    double t;
+
+    if (displays == NULL) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        displays[i] = bins[i].hi;
+    }
+    printf("\nDisplay filter (%zu displays):\n", n);
+
+    t = now_sec();
+    if (mobi_filter_build(&f, displays, n) != MOBI_OK) {
+        free(displays);
+        return;
+    }
+    report("mobi_filter_build", "", n, now_sec() - t);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        hits += (size_t)mobi_filter_contains(&f, displays[(i * 7919) % n]);
+    }
+    report("mobi_filter_contains", "member", n, now_sec() - t);
+
+    /* Displays shifted by a constant are, with overwhelming odds, not members */
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        positives += (size_t)mobi_filter_contains(&f, (displays[i] + 500000000000ULL) %
+                                                      1000000000000ULL);
+    }
+    report("mobi_filter_contains", "absent", n, now_sec() - t);
+    printf("  %.2f bits/display, %.3f%% false positives\n",
+           (double)f.array_length * 8 / (double)f.count, 100.0 * (double)positives / (double)n);
+
+    mobi_filter_free(&f);
+    free(displays);
+    if (hits == 0) {
+        printf("  (unreachable)\n");
+    }
+}
+
+/* Succinct directory: size against mobi_bin_t and mobi_t, then queries */
+static void bench_ef(const mobi_bin_t *bins, size_t n) {
+    mobi_ef_t ef;
+    mobi_bin_t m;
+    size_t i, first, count, sink = 0;
+    char full[MOBI_FULL_LEN + 1];
+    double t;
+
+    if (n == 0) {
+        return;
+    }
+    printf("\nSuccinct directory (%zu mobis):\n", n);
+    t = now_sec();
+    if (mobi_ef_build(&ef, bins, n, 0) != MOBI_OK) {
+        return;
+    }
+    report("mobi_ef_build", "", n, now_sec() - t);
+    printf("  %.1f bits/mobi (l = %d): %.1f MB vs %.1f MB mobi_bin_t, %.1f MB mobi_t\n",
+           (double)ef.bytes * 8 / (double)n, ef.low_bits, (double)ef.bytes / 1e6,
+           (double)n * sizeof(mobi_bin_t) / 1e6, (double)n * sizeof(mobi_t) / 1e6);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        if (mobi_ef_select(&ef, (i * 7919) % n, &m) == MOBI_OK) {
+            sink += m.lo;
+        }
+    }
+    report("mobi_ef_select", "", n, now_sec() - t);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        sink += mobi_ef_rank(&ef, &bins[(i * 7919) % n]);
+    }
+    report("mobi_ef_rank", "", n, now_sec() - t);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        mobi_bin_to_string(&bins[(i * 7919) % n], MOBI_FULL_LEN, full);
+        if (mobi_ef_lookup(&ef, full, MOBI_DISPLAY_LEN, &first, &count) == MOBI_OK) {
+            sink += count;
+        }
+    }
+    report("mobi_ef_lookup", "display", n, now_sec() - t);
+
+    mobi_ef_free(&ef);
+    if (sink == 0) {
+        printf("  (unreachable)\n");
+    }
+}
+
+/* ============================================================================
+ * SORTED SEARCH
+ * ============================================================================ */
+
+/* Uniform random mobis, xorshift64 */
+static void next_mobi(uint64_t *x, mobi_bin_t *m) {
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    m->hi = *x % 1000000000000ULL;
+    m->lo = (uint32_t)((*x >> 20) % 1000000000u);
+}
+
+/*
+ * n uniform mobis in order, without a sort's scratch space: count them
+ * into n buckets by hi, draw them again into place, insertion-sort each
+ * bucket (about one mobi each). Returns NULL if memory is short.
+ */
+static mobi_bin_t *sorted_uniform(size_t n, uint64_t seed) {
+    uint64_t width = (1000000000000ULL + n - 1) / n, x;
+    mobi_bin_t *a = malloc(n * sizeof(mobi_bin_t));
+    uint32_t *end = calloc(n + 1, sizeof(uint32_t));
+    mobi_bin_t m;
+    size_t i, b;
+
+    if (a == NULL || end == NULL || n > UINT32_MAX) {
+        free(a);
+        free(end);
+        return NULL;
+    }
+    for (i = 0, x = seed; i < n; i++) {
+        next_mobi(&x, &m);
+        end[m.hi / width + 1]++;
+    }
+    for (b = 1; b <= n; b++) {
+        end[b] += end[b - 1];
+    }
+    for (i = 0, x = seed; i < n; i++) {
+        next_mobi(&x, &m);
+        a[end[m.hi / width]++] = m;
+    }
+    /* end[b] is now where bucket b ends */
+    for (b = 0; b < n; b++) {
+        size_t lo = b == 0 ? 0 : end[b - 1], j, k;
+
+        for (j = lo + 1; j < end[b]; j++) {
+            m = a[j];
+            for (k = j; k > lo && mobi_bin_compare(&a[k - 1], &m) > 0; k--) {
+                a[k] = a[k - 1];
+            }
+            a[k] = m;
+        }
+    }
+    free(end);
+    return a;
+}
+
+/*
+ * Binary against interpolation lower bounds over a sorted array, half
+ * member probes and half random values, at each size up to max that fits
+ * in memory (16 bytes per mobi: 1.6 GB at 10^8).
+ */
+static void bench_search(size_t max) {
+    static const size_t sizes[4] = { 1000000, 10000000, 100000000, 1000000000 };
+    static const char *labels[4] = { "1M", "10M", "100M", "1B" };
+    enum { Q = 1000000 };
+    mobi_bin_t *probes = malloc(Q * sizeof(mobi_bin_t));
+    size_t s;
+
+    if (probes == NULL) {
+        return;
+    }
+    printf("\nSorted search (uniform mobis, %d lookups):\n", Q);
+    for (s = 0; s < 4 && sizes[s] <= max; s++) {
+        size_t n = sizes[s], i, sink[3] = { 0, 0, 0 };
+        mobi_bin_t *a = sorted_uniform(n, 0x2545f4914f6cdd1dULL + s);
+        uint64_t x = 0x9e3779b97f4a7c15ULL;
+        double t;
+
+        if (a == NULL) {
+            printf("  %s: out of memory, skipped\n", labels[s]);
+            break;
+        }
+        for (i = 0; i < Q; i++) {
+            next_mobi(&x, &probes[i]);
+            if (i % 2 == 0) {
+                probes[i] = a[(size_t)(x >> 11) % n];
+            }
+        }
+
+        t = now_sec();
+        for (i = 0; i < Q; i++) {
+            sink[0] += mobi_bin_lower_bound(a, n, &probes[i], MOBI_SEARCH_BINARY);
+        }
+        report("binary search", labels[s], Q, now_sec() - t);
+
+        t = now_sec();
+        for (i = 0; i < Q; i++) {
+            sink[1] += mobi_bin_lower_bound(a, n, &probes[i], MOBI_SEARCH_INTERPOLATE);
+        }
+        report("interpolation search", labels[s], Q, now_sec() - t);
+
+        /* At every size, to re-measure where the mode stops bisecting */
+        t = now_sec();
+        for (i = 0; i < Q; i++) {
+            sink[2] += mobi_interp_lower_bound(a, n, &probes[i]);
+        }
+        report("interpolation (always)", labels[s], Q, now_sec() - t);
+
+        if (sink[0] != sink[1] || sink[0] != sink[2]) {
+            printf("  %s: results differ\n", labels[s]);
+        }
+        free(a);
+    }
+    free(probes);
+}
+
+/* ============================================================================
+ * PERFECT HASH
+ * ============================================================================ */
+
+static void bench_mphf(const mobi_bin_t *bins, size_t n) {
+    mobi_mphf_t f;
+    mobi_bin_t m;
+    size_t i, found = 0;
+    uint64_t x = 0x9e3779b97f4a7c15ULL;
+    uint32_t id;
+    double t;
+
+    if (n == 0) {
+        return;
+    }
+    printf("\nPerfect hash (%zu mobis):\n", n);
+    t = now_sec();
+    if (mobi_mphf_build(&f, bins, n, 0) != MOBI_OK) {
+        printf("  build failed (repeated mobis?)\n");
+        return;
+    }
+    report("mobi_mphf_build", "", n, now_sec() - t);
+    printf("  %.2f bits/mobi of hash, %.1f bytes/mobi with keys and ids\n",
+           ((double)f.pilot_bytes * 8 + (double)f.remaps * f.remap_bits +
+            (double)(f.partitions + 1) * 256) / (double)n, (double)f.data_len / (double)n);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        found += mobi_mphf_lookup(&f, &bins[(i * 7919) % n], NULL, &id) == MOBI_OK;
+    }
+    report("mobi_mphf_lookup", "member", n, now_sec() - t);
+
+    t = now_sec();
+    for (i = 0; i < n; i++) {
+        next_mobi(&x, &m);
+        found += mobi_mphf_lookup(&f, &m, NULL, &id) == MOBI_OK;
+    }
+    report("mobi_mphf_lookup", "absent", n, now_sec() - t);
+
+    if (found < n) {
+        printf("  %zu members not found\n", n - found);
+    }
+    mobi_mphf_free(&f);
+}
+
+/* ============================================================================
+ * MAIN
+ * ============================================================================ */
+
+int main(int argc, char **argv) {
+    size_t n = 1000000;
+    uint8_t *keys;
+    mobi_t *out;
+    mobi_bin_t *bins;
+    size_t search_max = 100000000;
+
+    if (argc > 1) {
+        n = (size_t)strtoull(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        search_max = (size_t)strtoull(argv[2], NULL, 10);
+    }
+
+    keys = malloc(n * 32);
+    out = malloc(n * sizeof(mobi_t));
+    bins = malloc(n * sizeof(mobi_bin_t));
+    if (keys == NULL || out == NULL || bins == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    fill_pubkeys(keys, n, 0x9e3779b97f4a7c15ULL);
+
+    printf("Mobi Protocol Benchmarks (features 0x%x)\n", mobi_cpu_features());
+    printf("==========================\n\n");
+
+    bench_kernels();
+    bench_derive(keys, n, out, bins);
+    bench_threads(keys, n, bins);
+    bench_format(out, bins, n);
+    bench_hex(keys, n);
+    bench_ingest(keys, n);
+    bench_dir(bins, n);
+    bench_dir_file(keys, bins, n);
+    bench_registry(bins, n);
+    bench_table(bins, n);
+    bench_filter(bins, n);
+    bench_ef(bins, n);
+    bench_search(search_max);
+    bench_mphf(bins, n);
+
+    free(keys);
+    free(out);
+    free(bins);
+    return 0;
+}
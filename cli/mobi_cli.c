@@ -0,0 +1,516 @@
+/*
+ * Mobi Protocol - Command-Line Deriver
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ *
+ * Usage: mobi [-i hex|raw|corpus] [-o tsv|ndjson] [-H] [-t threads]
+ *             [-O corpus-file | -A arrow-file] [-V] [-P] [file]
+ *
+ * Streams pubkeys from file (or stdin) to one output line per key:
+ *
+ *   tsv     <pubkey hex> TAB <full> TAB <display>
+ *   ndjson  {"pubkey":"<hex>","full":"<full>","display":"<display>"}
+ *
+ * Input is newline-separated hex (CRLF and surrounding blanks are
+ * tolerated, empty lines skipped), back-to-back raw 32-byte records, or a
+ * corpus file (see mobi.h), which is mapped and derived in place.
+ * Keys are decoded into batches, derived with the multithreaded batch
+ * path and formatted into one output buffer per batch; stdio is only
+ * used for whole-buffer reads and writes.
+ *
+ * -O writes the keys to a corpus file with its mobi column instead of
+ * printing them; -A writes them with their mobis to an Arrow IPC file, one
+ * record batch per derived batch. -V checks a corpus's stored mobis
+ * against fresh ones.
+ *
+ * A raw key file named on the command line goes through mobi_ingest, which
+ * keeps reads in flight with io_uring while earlier buffers are hashed;
+ * -P forces its synchronous pread() fallback.
+ *
+ * Exit status: 0 on success, 1 if some input was invalid (reported on
+ * stderr and skipped) or failed verification, 2 on usage or I/O errors.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "mobi.h"
+
+/* Keys derived per batch */
+#define BATCH_KEYS   65536
+
+/* Hex input is read in blocks this large */
+#define READ_BLOCK   (8u << 20)
+
+/* {"pubkey":"<64>","full":"<27>","display":"<15>"}\n */
+#define MAX_LINE_OUT 160
+
+typedef enum { IN_HEX, IN_RAW, IN_CORPUS } in_format;
+typedef enum { OUT_TSV, OUT_NDJSON } out_format;
+
+typedef struct {
+    in_format input;
+    out_format output;
+    int hyphens;
+    int threads;
+    FILE *out;
+    mobi_corpus_writer_t *corpus_out;   /* -O: keys go here instead of out */
+    mobi_arrow_writer_t *arrow_out;     /* -A: records go here instead of out */
+
+    uint8_t *keys;                  /* BATCH_KEYS * 32 */
+    mobi_bin_t *bins;               /* BATCH_KEYS */
+    char *text;                     /* BATCH_KEYS * MAX_LINE_OUT */
+    size_t queued;
+
+    unsigned long long line;        /* hex input line number */
+    unsigned long long invalid;
+    int io_error;
+} cli_t;
+
+static char hex_pairs[512];
+
+/* ============================================================================
+ * OUTPUT
+ * ============================================================================ */
+
+static char *put_str(char *p, const char *s, size_t len) {
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static char *put_hex(char *p, const uint8_t *key) {
+    int i;
+    for (i = 0; i < MOBI_PUBKEY_LEN; i++) {
+        memcpy(p + i * 2, hex_pairs + key[i] * 2, 2);
+    }
+    return p + MOBI_PUBKEY_HEX_LEN;
+}
+
+/* mobi_bin_to_string / mobi_bin_format write a terminator we overwrite */
+static char *put_mobi(const cli_t *c, char *p, const mobi_bin_t *m, int digits) {
+    if (c->hyphens) {
+        mobi_bin_format(m, digits, p);
+        return p + digits + digits / 3 - 1;
+    }
+    mobi_bin_to_string(m, digits, p);
+    return p + digits;
+}
+
+static char *put_record(const cli_t *c, char *p, const uint8_t *key, const mobi_bin_t *m) {
+    if (c->output == OUT_NDJSON) {
+        p = put_str(p, "{\"pubkey\":\"", 11);
+        p = put_hex(p, key);
+        p = put_str(p, "\",\"full\":\"", 10);
+        p = put_mobi(c, p, m, MOBI_FULL_LEN);
+        p = put_str(p, "\",\"display\":\"", 13);
+        p = put_mobi(c, p, m, MOBI_DISPLAY_LEN);
+        p = put_str(p, "\"}\n", 3);
+    } else {
+        p = put_hex(p, key);
+        *p++ = '\t';
+        p = put_mobi(c, p, m, MOBI_FULL_LEN);
+        *p++ = '\t';
+        p = put_mobi(c, p, m, MOBI_DISPLAY_LEN);
+        *p++ = '\n';
+    }
+    return p;
+}
+
+/* Format and write count keys whose mobis are already derived */
+static void write_records(cli_t *c, const uint8_t *keys, const mobi_bin_t *bins, size_t count) {
+    char *p = c->text;
+    size_t i;
+
+    if (c->arrow_out != NULL) {
+        if (mobi_arrow_writer_add(c->arrow_out, keys, bins, count) != MOBI_OK) {
+            c->io_error = 1;
+        }
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        p = put_record(c, p, keys + i * MOBI_PUBKEY_LEN, &bins[i]);
+    }
+    if (fwrite(c->text, 1, (size_t)(p - c->text), c->out) != (size_t)(p - c->text)) {
+        c->io_error = 1;
+    }
+}
+
+/* Derive, format and write count keys */
+static void emit(cli_t *c, const uint8_t *keys, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    if (c->corpus_out != NULL) {
+        if (mobi_corpus_writer_add(c->corpus_out, keys, count) != MOBI_OK) {
+            c->io_error = 1;
+        }
+        return;
+    }
+    /* Cannot fail: every key is 32 bytes and rejection never runs out */
+    mobi_derive_batch_bin_mt(keys, count, c->bins, c->threads);
+    write_records(c, keys, c->bins, count);
+}
+
+/* ============================================================================
+ * INPUT
+ * ============================================================================ */
+
+static int is_blank(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+static void hex_line(cli_t *c, const char *s, size_t len) {
+    c->line++;
+
+    while (len > 0 && is_blank(s[len - 1])) {
+        len--;
+    }
+    while (len > 0 && is_blank(*s)) {
+        s++;
+        len--;
+    }
+    if (len == 0) {
+        return;
+    }
+
+    if (len != MOBI_PUBKEY_HEX_LEN ||
+        mobi_hex_decode_batch(s, 1, 0, c->keys + c->queued * MOBI_PUBKEY_LEN) != MOBI_OK) {
+        fprintf(stderr, "mobi: line %llu: not a 64-character hex pubkey\n", c->line);
+        c->invalid++;
+        return;
+    }
+
+    if (++c->queued == BATCH_KEYS) {
+        emit(c, c->keys, c->queued);
+        c->queued = 0;
+    }
+}
+
+static int read_hex(cli_t *c, FILE *in) {
+    char *buf = malloc(READ_BLOCK);
+    size_t have = 0;
+    int skipping = 0;   /* inside a line longer than the whole buffer */
+
+    if (buf == NULL) {
+        return -1;
+    }
+
+    for (;;) {
+        size_t got = fread(buf + have, 1, READ_BLOCK - have, in);
+        size_t start = 0;
+        char *nl;
+
+        have += got;
+        while ((nl = memchr(buf + start, '\n', have - start)) != NULL) {
+            size_t end = (size_t)(nl - buf);
+            if (skipping) {
+                skipping = 0;
+            } else {
+                hex_line(c, buf + start, end - start);
+            }
+            start = end + 1;
+        }
+
+        if (got == 0) {
+            if (start < have && !skipping) {
+                hex_line(c, buf + start, have - start);   /* no final newline */
+            }
+            break;
+        }
+
+        memmove(buf, buf + start, have - start);
+        have -= start;
+        if (have == READ_BLOCK) {
+            if (!skipping) {
+                c->line++;
+                fprintf(stderr, "mobi: line %llu: not a 64-character hex pubkey\n", c->line);
+                c->invalid++;
+            }
+            skipping = 1;
+            have = 0;
+        }
+    }
+
+    emit(c, c->keys, c->queued);
+    c->queued = 0;
+    free(buf);
+    return ferror(in) ? -1 : 0;
+}
+
+/* Raw records are derived straight out of the read buffer */
+static int read_raw(cli_t *c, FILE *in) {
+    const size_t block = (size_t)BATCH_KEYS * MOBI_PUBKEY_LEN;
+    size_t got;
+
+    while ((got = fread(c->keys, 1, block, in)) > 0) {
+        emit(c, c->keys, got / MOBI_PUBKEY_LEN);
+        if (got % MOBI_PUBKEY_LEN != 0) {
+            fprintf(stderr, "mobi: trailing %zu bytes are not a whole record\n",
+                    got % MOBI_PUBKEY_LEN);
+            c->invalid++;
+        }
+        if (got < block) {
+            break;
+        }
+    }
+    return ferror(in) ? -1 : 0;
+}
+
+static int ingest_write(void *ctx, const uint8_t *keys, const mobi_bin_t *mobis,
+                        size_t count, uint64_t first) {
+    cli_t *c = (cli_t *)ctx;
+    size_t done;
+
+    (void)first;
+    for (done = 0; done < count && !c->io_error; done += BATCH_KEYS) {
+        size_t n = count - done < BATCH_KEYS ? count - done : BATCH_KEYS;
+        write_records(c, keys + done * MOBI_PUBKEY_LEN, mobis + done, n);
+    }
+    return c->io_error;
+}
+
+/*
+ * A raw key file: reads stay in flight (io_uring) while earlier buffers
+ * are derived and written. Whole records are ingested; trailing bytes
+ * are reported like read_raw does.
+ */
+static int ingest_raw(cli_t *c, const char *path, unsigned flags) {
+    mobi_ingest_opts_t opts;
+    mobi_error_t err;
+    struct stat st;
+    uint64_t size, tail;
+
+    if (stat(path, &st) != 0) {
+        perror(path);
+        return -1;
+    }
+    size = (uint64_t)st.st_size;
+    tail = size % MOBI_PUBKEY_LEN;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.threads = c->threads;
+    opts.flags = flags;
+    opts.length = size - tail;
+
+    /* length 0 means "to end of file", so a file under one record is skipped */
+    if (opts.length > 0) {
+        err = mobi_ingest(path, &opts, ingest_write, c);
+        if (err != MOBI_OK) {
+            fprintf(stderr, "mobi: %s: %s\n", path, mobi_strerror(err));
+            return -1;
+        }
+    }
+    if (tail != 0) {
+        fprintf(stderr, "mobi: trailing %llu bytes are not a whole record\n",
+                (unsigned long long)tail);
+        c->invalid++;
+    }
+    return 0;
+}
+
+/* The keys are already in memory: hand mapped pages straight to emit() */
+static int read_corpus(cli_t *c, const char *path, int verify) {
+    mobi_corpus_t corpus;
+    mobi_error_t err = mobi_corpus_open(path, &corpus);
+    uint64_t at;
+
+    if (err != MOBI_OK) {
+        fprintf(stderr, "mobi: %s: %s\n", path, mobi_strerror(err));
+        return -1;
+    }
+
+    if (verify) {
+        uint64_t bad = 0;
+
+        err = mobi_corpus_verify(&corpus, c->threads, &bad);
+        if (err != MOBI_OK) {
+            fprintf(stderr, "mobi: %s: %s\n", path, mobi_strerror(err));
+            mobi_corpus_close(&corpus);
+            return -1;
+        }
+        fprintf(c->out, "%llu keys, %llu mismatched mobis\n",
+                (unsigned long long)corpus.count, (unsigned long long)bad);
+        c->invalid += bad;
+    } else {
+        for (at = 0; at < corpus.count; at += BATCH_KEYS) {
+            uint64_t n = corpus.count - at < BATCH_KEYS ? corpus.count - at : BATCH_KEYS;
+            emit(c, corpus.keys + at * MOBI_PUBKEY_LEN, (size_t)n);
+        }
+    }
+
+    mobi_corpus_close(&corpus);
+    return 0;
+}
+
+/* ============================================================================
+ * MAIN
+ * ============================================================================ */
+
+static int usage(void) {
+    fprintf(stderr,
+        "usage: mobi [-i hex|raw|corpus] [-o tsv|ndjson] [-H] [-t threads]\n"
+        "            [-O corpus-file | -A arrow-file] [-V] [-P] [file]\n"
+        "  -i  input: newline-separated hex pubkeys (default), raw 32-byte records\n"
+        "      or a corpus file\n"
+        "  -o  output: tab-separated (default) or one JSON object per line\n"
+        "  -H  hyphenate the mobis (XXX-XXX-...)\n"
+        "  -t  worker threads, 0 for one per CPU (default)\n"
+        "  -O  write the keys and their mobis to a corpus file instead\n"
+        "  -A  write the keys and their mobis to an Arrow IPC file instead\n"
+        "  -V  verify the stored mobis of a corpus (-i corpus)\n"
+        "  -P  read raw files with pread() instead of io_uring\n"
+        "  file defaults to stdin\n");
+    return 2;
+}
+
+int main(int argc, char **argv) {
+    cli_t c;
+    mobi_corpus_writer_t writer;
+    mobi_arrow_writer_t arrow;
+    const char *path = NULL;
+    const char *corpus_path = NULL;
+    const char *arrow_path = NULL;
+    FILE *in = stdin;
+    int verify = 0;
+    unsigned ingest_flags = 0;
+    int i, rc;
+
+    memset(&c, 0, sizeof(c));
+    c.out = stdout;
+
+    for (i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+
+        if (strcmp(a, "-i") == 0 && val != NULL) {
+            if (strcmp(val, "hex") == 0) c.input = IN_HEX;
+            else if (strcmp(val, "raw") == 0) c.input = IN_RAW;
+            else if (strcmp(val, "corpus") == 0) c.input = IN_CORPUS;
+            else return usage();
+            i++;
+        } else if (strcmp(a, "-o") == 0 && val != NULL) {
+            if (strcmp(val, "tsv") == 0) c.output = OUT_TSV;
+            else if (strcmp(val, "ndjson") == 0) c.output = OUT_NDJSON;
+            else return usage();
+            i++;
+        } else if (strcmp(a, "-t") == 0 && val != NULL) {
+            c.threads = atoi(val);
+            i++;
+        } else if (strcmp(a, "-O") == 0 && val != NULL) {
+            corpus_path = val;
+            i++;
+        } else if (strcmp(a, "-A") == 0 && val != NULL) {
+            arrow_path = val;
+            i++;
+        } else if (strcmp(a, "-V") == 0) {
+            verify = 1;
+        } else if (strcmp(a, "-P") == 0) {
+            ingest_flags |= MOBI_INGEST_PREAD;
+        } else if (strcmp(a, "-H") == 0) {
+            c.hyphens = 1;
+        } else if (a[0] == '-' && a[1] != '\0') {
+            return usage();
+        } else if (path == NULL) {
+            path = a;
+        } else {
+            return usage();
+        }
+    }
+
+    if (c.input == IN_CORPUS && (path == NULL || strcmp(path, "-") == 0)) {
+        fprintf(stderr, "mobi: a corpus is mapped, not streamed: give its path\n");
+        return usage();
+    }
+    if (verify && (c.input != IN_CORPUS || corpus_path != NULL || arrow_path != NULL)) {
+        return usage();
+    }
+    if (corpus_path != NULL && arrow_path != NULL) {
+        return usage();
+    }
+
+    if (c.input != IN_CORPUS && path != NULL && strcmp(path, "-") != 0) {
+        in = fopen(path, "rb");
+        if (in == NULL) {
+            perror(path);
+            return 2;
+        }
+    }
+
+    for (i = 0; i < 256; i++) {
+        hex_pairs[i * 2] = "0123456789abcdef"[i >> 4];
+        hex_pairs[i * 2 + 1] = "0123456789abcdef"[i & 0xF];
+    }
+
+    c.keys = malloc((size_t)BATCH_KEYS * MOBI_PUBKEY_LEN);
+    c.bins = malloc((size_t)BATCH_KEYS * sizeof(mobi_bin_t));
+    c.text = malloc((size_t)BATCH_KEYS * MAX_LINE_OUT);
+    if (c.keys == NULL || c.bins == NULL || c.text == NULL) {
+        fprintf(stderr, "mobi: out of memory\n");
+        return 2;
+    }
+
+    if (corpus_path != NULL) {
+        mobi_error_t err = mobi_corpus_writer_open(&writer, corpus_path);
+        if (err != MOBI_OK) {
+            fprintf(stderr, "mobi: %s: %s\n", corpus_path, mobi_strerror(err));
+            return 2;
+        }
+        c.corpus_out = &writer;
+    }
+    if (arrow_path != NULL) {
+        mobi_error_t err = mobi_arrow_writer_open(&arrow, arrow_path);
+        if (err != MOBI_OK) {
+            fprintf(stderr, "mobi: %s: %s\n", arrow_path, mobi_strerror(err));
+            return 2;
+        }
+        c.arrow_out = &arrow;
+    }
+
+    if (c.input == IN_CORPUS) {
+        rc = read_corpus(&c, path, verify);
+    } else if (c.input == IN_RAW && in != stdin && c.corpus_out == NULL) {
+        rc = ingest_raw(&c, path, ingest_flags);
+    } else {
+        rc = c.input == IN_RAW ? read_raw(&c, in) : read_hex(&c, in);
+        if (rc != 0) {
+            perror(path != NULL ? path : "stdin");
+        }
+    }
+
+    if (c.corpus_out != NULL) {
+        mobi_error_t err = mobi_corpus_writer_close(&writer, MOBI_CORPUS_MOBIS, c.threads);
+        if (err != MOBI_OK) {
+            fprintf(stderr, "mobi: %s: %s\n", corpus_path, mobi_strerror(err));
+            c.io_error = 1;
+        }
+    }
+    if (c.arrow_out != NULL) {
+        mobi_error_t err = mobi_arrow_writer_close(&arrow);
+        if (err != MOBI_OK) {
+            fprintf(stderr, "mobi: %s: %s\n", arrow_path, mobi_strerror(err));
+            c.io_error = 1;
+        }
+    }
+    if (fflush(c.out) != 0) {
+        c.io_error = 1;
+    }
+    if (c.io_error && c.corpus_out == NULL && c.arrow_out == NULL) {
+        perror("mobi: write");
+    }
+
+    if (in != stdin) {
+        fclose(in);
+    }
+    free(c.keys);
+    free(c.bins);
+    free(c.text);
+
+    if (rc != 0 || c.io_error) {
+        return 2;
+    }
+    return c.invalid > 0 ? 1 : 0;
+}
@@ -22,25 +22,24 @@
  * Licensed under MIT OR Apache-2.0
  */
 
-#include "mobi.h"
+#include "mobi_internal.h"
 #include <string.h>
 #include <ctype.h>
-#include <stdio.h>
+#include <pthread.h>
 
 /* ============================================================================
  * SHA-256 IMPLEMENTATION (FIPS 180-4, standalone)
  * ============================================================================ */
 
-#define SHA256_BLOCK_SIZE 64
-#define SHA256_DIGEST_SIZE 32
-
-typedef struct {
-    uint32_t state[8];
-    uint64_t count;
-    uint8_t buffer[SHA256_BLOCK_SIZE];
-} sha256_ctx;
+/*
+ * Every message mobi hashes is either a 32-byte pubkey (round 0) or a
+ * 33-byte pubkey || round (rounds 1-255). Both fit in a single 64-byte
+ * block, so there is no streaming context: the block is built directly
+ * as 16 big-endian words with constant padding, compressed once from the
+ * IV, and only the 3 digest words covering the 9-byte prefix come out.
+ */
 
-static const uint32_t K256[64] = {
+const uint32_t mobi_sha256_k[64] = {
     0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
     0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
     0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -59,6 +58,20 @@ static const uint32_t K256[64] = {
     0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
 };
 
+const uint32_t mobi_sha256_iv[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+/*
+ * Padding words W[8..15] for the two message lengths.
+ *   32 bytes: 0x80 terminator in W[8], bit length 256 in W[15]
+ *   33 bytes: round byte then 0x80 in W[8], bit length 264 in W[15]
+ * The round byte is ORed into the top of W[8] at run time.
+ */
+static const uint32_t PAD_32[8] = { 0x80000000, 0, 0, 0, 0, 0, 0, 256 };
+static const uint32_t PAD_33[8] = { 0x00800000, 0, 0, 0, 0, 0, 0, 264 };
+
 #define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
 #define CH(x, y, z)  (((x) & (y)) ^ (~(x) & (z)))
 #define MAJ(x, y, z) (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
@@ -67,131 +80,244 @@ static const uint32_t K256[64] = {
 #define SIG0(x) (ROTR32(x, 7) ^ ROTR32(x, 18) ^ ((x) >> 3))
 #define SIG1(x) (ROTR32(x, 17) ^ ROTR32(x, 19) ^ ((x) >> 10))
 
-static void sha256_init(sha256_ctx *ctx) {
-    ctx->state[0] = 0x6a09e667;
-    ctx->state[1] = 0xbb67ae85;
-    ctx->state[2] = 0x3c6ef372;
-    ctx->state[3] = 0xa54ff53a;
-    ctx->state[4] = 0x510e527f;
-    ctx->state[5] = 0x9b05688c;
-    ctx->state[6] = 0x1f83d9ab;
-    ctx->state[7] = 0x5be0cd19;
-    ctx->count = 0;
+/* First 8 message words: the pubkey, big-endian */
+static void sha256_load_pubkey(const uint8_t *pubkey, uint32_t *w) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        w[i] = ((uint32_t)pubkey[i * 4] << 24) |
+               ((uint32_t)pubkey[i * 4 + 1] << 16) |
+               ((uint32_t)pubkey[i * 4 + 2] << 8) |
+               ((uint32_t)pubkey[i * 4 + 3]);
+    }
 }
 
-static void sha256_transform(sha256_ctx *ctx, const uint8_t *block) {
+static void sha256_block_scalar(const uint32_t *block, uint32_t out[3]) {
     uint32_t w[64];
     uint32_t a, b, c, d, e, f, g, h;
     uint32_t t1, t2;
     int i;
 
-    for (i = 0; i < 16; i++) {
-        w[i] = ((uint32_t)block[i * 4] << 24) |
-               ((uint32_t)block[i * 4 + 1] << 16) |
-               ((uint32_t)block[i * 4 + 2] << 8) |
-               ((uint32_t)block[i * 4 + 3]);
-    }
+    memcpy(w, block, 16 * sizeof(uint32_t));
     for (i = 16; i < 64; i++) {
         w[i] = SIG1(w[i - 2]) + w[i - 7] + SIG0(w[i - 15]) + w[i - 16];
     }
 
-    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
-    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+    a = mobi_sha256_iv[0]; b = mobi_sha256_iv[1];
+    c = mobi_sha256_iv[2]; d = mobi_sha256_iv[3];
+    e = mobi_sha256_iv[4]; f = mobi_sha256_iv[5];
+    g = mobi_sha256_iv[6]; h = mobi_sha256_iv[7];
 
     for (i = 0; i < 64; i++) {
-        t1 = h + EP1(e) + CH(e, f, g) + K256[i] + w[i];
+        t1 = h + EP1(e) + CH(e, f, g) + mobi_sha256_k[i] + w[i];
         t2 = EP0(a) + MAJ(a, b, c);
         h = g; g = f; f = e; e = d + t1;
         d = c; c = b; b = a; a = t1 + t2;
     }
 
-    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
-    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+    /* Digest words 0-2 hold the 9-byte prefix; the rest are never read */
+    out[0] = mobi_sha256_iv[0] + a;
+    out[1] = mobi_sha256_iv[1] + b;
+    out[2] = mobi_sha256_iv[2] + c;
 }
 
-static void sha256_update(sha256_ctx *ctx, const uint8_t *data, size_t len) {
-    size_t i, idx;
-    idx = (size_t)(ctx->count & 0x3F);
-    ctx->count += len;
-    for (i = 0; i < len; i++) {
-        ctx->buffer[idx++] = data[i];
-        if (idx == SHA256_BLOCK_SIZE) {
-            sha256_transform(ctx, ctx->buffer);
-            idx = 0;
-        }
+/*
+ * Round-invariant precomputation for rounds 1-255.
+ *
+ * Between rounds of the same key only the round byte in W[8] changes, so
+ * everything upstream of W[8] is computed once per key:
+ *   - compression rounds 0-7, which consume only the pubkey words
+ *   - schedule words W[16..22], none of which reads W[8]
+ *   - the W[8]-free parts of W[23], W[24] and of round 8's T1/T2
+ * A round then costs 56 compression steps and 41 schedule words.
+ */
+typedef struct {
+    uint32_t w[64];     /* W[0..22] fixed; W[8] and W[23..63] per round */
+    uint32_t mid[8];    /* a..h after rounds 0-7 */
+    uint32_t t1_8;      /* round 8 T1 minus W[8] */
+    uint32_t t2_8;      /* round 8 T2 */
+    uint32_t pre_23;    /* W[23] minus SIG0(W[8]) */
+    uint32_t pre_24;    /* W[24] minus W[8] */
+} sha256_midstate;
+
+static void sha256_midstate_init(sha256_midstate *ms, const uint32_t *block) {
+    uint32_t *w = ms->w;
+    uint32_t a, b, c, d, e, f, g, h;
+    uint32_t t1, t2;
+    int i;
+
+    memcpy(w, block, 16 * sizeof(uint32_t));
+    w[8] = 0;
+    for (i = 16; i < 23; i++) {
+        w[i] = SIG1(w[i - 2]) + w[i - 7] + SIG0(w[i - 15]) + w[i - 16];
     }
+    ms->pre_23 = SIG1(w[21]) + w[16] + w[7];
+    ms->pre_24 = SIG1(w[22]) + w[17] + SIG0(w[9]);
+
+    a = mobi_sha256_iv[0]; b = mobi_sha256_iv[1];
+    c = mobi_sha256_iv[2]; d = mobi_sha256_iv[3];
+    e = mobi_sha256_iv[4]; f = mobi_sha256_iv[5];
+    g = mobi_sha256_iv[6]; h = mobi_sha256_iv[7];
+
+    for (i = 0; i < 8; i++) {
+        t1 = h + EP1(e) + CH(e, f, g) + mobi_sha256_k[i] + w[i];
+        t2 = EP0(a) + MAJ(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ms->mid[0] = a; ms->mid[1] = b; ms->mid[2] = c; ms->mid[3] = d;
+    ms->mid[4] = e; ms->mid[5] = f; ms->mid[6] = g; ms->mid[7] = h;
+    ms->t1_8 = h + EP1(e) + CH(e, f, g) + mobi_sha256_k[8];
+    ms->t2_8 = EP0(a) + MAJ(a, b, c);
 }
 
-static void sha256_final(sha256_ctx *ctx, uint8_t *digest) {
-    uint8_t final_block[SHA256_BLOCK_SIZE * 2];
-    uint64_t bits;
-    size_t idx;
+static void sha256_resume_scalar(sha256_midstate *ms, uint32_t w8, uint32_t out[3]) {
+    uint32_t *w = ms->w;
+    uint32_t a, b, c, d, e, f, g, h;
+    uint32_t t1, t2;
     int i;
 
-    bits = ctx->count * 8;
-    idx = (size_t)(ctx->count & 0x3F);
-    memcpy(final_block, ctx->buffer, idx);
-    final_block[idx++] = 0x80;
+    w[8] = w8;
+    w[23] = ms->pre_23 + SIG0(w8);
+    w[24] = ms->pre_24 + w8;
+    for (i = 25; i < 64; i++) {
+        w[i] = SIG1(w[i - 2]) + w[i - 7] + SIG0(w[i - 15]) + w[i - 16];
+    }
+
+    /* Round 8 from its precomputed halves */
+    t1 = ms->t1_8 + w8;
+    a = t1 + ms->t2_8; b = ms->mid[0]; c = ms->mid[1]; d = ms->mid[2];
+    e = ms->mid[3] + t1; f = ms->mid[4]; g = ms->mid[5]; h = ms->mid[6];
 
-    if (idx > 56) {
-        memset(final_block + idx, 0, SHA256_BLOCK_SIZE - idx);
-        sha256_transform(ctx, final_block);
-        memset(final_block, 0, 56);
-    } else {
-        memset(final_block + idx, 0, 56 - idx);
+    for (i = 9; i < 64; i++) {
+        t1 = h + EP1(e) + CH(e, f, g) + mobi_sha256_k[i] + w[i];
+        t2 = EP0(a) + MAJ(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
     }
 
-    final_block[56] = (uint8_t)(bits >> 56);
-    final_block[57] = (uint8_t)(bits >> 48);
-    final_block[58] = (uint8_t)(bits >> 40);
-    final_block[59] = (uint8_t)(bits >> 32);
-    final_block[60] = (uint8_t)(bits >> 24);
-    final_block[61] = (uint8_t)(bits >> 16);
-    final_block[62] = (uint8_t)(bits >> 8);
-    final_block[63] = (uint8_t)(bits);
+    out[0] = mobi_sha256_iv[0] + a;
+    out[1] = mobi_sha256_iv[1] + b;
+    out[2] = mobi_sha256_iv[2] + c;
+}
 
-    sha256_transform(ctx, final_block);
+#if MOBI_X86
+/* The SHA-NI kernel re-derives its schedule in registers; it only needs the midstate */
+static void sha256_resume_shani(sha256_midstate *ms, uint32_t w8, uint32_t out[3]) {
+    ms->w[8] = w8;
+    mobi_sha256_resume_shani(ms->mid, ms->w, out);
+}
+#endif
 
-    for (i = 0; i < 8; i++) {
-        digest[i * 4] = (uint8_t)(ctx->state[i] >> 24);
-        digest[i * 4 + 1] = (uint8_t)(ctx->state[i] >> 16);
-        digest[i * 4 + 2] = (uint8_t)(ctx->state[i] >> 8);
-        digest[i * 4 + 3] = (uint8_t)(ctx->state[i]);
+/* ============================================================================
+ * RUNTIME DISPATCH
+ * ============================================================================ */
+
+/*
+ * The compression backend is picked once, on first use, from the CPU
+ * features detected by mobi_cpu_detect() and narrowed by mobi_cpu_restrict().
+ * Every backend produces bit-identical output; only speed differs. The
+ * first resolution runs under pthread_once, so concurrent first calls all
+ * see the complete backend set; only mobi_cpu_restrict() re-resolves later.
+ */
+typedef void (*sha256_block_fn)(const uint32_t *block, uint32_t out[3]);
+typedef void (*sha256_resume_fn)(sha256_midstate *ms, uint32_t w8, uint32_t out[3]);
+typedef int (*hex_decode32_fn)(const char *hex, uint8_t out[32]);
+
+static pthread_once_t dispatch_once = PTHREAD_ONCE_INIT;
+static unsigned cpu_mask = ~0u;
+static unsigned cpu_features = 0;
+static sha256_block_fn sha256_block = NULL;
+static sha256_resume_fn sha256_resume = NULL;
+static hex_decode32_fn hex_decode32 = NULL;
+mobi_sha256_lanes_fn mobi_sha256_x8 = NULL;
+mobi_sha256_lanes_fn mobi_sha256_x16 = NULL;
+
+static int hex_decode32_scalar(const char *hex, uint8_t out[32]);
+
+static void dispatch_resolve(void) {
+    sha256_block = sha256_block_scalar;
+    sha256_resume = sha256_resume_scalar;
+    hex_decode32 = hex_decode32_scalar;
+    mobi_sha256_x8 = NULL;
+    mobi_sha256_x16 = NULL;
+#if MOBI_X86
+    if (cpu_features & cpu_mask & MOBI_CPU_SSE41) {
+        hex_decode32 = mobi_hex_decode32_sse41;
+    }
+    if (cpu_features & cpu_mask & MOBI_CPU_AVX2) {
+        mobi_sha256_x8 = mobi_sha256_x8_avx2;
+        hex_decode32 = mobi_hex_decode32_avx2;
+    }
+    if (cpu_features & cpu_mask & MOBI_CPU_AVX512) {
+        mobi_sha256_x16 = mobi_sha256_x16_avx512;
     }
+    if (cpu_features & cpu_mask & MOBI_CPU_SHANI) {
+        sha256_block = mobi_sha256_block_shani;
+        sha256_resume = sha256_resume_shani;
+    }
+#endif
+}
+
+static void dispatch_init(void) {
+    cpu_features = mobi_cpu_detect();
+    dispatch_resolve();
 }
 
-static void sha256(const uint8_t *data, size_t len, uint8_t *digest) {
-    sha256_ctx ctx;
-    sha256_init(&ctx);
-    sha256_update(&ctx, data, len);
-    sha256_final(&ctx, digest);
+/* Every reader of the backend pointers goes through here first */
+static void dispatch_ready(void) {
+    (void)pthread_once(&dispatch_once, dispatch_init);
 }
 
 /* ============================================================================
  * HEX UTILITIES
  * ============================================================================ */
 
-static int hex_char_to_nibble(char c) {
-    if (c >= '0' && c <= '9') return c - '0';
-    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-    return -1;
-}
+/* Nibble value of every byte, -1 for anything that is not a hex digit */
+static const int8_t HEX_NIBBLE[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
 
 static int hex_decode(const char *hex, size_t hex_len, uint8_t *out, size_t out_len) {
+    const unsigned char *in = (const unsigned char *)hex;
     size_t i;
-    int hi, lo;
+    int bad = 0;
 
     if (hex_len % 2 != 0) return -1;
     if (out_len < hex_len / 2) return -1;
 
+    /* Branch-free: invalid characters set the sign bit of bad */
     for (i = 0; i < hex_len / 2; i++) {
-        hi = hex_char_to_nibble(hex[i * 2]);
-        lo = hex_char_to_nibble(hex[i * 2 + 1]);
-        if (hi < 0 || lo < 0) return -1;
-        out[i] = (uint8_t)((hi << 4) | lo);
+        int hi = HEX_NIBBLE[in[i * 2]];
+        int lo = HEX_NIBBLE[in[i * 2 + 1]];
+        bad |= hi | lo;
+        out[i] = (uint8_t)(((hi & 0xF) << 4) | (lo & 0xF));
     }
-    return 0;
+    return bad < 0 ? -1 : 0;
+}
+
+static int hex_decode32_scalar(const char *hex, uint8_t out[32]) {
+    return hex_decode(hex, MOBI_PUBKEY_HEX_LEN, out, MOBI_PUBKEY_LEN);
+}
+
+int mobi_hex_decode32(const char *hex, uint8_t out[32]) {
+    dispatch_ready();
+    return hex_decode32(hex, out);
 }
 
 /* ============================================================================
@@ -205,71 +331,208 @@ static int hex_decode(const char *hex, size_t hex_len, uint8_t *out, size_t out_
  *   - 10^21 / 2^72 ≈ 0.212 (21.2% acceptance rate)
  *   - Expected rounds for rejection sampling: ~4.7
  *
- * We extract 9 bytes (72 bits), convert to decimal, check if < 10^21.
- * Simple digit counting works: 10^21 has 22 digits, so accept if <= 21 digits.
+ * The 72-bit value is held as an 8-bit top byte plus a 64-bit low word.
+ * The rejection test is a plain integer compare against 10^21, done
+ * before any decimal work, so a rejected round costs two compares.
+ * Accepted values become a mobi_bin_t; strings are rendered from that.
  */
 
+/* 10^21 = 0x36_35C9ADC5DEA00000 */
+#define TEN21_HI 0x36u
+#define TEN21_LO 0x35C9ADC5DEA00000ULL
+
+#define TEN9     1000000000u
+
 /*
- * Convert 9 bytes (72 bits) to decimal and check if < 10^21.
- *
- * Returns 1 if valid (value < 10^21), writes 21-digit zero-padded result.
- * Returns 0 if should reject (value >= 10^21).
+ * "000-" "001-" ... "999-": every 3-digit group with its separator, 4 bytes
+ * each, so a group is one fixed-width store. Plain digit strings advance
+ * by 3 and let the next store overwrite the hyphen.
+ */
+static const char GROUP_TABLE[4001] =
+    "000-001-002-003-004-005-006-007-008-009-"
+    "010-011-012-013-014-015-016-017-018-019-"
+    "020-021-022-023-024-025-026-027-028-029-"
+    "030-031-032-033-034-035-036-037-038-039-"
+    "040-041-042-043-044-045-046-047-048-049-"
+    "050-051-052-053-054-055-056-057-058-059-"
+    "060-061-062-063-064-065-066-067-068-069-"
+    "070-071-072-073-074-075-076-077-078-079-"
+    "080-081-082-083-084-085-086-087-088-089-"
+    "090-091-092-093-094-095-096-097-098-099-"
+    "100-101-102-103-104-105-106-107-108-109-"
+    "110-111-112-113-114-115-116-117-118-119-"
+    "120-121-122-123-124-125-126-127-128-129-"
+    "130-131-132-133-134-135-136-137-138-139-"
+    "140-141-142-143-144-145-146-147-148-149-"
+    "150-151-152-153-154-155-156-157-158-159-"
+    "160-161-162-163-164-165-166-167-168-169-"
+    "170-171-172-173-174-175-176-177-178-179-"
+    "180-181-182-183-184-185-186-187-188-189-"
+    "190-191-192-193-194-195-196-197-198-199-"
+    "200-201-202-203-204-205-206-207-208-209-"
+    "210-211-212-213-214-215-216-217-218-219-"
+    "220-221-222-223-224-225-226-227-228-229-"
+    "230-231-232-233-234-235-236-237-238-239-"
+    "240-241-242-243-244-245-246-247-248-249-"
+    "250-251-252-253-254-255-256-257-258-259-"
+    "260-261-262-263-264-265-266-267-268-269-"
+    "270-271-272-273-274-275-276-277-278-279-"
+    "280-281-282-283-284-285-286-287-288-289-"
+    "290-291-292-293-294-295-296-297-298-299-"
+    "300-301-302-303-304-305-306-307-308-309-"
+    "310-311-312-313-314-315-316-317-318-319-"
+    "320-321-322-323-324-325-326-327-328-329-"
+    "330-331-332-333-334-335-336-337-338-339-"
+    "340-341-342-343-344-345-346-347-348-349-"
+    "350-351-352-353-354-355-356-357-358-359-"
+    "360-361-362-363-364-365-366-367-368-369-"
+    "370-371-372-373-374-375-376-377-378-379-"
+    "380-381-382-383-384-385-386-387-388-389-"
+    "390-391-392-393-394-395-396-397-398-399-"
+    "400-401-402-403-404-405-406-407-408-409-"
+    "410-411-412-413-414-415-416-417-418-419-"
+    "420-421-422-423-424-425-426-427-428-429-"
+    "430-431-432-433-434-435-436-437-438-439-"
+    "440-441-442-443-444-445-446-447-448-449-"
+    "450-451-452-453-454-455-456-457-458-459-"
+    "460-461-462-463-464-465-466-467-468-469-"
+    "470-471-472-473-474-475-476-477-478-479-"
+    "480-481-482-483-484-485-486-487-488-489-"
+    "490-491-492-493-494-495-496-497-498-499-"
+    "500-501-502-503-504-505-506-507-508-509-"
+    "510-511-512-513-514-515-516-517-518-519-"
+    "520-521-522-523-524-525-526-527-528-529-"
+    "530-531-532-533-534-535-536-537-538-539-"
+    "540-541-542-543-544-545-546-547-548-549-"
+    "550-551-552-553-554-555-556-557-558-559-"
+    "560-561-562-563-564-565-566-567-568-569-"
+    "570-571-572-573-574-575-576-577-578-579-"
+    "580-581-582-583-584-585-586-587-588-589-"
+    "590-591-592-593-594-595-596-597-598-599-"
+    "600-601-602-603-604-605-606-607-608-609-"
+    "610-611-612-613-614-615-616-617-618-619-"
+    "620-621-622-623-624-625-626-627-628-629-"
+    "630-631-632-633-634-635-636-637-638-639-"
+    "640-641-642-643-644-645-646-647-648-649-"
+    "650-651-652-653-654-655-656-657-658-659-"
+    "660-661-662-663-664-665-666-667-668-669-"
+    "670-671-672-673-674-675-676-677-678-679-"
+    "680-681-682-683-684-685-686-687-688-689-"
+    "690-691-692-693-694-695-696-697-698-699-"
+    "700-701-702-703-704-705-706-707-708-709-"
+    "710-711-712-713-714-715-716-717-718-719-"
+    "720-721-722-723-724-725-726-727-728-729-"
+    "730-731-732-733-734-735-736-737-738-739-"
+    "740-741-742-743-744-745-746-747-748-749-"
+    "750-751-752-753-754-755-756-757-758-759-"
+    "760-761-762-763-764-765-766-767-768-769-"
+    "770-771-772-773-774-775-776-777-778-779-"
+    "780-781-782-783-784-785-786-787-788-789-"
+    "790-791-792-793-794-795-796-797-798-799-"
+    "800-801-802-803-804-805-806-807-808-809-"
+    "810-811-812-813-814-815-816-817-818-819-"
+    "820-821-822-823-824-825-826-827-828-829-"
+    "830-831-832-833-834-835-836-837-838-839-"
+    "840-841-842-843-844-845-846-847-848-849-"
+    "850-851-852-853-854-855-856-857-858-859-"
+    "860-861-862-863-864-865-866-867-868-869-"
+    "870-871-872-873-874-875-876-877-878-879-"
+    "880-881-882-883-884-885-886-887-888-889-"
+    "890-891-892-893-894-895-896-897-898-899-"
+    "900-901-902-903-904-905-906-907-908-909-"
+    "910-911-912-913-914-915-916-917-918-919-"
+    "920-921-922-923-924-925-926-927-928-929-"
+    "930-931-932-933-934-935-936-937-938-939-"
+    "940-941-942-943-944-945-946-947-948-949-"
+    "950-951-952-953-954-955-956-957-958-959-"
+    "960-961-962-963-964-965-966-967-968-969-"
+    "970-971-972-973-974-975-976-977-978-979-"
+    "980-981-982-983-984-985-986-987-988-989-"
+    "990-991-992-993-994-995-996-997-998-999-";
+
+/* The 7 base-1000 groups of value = hi * 10^9 + lo, most significant first */
+static void bin_groups(const mobi_bin_t *m, uint32_t g[7]) {
+    uint32_t hh = (uint32_t)(m->hi / 1000000u);
+    uint32_t hl = (uint32_t)(m->hi % 1000000u);
+    uint32_t lh = m->lo / 1000000u;
+    uint32_t ll = m->lo % 1000000u;
+
+    g[0] = hh / 1000u; g[1] = hh % 1000u;
+    g[2] = hl / 1000u; g[3] = hl % 1000u;
+    g[4] = lh;
+    g[5] = ll / 1000u; g[6] = ll % 1000u;
+}
+
+/*
+ * Write the first digits / 3 groups at out, 3 apart (plain digits) or 4
+ * apart (hyphenated). Returns the length; out[length] is clobbered and
+ * must be overwritten by the caller (terminator or separator).
  */
-static int try_convert_hash(const uint8_t *hash, char *out) {
-    uint8_t work[10] = {0};
-    char digits[24] = {0};
-    int num_digits = 0;
+static size_t put_groups(const mobi_bin_t *m, int digits, int hyphens, char *out) {
+    uint32_t g[7];
+    size_t step = hyphens ? 4 : 3;
+    int n = digits / 3;
     int i;
 
-    /* Copy 9 bytes with leading zero for clean division */
-    for (i = 0; i < 9; i++) {
-        work[i + 1] = hash[i];
+    bin_groups(m, g);
+    for (i = 0; i < n; i++) {
+        memcpy(out + (size_t)i * step, GROUP_TABLE + g[i] * 4, 4);
     }
+    return (size_t)n * step - (hyphens ? 1 : 0);
+}
 
-    /* Extract digits via repeated division by 10 (big-endian long division) */
-    while (1) {
-        int all_zero = 1;
-        for (i = 0; i < 10; i++) {
-            if (work[i] != 0) { all_zero = 0; break; }
-        }
-        if (all_zero) break;
-
-        uint32_t remainder = 0;
-        for (i = 0; i < 10; i++) {
-            uint32_t current = remainder * 256 + work[i];
-            work[i] = (uint8_t)(current / 10);
-            remainder = current % 10;
-        }
-
-        /* Prepend digit (extracting from least significant) */
-        memmove(digits + 1, digits, (size_t)num_digits + 1);
-        digits[0] = '0' + (char)remainder;
-        num_digits++;
-    }
+/*
+ * Rejection test on a 72-bit value (top 8 bits, low 64 bits).
+ *
+ * Returns 1 if valid (value < 10^21) and writes its binary form.
+ * Returns 0 if should reject (value >= 10^21); out is untouched.
+ */
+static int u72_to_bin(uint32_t top, uint64_t low, mobi_bin_t *out) {
+    uint64_t x, t;
 
-    if (num_digits == 0) {
-        digits[0] = '0';
-        num_digits = 1;
+    if (top > TEN21_HI || (top == TEN21_HI && low >= TEN21_LO)) {
+        return 0;  /* Reject: value >= 10^21 */
     }
 
     /*
-     * Rejection check: value must be < 10^21
-     *
-     * 10^21 = "1" followed by 21 zeros = 22 decimal digits
-     * 2^72 max = 4,722,366,482,869,645,213,695 = 22 decimal digits
-     *
-     * If num_digits <= 21: value < 10^21, accept
-     * If num_digits == 22: value >= 10^21, reject
+     * Split value into hi = value / 10^9 (12 digits) and
+     * lo = value % 10^9 (9 digits) using only 64-bit division:
+     * value = x * 2^32 + y with x < 2^40, and (x % 10^9) * 2^32 + y < 2^62.
      */
-    if (num_digits > 21) {
-        return 0;  /* Reject: value >= 10^21 */
-    }
+    x = ((uint64_t)top << 32) | (low >> 32);
+    t = ((x % TEN9) << 32) | (low & 0xFFFFFFFFu);
+    out->hi = ((x / TEN9) << 32) + t / TEN9;
+    out->lo = (uint32_t)(t % TEN9);
+    return 1;
+}
+
+/* Inverse of u72_to_bin: value = hi * 10^9 + lo as top 8 / low 64 bits */
+static void bin_to_u72(const mobi_bin_t *m, uint32_t *top, uint64_t *low) {
+    uint64_t b = (m->hi >> 32) * TEN9;                        /* < 2^38 */
+    uint64_t a = (m->hi & 0xFFFFFFFFu) * TEN9 + m->lo;        /* < 2^63 */
+    uint64_t sum = (b << 32) + a;
+
+    *low = sum;
+    *top = (uint32_t)(b >> 32) + (sum < a);
+}
+
 
-    /* Accept: left-pad with zeros to 21 digits */
-    int pad = 21 - num_digits;
-    memset(out, '0', (size_t)pad);
-    memcpy(out + pad, digits, (size_t)num_digits);
-    out[21] = '\0';
+int mobi_accept_bin(const uint32_t digest[3], mobi_bin_t *out) {
+    uint32_t top = digest[0] >> 24;
+    uint64_t low = ((uint64_t)(digest[0] & 0xFFFFFF) << 40) |
+                   ((uint64_t)digest[1] << 8) |
+                   (digest[2] >> 24);
+
+    return u72_to_bin(top, low, out);
+}
+
+int mobi_accept_digest(const uint32_t digest[3], mobi_t *out) {
+    mobi_bin_t m;
+
+    if (!mobi_accept_bin(digest, &m)) {
+        return 0;
+    }
+    mobi_bin_to_mobi(&m, out);
     return 1;
 }
 
@@ -277,23 +540,16 @@ static int try_convert_hash(const uint8_t *hash, char *out) {
  * CORE API IMPLEMENTATION
  * ============================================================================ */
 
-/*
- * Maximum rejection sampling rounds before giving up.
- * Probability of reaching this: (1 - 0.212)^256 ≈ 10^-25
- */
-#define MOBI_MAX_ROUNDS 256
-
-mobi_error_t mobi_derive_bytes(const uint8_t *pubkey, mobi_t *out) {
-    uint8_t hash[SHA256_DIGEST_SIZE];
-    uint8_t input[MOBI_PUBKEY_LEN + 1];  /* pubkey + round byte */
+/* The rejection sampling loop, shared by every single-key entry point */
+static mobi_error_t derive_bin(const uint8_t *pubkey, mobi_bin_t *out) {
+    sha256_midstate ms;
+    uint32_t block[16];
+    uint32_t digest[3];
     int round;
 
-    if (pubkey == NULL || out == NULL) {
-        return MOBI_ERR_NULL;
-    }
+    dispatch_ready();
 
-    /* Copy pubkey for potential round-appending */
-    memcpy(input, pubkey, MOBI_PUBKEY_LEN);
+    sha256_load_pubkey(pubkey, block);
 
     /*
      * Rejection sampling loop:
@@ -303,25 +559,19 @@ mobi_error_t mobi_derive_bytes(const uint8_t *pubkey, mobi_t *out) {
      * Accept if first 9 bytes of hash, as decimal, < 10^21.
      * Expected rounds: ~4.7 (21.2% acceptance rate)
      */
-    for (round = 0; round < MOBI_MAX_ROUNDS; round++) {
-        if (round == 0) {
-            sha256(pubkey, MOBI_PUBKEY_LEN, hash);
-        } else {
-            input[MOBI_PUBKEY_LEN] = (uint8_t)round;
-            sha256(input, MOBI_PUBKEY_LEN + 1, hash);
-        }
-
-        if (try_convert_hash(hash, out->full)) {
-            /* Success: extract prefix forms */
-            memcpy(out->display, out->full, MOBI_DISPLAY_LEN);
-            out->display[MOBI_DISPLAY_LEN] = '\0';
-
-            memcpy(out->extended, out->full, MOBI_EXTENDED_LEN);
-            out->extended[MOBI_EXTENDED_LEN] = '\0';
+    memcpy(block + 8, PAD_32, sizeof(PAD_32));
+    sha256_block(block, digest);
+    if (mobi_accept_bin(digest, out)) {
+        return MOBI_OK;
+    }
 
-            memcpy(out->lng, out->full, MOBI_LONG_LEN);
-            out->lng[MOBI_LONG_LEN] = '\0';
+    /* Rounds 1-255 share everything but the round byte */
+    memcpy(block + 8, PAD_33, sizeof(PAD_33));
+    sha256_midstate_init(&ms, block);
+    for (round = 1; round < MOBI_MAX_ROUNDS; round++) {
+        sha256_resume(&ms, ((uint32_t)round << 24) | PAD_33[0], digest);
 
+        if (mobi_accept_bin(digest, out)) {
             return MOBI_OK;
         }
     }
@@ -333,39 +583,227 @@ mobi_error_t mobi_derive_bytes(const uint8_t *pubkey, mobi_t *out) {
     return MOBI_ERR_INVALID_LEN;  /* Reuse error code for this edge case */
 }
 
+mobi_error_t mobi_derive_bytes(const uint8_t *pubkey, mobi_t *out) {
+    mobi_bin_t m;
+    mobi_error_t err;
+
+    if (pubkey == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+
+    err = derive_bin(pubkey, &m);
+    if (err == MOBI_OK) {
+        mobi_bin_to_mobi(&m, out);
+    }
+    return err;
+}
+
 mobi_error_t mobi_derive(const char *pubkey_hex, mobi_t *out) {
+    if (pubkey_hex == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    return mobi_derive_hex_n(pubkey_hex, strlen(pubkey_hex), out);
+}
+
+mobi_error_t mobi_derive_hex_n(const char *pubkey_hex, size_t len, mobi_t *out) {
     uint8_t pubkey[MOBI_PUBKEY_LEN];
-    size_t hex_len;
 
     if (pubkey_hex == NULL || out == NULL) {
         return MOBI_ERR_NULL;
     }
-
-    hex_len = strlen(pubkey_hex);
-    if (hex_len != MOBI_PUBKEY_HEX_LEN) {
+    if (len != MOBI_PUBKEY_HEX_LEN) {
         return MOBI_ERR_INVALID_LEN;
     }
-
-    if (hex_decode(pubkey_hex, hex_len, pubkey, MOBI_PUBKEY_LEN) != 0) {
+    if (mobi_hex_decode32(pubkey_hex, pubkey) != 0) {
         return MOBI_ERR_INVALID_HEX;
     }
 
     return mobi_derive_bytes(pubkey, out);
 }
 
+mobi_error_t mobi_hex_decode_batch(const char *hex, size_t count, size_t stride,
+                                   uint8_t *out) {
+    mobi_error_t result = MOBI_OK;
+    size_t i;
+
+    if (count == 0) {
+        return MOBI_OK;
+    }
+    if (hex == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (stride == 0) {
+        stride = MOBI_PUBKEY_HEX_LEN;
+    }
+    if (stride < MOBI_PUBKEY_HEX_LEN) {
+        return MOBI_ERR_INVALID_LEN;
+    }
+    dispatch_ready();
+
+    for (i = 0; i < count; i++) {
+        uint8_t *key = out + i * MOBI_PUBKEY_LEN;
+        if (hex_decode32(hex + i * stride, key) != 0) {
+            memset(key, 0, MOBI_PUBKEY_LEN);
+            result = MOBI_ERR_INVALID_HEX;
+        }
+    }
+    return result;
+}
+
+/* ============================================================================
+ * BINARY API IMPLEMENTATION
+ * ============================================================================ */
+
+mobi_error_t mobi_derive_bin(const uint8_t *pubkey, mobi_bin_t *out) {
+    if (pubkey == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    return derive_bin(pubkey, out);
+}
+
+mobi_error_t mobi_bin_to_mobi(const mobi_bin_t *m, mobi_t *out) {
+    if (m == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+
+    put_groups(m, MOBI_FULL_LEN, 0, out->full);
+    out->full[MOBI_FULL_LEN] = '\0';
+
+    /* Prefix forms */
+    memcpy(out->display, out->full, MOBI_DISPLAY_LEN);
+    out->display[MOBI_DISPLAY_LEN] = '\0';
+
+    memcpy(out->extended, out->full, MOBI_EXTENDED_LEN);
+    out->extended[MOBI_EXTENDED_LEN] = '\0';
+
+    memcpy(out->lng, out->full, MOBI_LONG_LEN);
+    out->lng[MOBI_LONG_LEN] = '\0';
+
+    return MOBI_OK;
+}
+
+static int valid_form_len(int digits) {
+    return digits == MOBI_DISPLAY_LEN || digits == MOBI_EXTENDED_LEN ||
+           digits == MOBI_LONG_LEN || digits == MOBI_FULL_LEN;
+}
+
+mobi_error_t mobi_bin_to_string(const mobi_bin_t *m, int digits, char *out) {
+    if (m == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (!valid_form_len(digits)) {
+        return MOBI_ERR_INVALID_LEN;
+    }
+
+    out[put_groups(m, digits, 0, out)] = '\0';
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_bin_parse(const char *full, mobi_bin_t *out) {
+    uint64_t hi = 0;
+    uint32_t lo = 0;
+    int i;
+
+    if (full == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+
+    for (i = 0; i < MOBI_FULL_LEN; i++) {
+        if (full[i] < '0' || full[i] > '9') {
+            return full[i] == '\0' ? MOBI_ERR_INVALID_LEN : MOBI_ERR_INVALID_CHAR;
+        }
+        if (i < MOBI_DISPLAY_LEN) {
+            hi = hi * 10 + (uint64_t)(full[i] - '0');
+        } else {
+            lo = lo * 10 + (uint32_t)(full[i] - '0');
+        }
+    }
+    if (full[MOBI_FULL_LEN] != '\0') {
+        return MOBI_ERR_INVALID_LEN;
+    }
+
+    out->hi = hi;
+    out->lo = lo;
+    return MOBI_OK;
+}
+
+int mobi_bin_compare(const mobi_bin_t *a, const mobi_bin_t *b) {
+    if (a->hi != b->hi) {
+        return a->hi < b->hi ? -1 : 1;
+    }
+    if (a->lo != b->lo) {
+        return a->lo < b->lo ? -1 : 1;
+    }
+    return 0;
+}
+
+uint64_t mobi_bin_hash(const mobi_bin_t *m) {
+    /* splitmix64 finalizer over both halves */
+    uint64_t x = m->hi * 0x9E3779B97F4A7C15ULL ^ m->lo;
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBULL;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t mobi_bin_prefix(const mobi_bin_t *m, int digits) {
+    switch (digits) {
+        case MOBI_DISPLAY_LEN:  return m->hi;
+        case MOBI_EXTENDED_LEN: return m->hi * 1000u + m->lo / 1000000u;
+        case MOBI_LONG_LEN:     return m->hi * 1000000u + m->lo / 1000u;
+        default:                return UINT64_MAX;
+    }
+}
+
+void mobi_bin_pack(const mobi_bin_t *m, uint8_t out[9]) {
+    uint32_t top;
+    uint64_t low;
+    int i;
+
+    bin_to_u72(m, &top, &low);
+    out[0] = (uint8_t)top;
+    for (i = 0; i < 8; i++) {
+        out[1 + i] = (uint8_t)(low >> (56 - 8 * i));
+    }
+}
+
+mobi_error_t mobi_bin_unpack(const uint8_t in[9], mobi_bin_t *out) {
+    uint64_t low = 0;
+    int i;
+
+    if (in == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    for (i = 1; i < 9; i++) {
+        low = (low << 8) | in[i];
+    }
+    return u72_to_bin(in[0], low, out) ? MOBI_OK : MOBI_ERR_RANGE;
+}
+
 /* ============================================================================
  * FORMATTING API IMPLEMENTATION
  * ============================================================================ */
 
+/* Copy 3-digit groups from a digit string, joined by hyphens */
+static void format_digit_groups(const char *digits, int groups, char *out) {
+    int i;
+
+    for (i = 0; i < groups; i++) {
+        memcpy(out + i * 4, digits + i * 3, 3);
+        out[i * 4 + 3] = '-';
+    }
+    out[groups * 4 - 1] = '\0';
+}
+
 mobi_error_t mobi_format_display(const mobi_t *mobi, char *out) {
     if (mobi == NULL || out == NULL) {
         return MOBI_ERR_NULL;
     }
 
     /* Format: XXX-XXX-XXX-XXX */
-    sprintf(out, "%.3s-%.3s-%.3s-%.3s",
-            mobi->display, mobi->display + 3,
-            mobi->display + 6, mobi->display + 9);
+    format_digit_groups(mobi->display, MOBI_DISPLAY_LEN / 3, out);
 
     return MOBI_OK;
 }
@@ -376,9 +814,7 @@ mobi_error_t mobi_format_extended(const mobi_t *mobi, char *out) {
     }
 
     /* Format: XXX-XXX-XXX-XXX-XXX */
-    sprintf(out, "%.3s-%.3s-%.3s-%.3s-%.3s",
-            mobi->extended, mobi->extended + 3, mobi->extended + 6,
-            mobi->extended + 9, mobi->extended + 12);
+    format_digit_groups(mobi->extended, MOBI_EXTENDED_LEN / 3, out);
 
     return MOBI_OK;
 }
@@ -389,13 +825,40 @@ mobi_error_t mobi_format_full(const mobi_t *mobi, char *out) {
     }
 
     /* Format: XXX-XXX-XXX-XXX-XXX-XXX-XXX */
-    sprintf(out, "%.3s-%.3s-%.3s-%.3s-%.3s-%.3s-%.3s",
-            mobi->full, mobi->full + 3, mobi->full + 6, mobi->full + 9,
-            mobi->full + 12, mobi->full + 15, mobi->full + 18);
+    format_digit_groups(mobi->full, MOBI_FULL_LEN / 3, out);
+
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_bin_format(const mobi_bin_t *m, int digits, char *out) {
+    if (m == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (!valid_form_len(digits)) {
+        return MOBI_ERR_INVALID_LEN;
+    }
 
+    out[put_groups(m, digits, 1, out)] = '\0';
     return MOBI_OK;
 }
 
+size_t mobi_bin_format_batch(const mobi_bin_t *mobis, size_t count, int digits,
+                             int hyphens, char sep, char *out) {
+    size_t i, len;
+    char *p = out;
+
+    if (mobis == NULL || out == NULL || !valid_form_len(digits)) {
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        len = put_groups(&mobis[i], digits, hyphens, p);
+        p[len] = sep;
+        p += len + 1;
+    }
+    return (size_t)(p - out);
+}
+
 /* ============================================================================
  * PARSING API IMPLEMENTATION
  * ============================================================================ */
@@ -475,6 +938,21 @@ int mobi_full_matches(const mobi_t *a, const mobi_t *b) {
  * UTILITY API IMPLEMENTATION
  * ============================================================================ */
 
+unsigned mobi_cpu_features(void) {
+    dispatch_ready();
+    return cpu_features & cpu_mask;
+}
+
+unsigned mobi_cpu_restrict(unsigned mask) {
+    unsigned previous;
+
+    dispatch_ready();
+    previous = cpu_mask;
+    cpu_mask = mask;
+    dispatch_resolve();
+    return previous;
+}
+
 const char* mobi_strerror(mobi_error_t err) {
     switch (err) {
         case MOBI_OK:              return "Success";
@@ -482,6 +960,12 @@ const char* mobi_strerror(mobi_error_t err) {
         case MOBI_ERR_INVALID_HEX: return "Invalid hexadecimal character";
         case MOBI_ERR_INVALID_LEN: return "Invalid input length";
         case MOBI_ERR_INVALID_CHAR:return "Invalid character in mobi";
+        case MOBI_ERR_RANGE:       return "Value out of range (>= 10^21)";
+        case MOBI_ERR_IO:          return "File could not be read or written";
+        case MOBI_ERR_FORMAT:      return "Not a valid mobi corpus or directory file";
+        case MOBI_ERR_NOMEM:       return "Out of memory";
+        case MOBI_ERR_EXISTS:      return "Already registered";
+        case MOBI_ERR_NOT_FOUND:   return "Not registered";
         default:                     return "Unknown error";
     }
 }
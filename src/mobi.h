@@ -60,8 +60,25 @@ typedef enum {
     MOBI_ERR_INVALID_HEX = -2,   /* Invalid hex character */
     MOBI_ERR_INVALID_LEN = -3,   /* Wrong input length */
     MOBI_ERR_INVALID_CHAR= -4,   /* Invalid character in mobi */
+    MOBI_ERR_RANGE       = -5,   /* Value >= 10^21 */
+    MOBI_ERR_IO          = -6,   /* File could not be read or written */
+    MOBI_ERR_FORMAT      = -7,   /* File is not a valid corpus or directory */
+    MOBI_ERR_NOMEM       = -8,   /* Out of memory */
+    MOBI_ERR_EXISTS      = -9,   /* Already registered */
+    MOBI_ERR_NOT_FOUND   = -10,  /* Not registered */
 } mobi_error_t;
 
+/* ============================================================================
+ * CPU FEATURES
+ * ============================================================================ */
+
+typedef enum {
+    MOBI_CPU_SHANI       = 1 << 0,   /* x86 SHA extensions */
+    MOBI_CPU_AVX2        = 1 << 1,   /* 8-lane multi-buffer SHA-256 */
+    MOBI_CPU_AVX512      = 1 << 2,   /* 16-lane multi-buffer SHA-256 */
+    MOBI_CPU_SSE41       = 1 << 3,   /* 16-byte hex decoding */
+} mobi_cpu_t;
+
 /* ============================================================================
  * DATA STRUCTURES
  * ============================================================================ */
@@ -79,6 +96,20 @@ typedef struct {
     char lng[19];       /* 18 digits + null: extended resolution */
 } mobi_t;
 
+/*
+ * mobi_bin_t: The same identity as a 70-bit integer
+ *
+ * value = hi * 10^9 + lo, 0 <= value < 10^21. Splitting at 10^9 keeps the
+ * 12-digit display form as a plain integer (hi) and makes the 15/18-digit
+ * prefixes one multiply-add away. 16 bytes instead of mobi_t's 70; strings
+ * are rendered only when asked for. Ordering (hi, then lo) is numeric
+ * order, which is also the lexicographic order of the 21-digit strings.
+ */
+typedef struct {
+    uint64_t hi;        /* leading 12 digits (the display value), < 10^12 */
+    uint32_t lo;        /* trailing 9 digits, < 10^9 */
+} mobi_bin_t;
+
 /* ============================================================================
  * CORE API
  * ============================================================================ */
@@ -98,6 +129,19 @@ typedef struct {
  */
 mobi_error_t mobi_derive(const char *pubkey_hex, mobi_t *out);
 
+/*
+ * mobi_derive_hex_n: mobi_derive for a hex key of known length
+ *
+ * Skips the strlen; pubkey_hex need not be NUL-terminated, so a key can
+ * be derived straight out of a larger buffer (a JSON event, a text line).
+ *
+ * @param pubkey_hex  Hex characters (upper or lower case)
+ * @param len         Number of characters at pubkey_hex; must be 64
+ * @param out         Output mobi_t structure
+ * @return            MOBI_OK on success, error code otherwise
+ */
+mobi_error_t mobi_derive_hex_n(const char *pubkey_hex, size_t len, mobi_t *out);
+
 /*
  * mobi_derive_bytes: Derive mobi from raw public key bytes
  *
@@ -107,6 +151,1052 @@ mobi_error_t mobi_derive(const char *pubkey_hex, mobi_t *out);
  */
 mobi_error_t mobi_derive_bytes(const uint8_t *pubkey, mobi_t *out);
 
+/*
+ * mobi_derive_bytes_speculative: Low-latency single-key derivation
+ *
+ * Same result as mobi_derive_bytes, tuned for one interactive lookup
+ * rather than throughput: rounds 0-7 (AVX2) or 0-15 (AVX-512) are hashed
+ * together in SIMD lanes and the first accepted round wins. Most keys
+ * finish in one vector pass instead of ~4.7 sequential hashes; the extra
+ * lanes are wasted work, so prefer mobi_derive_batch for bulk jobs.
+ * SHA-NI runs those sequential hashes faster than one lane pass, so with
+ * SHA-NI (or without SIMD support) this is mobi_derive_bytes.
+ *
+ * @param pubkey  32-byte x-only public key
+ * @param out     Output mobi_t structure
+ * @return        MOBI_OK on success, error code otherwise
+ */
+mobi_error_t mobi_derive_bytes_speculative(const uint8_t *pubkey, mobi_t *out);
+
+/* ============================================================================
+ * BINARY API
+ * ============================================================================ */
+
+/*
+ * mobi_derive_bin: Derive the binary form from raw public key bytes
+ *
+ * Same rejection sampling as mobi_derive_bytes, without rendering strings.
+ *
+ * @param pubkey  32-byte x-only public key
+ * @param out     Output mobi_bin_t
+ * @return        MOBI_OK on success, error code otherwise
+ */
+mobi_error_t mobi_derive_bin(const uint8_t *pubkey, mobi_bin_t *out);
+
+/*
+ * mobi_bin_to_mobi: Render every string form into a mobi_t
+ *
+ * @param m     Binary mobi
+ * @param out   Output mobi_t structure
+ * @return      MOBI_OK on success
+ */
+mobi_error_t mobi_bin_to_mobi(const mobi_bin_t *m, mobi_t *out);
+
+/*
+ * mobi_bin_to_string: Render one form as digits
+ *
+ * @param m       Binary mobi
+ * @param digits  12, 15, 18 or 21
+ * @param out     Output buffer (min digits + 1 bytes)
+ * @return        MOBI_OK on success, MOBI_ERR_INVALID_LEN for other lengths
+ */
+mobi_error_t mobi_bin_to_string(const mobi_bin_t *m, int digits, char *out);
+
+/*
+ * mobi_bin_parse: Parse a 21-digit canonical mobi
+ *
+ * @param full  Exactly 21 digits, NUL-terminated (see mobi_normalize)
+ * @param out   Output mobi_bin_t
+ * @return      MOBI_OK, MOBI_ERR_INVALID_LEN or MOBI_ERR_INVALID_CHAR
+ */
+mobi_error_t mobi_bin_parse(const char *full, mobi_bin_t *out);
+
+/*
+ * mobi_bin_compare: Numeric order of two binary mobis
+ *
+ * @return  <0, 0 or >0, like memcmp (and like strcmp on the full strings)
+ */
+int mobi_bin_compare(const mobi_bin_t *a, const mobi_bin_t *b);
+
+/*
+ * mobi_bin_hash: 64-bit hash for hash tables
+ *
+ * Mobis are already uniform, but not in every bit of (hi, lo); this mixes
+ * both halves so any subset of hash bits is usable as a bucket index.
+ */
+uint64_t mobi_bin_hash(const mobi_bin_t *m);
+
+/*
+ * mobi_bin_prefix: Leading digits as an integer
+ *
+ * @param m       Binary mobi
+ * @param digits  12, 15 or 18 (21 digits do not fit in 64 bits: use m)
+ * @return        The prefix value, or UINT64_MAX for other lengths
+ *
+ * Example: full 879044656584686196443 -> 12: 879044656584, 15: 879044656584686
+ */
+uint64_t mobi_bin_prefix(const mobi_bin_t *m, int digits);
+
+/*
+ * mobi_bin_pack: 9-byte big-endian encoding of the 72-bit value
+ *
+ * This is exactly the accepted digest prefix the value came from. Useful
+ * as a compact on-disk column (9 bytes vs 16 for the aligned struct).
+ */
+void mobi_bin_pack(const mobi_bin_t *m, uint8_t out[9]);
+
+/*
+ * mobi_bin_unpack: Decode mobi_bin_pack output
+ *
+ * @return  MOBI_OK, or MOBI_ERR_RANGE if the value is not below 10^21
+ */
+mobi_error_t mobi_bin_unpack(const uint8_t in[9], mobi_bin_t *out);
+
+/* ============================================================================
+ * BATCH API
+ * ============================================================================ */
+
+/*
+ * mobi_derive_batch: Derive mobis for many raw public keys
+ *
+ * Equivalent to calling mobi_derive_bytes on each key, but hashes several
+ * keys at once in SIMD lanes when the CPU allows. A lane whose key passes
+ * the rejection test is refilled from the queue immediately, so a key that
+ * needs many rounds never holds up the others.
+ *
+ * @param pubkeys  count * 32 bytes of x-only public keys, back to back
+ * @param count    Number of keys
+ * @param out      Output array of count mobi_t
+ * @return         MOBI_OK on success, otherwise the first error seen
+ *                 (the remaining keys are still derived)
+ */
+mobi_error_t mobi_derive_batch(const uint8_t *pubkeys, size_t count, mobi_t *out);
+
+/*
+ * mobi_derive_batch_bin: mobi_derive_batch producing binary mobis
+ *
+ * @param pubkeys  count * 32 bytes of x-only public keys, back to back
+ * @param count    Number of keys
+ * @param out      Output array of count mobi_bin_t
+ * @return         MOBI_OK on success, otherwise the first error seen
+ */
+mobi_error_t mobi_derive_batch_bin(const uint8_t *pubkeys, size_t count, mobi_bin_t *out);
+
+/*
+ * mobi_derive_batch_mt: mobi_derive_batch spread over several threads
+ *
+ * The keys are split into chunks that worker threads take from their own
+ * share and, once it runs dry, steal from the busiest other share. Each
+ * chunk goes through the same lane engine as mobi_derive_batch, so the
+ * output is identical to the single-threaded call.
+ *
+ * @param pubkeys  count * 32 bytes of x-only public keys, back to back
+ * @param count    Number of keys
+ * @param out      Output array of count mobi_t
+ * @param threads  Worker threads (including the caller), or 0 for one per
+ *                 online CPU
+ * @return         MOBI_OK on success, otherwise an error from some chunk
+ */
+mobi_error_t mobi_derive_batch_mt(const uint8_t *pubkeys, size_t count, mobi_t *out,
+                                  int threads);
+
+/*
+ * mobi_derive_batch_bin_mt: mobi_derive_batch_mt producing binary mobis
+ *
+ * @param pubkeys  count * 32 bytes of x-only public keys, back to back
+ * @param count    Number of keys
+ * @param out      Output array of count mobi_bin_t
+ * @param threads  Worker threads (including the caller), or 0 for one per
+ *                 online CPU
+ * @return         MOBI_OK on success, otherwise an error from some chunk
+ */
+mobi_error_t mobi_derive_batch_bin_mt(const uint8_t *pubkeys, size_t count, mobi_bin_t *out,
+                                      int threads);
+
+/*
+ * mobi_hex_decode_batch: Decode many hex keys into 32-byte records
+ *
+ * Key i is the 64 characters starting at hex + i * stride; whatever
+ * follows them (a newline, a comma) is skipped. The output is ready for
+ * mobi_derive_batch. Uses SSE4.1 / AVX2 when available.
+ *
+ * @param hex     First key's characters
+ * @param count   Number of keys
+ * @param stride  Distance between keys in bytes (>= 64), or 0 for 64
+ * @param out     Output buffer of count * 32 bytes
+ * @return        MOBI_OK, or MOBI_ERR_INVALID_HEX if any key had a non-hex
+ *                character (those records are zeroed, the rest decoded)
+ */
+mobi_error_t mobi_hex_decode_batch(const char *hex, size_t count, size_t stride,
+                                   uint8_t *out);
+
+/* ============================================================================
+ * CORPUS FILES
+ * ============================================================================ */
+
+/*
+ * A corpus is a flat binary file of pubkeys, mapped into memory and derived
+ * in place:
+ *
+ *   offset 0    64-byte header, all integers little-endian
+ *                 0  magic "MOBICORP"
+ *                 8  uint32 version (1)
+ *                12  uint32 flags (MOBI_CORPUS_MOBIS)
+ *                16  uint64 key count n
+ *                24  uint64 offset of the key column (64)
+ *                32  uint64 offset of the mobi column (64 + 32n, or 0)
+ *                40  reserved, zero
+ *   offset 64   n x 32-byte x-only pubkeys
+ *   then        n x 9-byte mobis (mobi_bin_pack), if MOBI_CORPUS_MOBIS
+ */
+#define MOBI_CORPUS_MAGIC       "MOBICORP"
+#define MOBI_CORPUS_VERSION     1
+#define MOBI_CORPUS_HEADER_LEN  64
+#define MOBI_CORPUS_MOBIS       0x1u    /* flag: derived mobi column present */
+
+/* An open, read-only corpus. keys and mobis point into the mapping. */
+typedef struct {
+    const uint8_t *keys;    /* count * 32 bytes */
+    const uint8_t *mobis;   /* count * 9 bytes, or NULL without the column */
+    uint64_t count;
+    uint32_t flags;
+    void *map;              /* private */
+    size_t map_len;         /* private */
+} mobi_corpus_t;
+
+/* A corpus being written. Keys are streamed in; see mobi_corpus_writer_close. */
+typedef struct {
+    void *file;             /* private */
+    uint64_t count;         /* keys written so far */
+} mobi_corpus_writer_t;
+
+/*
+ * mobi_corpus_open: Map a corpus file read-only
+ *
+ * The header and column sizes are checked against the file size; no key
+ * data is read until it is used.
+ *
+ * @param path    Corpus file
+ * @param out     Filled on success; release with mobi_corpus_close
+ * @return        MOBI_OK, MOBI_ERR_IO or MOBI_ERR_FORMAT
+ */
+mobi_error_t mobi_corpus_open(const char *path, mobi_corpus_t *out);
+
+/* mobi_corpus_close: Unmap a corpus opened with mobi_corpus_open */
+void mobi_corpus_close(mobi_corpus_t *corpus);
+
+/*
+ * mobi_corpus_derive: Derive keys [first, first + count) from the mapping
+ *
+ * The keys are hashed straight out of the mapped pages (no copy) with
+ * mobi_derive_batch_bin_mt.
+ *
+ * @param corpus   Open corpus
+ * @param first    Index of the first key
+ * @param count    Number of keys
+ * @param out      Output array of count mobi_bin_t
+ * @param threads  Worker threads, or 0 for one per online CPU
+ * @return         MOBI_OK, MOBI_ERR_NULL, or MOBI_ERR_INVALID_LEN if the
+ *                 range runs past the end of the corpus
+ */
+mobi_error_t mobi_corpus_derive(const mobi_corpus_t *corpus, uint64_t first, size_t count,
+                                mobi_bin_t *out, int threads);
+
+/*
+ * mobi_corpus_verify: Re-derive every key and compare with the mobi column
+ *
+ * @param corpus      Open corpus with MOBI_CORPUS_MOBIS
+ * @param threads     Worker threads, or 0 for one per online CPU
+ * @param mismatches  Set to the number of keys whose stored mobi is wrong
+ * @return            MOBI_OK (check mismatches), MOBI_ERR_NULL, or
+ *                    MOBI_ERR_FORMAT if the corpus has no mobi column
+ */
+mobi_error_t mobi_corpus_verify(const mobi_corpus_t *corpus, int threads,
+                                uint64_t *mismatches);
+
+/*
+ * mobi_corpus_writer_open: Start writing a corpus file
+ *
+ * mobi_corpus_writer_close replaces path atomically; until then path is
+ * left as it was.
+ *
+ * @param w       Writer state
+ * @param path    File to create, replaced if it exists
+ * @return        MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM or MOBI_ERR_IO
+ */
+mobi_error_t mobi_corpus_writer_open(mobi_corpus_writer_t *w, const char *path);
+
+/*
+ * mobi_corpus_writer_add: Append count raw 32-byte keys
+ *
+ * @return  MOBI_OK, MOBI_ERR_NULL or MOBI_ERR_IO
+ */
+mobi_error_t mobi_corpus_writer_add(mobi_corpus_writer_t *w, const uint8_t *keys,
+                                    size_t count);
+
+/*
+ * mobi_corpus_writer_close: Finish the header and move the file into place
+ *
+ * With MOBI_CORPUS_MOBIS in flags the key column is mapped back in and
+ * the mobi column is derived from it and appended. On error path is left
+ * as it was.
+ *
+ * @param w        Writer state (closed even on error)
+ * @param flags    0 or MOBI_CORPUS_MOBIS
+ * @param threads  Worker threads for the mobi column, or 0 for one per CPU
+ * @return         MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM or MOBI_ERR_IO
+ */
+mobi_error_t mobi_corpus_writer_close(mobi_corpus_writer_t *w, uint32_t flags, int threads);
+
+/* ============================================================================
+ * FILE INGEST
+ * ============================================================================ */
+
+/*
+ * Streams a region of raw 32-byte keys from a file through batch
+ * derivation with reads kept in flight while earlier buffers are hashed.
+ * On Linux this uses io_uring with registered buffers; elsewhere, or when
+ * the kernel refuses a ring, it falls back to synchronous pread().
+ */
+#define MOBI_INGEST_PREAD   0x1u    /* flag: never use io_uring */
+
+typedef struct {
+    uint64_t offset;        /* file offset of the first key */
+    uint64_t length;        /* bytes of keys, a multiple of 32; 0 = to end of file */
+    size_t buffer_size;     /* bytes per read, rounded down to whole keys; 0 = 4 MiB */
+    int depth;              /* buffers (reads in flight + the one being hashed); 0 = 8 */
+    int threads;            /* derivation threads, 0 = one per online CPU */
+    unsigned flags;         /* MOBI_INGEST_* */
+} mobi_ingest_opts_t;
+
+/*
+ * Called once per buffer, in file order, on the thread that called
+ * mobi_ingest. keys and mobis are only valid during the call.
+ *
+ * @param first  Index of keys[0] within the region
+ * @return       0 to continue, nonzero to stop early
+ */
+typedef int (*mobi_ingest_fn)(void *ctx, const uint8_t *keys, const mobi_bin_t *mobis,
+                              size_t count, uint64_t first);
+
+/*
+ * mobi_ingest: Derive every key in a file region, overlapping I/O and hashing
+ *
+ * @param path  File to read
+ * @param opts  Region and tuning, or NULL for the whole file with defaults
+ * @param fn    Receives each buffer of keys with their mobis
+ * @param ctx   Passed through to fn
+ * @return      MOBI_OK (also when fn stops early), MOBI_ERR_NULL, MOBI_ERR_NOMEM,
+ *              MOBI_ERR_IO, or MOBI_ERR_INVALID_LEN if the region is not whole keys
+ */
+mobi_error_t mobi_ingest(const char *path, const mobi_ingest_opts_t *opts,
+                         mobi_ingest_fn fn, void *ctx);
+
+/*
+ * mobi_ingest_uring_available: Whether mobi_ingest can use io_uring here
+ *
+ * @return  1 if this kernel lets us set up a ring, 0 if mobi_ingest will
+ *          use pread()
+ */
+int mobi_ingest_uring_available(void);
+
+/* ============================================================================
+ * ARROW EXPORT
+ * ============================================================================ */
+
+/*
+ * Writes keys and their mobis as an Arrow IPC file (Feather v2), one
+ * record batch per mobi_arrow_writer_add call, with three non-null
+ * columns:
+ *
+ *   pubkey   fixed_size_binary[32]   x-only pubkey
+ *   full     decimal128(21, 0)       the 21-digit canonical mobi
+ *   display  uint64                  the 12-digit display mobi
+ *
+ * Buffers are little-endian and 8-byte aligned, so Arrow readers can map
+ * the file and use the columns without parsing or copying.
+ */
+typedef struct {
+    void *file;             /* private */
+    void *blocks;           /* private: footer entries */
+    size_t blocks_cap;      /* private */
+    uint64_t offset;        /* private: bytes written so far */
+    size_t batches;         /* record batches written so far */
+    uint64_t rows;          /* rows written so far */
+} mobi_arrow_writer_t;
+
+/*
+ * mobi_arrow_writer_open: Create an Arrow file and write its schema
+ *
+ * @param w       Writer state
+ * @param path    File to create (truncated if it exists)
+ * @return        MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM or MOBI_ERR_IO
+ */
+mobi_error_t mobi_arrow_writer_open(mobi_arrow_writer_t *w, const char *path);
+
+/*
+ * mobi_arrow_writer_add: Append one record batch
+ *
+ * The pubkey column is written straight from keys; full and display are
+ * converted from mobis, typically the output of mobi_derive_batch_bin_mt.
+ * An empty batch writes nothing.
+ *
+ * @param w       Open writer
+ * @param keys    count * 32 bytes of raw pubkeys
+ * @param mobis   count mobis derived from keys
+ * @param count   Rows in the batch
+ * @return        MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM or MOBI_ERR_IO
+ */
+mobi_error_t mobi_arrow_writer_add(mobi_arrow_writer_t *w, const uint8_t *keys,
+                                   const mobi_bin_t *mobis, size_t count);
+
+/*
+ * mobi_arrow_writer_close: Write the footer and close the file
+ *
+ * @param w       Writer state (closed even on error)
+ * @return        MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM or MOBI_ERR_IO
+ */
+mobi_error_t mobi_arrow_writer_close(mobi_arrow_writer_t *w);
+
+/* ============================================================================
+ * DIRECTORY
+ * ============================================================================ */
+
+/*
+ * mobi_entry_t: A binary mobi with a 32-bit payload
+ *
+ * Laid out like mobi_bin_t, with the payload in what would be padding:
+ * 16 bytes per entry. In a directory, id is the index of the pubkey in
+ * the array the directory was built from.
+ */
+typedef struct {
+    uint64_t hi;        /* as mobi_bin_t */
+    uint32_t lo;
+    uint32_t id;        /* payload */
+} mobi_entry_t;
+
+/*
+ * mobi_sort_entries: Stable sort by (hi, lo)
+ *
+ * Parallel LSD radix sort: seven 11-bit digits, per-worker histograms and
+ * write-combining scatter buffers. Equal mobis keep their input order.
+ *
+ * @param entries  Array to sort in place
+ * @param scratch  count entries of scratch space, or NULL to allocate it
+ * @param count    Number of entries
+ * @param threads  Worker threads, or 0 for one per online CPU
+ * @return         MOBI_OK, MOBI_ERR_NULL or MOBI_ERR_NOMEM (entries unchanged)
+ */
+mobi_error_t mobi_sort_entries(mobi_entry_t *entries, mobi_entry_t *scratch, size_t count,
+                               int threads);
+
+/*
+ * Every mobi of a user set in numeric order (equal mobis in input order),
+ * with a search layer: every 16th entry in Eytzinger order, so lookups
+ * touch a few predictable cache lines instead of ~log2(n) scattered ones.
+ * A directory opened from a file points into a read-only mapping.
+ */
+typedef struct {
+    mobi_entry_t *entries;
+    size_t count;
+    mobi_entry_t *index;        /* search layer, nodes 1..index_count */
+    size_t index_count;
+    const uint8_t *pubkeys;     /* count * 32 bytes in entry order, or NULL */
+    void *map;                  /* private */
+    size_t map_len;             /* private */
+} mobi_dir_t;
+
+/*
+ * mobi_dir_build: Sort derived mobis into a directory
+ *
+ * @param dir     Output; release with mobi_dir_free
+ * @param mobis   count mobis, typically from mobi_derive_batch_bin;
+ *                entries[i].id is the index into this array
+ * @param count   Number of mobis (below 2^32)
+ * @return        MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM, or
+ *                MOBI_ERR_INVALID_LEN if count does not fit the payload
+ */
+mobi_error_t mobi_dir_build(mobi_dir_t *dir, const mobi_bin_t *mobis, size_t count);
+
+/* mobi_dir_build sorting on threads workers (0 = one per online CPU) */
+mobi_error_t mobi_dir_build_mt(mobi_dir_t *dir, const mobi_bin_t *mobis, size_t count,
+                               int threads);
+
+/* mobi_dir_free: Release a directory from mobi_dir_build or mobi_dir_open */
+void mobi_dir_free(mobi_dir_t *dir);
+
+/*
+ * mobi_prefix_range: The mobis a typed prefix can stand for
+ *
+ * A prefix p of d digits matches exactly [p * 10^(21-d), (p+1) * 10^(21-d)),
+ * e.g. a 12-digit display covers [p * 10^9, (p+1) * 10^9). end may be
+ * 10^21, represented as hi = 10^12, lo = 0.
+ *
+ * @param digits  Digits only (see mobi_normalize), need not be terminated
+ * @param len     Number of digits, 1 to 21
+ * @param start   First matching value
+ * @param end     One past the last matching value
+ * @return        MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_INVALID_LEN or
+ *                MOBI_ERR_INVALID_CHAR
+ */
+mobi_error_t mobi_prefix_range(const char *digits, size_t len, mobi_bin_t *start,
+                               mobi_bin_t *end);
+
+/*
+ * mobi_lookup: Every directory entry starting with a typed prefix
+ *
+ * Two descents of the search layer, O(log n). A count of 1 is a unique
+ * match; more than one means the user should type more digits.
+ *
+ * @param dir     Directory
+ * @param digits  Digits only, e.g. a 12/15/18/21-digit form
+ * @param len     Number of digits, 1 to 21
+ * @param first   Index of the first match in dir->entries
+ * @param count   Number of matches (they are contiguous)
+ * @return        As mobi_prefix_range
+ */
+mobi_error_t mobi_lookup(const mobi_dir_t *dir, const char *digits, size_t len,
+                         size_t *first, size_t *count);
+
+/*
+ * mobi_resolve_levels: How many digits each user of a set must show
+ *
+ * The protocol displays 12 digits and reveals more on collision; this
+ * computes, for a whole user set at once, the shortest of 12/15/18/21
+ * digits that no other member shares. The mobis are radix-sorted and each
+ * is compared with its two neighbours, which share the longest prefixes.
+ * Users with identical full mobis (the same pubkey twice) get 21.
+ *
+ * @param mobis    count derived mobis
+ * @param count    Number of users (below 2^32)
+ * @param levels   Output: count bytes, levels[i] is 12, 15, 18 or 21 for mobis[i]
+ * @param threads  Worker threads, or 0 for one per online CPU
+ * @return         MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM or MOBI_ERR_INVALID_LEN
+ */
+mobi_error_t mobi_resolve_levels(const mobi_bin_t *mobis, size_t count, uint8_t *levels,
+                                 int threads);
+
+/* How mobi_bin_lower_bound and mobi_bin_lookup search */
+typedef enum {
+    MOBI_SEARCH_BINARY      = 0,    /* bisection, ~log2(n) probes */
+    MOBI_SEARCH_INTERPOLATE = 1,    /* predicted positions, from 2^24 uniform mobis up */
+} mobi_search_t;
+
+/*
+ * mobi_bin_lower_bound: The first mobi of a sorted array not below m
+ *
+ * MOBI_SEARCH_INTERPOLATE predicts the position from the value, since
+ * mobis are uniform over [0, 10^21), and brackets the prediction error; a
+ * random set of n mobis takes about log2(log2(n)) rounds of two probes.
+ * Those rounds are cold misses where bisection's first levels stay in
+ * cache, so interpolation only wins on large arrays: below 2^24 mobis
+ * (256 MB) this mode bisects. It assumes the array spans the whole range
+ * (a full user set, not a slice of one); any other sorted array is still
+ * searched correctly, in O(log n) probes.
+ *
+ * @param sorted  count mobis in mobi order (mobi_bin_compare)
+ * @param m       Value to search for
+ * @param mode    MOBI_SEARCH_BINARY or MOBI_SEARCH_INTERPOLATE
+ * @return        Index of the first element >= m, count if none, 0 on NULL
+ */
+size_t mobi_bin_lower_bound(const mobi_bin_t *sorted, size_t count, const mobi_bin_t *m,
+                            mobi_search_t mode);
+
+/*
+ * mobi_bin_lookup: Every mobi of a sorted array starting with a typed prefix
+ *
+ * As mobi_lookup, for a plain sorted array: two lower bounds over
+ * mobi_prefix_range, matches at [first, first + matches).
+ *
+ * @return  As mobi_prefix_range
+ */
+mobi_error_t mobi_bin_lookup(const mobi_bin_t *sorted, size_t count, const char *digits,
+                             size_t len, mobi_search_t mode, size_t *first, size_t *matches);
+
+/* ============================================================================
+ * DIRECTORY FILES
+ * ============================================================================ */
+
+/*
+ * An immutable directory on disk, mapped and used in place. All integers
+ * little-endian; every section starts on a 4096-byte boundary.
+ *
+ *   offset 0    header (4096 bytes)
+ *                 0  magic "MOBIDIRF"
+ *                 8  uint32 version (1)
+ *                12  uint32 flags (MOBI_DIRFILE_PUBKEYS)
+ *                16  uint64 entry count n
+ *                24  uint64 offset of the entries (4096)
+ *                32  uint64 search layer node count m (ceil(n / 16))
+ *                40  uint64 offset of the search layer
+ *                48  uint64 offset of the pubkeys, or 0
+ *                56  reserved, zero
+ *   then        n x 16-byte mobi_entry_t, sorted
+ *   then        (m + 1) x 16-byte mobi_entry_t, Eytzinger order; node 0 unused
+ *   then        n x 32-byte pubkeys in entry order, if MOBI_DIRFILE_PUBKEYS
+ */
+#define MOBI_DIRFILE_MAGIC       "MOBIDIRF"
+#define MOBI_DIRFILE_VERSION     1
+#define MOBI_DIRFILE_HEADER_LEN  4096
+#define MOBI_DIRFILE_PUBKEYS     0x1u   /* flag: pubkey column present */
+
+/* mobi_dir_open flags */
+#define MOBI_DIR_POPULATE   0x1u    /* fault the whole file in up front */
+#define MOBI_DIR_HUGEPAGES  0x2u    /* ask for transparent huge pages (hint) */
+
+/*
+ * mobi_dir_write: Save a directory as a directory file
+ *
+ * Replaces path atomically.
+ *
+ * @param dir     Directory from mobi_dir_build or mobi_dir_open
+ * @param keys    The 32-byte pubkeys the directory was built from, in input
+ *                order (keys + 32 * id), or NULL to omit the column
+ * @param path    Output file, replaced if it exists
+ * @return        MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM or MOBI_ERR_IO
+ */
+mobi_error_t mobi_dir_write(const mobi_dir_t *dir, const uint8_t *keys, const char *path);
+
+/*
+ * mobi_dir_open: Map a directory file read-only
+ *
+ * Only the header is read; mobi_lookup works at once and faults in the
+ * pages it touches. The search layer is prefetched and the entries are
+ * marked for random access. The entries, search layer and pubkeys point
+ * into the mapping and must not be written.
+ *
+ * @param dir     Filled on success; release with mobi_dir_free
+ * @param path    Directory file
+ * @param flags   MOBI_DIR_POPULATE and/or MOBI_DIR_HUGEPAGES, or 0
+ * @return        MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_IO, or MOBI_ERR_FORMAT
+ *                (also on big-endian hosts, which cannot use it in place)
+ */
+mobi_error_t mobi_dir_open(mobi_dir_t *dir, const char *path, unsigned flags);
+
+/* ============================================================================
+ * REGISTRY
+ * ============================================================================ */
+
+/*
+ * A mutable user set that keeps every member's display level current.
+ * Users are identified by their mobi and a caller-chosen id (e.g. a row
+ * number), so two pubkeys with the same full mobi are still two users.
+ * Not thread-safe: serialize calls on one registry.
+ */
+typedef struct {
+    void *head;         /* private */
+    size_t count;       /* registered users */
+    int height;         /* private */
+    uint64_t rng;       /* private */
+} mobi_registry_t;
+
+/* A user whose level (12, 15, 18 or 21) changed */
+typedef struct {
+    uint32_t id;
+    uint8_t level;
+} mobi_level_change_t;
+
+/* mobi_registry_init: An empty registry; release with mobi_registry_free */
+mobi_error_t mobi_registry_init(mobi_registry_t *reg);
+
+/* mobi_registry_free: Release a registry and every user in it */
+void mobi_registry_free(mobi_registry_t *reg);
+
+/*
+ * mobi_registry_insert: Register a user, O(log n)
+ *
+ * The new user and its two neighbours in mobi order are the only users
+ * whose level can change; each one that did is reported, the new user
+ * first. A user colliding at 12 digits with A makes both of them 15.
+ *
+ * @param reg      Registry
+ * @param m        The user's mobi
+ * @param id       Caller's handle for the user
+ * @param changes  Output: up to 3 changes, or NULL
+ * @param changed  Output: number of changes (at least 1), or NULL
+ * @return         MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_RANGE, MOBI_ERR_NOMEM, or
+ *                 MOBI_ERR_EXISTS if (m, id) is already registered
+ */
+mobi_error_t mobi_registry_insert(mobi_registry_t *reg, const mobi_bin_t *m, uint32_t id,
+                                  mobi_level_change_t changes[3], size_t *changed);
+
+/*
+ * mobi_registry_remove: Unregister a user, O(log n)
+ *
+ * Its former neighbours may drop back to a shorter level; each one that
+ * did is reported.
+ *
+ * @param changes  Output: up to 2 changes, or NULL
+ * @param changed  Output: number of changes, or NULL
+ * @return         MOBI_OK, MOBI_ERR_NULL or MOBI_ERR_NOT_FOUND
+ */
+mobi_error_t mobi_registry_remove(mobi_registry_t *reg, const mobi_bin_t *m, uint32_t id,
+                                  mobi_level_change_t changes[2], size_t *changed);
+
+/*
+ * mobi_registry_level: A registered user's current level, O(log n)
+ *
+ * @param level   Output: 12, 15, 18 or 21
+ * @return        MOBI_OK, MOBI_ERR_NULL or MOBI_ERR_NOT_FOUND
+ */
+mobi_error_t mobi_registry_level(const mobi_registry_t *reg, const mobi_bin_t *m,
+                                 uint32_t id, uint8_t *level);
+
+/* ============================================================================
+ * DISPLAY TABLE
+ * ============================================================================ */
+
+/*
+ * A concurrent hash table from 12-digit display (mobi_bin_t.hi) to every
+ * user showing it: full mobi plus a caller-chosen id such as a pubkey
+ * handle. Lookups are lock-free and never wait for a writer. Writers
+ * claim slots with a CAS each; inserts of one display also serialize on
+ * one of 64 striped locks, so there is no global mutex. Any number of
+ * threads may insert, remove and find at once.
+ *
+ * Capacity is fixed at init. Removed slots are reused by later inserts,
+ * and once removed slots pile up, an insert rebuilds the slot array
+ * without them; lookups carry on in the old array meanwhile.
+ */
+typedef struct {
+    void *state;        /* private */
+    size_t mask;        /* private */
+    size_t limit;       /* most users at once */
+    size_t count;       /* users present (exact when no writer is running) */
+} mobi_table_t;
+
+/*
+ * mobi_table_init: An empty table for up to max_users users
+ *
+ * Sized to stay at most 3/4 full: 16 bytes per slot, power-of-two slots.
+ * Live and removed slots together are kept under 7/8.
+ *
+ * @return        MOBI_OK, MOBI_ERR_NULL or MOBI_ERR_NOMEM
+ */
+mobi_error_t mobi_table_init(mobi_table_t *t, size_t max_users);
+
+/* mobi_table_free: Release a table; no other thread may be using it */
+void mobi_table_free(mobi_table_t *t);
+
+/*
+ * mobi_table_insert: Add a user
+ *
+ * The same (m, id) inserted by several threads at once is added once;
+ * the others get MOBI_ERR_EXISTS.
+ *
+ * @return        MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_RANGE, MOBI_ERR_EXISTS, or
+ *                MOBI_ERR_NOMEM if the table already holds limit users
+ */
+mobi_error_t mobi_table_insert(mobi_table_t *t, const mobi_bin_t *m, uint32_t id);
+
+/*
+ * mobi_table_remove: Remove a user
+ *
+ * @return        MOBI_OK, MOBI_ERR_NULL or MOBI_ERR_NOT_FOUND
+ */
+mobi_error_t mobi_table_remove(mobi_table_t *t, const mobi_bin_t *m, uint32_t id);
+
+/*
+ * mobi_table_find: Every user with a given display
+ *
+ * Lock-free. A user being inserted or removed concurrently may or may not
+ * be reported, but each user reported is complete and was present.
+ *
+ * @param t        Table
+ * @param display  12-digit display value, e.g. start.hi from mobi_prefix_range
+ * @param out      Output: up to max users (hi, lo, id)
+ * @param max      Capacity of out
+ * @return         Number of users with this display (may exceed max)
+ */
+size_t mobi_table_find(const mobi_table_t *t, uint64_t display, mobi_entry_t *out,
+                       size_t max);
+
+/*
+ * mobi_table_probes: Slots a lookup of display walks, for monitoring
+ *
+ * @return         Slots read before the first empty one, 0 on NULL input
+ */
+size_t mobi_table_probes(const mobi_table_t *t, uint64_t display);
+
+/* ============================================================================
+ * DISPLAY FILTER
+ * ============================================================================ */
+
+/*
+ * A static binary fuse filter over a set of 12-digit displays: about 9
+ * bits per display, no false negatives, and a false-positive rate of
+ * 1/256 (0.39%). Answers "is this display taken?" without the index.
+ *
+ * Serialized form, used in place (all integers little-endian):
+ *
+ *   offset 0    header (64 bytes)
+ *                 0  magic "MOBIFUSE"
+ *                 8  uint32 version (1)
+ *                12  uint32 fingerprint bits (8)
+ *                16  uint64 distinct displays
+ *                24  uint64 seed
+ *                32  uint32 segment length (a power of two)
+ *                36  uint32 segment count x segment length
+ *                40  uint32 fingerprint count (the above + 2 segments)
+ *                44  reserved, zero
+ *   offset 64   fingerprints, one byte each
+ */
+#define MOBI_FILTER_MAGIC       "MOBIFUSE"
+#define MOBI_FILTER_VERSION     1
+#define MOBI_FILTER_HEADER_LEN  64
+
+typedef struct {
+    uint64_t count;                 /* distinct displays */
+    uint64_t seed;
+    uint32_t segment_length;
+    uint32_t segment_count_length;
+    uint32_t array_length;          /* fingerprints */
+    const uint8_t *fingerprints;
+    void *data;                     /* serialized form: data_len bytes */
+    size_t data_len;
+    int owned;                      /* private */
+    size_t map_len;                 /* private */
+} mobi_filter_t;
+
+/*
+ * mobi_filter_build: Build a filter from display values
+ *
+ * Repeated displays are fine (they are deduplicated first).
+ *
+ * @param f         Output; release with mobi_filter_free
+ * @param displays  count display values (mobi_bin_t.hi)
+ * @return          MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_RANGE, MOBI_ERR_NOMEM, or
+ *                  MOBI_ERR_INVALID_LEN for 2^31 or more distinct displays
+ */
+mobi_error_t mobi_filter_build(mobi_filter_t *f, const uint64_t *displays, size_t count);
+
+/*
+ * mobi_filter_contains: Whether a display may be in the set
+ *
+ * @return  0 if it is definitely not; 1 if it is, or with probability
+ *          1/256 for a display that is not
+ */
+int mobi_filter_contains(const mobi_filter_t *f, uint64_t display);
+
+/*
+ * mobi_filter_view: Use a serialized filter in place
+ *
+ * For a filter received over the network or embedded in another file.
+ * Nothing is copied; data must outlive the filter. f->data and
+ * f->data_len of a built filter are its serialized form.
+ *
+ * @return  MOBI_OK, MOBI_ERR_NULL or MOBI_ERR_FORMAT
+ */
+mobi_error_t mobi_filter_view(mobi_filter_t *f, const uint8_t *data, size_t len);
+
+/*
+ * mobi_filter_write: Save the serialized form
+ *
+ * Replaces path atomically.
+ *
+ * @return  MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM or MOBI_ERR_IO
+ */
+mobi_error_t mobi_filter_write(const mobi_filter_t *f, const char *path);
+
+/*
+ * mobi_filter_open: Map a filter file read-only
+ *
+ * @return  MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_IO or MOBI_ERR_FORMAT
+ */
+mobi_error_t mobi_filter_open(mobi_filter_t *f, const char *path);
+
+/* mobi_filter_free: Release a built or opened filter (a view owns nothing) */
+void mobi_filter_free(mobi_filter_t *f);
+
+/* ============================================================================
+ * SUCCINCT DIRECTORY
+ * ============================================================================ */
+
+/*
+ * A sorted set of mobis in Elias-Fano form: log2(10^21 / n) + 2 bits per
+ * mobi plus ~1% for select samples, e.g. about 45 bits (5.7 bytes) each
+ * at 100M users. Element i is the i-th smallest mobi; equal mobis are
+ * kept. There are no ids: position i is the handle, and a caller that
+ * needs pubkeys keeps them in the same order.
+ */
+typedef struct {
+    size_t count;
+    int low_bits;           /* l: bits stored verbatim per mobi */
+    uint64_t *low;          /* count * l bits */
+    uint64_t *high;         /* high_len bits: the rest, in unary */
+    size_t high_len;
+    uint64_t *select1;      /* private: every 256th one */
+    uint64_t *select0;      /* private: every 256th zero */
+    size_t bytes;           /* heap used by all of the above */
+} mobi_ef_t;
+
+/*
+ * mobi_ef_build: Encode a set of mobis
+ *
+ * Sorted input is encoded directly; otherwise a sorted copy (16 bytes per
+ * mobi) is made first with mobi_sort_entries.
+ *
+ * @param ef       Output; release with mobi_ef_free
+ * @param mobis    count mobis, any order
+ * @param threads  Worker threads for the sort, or 0 for one per online CPU
+ * @return         MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_RANGE or MOBI_ERR_NOMEM
+ */
+mobi_error_t mobi_ef_build(mobi_ef_t *ef, const mobi_bin_t *mobis, size_t count,
+                           int threads);
+
+/* mobi_ef_free: Release a succinct directory */
+void mobi_ef_free(mobi_ef_t *ef);
+
+/*
+ * mobi_ef_select: The i-th smallest mobi
+ *
+ * @return  MOBI_OK, MOBI_ERR_NULL, or MOBI_ERR_RANGE if i >= count
+ */
+mobi_error_t mobi_ef_select(const mobi_ef_t *ef, size_t i, mobi_bin_t *out);
+
+/* mobi_ef_rank: How many mobis of the set are below m */
+size_t mobi_ef_rank(const mobi_ef_t *ef, const mobi_bin_t *m);
+
+/*
+ * mobi_ef_successor: The smallest mobi of the set not below m
+ *
+ * @param index   Output: its position
+ * @param out     Output: the mobi
+ * @return        MOBI_OK, MOBI_ERR_NULL, or MOBI_ERR_NOT_FOUND if every
+ *                mobi is below m
+ */
+mobi_error_t mobi_ef_successor(const mobi_ef_t *ef, const mobi_bin_t *m, size_t *index,
+                               mobi_bin_t *out);
+
+/*
+ * mobi_ef_lookup: Every mobi starting with a typed prefix
+ *
+ * As mobi_lookup: two ranks over mobi_prefix_range, matches at positions
+ * [first, first + count).
+ *
+ * @return  As mobi_prefix_range
+ */
+mobi_error_t mobi_ef_lookup(const mobi_ef_t *ef, const char *digits, size_t len,
+                            size_t *first, size_t *count);
+
+/* ============================================================================
+ * PERFECT HASH
+ * ============================================================================ */
+
+/*
+ * A minimal perfect hash over a static set of full mobis: each member maps
+ * to its own slot in [0, count) in O(1), through about 3 bits per mobi of
+ * pilots. Every slot also stores its mobi (9 bytes) and the index it had
+ * in the build input (4 bytes), so lookups reject non-members.
+ *
+ * Serialized form, used in place (all integers little-endian):
+ *
+ *   offset 0    header (64 bytes)
+ *                 0  magic "MOBIMPHF"
+ *                 8  uint32 version (1)
+ *                12  uint32 partition count P
+ *                16  uint64 mobi count n
+ *                24  uint64 seed
+ *                32  uint64 bucket count (all partitions)
+ *                40  uint64 remap entry count (all partitions)
+ *                48  uint64 pilot bytes
+ *                56  uint8 remap entry bits (1 to 32)
+ *                57  reserved, zero
+ *   offset 64   (P + 1) x 4 uint64 per partition, then the totals: first
+ *               slot, first bucket, first remap entry, and the byte offset
+ *               of its pilots (low 56 bits) with their width (top 8 bits)
+ *   then        pilots, then remap entries: fixed-width fields packed LSB
+ *               first, each section padded to 8 bytes plus 8
+ *   then        n x 9-byte mobis (mobi_bin_pack) in slot order, padded to 8
+ *   then        n x uint32 build input index, in slot order
+ */
+#define MOBI_MPHF_MAGIC       "MOBIMPHF"
+#define MOBI_MPHF_VERSION     1
+#define MOBI_MPHF_HEADER_LEN  64
+
+typedef struct {
+    uint64_t count;
+    uint64_t seed;
+    uint32_t partitions;
+    uint8_t remap_bits;
+    uint64_t buckets;
+    uint64_t remaps;
+    uint64_t pilot_bytes;
+    const uint8_t *parts;           /* sections of the serialized form */
+    const uint8_t *pilots;
+    const uint8_t *remap;
+    const uint8_t *keys;
+    const uint8_t *ids;
+    void *data;                     /* serialized form: data_len bytes */
+    size_t data_len;
+    int owned;                      /* private */
+    size_t map_len;                 /* private */
+} mobi_mphf_t;
+
+/*
+ * mobi_mphf_build: Build a perfect hash over distinct mobis
+ *
+ * Partitions of ~16K mobis are built in parallel.
+ *
+ * @param f        Output; release with mobi_mphf_free
+ * @param mobis    count distinct mobis, in any order
+ * @param count    Number of mobis (below 2^32)
+ * @param threads  Worker threads, or 0 for one per online CPU
+ * @return         MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_RANGE, MOBI_ERR_NOMEM,
+ *                 MOBI_ERR_EXISTS if a mobi appears twice, or
+ *                 MOBI_ERR_INVALID_LEN if count does not fit
+ */
+mobi_error_t mobi_mphf_build(mobi_mphf_t *f, const mobi_bin_t *mobis, size_t count,
+                             int threads);
+
+/*
+ * mobi_mphf_lookup: The slot of a member
+ *
+ * @param slot  Output if not NULL: its slot, in [0, count)
+ * @param id    Output if not NULL: its index in the build input
+ * @return      MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_RANGE, or
+ *              MOBI_ERR_NOT_FOUND if m is not in the set
+ */
+mobi_error_t mobi_mphf_lookup(const mobi_mphf_t *f, const mobi_bin_t *m, uint64_t *slot,
+                              uint32_t *id);
+
+/*
+ * mobi_mphf_slot: The slot of a member, unverified
+ *
+ * For callers that check the record themselves. A non-member gets some
+ * slot, or count when its partition is empty.
+ */
+uint64_t mobi_mphf_slot(const mobi_mphf_t *f, const mobi_bin_t *m);
+
+/*
+ * mobi_mphf_view: Use a serialized perfect hash in place
+ *
+ * Nothing is copied; data must outlive f. f->data and f->data_len of a
+ * built perfect hash are its serialized form.
+ *
+ * @return  MOBI_OK, MOBI_ERR_NULL or MOBI_ERR_FORMAT
+ */
+mobi_error_t mobi_mphf_view(mobi_mphf_t *f, const uint8_t *data, size_t len);
+
+/*
+ * mobi_mphf_write: Save the serialized form
+ *
+ * Replaces path atomically.
+ *
+ * @return  MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_NOMEM or MOBI_ERR_IO
+ */
+mobi_error_t mobi_mphf_write(const mobi_mphf_t *f, const char *path);
+
+/*
+ * mobi_mphf_open: Map a perfect hash file read-only
+ *
+ * @return  MOBI_OK, MOBI_ERR_NULL, MOBI_ERR_IO or MOBI_ERR_FORMAT
+ */
+mobi_error_t mobi_mphf_open(mobi_mphf_t *f, const char *path);
+
+/* mobi_mphf_free: Release a built or opened perfect hash (a view owns nothing) */
+void mobi_mphf_free(mobi_mphf_t *f);
+
 /* ============================================================================
  * FORMATTING API
  * ============================================================================ */
@@ -144,6 +1234,40 @@ mobi_error_t mobi_format_extended(const mobi_t *mobi, char *out);
  */
 mobi_error_t mobi_format_full(const mobi_t *mobi, char *out);
 
+/*
+ * mobi_bin_format: Format any form with hyphens from the binary value
+ *
+ * Each 3-digit group is a single 4-byte copy from a 1000-entry table;
+ * no libc formatting is involved.
+ *
+ * @param m       Binary mobi
+ * @param digits  12, 15, 18 or 21
+ * @param out     Output buffer (min MOBI_*_FMT_LEN + 1 bytes for the form)
+ * @return        MOBI_OK on success, MOBI_ERR_INVALID_LEN for other lengths
+ *
+ * Output (digits = 15): "XXX-XXX-XXX-XXX-XXX"
+ */
+mobi_error_t mobi_bin_format(const mobi_bin_t *m, int digits, char *out);
+
+/*
+ * mobi_bin_format_batch: Format many mobis into one contiguous buffer
+ *
+ * Records are fixed width: the form (hyphenated or plain digits), then
+ * sep. With sep = '\n' the buffer is ready to write out as lines; with
+ * sep = '\0' each record is a C string.
+ *
+ * @param mobis    Array of count binary mobis
+ * @param count    Number of mobis
+ * @param digits   12, 15, 18 or 21
+ * @param hyphens  Nonzero for "XXX-XXX-...", zero for plain digits
+ * @param sep      Byte written after every record
+ * @param out      Output buffer, count * (record length + 1) bytes; the
+ *                 record length is digits, or its MOBI_*_FMT_LEN if hyphens
+ * @return         Bytes written, 0 on NULL input or an invalid length
+ */
+size_t mobi_bin_format_batch(const mobi_bin_t *mobis, size_t count, int digits,
+                             int hyphens, char sep, char *out);
+
 /* ============================================================================
  * PARSING API
  * ============================================================================ */
@@ -199,6 +1323,28 @@ int mobi_full_matches(const mobi_t *a, const mobi_t *b);
  * UTILITY API
  * ============================================================================ */
 
+/*
+ * mobi_cpu_features: Report the accelerated backends in use
+ *
+ * Derivation picks its SHA-256 backend at runtime from CPUID. All backends
+ * produce bit-identical results; the portable C path is always available.
+ *
+ * @return  Bitmask of mobi_cpu_t features detected and not restricted
+ */
+unsigned mobi_cpu_features(void);
+
+/*
+ * mobi_cpu_restrict: Limit which CPU features dispatch may use
+ *
+ * Intended for testing and benchmarking backends against each other.
+ * Pass 0 to force the portable C path, ~0u to allow everything detected.
+ * Not thread-safe: call before deriving from multiple threads.
+ *
+ * @param mask  Bitmask of mobi_cpu_t features to allow
+ * @return      Previous mask
+ */
+unsigned mobi_cpu_restrict(unsigned mask);
+
 /*
  * mobi_strerror: Get human-readable error message
  *
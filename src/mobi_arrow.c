@@ -0,0 +1,508 @@
+/*
+ * Mobi Protocol v21.0.0 - Arrow IPC Export
+ *
+ * Writes derived mobis as an Arrow IPC file (the random-access "Feather
+ * v2" format): magic, a schema message, one record batch message per
+ * call to mobi_arrow_writer_add, an end-of-stream marker and a footer
+ * indexing the batches. Column buffers are little-endian, 8-byte aligned
+ * and never null, so readers map the file and use the columns in place.
+ *
+ * The FlatBuffers metadata is small and fixed in shape, so it is laid out
+ * here by hand instead of pulling in a FlatBuffers runtime. Tables are
+ * written front to back: every table comes before the strings, vectors
+ * and tables it points to, since FlatBuffers offsets only point forward.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "mobi_internal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Mobis converted per write when filling the full and display columns */
+#define COLUMN_CHUNK 1024
+
+/* Arrow format constants (Schema.fbs, Message.fbs, File.fbs) */
+#define ARROW_MAGIC         "ARROW1"
+#define ARROW_V5            4       /* MetadataVersion */
+#define ARROW_CONTINUATION  0xFFFFFFFFu
+
+#define HEADER_SCHEMA       1       /* MessageHeader union */
+#define HEADER_RECORD_BATCH 3
+
+#define TYPE_INT            2       /* Type union */
+#define TYPE_DECIMAL        7
+#define TYPE_FIXED_BINARY   15
+
+#define COLUMNS 3
+
+/* Bytes per row in each column's data buffer */
+static const size_t COLUMN_WIDTH[COLUMNS] = { MOBI_PUBKEY_LEN, 16, 8 };
+
+/* One footer entry (File.fbs Block) */
+typedef struct {
+    uint64_t offset;        /* file offset of the message */
+    uint32_t meta_len;      /* prefix + FlatBuffer, padded */
+    uint64_t body_len;
+} arrow_block;
+
+/* ============================================================================
+ * FLATBUFFER LAYOUT
+ * ============================================================================ */
+
+typedef struct {
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+    int failed;
+} fb_t;
+
+/* One scalar or offset field of a table; offsets are patched with fb_link */
+typedef struct {
+    int id;                 /* field index in the schema */
+    int size;               /* 1, 2, 4 or 8 bytes */
+    uint64_t value;
+} fb_field;
+
+static void put_le(uint8_t *p, uint64_t v, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+/* Append n zero bytes; returns their position */
+static size_t fb_grow(fb_t *b, size_t n) {
+    size_t at = b->len;
+
+    if (b->failed) {
+        return 0;
+    }
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 512;
+        uint8_t *p;
+
+        while (cap < b->len + n) {
+            cap *= 2;
+        }
+        p = realloc(b->data, cap);
+        if (p == NULL) {
+            b->failed = 1;  /* checked before any byte is stored */
+            return 0;
+        }
+        b->data = p;
+        b->cap = cap;
+    }
+    memset(b->data + at, 0, n);
+    b->len += n;
+    return at;
+}
+
+/* Pad with zeros until the length is phase modulo align */
+static void fb_align(fb_t *b, size_t align, size_t phase) {
+    size_t pad = (phase + align - b->len % align) % align;
+    fb_grow(b, pad);
+}
+
+/* Point the uoffset at `at` to the object at `target` (always later) */
+static void fb_link(fb_t *b, size_t at, size_t target) {
+    if (!b->failed) {
+        put_le(b->data + at, (uint64_t)(target - at), 4);
+    }
+}
+
+/*
+ * Append a table preceded by its vtable. Fields are placed largest first
+ * after the 4-byte vtable offset, with the table starting 4 bytes past an
+ * 8-byte boundary, so every field lands on its natural alignment.
+ * pos[i] receives the position of fields[i].
+ */
+static size_t fb_table(fb_t *b, const fb_field *fields, int n, size_t *pos) {
+    size_t field_off[8];
+    size_t vtable, table, size = 4;
+    int slots = 0;
+    int width, i;
+
+    for (width = 8; width >= 1; width /= 2) {
+        for (i = 0; i < n; i++) {
+            if (fields[i].size == width) {
+                field_off[i] = size;
+                size += (size_t)width;
+            }
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (fields[i].id + 1 > slots) {
+            slots = fields[i].id + 1;
+        }
+    }
+
+    fb_align(b, 2, 0);
+    vtable = fb_grow(b, 4 + 2 * (size_t)slots);
+    fb_align(b, 8, 4);
+    table = fb_grow(b, size);
+    if (b->failed) {
+        return 0;
+    }
+
+    put_le(b->data + vtable, 4 + 2 * (uint64_t)slots, 2);
+    put_le(b->data + vtable + 2, size, 2);
+    put_le(b->data + table, table - vtable, 4);
+    for (i = 0; i < n; i++) {
+        put_le(b->data + vtable + 4 + 2 * (size_t)fields[i].id, field_off[i], 2);
+        put_le(b->data + table + field_off[i], fields[i].value, fields[i].size);
+        if (pos != NULL) {
+            pos[i] = table + field_off[i];
+        }
+    }
+    return table;
+}
+
+/*
+ * Append a vector of n zeroed elements; returns the position of its
+ * length word. align (4 or 8) applies to the elements that follow it.
+ */
+static size_t fb_vector(fb_t *b, size_t n, size_t elem, size_t align) {
+    size_t at;
+
+    fb_align(b, align, align == 8 ? 4 : 0);
+    at = fb_grow(b, 4 + n * elem);
+    if (!b->failed) {
+        put_le(b->data + at, n, 4);
+    }
+    return at;
+}
+
+static size_t fb_string(fb_t *b, const char *s) {
+    size_t len = strlen(s);
+    size_t at = fb_vector(b, len + 1, 1, 4);
+
+    if (!b->failed) {
+        put_le(b->data + at, len, 4);
+        memcpy(b->data + at + 4, s, len);
+    }
+    return at;
+}
+
+/* ============================================================================
+ * ARROW METADATA
+ * ============================================================================ */
+
+/* Field with its type table: pubkey, full or display */
+static size_t write_field(fb_t *b, int column) {
+    static const char *const names[COLUMNS] = { "pubkey", "full", "display" };
+    static const uint8_t types[COLUMNS] = { TYPE_FIXED_BINARY, TYPE_DECIMAL, TYPE_INT };
+    /* FixedSizeBinary(32); Decimal(21, 0) in 128 bits; Int(64, unsigned) */
+    static const fb_field type_fields[COLUMNS][3] = {
+        { { 0, 4, MOBI_PUBKEY_LEN }, { 0, 0, 0 }, { 0, 0, 0 } },
+        { { 0, 4, MOBI_FULL_LEN }, { 1, 4, 0 }, { 2, 4, 128 } },
+        { { 0, 4, 64 }, { 1, 1, 0 }, { 0, 0, 0 } }
+    };
+    static const int type_count[COLUMNS] = { 1, 3, 2 };
+    fb_field f[5];
+    size_t pos[5];
+    size_t field;
+
+    /* name, nullable, type_type, type, children */
+    f[0].id = 0; f[0].size = 4; f[0].value = 0;
+    f[1].id = 1; f[1].size = 1; f[1].value = 0;
+    f[2].id = 2; f[2].size = 1; f[2].value = types[column];
+    f[3].id = 3; f[3].size = 4; f[3].value = 0;
+    f[4].id = 5; f[4].size = 4; f[4].value = 0;
+    field = fb_table(b, f, 5, pos);
+
+    fb_link(b, pos[0], fb_string(b, names[column]));
+    fb_link(b, pos[3], fb_table(b, type_fields[column], type_count[column], NULL));
+    /* Readers insist on a children vector, even an empty one */
+    fb_link(b, pos[4], fb_vector(b, 0, 4, 4));
+    return field;
+}
+
+static size_t write_schema(fb_t *b) {
+    fb_field f[2];
+    size_t pos[2];
+    size_t schema, vec;
+    int i;
+
+    /* endianness (Little), fields */
+    f[0].id = 0; f[0].size = 2; f[0].value = 0;
+    f[1].id = 1; f[1].size = 4; f[1].value = 0;
+    schema = fb_table(b, f, 2, pos);
+
+    vec = fb_vector(b, COLUMNS, 4, 4);
+    fb_link(b, pos[1], vec);
+    for (i = 0; i < COLUMNS; i++) {
+        fb_link(b, vec + 4 + 4 * (size_t)i, write_field(b, i));
+    }
+    return schema;
+}
+
+static void write_record_batch(fb_t *b, size_t at, uint64_t rows) {
+    fb_field f[3];
+    size_t pos[3];
+    size_t nodes, buffers, offset = 0;
+    int i;
+
+    /* length, nodes, buffers */
+    f[0].id = 0; f[0].size = 8; f[0].value = rows;
+    f[1].id = 1; f[1].size = 4; f[1].value = 0;
+    f[2].id = 2; f[2].size = 4; f[2].value = 0;
+    fb_link(b, at, fb_table(b, f, 3, pos));
+
+    /* FieldNode { length, null_count } per column */
+    nodes = fb_vector(b, COLUMNS, 16, 8);
+    fb_link(b, pos[1], nodes);
+    /* Buffer { offset, length }: an empty validity bitmap, then the data */
+    buffers = fb_vector(b, 2 * COLUMNS, 16, 8);
+    fb_link(b, pos[2], buffers);
+    if (b->failed) {
+        return;
+    }
+    for (i = 0; i < COLUMNS; i++) {
+        size_t len = (size_t)rows * COLUMN_WIDTH[i];
+
+        put_le(b->data + nodes + 4 + 16 * (size_t)i, rows, 8);
+        put_le(b->data + buffers + 4 + 32 * (size_t)i, offset, 8);
+        put_le(b->data + buffers + 4 + 32 * (size_t)i + 16, offset, 8);
+        put_le(b->data + buffers + 4 + 32 * (size_t)i + 24, len, 8);
+        offset += len;      /* widths are multiples of 8: no padding */
+    }
+}
+
+/*
+ * A Message FlatBuffer: the schema, or a record batch header with
+ * bodyLength body bytes to follow. Padded to 8 bytes.
+ */
+static void write_message(fb_t *b, int header, uint64_t rows, uint64_t body_len) {
+    fb_field f[4];
+    size_t pos[4];
+
+    b->len = 0;
+    b->failed = 0;
+    fb_grow(b, 4);  /* root offset */
+
+    /* version, header_type, header, bodyLength */
+    f[0].id = 0; f[0].size = 2; f[0].value = ARROW_V5;
+    f[1].id = 1; f[1].size = 1; f[1].value = (uint64_t)header;
+    f[2].id = 2; f[2].size = 4; f[2].value = 0;
+    f[3].id = 3; f[3].size = 8; f[3].value = body_len;
+    fb_link(b, 0, fb_table(b, f, 4, pos));
+
+    if (header == HEADER_SCHEMA) {
+        fb_link(b, pos[2], write_schema(b));
+    } else {
+        write_record_batch(b, pos[2], rows);
+    }
+    fb_align(b, 8, 0);
+}
+
+static void write_footer(fb_t *b, const arrow_block *blocks, size_t count) {
+    fb_field f[4];
+    size_t pos[4];
+    size_t vec;
+    size_t i;
+
+    b->len = 0;
+    b->failed = 0;
+    fb_grow(b, 4);
+
+    /* version, schema, dictionaries, recordBatches */
+    f[0].id = 0; f[0].size = 2; f[0].value = ARROW_V5;
+    f[1].id = 1; f[1].size = 4; f[1].value = 0;
+    f[2].id = 2; f[2].size = 4; f[2].value = 0;
+    f[3].id = 3; f[3].size = 4; f[3].value = 0;
+    fb_link(b, 0, fb_table(b, f, 4, pos));
+
+    fb_link(b, pos[1], write_schema(b));
+    fb_link(b, pos[2], fb_vector(b, 0, 24, 8));
+    vec = fb_vector(b, count, 24, 8);
+    fb_link(b, pos[3], vec);
+    if (b->failed) {
+        return;
+    }
+    /* Block { offset, metaDataLength, (pad), bodyLength } */
+    for (i = 0; i < count; i++) {
+        uint8_t *p = b->data + vec + 4 + 24 * i;
+        put_le(p, blocks[i].offset, 8);
+        put_le(p + 8, blocks[i].meta_len, 4);
+        put_le(p + 16, blocks[i].body_len, 8);
+    }
+}
+
+/* ============================================================================
+ * WRITER
+ * ============================================================================ */
+
+static int write_bytes(mobi_arrow_writer_t *w, const void *p, size_t n) {
+    if (n > 0 && fwrite(p, 1, n, (FILE *)w->file) != n) {
+        return -1;
+    }
+    w->offset += n;
+    return 0;
+}
+
+/* Continuation marker, metadata length, then the FlatBuffer */
+static int write_encapsulated(mobi_arrow_writer_t *w, const fb_t *b) {
+    uint8_t prefix[8];
+
+    put_le(prefix, ARROW_CONTINUATION, 4);
+    put_le(prefix + 4, b->len, 4);
+    if (write_bytes(w, prefix, 8) != 0) {
+        return -1;
+    }
+    return write_bytes(w, b->data, b->len);
+}
+
+/* full as a Decimal128 (little-endian) and display as a uint64 */
+static int write_numeric(mobi_arrow_writer_t *w, const mobi_bin_t *mobis, size_t count,
+                         int column) {
+    uint8_t buf[COLUMN_CHUNK * 16];
+    size_t done, i;
+
+    for (done = 0; done < count; done += COLUMN_CHUNK) {
+        size_t n = count - done < COLUMN_CHUNK ? count - done : COLUMN_CHUNK;
+        const mobi_bin_t *m = mobis + done;
+
+        if (column == 1) {
+            memset(buf, 0, n * 16);
+            for (i = 0; i < n; i++) {
+                uint8_t packed[9];
+                int j;
+
+                mobi_bin_pack(&m[i], packed);   /* 72-bit big-endian */
+                for (j = 0; j < 9; j++) {
+                    buf[i * 16 + j] = packed[8 - j];
+                }
+            }
+        } else {
+            for (i = 0; i < n; i++) {
+                put_le(buf + i * 8, m[i].hi, 8);
+            }
+        }
+        if (write_bytes(w, buf, n * COLUMN_WIDTH[column]) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+mobi_error_t mobi_arrow_writer_open(mobi_arrow_writer_t *w, const char *path) {
+    static const uint8_t magic[8] = { 'A', 'R', 'R', 'O', 'W', '1', 0, 0 };
+    fb_t b;
+    FILE *f;
+    int failed;
+
+    if (w == NULL || path == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    memset(w, 0, sizeof(*w));
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        return MOBI_ERR_IO;
+    }
+    w->file = f;
+
+    memset(&b, 0, sizeof(b));
+    write_message(&b, HEADER_SCHEMA, 0, 0);
+    failed = b.failed || write_bytes(w, magic, 8) != 0 || write_encapsulated(w, &b) != 0;
+    free(b.data);
+    if (failed) {
+        fclose(f);
+        w->file = NULL;
+        return b.failed ? MOBI_ERR_NOMEM : MOBI_ERR_IO;
+    }
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_arrow_writer_add(mobi_arrow_writer_t *w, const uint8_t *keys,
+                                   const mobi_bin_t *mobis, size_t count) {
+    arrow_block block;
+    uint64_t body_len = 0;
+    fb_t b;
+    int i, failed;
+
+    if (w == NULL || w->file == NULL || keys == NULL || mobis == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (count == 0) {
+        return MOBI_OK;
+    }
+
+    if (w->batches == w->blocks_cap) {
+        size_t cap = w->blocks_cap ? w->blocks_cap * 2 : 64;
+        void *p = realloc(w->blocks, cap * sizeof(arrow_block));
+        if (p == NULL) {
+            return MOBI_ERR_NOMEM;
+        }
+        w->blocks = p;
+        w->blocks_cap = cap;
+    }
+
+    for (i = 0; i < COLUMNS; i++) {
+        body_len += (uint64_t)count * COLUMN_WIDTH[i];
+    }
+
+    memset(&b, 0, sizeof(b));
+    write_message(&b, HEADER_RECORD_BATCH, count, body_len);
+    if (b.failed) {
+        free(b.data);
+        return MOBI_ERR_NOMEM;     /* Nothing written: the file is still whole */
+    }
+    block.offset = w->offset;
+    block.meta_len = (uint32_t)(8 + b.len);
+    block.body_len = body_len;
+
+    /* The pubkey column goes out straight from the caller's buffer */
+    failed = write_encapsulated(w, &b) != 0 ||
+             write_bytes(w, keys, count * MOBI_PUBKEY_LEN) != 0 ||
+             write_numeric(w, mobis, count, 1) != 0 ||
+             write_numeric(w, mobis, count, 2) != 0;
+    free(b.data);
+    if (failed) {
+        return MOBI_ERR_IO;
+    }
+
+    ((arrow_block *)w->blocks)[w->batches++] = block;
+    w->rows += count;
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_arrow_writer_close(mobi_arrow_writer_t *w) {
+    static const uint8_t eos[8] = { 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0 };
+    uint8_t tail[10];
+    mobi_error_t result = MOBI_OK;
+    fb_t b;
+    FILE *f;
+
+    if (w == NULL || w->file == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    f = (FILE *)w->file;
+
+    memset(&b, 0, sizeof(b));
+    write_footer(&b, (const arrow_block *)w->blocks, w->batches);
+    put_le(tail, b.len, 4);
+    memcpy(tail + 4, ARROW_MAGIC, 6);
+    if (b.failed) {
+        result = MOBI_ERR_NOMEM;
+    } else if (write_bytes(w, eos, 8) != 0 || write_bytes(w, b.data, b.len) != 0 ||
+               write_bytes(w, tail, 10) != 0) {
+        result = MOBI_ERR_IO;
+    }
+    free(b.data);
+
+    if (fclose(f) != 0 && result == MOBI_OK) {
+        result = MOBI_ERR_IO;
+    }
+    free(w->blocks);
+    w->file = NULL;
+    w->blocks = NULL;
+    w->blocks_cap = 0;
+    return result;
+}
@@ -0,0 +1,301 @@
+/*
+ * Mobi Protocol v21.0.0 - Batch Derivation
+ *
+ * Derives many keys per call by running independent rejection-sampling
+ * rounds side by side in the lanes of a multi-buffer SHA-256 kernel.
+ *
+ * Every lane holds one (key, round) pair. After each kernel pass a lane
+ * either accepts (its key is done and the next queued key takes the lane)
+ * or rejects (it advances to the next round of the same key). Keys that
+ * need 1 round and keys that need 12 therefore never wait on each other;
+ * the only idle lanes are at the very end of the queue.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#include "mobi_internal.h"
+#include <string.h>
+
+/* Widest kernel the engine is built for */
+#define MAX_LANES 16
+
+/* ============================================================================
+ * LANE ENGINE
+ * ============================================================================ */
+
+typedef struct {
+    int lanes;
+    uint32_t w[16 * MAX_LANES];         /* word-major message blocks */
+    uint32_t digest[3 * MAX_LANES];     /* word-major digest prefixes */
+    size_t key[MAX_LANES];              /* key index held by each lane */
+    int round[MAX_LANES];               /* round of that key, -1 if idle */
+} lane_state;
+
+/*
+ * Round 0 hashes the bare 32-byte key; round N hashes key || N. Either way
+ * the message fits in one block, so only W[8] (round byte or padding bit)
+ * and W[15] (bit length) change between rounds of the same key.
+ */
+static void lane_set_round(lane_state *ls, int lane, int round) {
+    int n = ls->lanes;
+
+    ls->round[lane] = round;
+    if (round == 0) {
+        ls->w[8 * n + lane] = 0x80000000u;
+        ls->w[15 * n + lane] = MOBI_PUBKEY_LEN * 8;
+    } else {
+        ls->w[8 * n + lane] = ((uint32_t)round << 24) | 0x00800000u;
+        ls->w[15 * n + lane] = (MOBI_PUBKEY_LEN + 1) * 8;
+    }
+}
+
+static void lane_load(lane_state *ls, int lane, const uint8_t *pubkey, size_t key) {
+    int n = ls->lanes;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        ls->w[i * n + lane] = ((uint32_t)pubkey[i * 4] << 24) |
+                              ((uint32_t)pubkey[i * 4 + 1] << 16) |
+                              ((uint32_t)pubkey[i * 4 + 2] << 8) |
+                              ((uint32_t)pubkey[i * 4 + 3]);
+    }
+    for (i = 9; i < 15; i++) {
+        ls->w[i * n + lane] = 0;
+    }
+    ls->key[lane] = key;
+    lane_set_round(ls, lane, 0);
+}
+
+/* Results go to exactly one of out / out_bin */
+static mobi_error_t derive_lanes(const uint8_t *pubkeys, size_t count,
+                                 mobi_t *out, mobi_bin_t *out_bin,
+                                 int lanes, mobi_sha256_lanes_fn kernel) {
+    lane_state ls;
+    mobi_error_t result = MOBI_OK;
+    size_t next = 0;
+    int active = 0;
+    int lane, i;
+
+    memset(&ls, 0, sizeof(ls));
+    ls.lanes = lanes;
+
+    for (lane = 0; lane < lanes; lane++) {
+        if (next < count) {
+            lane_load(&ls, lane, pubkeys + next * MOBI_PUBKEY_LEN, next);
+            next++;
+            active++;
+        } else {
+            ls.round[lane] = -1;
+        }
+    }
+
+    while (active > 0) {
+        kernel(ls.w, ls.digest);
+
+        for (lane = 0; lane < lanes; lane++) {
+            uint32_t digest[3];
+            int done;
+
+            if (ls.round[lane] < 0) {
+                continue;
+            }
+
+            for (i = 0; i < 3; i++) {
+                digest[i] = ls.digest[i * lanes + lane];
+            }
+
+            if (out_bin != NULL) {
+                done = mobi_accept_bin(digest, &out_bin[ls.key[lane]]);
+            } else {
+                done = mobi_accept_digest(digest, &out[ls.key[lane]]);
+            }
+            if (!done && ls.round[lane] + 1 < MOBI_MAX_ROUNDS) {
+                lane_set_round(&ls, lane, ls.round[lane] + 1);
+                continue;
+            }
+            if (!done && result == MOBI_OK) {
+                result = MOBI_ERR_INVALID_LEN;  /* Same as mobi_derive_bytes */
+            }
+
+            /* Key finished: hand the lane to the next one in the queue */
+            if (next < count) {
+                lane_load(&ls, lane, pubkeys + next * MOBI_PUBKEY_LEN, next);
+                next++;
+            } else {
+                ls.round[lane] = -1;
+                active--;
+            }
+        }
+    }
+
+    return result;
+}
+
+/*
+ * One key, consecutive rounds in every lane. Lanes are scanned in round
+ * order, so the first accepting lane is exactly the round the sequential
+ * loop would have stopped at.
+ */
+static mobi_error_t derive_speculative(const uint8_t *pubkey, mobi_t *out,
+                                       int lanes, mobi_sha256_lanes_fn kernel) {
+    lane_state ls;
+    uint32_t digest[3];
+    int base, lane, i;
+
+    memset(&ls, 0, sizeof(ls));
+    ls.lanes = lanes;
+    for (lane = 0; lane < lanes; lane++) {
+        lane_load(&ls, lane, pubkey, 0);
+    }
+
+    for (base = 0; base < MOBI_MAX_ROUNDS; base += lanes) {
+        for (lane = 0; lane < lanes; lane++) {
+            lane_set_round(&ls, lane, (base + lane) % MOBI_MAX_ROUNDS);
+        }
+
+        kernel(ls.w, ls.digest);
+
+        for (lane = 0; lane < lanes && base + lane < MOBI_MAX_ROUNDS; lane++) {
+            for (i = 0; i < 3; i++) {
+                digest[i] = ls.digest[i * lanes + lane];
+            }
+            if (mobi_accept_digest(digest, out)) {
+                return MOBI_OK;
+            }
+        }
+    }
+
+    return MOBI_ERR_INVALID_LEN;  /* Same as mobi_derive_bytes */
+}
+
+/* ============================================================================
+ * BATCH API IMPLEMENTATION
+ * ============================================================================ */
+
+mobi_error_t mobi_derive_bytes_speculative(const uint8_t *pubkey, mobi_t *out) {
+    if (pubkey == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+
+    /*
+     * A SHA-NI compression is fast enough that ~4.7 sequential rounds beat
+     * one pass over 8 or 16 lanes, so lanes only pay off without it.
+     */
+    if (mobi_cpu_features() & MOBI_CPU_SHANI) {
+        return mobi_derive_bytes(pubkey, out);
+    }
+    if (mobi_sha256_x16 != NULL) {
+        return derive_speculative(pubkey, out, 16, mobi_sha256_x16);
+    }
+    if (mobi_sha256_x8 != NULL) {
+        return derive_speculative(pubkey, out, 8, mobi_sha256_x8);
+    }
+    return mobi_derive_bytes(pubkey, out);
+}
+
+static mobi_error_t derive_batch(const uint8_t *pubkeys, size_t count,
+                                 mobi_t *out, mobi_bin_t *out_bin) {
+    mobi_error_t result = MOBI_OK;
+    mobi_error_t err;
+    size_t i;
+
+    /* Resolves dispatch on first use */
+    (void)mobi_cpu_features();
+
+    if (mobi_sha256_x16 != NULL) {
+        return derive_lanes(pubkeys, count, out, out_bin, 16, mobi_sha256_x16);
+    }
+    if (mobi_sha256_x8 != NULL) {
+        return derive_lanes(pubkeys, count, out, out_bin, 8, mobi_sha256_x8);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (out_bin != NULL) {
+            err = mobi_derive_bin(pubkeys + i * MOBI_PUBKEY_LEN, &out_bin[i]);
+        } else {
+            err = mobi_derive_bytes(pubkeys + i * MOBI_PUBKEY_LEN, &out[i]);
+        }
+        if (err != MOBI_OK && result == MOBI_OK) {
+            result = err;
+        }
+    }
+    return result;
+}
+
+mobi_error_t mobi_derive_batch(const uint8_t *pubkeys, size_t count, mobi_t *out) {
+    if (count == 0) {
+        return MOBI_OK;
+    }
+    if (pubkeys == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    return derive_batch(pubkeys, count, out, NULL);
+}
+
+mobi_error_t mobi_derive_batch_bin(const uint8_t *pubkeys, size_t count, mobi_bin_t *out) {
+    if (count == 0) {
+        return MOBI_OK;
+    }
+    if (pubkeys == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    return derive_batch(pubkeys, count, NULL, out);
+}
+
+/*
+ * Keys per stolen chunk: large enough that the lane engine's ramp-up and
+ * tail (at most 15 idle lanes) vanish, small enough to balance the tail
+ * of a batch across threads.
+ */
+#define MT_CHUNK 4096
+
+typedef struct {
+    const uint8_t *pubkeys;
+    mobi_t *out;
+    mobi_bin_t *out_bin;
+} batch_job;
+
+static int batch_task(void *ctx, size_t begin, size_t end, int worker) {
+    const batch_job *job = (const batch_job *)ctx;
+
+    (void)worker;
+    return derive_batch(job->pubkeys + begin * MOBI_PUBKEY_LEN, end - begin,
+                        job->out != NULL ? job->out + begin : NULL,
+                        job->out_bin != NULL ? job->out_bin + begin : NULL);
+}
+
+static mobi_error_t derive_batch_mt(const uint8_t *pubkeys, size_t count,
+                                    mobi_t *out, mobi_bin_t *out_bin, int threads) {
+    batch_job job;
+
+    /* Resolve dispatch before any worker reads the kernel pointers */
+    (void)mobi_cpu_features();
+
+    job.pubkeys = pubkeys;
+    job.out = out;
+    job.out_bin = out_bin;
+    return (mobi_error_t)mobi_parallel_for(count, MT_CHUNK, threads, batch_task, &job);
+}
+
+mobi_error_t mobi_derive_batch_mt(const uint8_t *pubkeys, size_t count, mobi_t *out,
+                                  int threads) {
+    if (count == 0) {
+        return MOBI_OK;
+    }
+    if (pubkeys == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    return derive_batch_mt(pubkeys, count, out, NULL, threads);
+}
+
+mobi_error_t mobi_derive_batch_bin_mt(const uint8_t *pubkeys, size_t count, mobi_bin_t *out,
+                                      int threads) {
+    if (count == 0) {
+        return MOBI_OK;
+    }
+    if (pubkeys == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    return derive_batch_mt(pubkeys, count, NULL, out, threads);
+}
@@ -0,0 +1,376 @@
+/*
+ * Mobi Protocol v21.0.0 - Binary Corpus Files
+ *
+ * A corpus is a header, a packed column of 32-byte pubkeys and optionally
+ * a column of 9-byte packed mobis (layout in mobi.h). Readers map the file
+ * and hand pointers into the mapping straight to the batch deriver, so
+ * re-deriving or verifying a corpus costs page faults and hashing, never
+ * parsing or copying.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "mobi_internal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Keys per unit of verification work */
+#define VERIFY_CHUNK 4096
+
+/* Keys derived per pass when appending the mobi column */
+#define COLUMN_CHUNK (1u << 20)
+
+#define PACKED_LEN 9
+
+/* ============================================================================
+ * HEADER
+ * ============================================================================ */
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    int i;
+    for (i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    uint32_t v = 0;
+    int i;
+    for (i = 3; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    uint64_t v = 0;
+    int i;
+    for (i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static void header_encode(uint8_t h[MOBI_CORPUS_HEADER_LEN], uint64_t count, uint32_t flags) {
+    memset(h, 0, MOBI_CORPUS_HEADER_LEN);
+    memcpy(h, MOBI_CORPUS_MAGIC, 8);
+    put_le32(h + 8, MOBI_CORPUS_VERSION);
+    put_le32(h + 12, flags);
+    put_le64(h + 16, count);
+    put_le64(h + 24, MOBI_CORPUS_HEADER_LEN);
+    put_le64(h + 32, (flags & MOBI_CORPUS_MOBIS)
+                     ? MOBI_CORPUS_HEADER_LEN + count * MOBI_PUBKEY_LEN : 0);
+}
+
+/* Checks the header against the file size; fills count and flags */
+static int header_decode(const uint8_t *h, uint64_t size, uint64_t *count, uint32_t *flags) {
+    uint64_t n, keys_end;
+
+    if (size < MOBI_CORPUS_HEADER_LEN || memcmp(h, MOBI_CORPUS_MAGIC, 8) != 0) {
+        return -1;
+    }
+    if (get_le32(h + 8) != MOBI_CORPUS_VERSION || (get_le32(h + 12) & ~MOBI_CORPUS_MOBIS)) {
+        return -1;
+    }
+    if (get_le64(h + 24) != MOBI_CORPUS_HEADER_LEN) {
+        return -1;
+    }
+
+    n = get_le64(h + 16);
+    if (n > (size - MOBI_CORPUS_HEADER_LEN) / MOBI_PUBKEY_LEN) {
+        return -1;  /* Truncated key column (also rules out overflow below) */
+    }
+    keys_end = MOBI_CORPUS_HEADER_LEN + n * MOBI_PUBKEY_LEN;
+
+    *flags = get_le32(h + 12);
+    if (*flags & MOBI_CORPUS_MOBIS) {
+        if (get_le64(h + 32) != keys_end || (size - keys_end) / PACKED_LEN < n) {
+            return -1;
+        }
+    } else if (get_le64(h + 32) != 0) {
+        return -1;
+    }
+
+    *count = n;
+    return 0;
+}
+
+/* ============================================================================
+ * READING
+ * ============================================================================ */
+
+mobi_error_t mobi_corpus_open(const char *path, mobi_corpus_t *out) {
+    struct stat st;
+    void *map;
+    uint64_t count;
+    uint32_t flags;
+    int fd;
+
+    if (path == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    memset(out, 0, sizeof(*out));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return MOBI_ERR_IO;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return MOBI_ERR_IO;
+    }
+    if ((uint64_t)st.st_size < MOBI_CORPUS_HEADER_LEN || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return MOBI_ERR_FORMAT;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  /* The mapping keeps the file alive */
+    if (map == MAP_FAILED) {
+        return MOBI_ERR_IO;
+    }
+
+    if (header_decode((const uint8_t *)map, (uint64_t)st.st_size, &count, &flags) != 0) {
+        munmap(map, (size_t)st.st_size);
+        return MOBI_ERR_FORMAT;
+    }
+
+    /* Derivation and verification stream through the columns front to back */
+    posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+
+    out->map = map;
+    out->map_len = (size_t)st.st_size;
+    out->count = count;
+    out->flags = flags;
+    out->keys = (const uint8_t *)map + MOBI_CORPUS_HEADER_LEN;
+    out->mobis = (flags & MOBI_CORPUS_MOBIS)
+               ? out->keys + count * MOBI_PUBKEY_LEN : NULL;
+    return MOBI_OK;
+}
+
+void mobi_corpus_close(mobi_corpus_t *corpus) {
+    if (corpus == NULL || corpus->map == NULL) {
+        return;
+    }
+    munmap(corpus->map, corpus->map_len);
+    memset(corpus, 0, sizeof(*corpus));
+}
+
+mobi_error_t mobi_corpus_derive(const mobi_corpus_t *corpus, uint64_t first, size_t count,
+                                mobi_bin_t *out, int threads) {
+    if (corpus == NULL || (out == NULL && count > 0)) {
+        return MOBI_ERR_NULL;
+    }
+    if (first > corpus->count || count > corpus->count - first) {
+        return MOBI_ERR_INVALID_LEN;
+    }
+    return mobi_derive_batch_bin_mt(corpus->keys + first * MOBI_PUBKEY_LEN, count, out, threads);
+}
+
+typedef struct {
+    const mobi_corpus_t *corpus;
+    uint64_t *mismatches;       /* one counter per worker */
+} verify_job;
+
+static int verify_task(void *ctx, size_t begin, size_t end, int worker) {
+    const verify_job *job = (const verify_job *)ctx;
+    const mobi_corpus_t *c = job->corpus;
+    mobi_bin_t bins[VERIFY_CHUNK];
+    uint8_t packed[PACKED_LEN];
+    size_t i;
+
+    mobi_derive_batch_bin(c->keys + begin * MOBI_PUBKEY_LEN, end - begin, bins);
+    for (i = begin; i < end; i++) {
+        mobi_bin_pack(&bins[i - begin], packed);
+        if (memcmp(packed, c->mobis + i * PACKED_LEN, PACKED_LEN) != 0) {
+            job->mismatches[worker]++;
+        }
+    }
+    return 0;
+}
+
+mobi_error_t mobi_corpus_verify(const mobi_corpus_t *corpus, int threads,
+                                uint64_t *mismatches) {
+    verify_job job;
+    uint64_t single = 0;
+    int workers, i;
+
+    if (corpus == NULL || mismatches == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (corpus->mobis == NULL) {
+        return MOBI_ERR_FORMAT;
+    }
+
+    /* Resolve dispatch before any worker reads the kernel pointers */
+    (void)mobi_cpu_features();
+
+    workers = mobi_pool_threads(threads);
+    job.corpus = corpus;
+    job.mismatches = calloc((size_t)workers, sizeof(uint64_t));
+    if (job.mismatches == NULL) {
+        workers = 1;    /* Still correct, just not parallel */
+        job.mismatches = &single;
+    }
+
+    mobi_parallel_for((size_t)corpus->count, VERIFY_CHUNK, workers, verify_task, &job);
+
+    *mismatches = 0;
+    for (i = 0; i < workers; i++) {
+        *mismatches += job.mismatches[i];
+    }
+    if (job.mismatches != &single) {
+        free(job.mismatches);
+    }
+    return MOBI_OK;
+}
+
+/* ============================================================================
+ * WRITING
+ * ============================================================================ */
+
+/*
+ * Replaced only by mobi_corpus_writer_close, once the real header is in
+ * place: no corpus with a placeholder header ever appears at path.
+ */
+mobi_error_t mobi_corpus_writer_open(mobi_corpus_writer_t *w, const char *path) {
+    uint8_t header[MOBI_CORPUS_HEADER_LEN];
+    mobi_replace_t *out;
+    mobi_error_t err;
+
+    if (w == NULL || path == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    w->file = NULL;
+    w->count = 0;
+
+    out = malloc(sizeof(*out));
+    if (out == NULL) {
+        return MOBI_ERR_NOMEM;
+    }
+    err = mobi_replace_open(out, path);
+    if (err != MOBI_OK) {
+        free(out);
+        return err;
+    }
+
+    /* Placeholder until the count is known */
+    header_encode(header, 0, 0);
+    if (fwrite(header, 1, sizeof(header), out->file) != sizeof(header)) {
+        mobi_replace_abort(out);
+        free(out);
+        return MOBI_ERR_IO;
+    }
+
+    w->file = out;
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_corpus_writer_add(mobi_corpus_writer_t *w, const uint8_t *keys,
+                                    size_t count) {
+    if (w == NULL || w->file == NULL || (keys == NULL && count > 0)) {
+        return MOBI_ERR_NULL;
+    }
+    if (fwrite(keys, MOBI_PUBKEY_LEN, count, ((mobi_replace_t *)w->file)->file) != count) {
+        return MOBI_ERR_IO;
+    }
+    w->count += count;
+    return MOBI_OK;
+}
+
+/* Derive the key column back out of the file and append the packed mobis */
+static mobi_error_t append_mobis(FILE *f, uint64_t count, int threads) {
+    size_t len = (size_t)(MOBI_CORPUS_HEADER_LEN + count * MOBI_PUBKEY_LEN);
+    size_t chunk = count < COLUMN_CHUNK ? (size_t)count : COLUMN_CHUNK;
+    mobi_error_t result = MOBI_OK;
+    const uint8_t *keys;
+    mobi_bin_t *bins;
+    uint8_t *packed;
+    void *map;
+    uint64_t done;
+    size_t i;
+
+    if (count == 0) {
+        return MOBI_OK;
+    }
+    if (fflush(f) != 0) {
+        return MOBI_ERR_IO;
+    }
+    map = mmap(NULL, len, PROT_READ, MAP_SHARED, fileno(f), 0);
+    if (map == MAP_FAILED) {
+        return MOBI_ERR_IO;
+    }
+    posix_madvise(map, len, POSIX_MADV_SEQUENTIAL);
+    keys = (const uint8_t *)map + MOBI_CORPUS_HEADER_LEN;
+
+    bins = malloc(chunk * sizeof(mobi_bin_t));
+    packed = malloc(chunk * PACKED_LEN);
+    if (bins == NULL || packed == NULL) {
+        result = MOBI_ERR_NOMEM;
+    }
+
+    for (done = 0; result == MOBI_OK && done < count; done += chunk) {
+        size_t n = count - done < chunk ? (size_t)(count - done) : chunk;
+
+        mobi_derive_batch_bin_mt(keys + done * MOBI_PUBKEY_LEN, n, bins, threads);
+        for (i = 0; i < n; i++) {
+            mobi_bin_pack(&bins[i], packed + i * PACKED_LEN);
+        }
+        if (fseek(f, 0, SEEK_END) != 0 || fwrite(packed, PACKED_LEN, n, f) != n) {
+            result = MOBI_ERR_IO;
+        }
+    }
+
+    free(bins);
+    free(packed);
+    munmap(map, len);
+    return result;
+}
+
+mobi_error_t mobi_corpus_writer_close(mobi_corpus_writer_t *w, uint32_t flags, int threads) {
+    uint8_t header[MOBI_CORPUS_HEADER_LEN];
+    mobi_error_t result = MOBI_OK;
+    mobi_replace_t *out;
+    FILE *f;
+
+    if (w == NULL || w->file == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    out = (mobi_replace_t *)w->file;
+    f = out->file;
+    w->file = NULL;
+
+    flags &= MOBI_CORPUS_MOBIS;
+    if (flags & MOBI_CORPUS_MOBIS) {
+        result = append_mobis(f, w->count, threads);
+    }
+
+    header_encode(header, w->count, flags);
+    if (result == MOBI_OK &&
+        (fseek(f, 0, SEEK_SET) != 0 || fwrite(header, 1, sizeof(header), f) != sizeof(header))) {
+        result = MOBI_ERR_IO;
+    }
+    if (result == MOBI_OK) {
+        result = mobi_replace_commit(out);
+    } else {
+        mobi_replace_abort(out);
+    }
+    free(out);
+    return result;
+}
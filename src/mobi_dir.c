@@ -0,0 +1,338 @@
+/*
+ * Mobi Protocol v21.0.0 - Sorted Directory
+ *
+ * A directory is every mobi of a user set in numeric order, each carrying
+ * the index of its pubkey in the input it was built from. A typed prefix
+ * of d digits covers one numeric interval, [p * 10^(21-d), (p+1) * 10^(21-d)),
+ * so resolving it is two searches instead of a string scan.
+ *
+ * Every 16th entry is copied into a search layer in Eytzinger (BFS) order:
+ * node k's children are nodes 2k and 2k+1, so a descent reads one small,
+ * predictable line per level and the top levels stay cached. The layer
+ * narrows a search to one 16-entry block, which is then binary searched.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mobi_internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)0)
+#endif
+
+#define LO_MOD 1000000000u      /* 10^9: range of mobi_bin_t.lo */
+
+/* Search layer nodes are 16 bytes; siblings share a 64-byte line */
+#define INDEX_ALIGN 64
+
+/* Entries per unit of work when filling entries and comparing neighbours */
+#define DIR_CHUNK 65536
+
+typedef struct {
+    const mobi_bin_t *mobis;
+    mobi_entry_t *entries;  /* sorted once filled */
+    size_t count;
+    uint8_t *levels;
+} dir_job;
+
+static const uint64_t POW10[13] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL
+};
+
+/* First entry not below (hi, lo) */
+static size_t lower_bound(const mobi_entry_t *e, size_t count, uint64_t hi, uint32_t lo) {
+    size_t first = 0;
+
+    while (count > 0) {
+        size_t half = count / 2;
+        const mobi_entry_t *mid = &e[first + half];
+
+        if (mid->hi < hi || (mid->hi == hi && mid->lo < lo)) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return first;
+}
+
+static int entry_below(const mobi_entry_t *e, uint64_t hi, uint32_t lo) {
+    return e->hi < hi || (e->hi == hi && e->lo < lo);
+}
+
+/*
+ * In-order walk of the Eytzinger tree rooted at k, handing out blocks in
+ * sorted order. Node k holds the first entry of its block, with the
+ * block number as its id. Returns the next unassigned block.
+ */
+static size_t index_fill(mobi_entry_t *index, size_t nodes, const mobi_entry_t *e,
+                         size_t block, size_t k) {
+    if (k <= nodes) {
+        block = index_fill(index, nodes, e, block, 2 * k);
+        index[k] = e[block * MOBI_DIR_BLOCK];
+        index[k].id = (uint32_t)block;
+        block = index_fill(index, nodes, e, block + 1, 2 * k + 1);
+    }
+    return block;
+}
+
+/* The first entry not below (hi, lo), through the search layer if any */
+static size_t dir_lower_bound(const mobi_dir_t *dir, uint64_t hi, uint32_t lo) {
+    const mobi_entry_t *index = dir->index;
+    size_t nodes = dir->index_count;
+    size_t k = 1, block, first, n;
+
+    if (index == NULL) {
+        return lower_bound(dir->entries, dir->count, hi, lo);
+    }
+
+    while (k <= nodes) {
+        /* Four levels down: 16 nodes, four cache lines */
+        if (16 * k <= nodes) {
+            PREFETCH(&index[16 * k]);
+        }
+        k = 2 * k + (size_t)entry_below(&index[k], hi, lo);
+    }
+    /* Undo the right turns after the last left turn: that node is the answer */
+    while (k & 1) {
+        k >>= 1;
+    }
+    k >>= 1;
+
+    /* The first block starting at or after the key; the answer is in the one before */
+    block = k == 0 ? nodes : index[k].id;
+    if (block == 0) {
+        return 0;
+    }
+    first = (block - 1) * MOBI_DIR_BLOCK;
+    n = dir->count - first < MOBI_DIR_BLOCK ? dir->count - first : MOBI_DIR_BLOCK;
+    return first + lower_bound(dir->entries + first, n, hi, lo);
+}
+
+static int fill_task(void *ctx, size_t begin, size_t end, int worker) {
+    dir_job *job = (dir_job *)ctx;
+    size_t i;
+
+    (void)worker;
+    for (i = begin; i < end; i++) {
+        job->entries[i].hi = job->mobis[i].hi;
+        job->entries[i].lo = job->mobis[i].lo;
+        job->entries[i].id = (uint32_t)i;
+    }
+    return 0;
+}
+
+/* mobis[i] as entry i, then sorted: the ids map entries back to mobis */
+static mobi_error_t sorted_entries(dir_job *job, int threads) {
+    mobi_error_t err;
+
+    if ((uint64_t)job->count > UINT32_MAX) {
+        return MOBI_ERR_INVALID_LEN;
+    }
+    job->entries = malloc(job->count * sizeof(mobi_entry_t));
+    if (job->entries == NULL) {
+        return MOBI_ERR_NOMEM;
+    }
+    mobi_parallel_for(job->count, DIR_CHUNK, threads, fill_task, job);
+    err = mobi_sort_entries(job->entries, NULL, job->count, threads);
+    if (err != MOBI_OK) {
+        free(job->entries);
+        job->entries = NULL;
+    }
+    return err;
+}
+
+size_t mobi_dir_index_count(size_t count) {
+    return (count + MOBI_DIR_BLOCK - 1) / MOBI_DIR_BLOCK;
+}
+
+mobi_error_t mobi_dir_build_mt(mobi_dir_t *dir, const mobi_bin_t *mobis, size_t count,
+                               int threads) {
+    dir_job job;
+    mobi_error_t err;
+    void *index;
+    size_t nodes;
+
+    if (dir == NULL || (mobis == NULL && count > 0)) {
+        return MOBI_ERR_NULL;
+    }
+    memset(dir, 0, sizeof(*dir));
+    if (count == 0) {
+        return MOBI_OK;
+    }
+
+    job.mobis = mobis;
+    job.count = count;
+    err = sorted_entries(&job, threads);
+    if (err != MOBI_OK) {
+        return err;
+    }
+
+    /* Node 0 is unused so that the root is node 1 */
+    nodes = mobi_dir_index_count(count);
+    if (posix_memalign(&index, INDEX_ALIGN, (nodes + 1) * sizeof(mobi_entry_t)) != 0) {
+        free(job.entries);
+        return MOBI_ERR_NOMEM;
+    }
+    memset(index, 0, sizeof(mobi_entry_t));
+    index_fill((mobi_entry_t *)index, nodes, job.entries, 0, 1);
+
+    dir->entries = job.entries;
+    dir->count = count;
+    dir->index = (mobi_entry_t *)index;
+    dir->index_count = nodes;
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_dir_build(mobi_dir_t *dir, const mobi_bin_t *mobis, size_t count) {
+    return mobi_dir_build_mt(dir, mobis, count, 1);
+}
+
+void mobi_dir_free(mobi_dir_t *dir) {
+    if (dir == NULL) {
+        return;
+    }
+    if (dir->map != NULL) {
+        munmap(dir->map, dir->map_len);
+    } else {
+        free(dir->entries);
+        free(dir->index);
+    }
+    memset(dir, 0, sizeof(*dir));
+}
+
+mobi_error_t mobi_prefix_range(const char *digits, size_t len, mobi_bin_t *start,
+                               mobi_bin_t *end) {
+    uint64_t hi = 0;
+    uint32_t lo = 0;
+    size_t i;
+
+    if (digits == NULL || start == NULL || end == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (len == 0 || len > MOBI_FULL_LEN) {
+        return MOBI_ERR_INVALID_LEN;
+    }
+
+    /* The prefix padded with zeros to 21 digits, split 12 + 9 */
+    for (i = 0; i < MOBI_FULL_LEN; i++) {
+        unsigned d = 0;
+
+        if (i < len) {
+            d = (unsigned)(unsigned char)digits[i] - '0';
+            if (d > 9) {
+                return MOBI_ERR_INVALID_CHAR;
+            }
+        }
+        if (i < MOBI_DISPLAY_LEN) {
+            hi = hi * 10 + d;
+        } else {
+            lo = lo * 10 + d;
+        }
+    }
+    start->hi = hi;
+    start->lo = lo;
+
+    /* Add one unit of the last typed digit; 10^21 itself is (10^12, 0) */
+    if (len <= MOBI_DISPLAY_LEN) {
+        end->hi = hi + POW10[MOBI_DISPLAY_LEN - len];
+        end->lo = 0;
+    } else {
+        uint32_t next = lo + (uint32_t)POW10[MOBI_FULL_LEN - len];
+        end->hi = hi + (next >= LO_MOD);
+        end->lo = next >= LO_MOD ? next - LO_MOD : next;
+    }
+    return MOBI_OK;
+}
+
+uint8_t mobi_split_level(const mobi_entry_t *a, const mobi_entry_t *b) {
+    if (a->hi != b->hi) {
+        return MOBI_DISPLAY_LEN;
+    }
+    if (a->lo / 1000000 != b->lo / 1000000) {
+        return MOBI_EXTENDED_LEN;
+    }
+    if (a->lo / 1000 != b->lo / 1000) {
+        return MOBI_LONG_LEN;
+    }
+    return MOBI_FULL_LEN;
+}
+
+/* An entry needs the deeper of the levels separating it from each neighbour */
+static int level_task(void *ctx, size_t begin, size_t end, int worker) {
+    dir_job *job = (dir_job *)ctx;
+    const mobi_entry_t *e = job->entries;
+    size_t i;
+
+    (void)worker;
+    for (i = begin; i < end; i++) {
+        uint8_t level = MOBI_DISPLAY_LEN;
+
+        if (i > 0) {
+            level = mobi_split_level(&e[i - 1], &e[i]);
+        }
+        if (i + 1 < job->count) {
+            uint8_t next = mobi_split_level(&e[i], &e[i + 1]);
+            level = next > level ? next : level;
+        }
+        job->levels[e[i].id] = level;
+    }
+    return 0;
+}
+
+mobi_error_t mobi_resolve_levels(const mobi_bin_t *mobis, size_t count, uint8_t *levels,
+                                 int threads) {
+    dir_job job;
+    mobi_error_t err;
+
+    if ((mobis == NULL || levels == NULL) && count > 0) {
+        return MOBI_ERR_NULL;
+    }
+    if (count == 0) {
+        return MOBI_OK;
+    }
+
+    job.mobis = mobis;
+    job.count = count;
+    job.levels = levels;
+    err = sorted_entries(&job, threads);
+    if (err != MOBI_OK) {
+        return err;
+    }
+    mobi_parallel_for(count, DIR_CHUNK, threads, level_task, &job);
+
+    free(job.entries);
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_lookup(const mobi_dir_t *dir, const char *digits, size_t len,
+                         size_t *first, size_t *count) {
+    mobi_bin_t start, end;
+    mobi_error_t err;
+    size_t a, b;
+
+    if (dir == NULL || first == NULL || count == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    err = mobi_prefix_range(digits, len, &start, &end);
+    if (err != MOBI_OK) {
+        return err;
+    }
+
+    a = dir_lower_bound(dir, start.hi, start.lo);
+    b = dir_lower_bound(dir, end.hi, end.lo);
+    *first = a;
+    *count = b - a;
+    return MOBI_OK;
+}
@@ -0,0 +1,274 @@
+/*
+ * Mobi Protocol v21.0.0 - Directory Files
+ *
+ * An immutable directory on disk: the sorted entries, the search layer and
+ * optionally the pubkeys, each section page-aligned and laid out exactly
+ * as mobi_dir_t holds it in memory. Opening one is a header check and an
+ * mmap; pages are faulted in by the first lookups that touch them, so a
+ * resolver is serving queries long before the file has been read.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#define _DEFAULT_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "mobi_internal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PAGE 4096
+
+/* Entries encoded per write */
+#define WRITE_CHUNK 4096
+
+#define ENTRY_LEN 16
+
+static void put_le(uint8_t *p, uint64_t v, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int n) {
+    uint64_t v = 0;
+    while (n-- > 0) {
+        v = (v << 8) | p[n];
+    }
+    return v;
+}
+
+/* The mapped sections are used in place, which needs mobi_entry_t to be little-endian */
+static int host_little_endian(void) {
+    const uint16_t probe = 1;
+    return *(const uint8_t *)&probe == 1;
+}
+
+static uint64_t page_align(uint64_t at) {
+    return (at + PAGE - 1) / PAGE * PAGE;
+}
+
+/* Section offsets for count entries; all page-aligned */
+static void layout(uint64_t count, int pubkeys, uint64_t *index_off, uint64_t *pubkeys_off,
+                   uint64_t *end) {
+    uint64_t nodes = mobi_dir_index_count((size_t)count);
+
+    *index_off = page_align(MOBI_DIRFILE_HEADER_LEN + count * ENTRY_LEN);
+    *end = *index_off + (nodes + 1) * ENTRY_LEN;
+    *pubkeys_off = 0;
+    if (pubkeys) {
+        *pubkeys_off = page_align(*end);
+        *end = *pubkeys_off + count * MOBI_PUBKEY_LEN;
+    }
+}
+
+/* ============================================================================
+ * WRITING
+ * ============================================================================ */
+
+static int write_entries(FILE *f, const mobi_entry_t *e, size_t count) {
+    uint8_t buf[WRITE_CHUNK * ENTRY_LEN];
+    size_t done, i;
+
+    for (done = 0; done < count; done += WRITE_CHUNK) {
+        size_t n = count - done < WRITE_CHUNK ? count - done : WRITE_CHUNK;
+
+        for (i = 0; i < n; i++) {
+            put_le(buf + i * ENTRY_LEN, e[done + i].hi, 8);
+            put_le(buf + i * ENTRY_LEN + 8, e[done + i].lo, 4);
+            put_le(buf + i * ENTRY_LEN + 12, e[done + i].id, 4);
+        }
+        if (fwrite(buf, ENTRY_LEN, n, f) != n) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Pubkeys of the entries in entry order: keys[id] for each entry */
+static int write_pubkeys(FILE *f, const mobi_entry_t *e, size_t count, const uint8_t *keys) {
+    uint8_t buf[WRITE_CHUNK * MOBI_PUBKEY_LEN];
+    size_t done, i;
+
+    for (done = 0; done < count; done += WRITE_CHUNK) {
+        size_t n = count - done < WRITE_CHUNK ? count - done : WRITE_CHUNK;
+
+        for (i = 0; i < n; i++) {
+            memcpy(buf + i * MOBI_PUBKEY_LEN,
+                   keys + (size_t)e[done + i].id * MOBI_PUBKEY_LEN, MOBI_PUBKEY_LEN);
+        }
+        if (fwrite(buf, MOBI_PUBKEY_LEN, n, f) != n) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int pad_to(FILE *f, uint64_t at) {
+    static const uint8_t zeros[PAGE];
+    off_t pos = ftello(f);
+
+    if (pos < 0 || (uint64_t)pos > at) {
+        return -1;
+    }
+    return fwrite(zeros, 1, (size_t)(at - (uint64_t)pos), f) == (size_t)(at - (uint64_t)pos)
+           ? 0 : -1;
+}
+
+mobi_error_t mobi_dir_write(const mobi_dir_t *dir, const uint8_t *keys, const char *path) {
+    uint8_t header[MOBI_DIRFILE_HEADER_LEN];
+    uint64_t index_off, pubkeys_off, end;
+    uint32_t flags = keys != NULL ? MOBI_DIRFILE_PUBKEYS : 0;
+    mobi_replace_t out;
+    mobi_error_t err;
+    size_t nodes;
+    int failed;
+    FILE *f;
+
+    if (dir == NULL || path == NULL || (dir->count > 0 && dir->index == NULL)) {
+        return MOBI_ERR_NULL;
+    }
+    nodes = mobi_dir_index_count(dir->count);
+    layout(dir->count, keys != NULL, &index_off, &pubkeys_off, &end);
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, MOBI_DIRFILE_MAGIC, 8);
+    put_le(header + 8, MOBI_DIRFILE_VERSION, 4);
+    put_le(header + 12, flags, 4);
+    put_le(header + 16, dir->count, 8);
+    put_le(header + 24, MOBI_DIRFILE_HEADER_LEN, 8);
+    put_le(header + 32, nodes, 8);
+    put_le(header + 40, index_off, 8);
+    put_le(header + 48, pubkeys_off, 8);
+
+    /* Built beside the old file: readers may have that one mapped */
+    err = mobi_replace_open(&out, path);
+    if (err != MOBI_OK) {
+        return err;
+    }
+    f = out.file;
+    failed = fwrite(header, 1, sizeof(header), f) != sizeof(header) ||
+             write_entries(f, dir->entries, dir->count) != 0 ||
+             pad_to(f, index_off) != 0;
+    if (!failed) {
+        /* Node 0 is unused but stored, so nodes keep their in-memory offsets */
+        static const mobi_entry_t unused;
+        failed = write_entries(f, dir->count > 0 ? dir->index : &unused,
+                               dir->count > 0 ? nodes + 1 : 1) != 0;
+    }
+    if (!failed && keys != NULL) {
+        failed = pad_to(f, pubkeys_off) != 0 ||
+                 write_pubkeys(f, dir->entries, dir->count, keys) != 0;
+    }
+    if (failed) {
+        mobi_replace_abort(&out);
+        return MOBI_ERR_IO;
+    }
+    return mobi_replace_commit(&out);
+}
+
+/* ============================================================================
+ * READING
+ * ============================================================================ */
+
+/* Checks the header against the file size; fills count and flags */
+static int header_decode(const uint8_t *h, uint64_t size, uint64_t *count, uint32_t *flags) {
+    uint64_t n, index_off, pubkeys_off, end;
+
+    if (size < MOBI_DIRFILE_HEADER_LEN || memcmp(h, MOBI_DIRFILE_MAGIC, 8) != 0) {
+        return -1;
+    }
+    *flags = (uint32_t)get_le(h + 12, 4);
+    if (get_le(h + 8, 4) != MOBI_DIRFILE_VERSION || (*flags & ~MOBI_DIRFILE_PUBKEYS)) {
+        return -1;
+    }
+    n = get_le(h + 16, 8);
+    if (n > size / ENTRY_LEN || get_le(h + 24, 8) != MOBI_DIRFILE_HEADER_LEN) {
+        return -1;  /* Also rules out overflow in layout() */
+    }
+
+    layout(n, (*flags & MOBI_DIRFILE_PUBKEYS) != 0, &index_off, &pubkeys_off, &end);
+    if (get_le(h + 32, 8) != mobi_dir_index_count((size_t)n) ||
+        get_le(h + 40, 8) != index_off || get_le(h + 48, 8) != pubkeys_off || end > size) {
+        return -1;
+    }
+    *count = n;
+    return 0;
+}
+
+mobi_error_t mobi_dir_open(mobi_dir_t *dir, const char *path, unsigned flags) {
+    struct stat st;
+    uint64_t count, index_off, pubkeys_off, end;
+    uint32_t file_flags;
+    uint8_t *map;
+    int fd, map_flags = MAP_SHARED;
+
+    if (dir == NULL || path == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    memset(dir, 0, sizeof(*dir));
+    if (!host_little_endian()) {
+        return MOBI_ERR_FORMAT;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return MOBI_ERR_IO;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return MOBI_ERR_IO;
+    }
+    if ((uint64_t)st.st_size < MOBI_DIRFILE_HEADER_LEN || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return MOBI_ERR_FORMAT;
+    }
+
+#ifdef MAP_POPULATE
+    if (flags & MOBI_DIR_POPULATE) {
+        map_flags |= MAP_POPULATE;
+    }
+#endif
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, map_flags, fd, 0);
+    close(fd);  /* The mapping keeps the file alive */
+    if (map == MAP_FAILED) {
+        return MOBI_ERR_IO;
+    }
+
+    if (header_decode(map, (uint64_t)st.st_size, &count, &file_flags) != 0) {
+        munmap(map, (size_t)st.st_size);
+        return MOBI_ERR_FORMAT;
+    }
+    layout(count, (file_flags & MOBI_DIRFILE_PUBKEYS) != 0, &index_off, &pubkeys_off, &end);
+
+    /*
+     * Lookups hop around the entries, so read-ahead would only evict other
+     * pages; the search layer is small and on every path, so ask for it now.
+     */
+    if (!(flags & MOBI_DIR_POPULATE)) {
+        posix_madvise(map, (size_t)index_off, POSIX_MADV_RANDOM);
+    }
+    posix_madvise(map + index_off, (mobi_dir_index_count((size_t)count) + 1) * ENTRY_LEN,
+                  POSIX_MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if (flags & MOBI_DIR_HUGEPAGES) {
+        madvise(map, (size_t)st.st_size, MADV_HUGEPAGE);   /* Only a hint */
+    }
+#endif
+
+    dir->map = map;
+    dir->map_len = (size_t)st.st_size;
+    dir->count = (size_t)count;
+    dir->entries = (mobi_entry_t *)(void *)(map + MOBI_DIRFILE_HEADER_LEN);
+    dir->index = (mobi_entry_t *)(void *)(map + index_off);
+    dir->index_count = mobi_dir_index_count((size_t)count);
+    dir->pubkeys = pubkeys_off != 0 ? map + pubkeys_off : NULL;
+    return MOBI_OK;
+}
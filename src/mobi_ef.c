@@ -0,0 +1,436 @@
+/*
+ * Mobi Protocol v21.0.0 - Elias-Fano Directory
+ *
+ * Mobis are uniform on [0, 10^21), so a sorted set of n of them is close
+ * to the worst case Elias-Fano is designed for: each value v = hi * 10^9 + lo
+ * is split into its low l = floor(log2(10^21 / n)) bits, stored verbatim,
+ * and its high bits, stored in unary as gaps in a bitvector of about 2n
+ * bits. That is l + 2 bits per mobi (45 at 100M users) instead of 16 for
+ * mobi_bin_t or 70 for mobi_t.
+ *
+ * In the high bitvector, element i is a one at (v_i >> l) + i and every
+ * bucket of the high part ends in a zero. Sampling the position of every
+ * 256th one and every 256th zero gives select in a few word scans, which
+ * is all rank, successor and prefix ranges need.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#include "mobi_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int popcount64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    int c = 0;
+    for (; x != 0; x &= x - 1) {
+        c++;
+    }
+    return c;
+#endif
+}
+
+/* Index of the lowest set bit; x != 0 */
+static int ctz64(uint64_t x) {
+#if defined(__GNUC__)
+    return __builtin_ctzll(x);
+#else
+    int c = 0;
+    for (; !(x & 1); x >>= 1) {
+        c++;
+    }
+    return c;
+#endif
+}
+
+#define LO_MOD 1000000000u      /* 10^9: range of mobi_bin_t.lo */
+
+/* Ones (and zeros) between select samples */
+#define SAMPLE 256
+
+/* ============================================================================
+ * 70-BIT VALUES
+ * ============================================================================ */
+
+/* hi * 10^9 + lo as a two-word integer; below 2^70 */
+typedef struct {
+    uint64_t hi;
+    uint64_t lo;
+} wide;
+
+/* 10^21, and the largest mobi */
+static const wide UNIVERSE = { 0x36ULL, 0x35c9adc5dea00000ULL };
+static const wide LARGEST = { 0x36ULL, 0x35c9adc5de9fffffULL };
+
+static wide wide_from_bin(uint64_t hi, uint32_t lo) {
+    /* hi * 10^9 in two 32-bit halves of hi */
+    uint64_t low = (hi & 0xffffffffULL) * LO_MOD;
+    uint64_t high = (hi >> 32) * LO_MOD;   /* below 2^38 */
+    wide v;
+
+    v.lo = low + (high << 32);
+    v.hi = (high >> 32) + (v.lo < low);
+    v.lo += lo;
+    v.hi += v.lo < lo;
+    return v;
+}
+
+static mobi_bin_t wide_to_bin(wide v) {
+    /* Long division by 10^9, 32 bits at a time; the top word is below 10^9 */
+    uint64_t rem = v.hi;
+    uint64_t q1, q0;
+    mobi_bin_t m;
+
+    rem = (rem << 32) | (v.lo >> 32);
+    q1 = rem / LO_MOD;
+    rem = ((rem % LO_MOD) << 32) | (v.lo & 0xffffffffULL);
+    q0 = rem / LO_MOD;
+    m.hi = (q1 << 32) + q0;
+    m.lo = (uint32_t)(rem % LO_MOD);
+    return m;
+}
+
+static int wide_below(wide a, wide b) {
+    return a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo);
+}
+
+static wide wide_shr(wide v, int s) {
+    wide r;
+
+    if (s == 0) {
+        return v;
+    }
+    if (s >= 64) {
+        r.lo = v.hi >> (s - 64);
+        r.hi = 0;
+    } else {
+        r.lo = (v.lo >> s) | (v.hi << (64 - s));
+        r.hi = v.hi >> s;
+    }
+    return r;
+}
+
+static wide wide_shl(wide v, int s) {
+    wide r;
+
+    if (s == 0) {
+        return v;
+    }
+    if (s >= 64) {
+        r.hi = v.lo << (s - 64);
+        r.lo = 0;
+    } else {
+        r.hi = (v.hi << s) | (v.lo >> (64 - s));
+        r.lo = v.lo << s;
+    }
+    return r;
+}
+
+/* The low s bits */
+static wide wide_low(wide v, int s) {
+    if (s < 64) {
+        v.lo &= s == 0 ? 0 : ~0ULL >> (64 - s);
+        v.hi = 0;
+    } else if (s < 128) {
+        v.hi &= s == 64 ? 0 : ~0ULL >> (128 - s);
+    }
+    return v;
+}
+
+/* ============================================================================
+ * BIT ARRAYS
+ * ============================================================================ */
+
+static void bits_put(uint64_t *a, size_t pos, int width, uint64_t v) {
+    size_t w = pos / 64;
+    int off = (int)(pos % 64);
+
+    if (width == 0) {
+        return;
+    }
+    a[w] |= v << off;
+    if (off + width > 64) {
+        a[w + 1] |= v >> (64 - off);
+    }
+}
+
+static uint64_t bits_get(const uint64_t *a, size_t pos, int width) {
+    size_t w = pos / 64;
+    int off = (int)(pos % 64);
+    uint64_t v;
+
+    if (width == 0) {
+        return 0;
+    }
+    v = a[w] >> off;
+    if (off + width > 64) {
+        v |= a[w + 1] << (64 - off);
+    }
+    return width == 64 ? v : v & (~0ULL >> (64 - width));
+}
+
+/* Low bits of element i; l can exceed 64 for tiny sets */
+static wide low_of(const mobi_ef_t *ef, size_t i) {
+    size_t pos = i * (size_t)ef->low_bits;
+    wide v;
+
+    if (ef->low_bits <= 64) {
+        v.lo = bits_get(ef->low, pos, ef->low_bits);
+        v.hi = 0;
+    } else {
+        v.lo = bits_get(ef->low, pos, 64);
+        v.hi = bits_get(ef->low, pos + 64, ef->low_bits - 64);
+    }
+    return v;
+}
+
+/* Position of the k-th set bit of x (k < popcount(x)) */
+static int select_in_word(uint64_t x, unsigned k) {
+    while (k-- > 0) {
+        x &= x - 1;
+    }
+    return ctz64(x);
+}
+
+/* Position of the k-th one (want = 1) or zero (want = 0) of the high bits */
+static size_t high_select(const mobi_ef_t *ef, size_t k, int want) {
+    const uint64_t *samples = want ? ef->select1 : ef->select0;
+    size_t pos = samples[k / SAMPLE];
+    size_t w = pos / 64;
+    size_t left = k % SAMPLE;
+    uint64_t bits = (want ? ef->high[w] : ~ef->high[w]) & (~0ULL << (pos % 64));
+
+    for (;;) {
+        size_t c = (size_t)popcount64(bits);
+
+        if (left < c) {
+            return w * 64 + (size_t)select_in_word(bits, (unsigned)left);
+        }
+        left -= c;
+        w++;
+        bits = want ? ef->high[w] : ~ef->high[w];
+    }
+}
+
+static int high_bit(const mobi_ef_t *ef, size_t pos) {
+    return (int)((ef->high[pos / 64] >> (pos % 64)) & 1);
+}
+
+/* ============================================================================
+ * CONSTRUCTION
+ * ============================================================================ */
+
+static int is_sorted(const mobi_bin_t *m, size_t count) {
+    size_t i;
+
+    for (i = 1; i < count; i++) {
+        if (m[i - 1].hi > m[i].hi || (m[i - 1].hi == m[i].hi && m[i - 1].lo > m[i].lo)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Sample every SAMPLE-th one and zero of the finished high bits */
+static void high_samples(mobi_ef_t *ef) {
+    size_t ones = 0, zeros = 0, pos;
+
+    for (pos = 0; pos < ef->high_len; pos++) {
+        if (high_bit(ef, pos)) {
+            if (ones % SAMPLE == 0) {
+                ef->select1[ones / SAMPLE] = pos;
+            }
+            ones++;
+        } else {
+            if (zeros % SAMPLE == 0) {
+                ef->select0[zeros / SAMPLE] = pos;
+            }
+            zeros++;
+        }
+    }
+}
+
+mobi_error_t mobi_ef_build(mobi_ef_t *ef, const mobi_bin_t *mobis, size_t count,
+                           int threads) {
+    mobi_entry_t *sorted = NULL;
+    size_t i, buckets, low_words, high_words;
+    int l = 0;
+
+    if (ef == NULL || (mobis == NULL && count > 0)) {
+        return MOBI_ERR_NULL;
+    }
+    memset(ef, 0, sizeof(*ef));
+    for (i = 0; i < count; i++) {
+        if (mobis[i].hi >= 1000000000000ULL || mobis[i].lo >= LO_MOD) {
+            return MOBI_ERR_RANGE;
+        }
+    }
+
+    /* Sorted input is used as is; anything else is sorted into a copy */
+    if (!is_sorted(mobis, count)) {
+        sorted = malloc(count * sizeof(mobi_entry_t));
+        if (sorted == NULL) {
+            return MOBI_ERR_NOMEM;
+        }
+        for (i = 0; i < count; i++) {
+            sorted[i].hi = mobis[i].hi;
+            sorted[i].lo = mobis[i].lo;
+            sorted[i].id = 0;
+        }
+        if (mobi_sort_entries(sorted, NULL, count, threads) != MOBI_OK) {
+            free(sorted);
+            return MOBI_ERR_NOMEM;
+        }
+    }
+
+    /* Largest l with count * 2^l <= 10^21 */
+    if (count > 0) {
+        wide n;
+
+        n.hi = 0;
+        n.lo = count;
+        while (l < 70 && !wide_below(UNIVERSE, wide_shl(n, l + 1))) {
+            l++;
+        }
+    }
+    buckets = count > 0 ? (size_t)wide_shr(LARGEST, l).lo + 1 : 0;
+
+    ef->count = count;
+    ef->low_bits = l;
+    ef->high_len = count + buckets;
+    low_words = (count * (size_t)l + 63) / 64 + 1;
+    high_words = (ef->high_len + 63) / 64 + 1;     /* scans may read one word past */
+    ef->low = calloc(low_words, sizeof(uint64_t));
+    ef->high = calloc(high_words, sizeof(uint64_t));
+    ef->select1 = malloc((count / SAMPLE + 1) * sizeof(uint64_t));
+    ef->select0 = malloc((buckets / SAMPLE + 1) * sizeof(uint64_t));
+    if (ef->low == NULL || ef->high == NULL || ef->select1 == NULL || ef->select0 == NULL) {
+        free(sorted);
+        mobi_ef_free(ef);
+        return MOBI_ERR_NOMEM;
+    }
+    ef->bytes = (low_words + high_words + count / SAMPLE + 1 + buckets / SAMPLE + 1) *
+                sizeof(uint64_t);
+
+    for (i = 0; i < count; i++) {
+        wide v = sorted != NULL ? wide_from_bin(sorted[i].hi, sorted[i].lo)
+                                : wide_from_bin(mobis[i].hi, mobis[i].lo);
+        wide low = wide_low(v, l);
+        size_t pos = (size_t)wide_shr(v, l).lo + i;
+
+        if (l <= 64) {
+            bits_put(ef->low, i * (size_t)l, l, low.lo);
+        } else {
+            bits_put(ef->low, i * (size_t)l, 64, low.lo);
+            bits_put(ef->low, i * (size_t)l + 64, l - 64, low.hi);
+        }
+        ef->high[pos / 64] |= 1ULL << (pos % 64);
+    }
+    high_samples(ef);
+
+    free(sorted);
+    return MOBI_OK;
+}
+
+void mobi_ef_free(mobi_ef_t *ef) {
+    if (ef == NULL) {
+        return;
+    }
+    free(ef->low);
+    free(ef->high);
+    free(ef->select1);
+    free(ef->select0);
+    memset(ef, 0, sizeof(*ef));
+}
+
+/* ============================================================================
+ * QUERIES
+ * ============================================================================ */
+
+mobi_error_t mobi_ef_select(const mobi_ef_t *ef, size_t i, mobi_bin_t *out) {
+    wide v, low;
+
+    if (ef == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (i >= ef->count) {
+        return MOBI_ERR_RANGE;
+    }
+    v.hi = 0;
+    v.lo = high_select(ef, i, 1) - i;
+    v = wide_shl(v, ef->low_bits);
+    low = low_of(ef, i);
+    v.lo |= low.lo;
+    v.hi |= low.hi;
+    *out = wide_to_bin(v);
+    return MOBI_OK;
+}
+
+/* Elements below v */
+static size_t ef_rank(const mobi_ef_t *ef, wide v) {
+    size_t bucket, pos, i;
+    wide low;
+
+    if (ef->count == 0) {
+        return 0;
+    }
+    if (!wide_below(v, UNIVERSE)) {
+        return ef->count;
+    }
+    bucket = (size_t)wide_shr(v, ef->low_bits).lo;
+    low = wide_low(v, ef->low_bits);
+
+    /* Bucket b starts after the zero that ends bucket b - 1 */
+    pos = bucket == 0 ? 0 : high_select(ef, bucket - 1, 0) + 1;
+    i = pos - bucket;
+    while (pos < ef->high_len && high_bit(ef, pos) && wide_below(low_of(ef, i), low)) {
+        pos++;
+        i++;
+    }
+    return i;
+}
+
+size_t mobi_ef_rank(const mobi_ef_t *ef, const mobi_bin_t *m) {
+    if (ef == NULL || m == NULL) {
+        return 0;
+    }
+    return ef_rank(ef, wide_from_bin(m->hi, m->lo));
+}
+
+mobi_error_t mobi_ef_successor(const mobi_ef_t *ef, const mobi_bin_t *m, size_t *index,
+                               mobi_bin_t *out) {
+    size_t i;
+
+    if (ef == NULL || m == NULL || index == NULL || out == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    i = mobi_ef_rank(ef, m);
+    if (i == ef->count) {
+        return MOBI_ERR_NOT_FOUND;
+    }
+    *index = i;
+    return mobi_ef_select(ef, i, out);
+}
+
+mobi_error_t mobi_ef_lookup(const mobi_ef_t *ef, const char *digits, size_t len,
+                            size_t *first, size_t *count) {
+    mobi_bin_t start, end;
+    mobi_error_t err;
+    size_t a, b;
+
+    if (ef == NULL || first == NULL || count == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    err = mobi_prefix_range(digits, len, &start, &end);
+    if (err != MOBI_OK) {
+        return err;
+    }
+    a = ef_rank(ef, wide_from_bin(start.hi, start.lo));
+    b = ef_rank(ef, wide_from_bin(end.hi, end.lo));
+    *first = a;
+    *count = b - a;
+    return MOBI_OK;
+}
@@ -0,0 +1,133 @@
+/*
+ * Mobi Protocol v21.0.0 - File Replacement
+ *
+ * Write-beside-and-rename for the library's file writers (mobi_replace_t
+ * in mobi_internal.h).
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "mobi_internal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TMP_SUFFIX ".XXXXXX"
+
+/*
+ * Permissions for the new file: those of the file it replaces, or what
+ * fopen would have created, 0666 less the umask. Linux reports the umask
+ * in /proc; setting it to read it back would race other threads.
+ */
+static mode_t replace_mode(const char *path) {
+    struct stat st;
+    char line[64];
+    unsigned mask = 022;
+    FILE *status;
+
+    if (stat(path, &st) == 0) {
+        return st.st_mode & 07777;
+    }
+    status = fopen("/proc/self/status", "r");
+    if (status != NULL) {
+        while (fgets(line, sizeof(line), status) != NULL) {
+            if (sscanf(line, "Umask: %o", &mask) == 1) {
+                break;
+            }
+        }
+        fclose(status);
+    }
+    return (mode_t)(0666 & ~mask);
+}
+
+/* Make the rename itself durable; best effort, the file is in place either way */
+static void sync_dir(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *dir;
+    int fd;
+
+    if (slash == NULL) {
+        fd = open(".", O_RDONLY);
+    } else {
+        size_t len = slash == path ? 1 : (size_t)(slash - path);
+
+        dir = malloc(len + 1);
+        if (dir == NULL) {
+            return;
+        }
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+        fd = open(dir, O_RDONLY);
+        free(dir);
+    }
+    if (fd >= 0) {
+        (void)fsync(fd);
+        close(fd);
+    }
+}
+
+mobi_error_t mobi_replace_open(mobi_replace_t *r, const char *path) {
+    size_t len = strlen(path);
+    int fd;
+
+    r->file = NULL;
+    r->path = malloc(2 * len + sizeof(TMP_SUFFIX) + 1);
+    if (r->path == NULL) {
+        return MOBI_ERR_NOMEM;
+    }
+    memcpy(r->path, path, len + 1);
+    r->tmp = r->path + len + 1;
+    memcpy(r->tmp, path, len);
+    memcpy(r->tmp + len, TMP_SUFFIX, sizeof(TMP_SUFFIX));
+
+    /* A name no other writer (or user file) has; read access for the corpus writer */
+    fd = mkstemp(r->tmp);
+    if (fd < 0) {
+        free(r->path);
+        r->path = NULL;
+        return MOBI_ERR_IO;
+    }
+    if (fchmod(fd, replace_mode(path)) != 0 || (r->file = fdopen(fd, "wb+")) == NULL) {
+        close(fd);
+        remove(r->tmp);
+        free(r->path);
+        r->path = NULL;
+        return MOBI_ERR_IO;
+    }
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_replace_commit(mobi_replace_t *r) {
+    int failed = fflush(r->file) != 0 || fsync(fileno(r->file)) != 0;
+
+    if (fclose(r->file) != 0) {
+        failed = 1;
+    }
+    if (!failed && rename(r->tmp, r->path) != 0) {
+        failed = 1;
+    }
+    if (failed) {
+        remove(r->tmp);
+    } else {
+        sync_dir(r->path);
+    }
+    free(r->path);
+    r->file = NULL;
+    r->path = r->tmp = NULL;
+    return failed ? MOBI_ERR_IO : MOBI_OK;
+}
+
+void mobi_replace_abort(mobi_replace_t *r) {
+    fclose(r->file);
+    remove(r->tmp);
+    free(r->path);
+    r->file = NULL;
+    r->path = r->tmp = NULL;
+}
@@ -0,0 +1,483 @@
+/*
+ * Mobi Protocol v21.0.0 - Display Filter
+ *
+ * A binary fuse filter (Graf & Lemire, 2022) over 12-digit display values
+ * with 8-bit fingerprints: about 9 bits per display and a false-positive
+ * rate of 1/256. A query is three byte loads from three neighbouring
+ * segments of the fingerprint array, XORed against the display's own
+ * fingerprint.
+ *
+ * Construction hashes every display to three slots, one in each of three
+ * consecutive segments, then peels: a slot used by exactly one display
+ * fixes that display's fingerprint last, and removing it may free others.
+ * If peeling stalls (rare at these sizes) it is retried with a new seed.
+ *
+ * The serialized form is a 64-byte header and the fingerprint array. It
+ * is used in place, from a mapped file or any buffer a caller received.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "mobi_internal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Largest segment the sizing rule picks */
+#define MAX_SEGMENT_BITS 18
+
+/* Seeds tried before giving up; each fails with probability well below 1% */
+#define MAX_ATTEMPTS 100
+
+static void put_le(uint8_t *p, uint64_t v, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int n) {
+    uint64_t v = 0;
+    while (n-- > 0) {
+        v = (v << 8) | p[n];
+    }
+    return v;
+}
+
+/* ============================================================================
+ * HASHING
+ * ============================================================================ */
+
+static uint64_t mix(uint64_t display, uint64_t seed) {
+    uint64_t h = display + seed;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint8_t fingerprint(uint64_t hash) {
+    return (uint8_t)(hash ^ (hash >> 32));
+}
+
+/* The three slots of a hash: h[0] in some segment, h[1] and h[2] in the next two */
+static void slots_of(const mobi_filter_t *f, uint64_t hash, uint32_t h[5]) {
+    /* High 64 bits of hash * segment_count_length, which is below 2^32 */
+    uint64_t top = (hash >> 32) * f->segment_count_length;
+    uint64_t low = (hash & 0xffffffffULL) * f->segment_count_length;
+    uint32_t h0 = (uint32_t)((top + (low >> 32)) >> 32);
+
+    h[0] = h0;
+    h[1] = (h0 + f->segment_length) ^ ((uint32_t)(hash >> 18) & (f->segment_length - 1));
+    h[2] = (h0 + 2 * f->segment_length) ^ ((uint32_t)hash & (f->segment_length - 1));
+    h[3] = h[0];    /* so h[found + 1] and h[found + 2] need no modulo */
+    h[4] = h[1];
+}
+
+/* ============================================================================
+ * SIZING
+ * ============================================================================ */
+
+/* log2 by repeated squaring; no libm */
+static double log2_of(double x) {
+    double r = 0, bit = 1;
+    int i;
+
+    while (x >= 2) {
+        x /= 2;
+        r += 1;
+    }
+    for (i = 0; i < 30; i++) {
+        x *= x;
+        bit /= 2;
+        if (x >= 2) {
+            x /= 2;
+            r += bit;
+        }
+    }
+    return r;
+}
+
+/*
+ * The reference sizing for three hashes: segments of
+ * 2^floor(log_3.33(n) + 2.25) slots, and 1.125n slots in all for large n,
+ * relatively more for small n where peeling needs the slack.
+ */
+static void filter_layout(mobi_filter_t *f, uint64_t count) {
+    uint32_t segments, segment_count;
+    double factor, capacity;
+    int bits;
+
+    f->count = count;
+    if (count == 0) {
+        f->segment_length = 0;
+        f->segment_count_length = 0;
+        f->array_length = 0;
+        return;
+    }
+
+    bits = count > 1 ? (int)(log2_of((double)count) / log2_of(3.33) + 2.25) : 2;
+    if (bits > MAX_SEGMENT_BITS) {
+        bits = MAX_SEGMENT_BITS;
+    }
+    f->segment_length = 1u << bits;
+
+    factor = 1.125;
+    if (count > 1) {
+        double small = 0.875 + 0.25 * log2_of(1e6) / log2_of((double)count);
+        factor = small > factor ? small : factor;
+    }
+    capacity = count > 1 ? (double)count * factor + 0.5 : 0;
+
+    segments = (uint32_t)(((uint64_t)capacity + f->segment_length - 1) / f->segment_length);
+    segment_count = segments <= 2 ? 1 : segments - 2;
+    f->segment_count_length = segment_count * f->segment_length;
+    f->array_length = (segment_count + 2) * f->segment_length;
+}
+
+/* ============================================================================
+ * CONSTRUCTION
+ * ============================================================================ */
+
+typedef struct {
+    uint8_t *count;         /* per slot: displays << 2 | XOR of their hash indices */
+    uint64_t *hash;         /* per slot: XOR of their hashes */
+    uint32_t *alone;        /* slots used by exactly one display */
+    uint64_t *order;        /* peeled hashes, in peeling order */
+    uint8_t *which;         /* which of its three slots each one was peeled from */
+} peel_state;
+
+static void peel_free(peel_state *p) {
+    free(p->count);
+    free(p->hash);
+    free(p->alone);
+    free(p->order);
+    free(p->which);
+}
+
+/* One attempt at seed f->seed; returns 1 and fills fingerprints on success */
+static int peel(mobi_filter_t *f, peel_state *p, const uint64_t *keys, size_t n,
+                uint8_t *fp) {
+    uint32_t h[5];
+    size_t i, queued = 0, peeled = 0;
+    int overflow = 0;
+
+    memset(p->count, 0, f->array_length);
+    memset(p->hash, 0, f->array_length * sizeof(uint64_t));
+    for (i = 0; i < n; i++) {
+        uint64_t hash = mix(keys[i], f->seed);
+        unsigned k;
+
+        slots_of(f, hash, h);
+        for (k = 0; k < 3; k++) {
+            p->count[h[k]] = (uint8_t)((p->count[h[k]] + 4) ^ k);
+            p->hash[h[k]] ^= hash;
+            overflow |= p->count[h[k]] < 4;     /* more than 63 displays in a slot */
+        }
+    }
+    if (overflow) {
+        return 0;
+    }
+
+    for (i = 0; i < f->array_length; i++) {
+        if ((p->count[i] >> 2) == 1) {
+            p->alone[queued++] = (uint32_t)i;
+        }
+    }
+    while (queued > 0) {
+        uint32_t slot = p->alone[--queued];
+        uint64_t hash;
+        unsigned found, k;
+
+        if ((p->count[slot] >> 2) != 1) {
+            continue;   /* its display was peeled through another slot */
+        }
+        hash = p->hash[slot];
+        found = p->count[slot] & 3;
+        p->order[peeled] = hash;
+        p->which[peeled++] = (uint8_t)found;
+
+        slots_of(f, hash, h);
+        for (k = 1; k <= 2; k++) {
+            uint32_t other = h[found + k];
+
+            p->count[other] = (uint8_t)((p->count[other] - 4) ^ ((found + k) % 3));
+            p->hash[other] ^= hash;
+            if ((p->count[other] >> 2) == 1) {
+                p->alone[queued++] = other;
+            }
+        }
+    }
+    if (peeled != n) {
+        return 0;
+    }
+
+    /* Last peeled first: each display's slot is set once its other two are final */
+    memset(fp, 0, f->array_length);
+    for (i = n; i-- > 0; ) {
+        unsigned found = p->which[i];
+
+        slots_of(f, p->order[i], h);
+        fp[h[found]] = (uint8_t)(fingerprint(p->order[i]) ^ fp[h[found + 1]] ^
+                                 fp[h[found + 2]]);
+    }
+    return 1;
+}
+
+/* The distinct displays, sorted; returns how many */
+static mobi_error_t distinct(const uint64_t *displays, size_t count, uint64_t **out,
+                             size_t *n) {
+    mobi_entry_t *e = malloc(count * sizeof(mobi_entry_t));
+    uint64_t *keys = malloc(count * sizeof(uint64_t));
+    mobi_error_t err;
+    size_t i, k = 0;
+
+    if (e == NULL || keys == NULL) {
+        free(e);
+        free(keys);
+        return MOBI_ERR_NOMEM;
+    }
+    for (i = 0; i < count; i++) {
+        e[i].hi = displays[i];
+        e[i].lo = 0;
+        e[i].id = 0;
+    }
+    err = mobi_sort_entries(e, NULL, count, 0);
+    if (err != MOBI_OK) {
+        free(e);
+        free(keys);
+        return err;
+    }
+    for (i = 0; i < count; i++) {
+        if (k == 0 || keys[k - 1] != e[i].hi) {
+            keys[k++] = e[i].hi;
+        }
+    }
+    free(e);
+    *out = keys;
+    *n = k;
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_filter_build(mobi_filter_t *f, const uint64_t *displays, size_t count) {
+    peel_state p;
+    uint64_t *keys = NULL;
+    uint64_t seed = 0x726f7466696c6966ULL;
+    uint8_t *mem;
+    mobi_error_t err;
+    size_t n = 0, i;
+    int attempt;
+
+    if (f == NULL || (displays == NULL && count > 0)) {
+        return MOBI_ERR_NULL;
+    }
+    memset(f, 0, sizeof(*f));
+    for (i = 0; i < count; i++) {
+        if (displays[i] >= 1000000000000ULL) {
+            return MOBI_ERR_RANGE;
+        }
+    }
+    if (count > 0) {
+        err = distinct(displays, count, &keys, &n);
+        if (err != MOBI_OK) {
+            return err;
+        }
+    }
+    if ((uint64_t)n > UINT32_MAX / 2) {
+        free(keys);
+        return MOBI_ERR_INVALID_LEN;    /* slot indices are 32-bit */
+    }
+
+    filter_layout(f, n);
+    mem = malloc(MOBI_FILTER_HEADER_LEN + f->array_length);
+    memset(&p, 0, sizeof(p));
+    if (f->array_length > 0) {
+        p.count = malloc(f->array_length);
+        p.hash = malloc(f->array_length * sizeof(uint64_t));
+        p.alone = malloc(f->array_length * sizeof(uint32_t));
+        p.order = malloc(n * sizeof(uint64_t));
+        p.which = malloc(n);
+    }
+    if (mem == NULL || (f->array_length > 0 && (p.count == NULL || p.hash == NULL ||
+                                                 p.alone == NULL || p.order == NULL ||
+                                                 p.which == NULL))) {
+        free(mem);
+        free(keys);
+        peel_free(&p);
+        memset(f, 0, sizeof(*f));
+        return MOBI_ERR_NOMEM;
+    }
+
+    err = MOBI_OK;
+    if (n > 0) {
+        err = MOBI_ERR_INVALID_LEN;
+        for (attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+            seed = mix(seed, 0x9e3779b97f4a7c15ULL);
+            f->seed = seed;
+            if (peel(f, &p, keys, n, mem + MOBI_FILTER_HEADER_LEN)) {
+                err = MOBI_OK;
+                break;
+            }
+        }
+    }
+    free(keys);
+    peel_free(&p);
+    if (err != MOBI_OK) {
+        free(mem);
+        memset(f, 0, sizeof(*f));
+        return err;
+    }
+
+    /* Owned filters keep their own serialized form, ready to write or ship */
+    memset(mem, 0, MOBI_FILTER_HEADER_LEN);
+    memcpy(mem, MOBI_FILTER_MAGIC, 8);
+    put_le(mem + 8, MOBI_FILTER_VERSION, 4);
+    put_le(mem + 12, 8, 4);
+    put_le(mem + 16, f->count, 8);
+    put_le(mem + 24, f->seed, 8);
+    put_le(mem + 32, f->segment_length, 4);
+    put_le(mem + 36, f->segment_count_length, 4);
+    put_le(mem + 40, f->array_length, 4);
+    f->fingerprints = mem + MOBI_FILTER_HEADER_LEN;
+    f->data = mem;
+    f->data_len = MOBI_FILTER_HEADER_LEN + f->array_length;
+    f->owned = 1;
+    return MOBI_OK;
+}
+
+/* ============================================================================
+ * QUERIES AND SERIALIZED FORM
+ * ============================================================================ */
+
+int mobi_filter_contains(const mobi_filter_t *f, uint64_t display) {
+    uint64_t hash;
+    uint32_t h[5];
+
+    if (f == NULL || f->array_length == 0) {
+        return 0;
+    }
+    hash = mix(display, f->seed);
+    slots_of(f, hash, h);
+    return (uint8_t)(fingerprint(hash) ^ f->fingerprints[h[0]] ^ f->fingerprints[h[1]] ^
+                     f->fingerprints[h[2]]) == 0;
+}
+
+mobi_error_t mobi_filter_view(mobi_filter_t *f, const uint8_t *data, size_t len) {
+    uint32_t segment, count_length, array_length;
+
+    if (f == NULL || data == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    memset(f, 0, sizeof(*f));
+    if (len < MOBI_FILTER_HEADER_LEN || memcmp(data, MOBI_FILTER_MAGIC, 8) != 0 ||
+        get_le(data + 8, 4) != MOBI_FILTER_VERSION || get_le(data + 12, 4) != 8) {
+        return MOBI_ERR_FORMAT;
+    }
+
+    /* The sizing rule is not re-run: only what queries rely on is checked */
+    segment = (uint32_t)get_le(data + 32, 4);
+    count_length = (uint32_t)get_le(data + 36, 4);
+    array_length = (uint32_t)get_le(data + 40, 4);
+    if (get_le(data + 16, 8) == 0) {
+        if (segment != 0 || count_length != 0 || array_length != 0) {
+            return MOBI_ERR_FORMAT;
+        }
+    } else if (segment == 0 || (segment & (segment - 1)) != 0 || count_length == 0 ||
+               count_length % segment != 0 || count_length > UINT32_MAX - 2 * segment ||
+               array_length != count_length + 2 * segment) {
+        return MOBI_ERR_FORMAT;
+    }
+    if (len - MOBI_FILTER_HEADER_LEN < array_length) {
+        return MOBI_ERR_FORMAT;
+    }
+
+    f->count = get_le(data + 16, 8);
+    f->seed = get_le(data + 24, 8);
+    f->segment_length = segment;
+    f->segment_count_length = count_length;
+    f->array_length = array_length;
+    f->fingerprints = data + MOBI_FILTER_HEADER_LEN;
+    f->data = (void *)(uintptr_t)data;
+    f->data_len = MOBI_FILTER_HEADER_LEN + array_length;
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_filter_write(const mobi_filter_t *f, const char *path) {
+    mobi_replace_t out;
+    mobi_error_t err;
+
+    if (f == NULL || path == NULL || f->data == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    /* Readers may have the old file mapped: build the new one beside it */
+    err = mobi_replace_open(&out, path);
+    if (err != MOBI_OK) {
+        return err;
+    }
+    if (fwrite(f->data, 1, f->data_len, out.file) != f->data_len) {
+        mobi_replace_abort(&out);
+        return MOBI_ERR_IO;
+    }
+    return mobi_replace_commit(&out);
+}
+
+mobi_error_t mobi_filter_open(mobi_filter_t *f, const char *path) {
+    struct stat st;
+    mobi_error_t err;
+    void *map;
+    int fd;
+
+    if (f == NULL || path == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    memset(f, 0, sizeof(*f));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return MOBI_ERR_IO;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return MOBI_ERR_IO;
+    }
+    if ((uint64_t)st.st_size < MOBI_FILTER_HEADER_LEN || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return MOBI_ERR_FORMAT;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  /* The mapping keeps the file alive */
+    if (map == MAP_FAILED) {
+        return MOBI_ERR_IO;
+    }
+
+    err = mobi_filter_view(f, (const uint8_t *)map, (size_t)st.st_size);
+    if (err != MOBI_OK) {
+        munmap(map, (size_t)st.st_size);
+        return err;
+    }
+    posix_madvise(map, (size_t)st.st_size, POSIX_MADV_RANDOM);
+    f->map_len = (size_t)st.st_size;
+    return MOBI_OK;
+}
+
+void mobi_filter_free(mobi_filter_t *f) {
+    if (f == NULL) {
+        return;
+    }
+    if (f->owned) {
+        free(f->data);
+    } else if (f->map_len > 0) {
+        munmap(f->data, f->map_len);
+    }
+    memset(f, 0, sizeof(*f));
+}
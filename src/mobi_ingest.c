@@ -0,0 +1,529 @@
+/*
+ * Mobi Protocol v21.0.0 - Asynchronous File Ingest
+ *
+ * Keeps the disk busy while keys are hashed. The file region is split into
+ * buffer-sized reads spread round-robin over a ring of buffers; while the
+ * oldest buffer is derived, the reads for the others are already queued.
+ * Buffers are handed to the caller strictly in file order.
+ *
+ * The Linux backend talks to io_uring directly through its three syscalls
+ * (no liburing): buffers are registered once and read with READ_FIXED, so
+ * the kernel skips pinning pages on every request; if registration is
+ * refused they are read with READV. Both opcodes date from the first
+ * io_uring kernel (5.1). Anything that goes wrong while setting the ring
+ * up, or a kernel that rejects the very first reads as unsupported, falls
+ * back to plain synchronous pread().
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE             /* syscall(), MAP_POPULATE */
+#else
+#define _POSIX_C_SOURCE 200809L
+#endif
+#define _FILE_OFFSET_BITS 64
+
+#include "mobi_internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+#define HAVE_URING 1
+#else
+#define HAVE_URING 0
+#endif
+
+#define DEFAULT_BUFFER (4u << 20)
+#define DEFAULT_DEPTH  8
+#define MAX_DEPTH      64
+
+/* ============================================================================
+ * BUFFERS
+ * ============================================================================ */
+
+typedef struct {
+    uint8_t *buf;
+    uint64_t off;           /* file offset of buf[0] */
+    size_t len;             /* bytes assigned, 0 once the region is used up */
+    size_t got;             /* bytes read so far */
+    int busy;               /* read outstanding */
+} slot_t;
+
+typedef struct {
+    int fd;
+    uint64_t start;         /* region start, for key indices */
+    uint64_t next;          /* first unassigned offset */
+    uint64_t end;           /* region end */
+    size_t buf_size;
+    int depth;
+    slot_t slots[MAX_DEPTH];
+    mobi_bin_t *bins;
+    int threads;
+    mobi_ingest_fn fn;
+    void *ctx;
+} ingest_t;
+
+/* Give a slot the next piece of the region; 0 if there is none left */
+static int slot_assign(ingest_t *in, slot_t *s) {
+    uint64_t left = in->end - in->next;
+
+    s->off = in->next;
+    s->len = left < in->buf_size ? (size_t)left : in->buf_size;
+    s->got = 0;
+    in->next += s->len;
+    return s->len > 0;
+}
+
+/* Derive a filled slot and hand it to the callback; nonzero means stop */
+static int slot_process(ingest_t *in, const slot_t *s) {
+    size_t count = s->len / MOBI_PUBKEY_LEN;
+
+    mobi_derive_batch_bin_mt(s->buf, count, in->bins, in->threads);
+    return in->fn(in->ctx, s->buf, in->bins, count, (s->off - in->start) / MOBI_PUBKEY_LEN);
+}
+
+/* ============================================================================
+ * PREAD BACKEND
+ * ============================================================================ */
+
+static mobi_error_t run_pread(ingest_t *in) {
+    slot_t *s = &in->slots[0];
+
+    while (slot_assign(in, s)) {
+        while (s->got < s->len) {
+            ssize_t r = pread(in->fd, s->buf + s->got, s->len - s->got,
+                              (off_t)(s->off + s->got));
+            if (r < 0 && errno == EINTR) {
+                continue;
+            }
+            if (r <= 0) {
+                return MOBI_ERR_IO;     /* Error, or the file shrank under us */
+            }
+            s->got += (size_t)r;
+        }
+        if (slot_process(in, s) != 0) {
+            break;
+        }
+    }
+    return MOBI_OK;
+}
+
+/* ============================================================================
+ * IO_URING BACKEND
+ * ============================================================================ */
+
+#if HAVE_URING
+
+typedef struct {
+    int fd;
+    unsigned *sq_tail, *sq_array, sq_mask;
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned to_submit;
+    int fixed;              /* buffers registered: use READ_FIXED */
+    int done;               /* a read has completed */
+    int refused;            /* reads failed as unsupported before any completed */
+    int stranded;           /* buffers left to reads that could not be waited for */
+    struct iovec iov[MAX_DEPTH];    /* READV targets, one per slot */
+} uring_t;
+
+static void uring_free(uring_t *r) {
+    if (r->sqes != NULL) {
+        munmap(r->sqes, r->sqes_len);
+    }
+    if (r->cq_ring != NULL && r->cq_ring != r->sq_ring) {
+        munmap(r->cq_ring, r->cq_len);
+    }
+    if (r->sq_ring != NULL) {
+        munmap(r->sq_ring, r->sq_len);
+    }
+    if (r->fd >= 0) {
+        close(r->fd);
+    }
+}
+
+static void *ring_map(int fd, size_t len, off_t what) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, what);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static int uring_setup(uring_t *r, unsigned entries) {
+    struct io_uring_params p;
+    uint8_t *sq, *cq;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0) {
+        return -1;
+    }
+
+    r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    /* Since 5.4 both rings share one mapping */
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_len > r->sq_len) {
+            r->sq_len = r->cq_len;
+        }
+        r->sq_ring = ring_map(r->fd, r->sq_len, IORING_OFF_SQ_RING);
+        r->cq_ring = r->sq_ring;
+    } else {
+        r->sq_ring = ring_map(r->fd, r->sq_len, IORING_OFF_SQ_RING);
+        r->cq_ring = ring_map(r->fd, r->cq_len, IORING_OFF_CQ_RING);
+    }
+    r->sqes = ring_map(r->fd, r->sqes_len, IORING_OFF_SQES);
+    if (r->sq_ring == NULL || r->cq_ring == NULL || r->sqes == NULL) {
+        uring_free(r);
+        return -1;
+    }
+
+    sq = (uint8_t *)r->sq_ring;
+    cq = (uint8_t *)r->cq_ring;
+    r->sq_tail = (unsigned *)(void *)(sq + p.sq_off.tail);
+    r->sq_array = (unsigned *)(void *)(sq + p.sq_off.array);
+    r->sq_mask = *(unsigned *)(void *)(sq + p.sq_off.ring_mask);
+    r->cq_head = (unsigned *)(void *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(void *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(void *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(void *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_register(uring_t *r, const ingest_t *in) {
+    struct iovec iov[MAX_DEPTH];
+    int i;
+
+    for (i = 0; i < in->depth; i++) {
+        iov[i].iov_base = in->slots[i].buf;
+        iov[i].iov_len = in->buf_size;
+    }
+    /* May fail on RLIMIT_MEMLOCK with older kernels: READV still works */
+    r->fixed = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS,
+                       iov, (unsigned)in->depth) == 0;
+}
+
+/*
+ * Queue a read of whatever the slot is still missing. IORING_OP_READ would
+ * avoid the iovec but needs 5.6; READV works on every io_uring kernel.
+ */
+static void uring_queue(uring_t *r, const ingest_t *in, int index) {
+    const slot_t *s = &in->slots[index];
+    unsigned tail = *r->sq_tail;    /* Only this thread writes the tail */
+    unsigned at = tail & r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[at];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = in->fd;
+    if (r->fixed) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t)(uintptr_t)(s->buf + s->got);
+        sqe->len = (uint32_t)(s->len - s->got);
+    } else {
+        r->iov[index].iov_base = s->buf + s->got;
+        r->iov[index].iov_len = s->len - s->got;
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (uint64_t)(uintptr_t)&r->iov[index];
+        sqe->len = 1;
+    }
+    sqe->off = s->off + s->got;
+    sqe->buf_index = (uint16_t)index;
+    sqe->user_data = (uint64_t)index;
+    r->sq_array[at] = at;
+
+    __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    r->to_submit++;
+}
+
+/* Submit queued reads and, if wait is set, block for one completion */
+static int uring_enter(uring_t *r, int wait) {
+    for (;;) {
+        long n = syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait ? 1u : 0u,
+                         wait ? IORING_ENTER_GETEVENTS : 0u, NULL, 0);
+        if (n >= 0) {
+            r->to_submit -= (unsigned)n;
+            return 0;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+/* Account every completion; short reads are queued again for the rest */
+static int uring_reap(uring_t *r, ingest_t *in) {
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    int failed = 0;
+
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &r->cqes[head & r->cq_mask];
+        int index = (int)cqe->user_data;
+        slot_t *s = &in->slots[index];
+
+        if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+            uring_queue(r, in, index);
+        } else if (cqe->res <= 0) {
+            s->busy = 0;    /* Error, or the file shrank under us */
+            failed = 1;
+            if (!r->done && (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)) {
+                r->refused = 1;
+            }
+        } else {
+            r->done = 1;
+            s->got += (size_t)cqe->res;
+            if (s->got < s->len) {
+                uring_queue(r, in, index);
+            } else {
+                s->busy = 0;
+            }
+        }
+    }
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    return failed ? -1 : 0;
+}
+
+/*
+ * Buffers of reads that can no longer be waited for. The kernel may still
+ * write to them, so they are never freed; the list only keeps them
+ * reachable.
+ */
+typedef struct stranded_buf {
+    struct stranded_buf *next;
+    uint8_t *buf;
+} stranded_buf;
+
+static stranded_buf *stranded_list;
+static pthread_mutex_t stranded_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Give up on every read still in flight: its buffer leaves the slot */
+static void uring_strand(uring_t *r, ingest_t *in) {
+    int i;
+
+    for (i = 0; i < in->depth; i++) {
+        slot_t *s = &in->slots[i];
+        stranded_buf *node;
+
+        if (!s->busy) {
+            continue;
+        }
+        node = malloc(sizeof(*node));
+        if (node != NULL) {
+            node->buf = s->buf;
+            pthread_mutex_lock(&stranded_lock);
+            node->next = stranded_list;
+            stranded_list = node;
+            pthread_mutex_unlock(&stranded_lock);
+        }
+        s->buf = NULL;
+        s->busy = 0;
+    }
+    r->stranded = 1;
+}
+
+static mobi_error_t run_uring(ingest_t *in, uring_t *r) {
+    mobi_error_t result = MOBI_OK;
+    int head = 0;
+    int i;
+
+    uring_register(r, in);
+
+    for (i = 0; i < in->depth; i++) {
+        if (slot_assign(in, &in->slots[i])) {
+            in->slots[i].busy = 1;
+            uring_queue(r, in, i);
+        }
+    }
+    if (uring_enter(r, 0) != 0) {
+        return MOBI_ERR_IO;     /* Nothing was accepted, nothing in flight */
+    }
+
+    while (in->slots[head].len > 0) {
+        slot_t *s = &in->slots[head];
+
+        while (s->busy && result == MOBI_OK) {
+            if (uring_enter(r, 1) != 0 || uring_reap(r, in) != 0) {
+                result = MOBI_ERR_IO;
+            }
+        }
+        if (result != MOBI_OK || slot_process(in, s) != 0) {
+            break;
+        }
+
+        /* Refill this buffer with the next piece while the others land */
+        if (slot_assign(in, s)) {
+            s->busy = 1;
+            uring_queue(r, in, head);
+            if (uring_enter(r, 0) != 0) {
+                result = MOBI_ERR_IO;
+                break;
+            }
+        }
+        head = (head + 1) % in->depth;
+    }
+
+    /*
+     * Stopped early: the buffers must outlive every read still in flight.
+     * If the ring cannot even be waited on, the busy buffers are abandoned
+     * to it rather than freed under the kernel.
+     */
+    for (i = 0; i < in->depth; i++) {
+        while (in->slots[i].busy) {
+            if (uring_enter(r, 1) != 0) {
+                uring_strand(r, in);
+                return MOBI_ERR_IO;
+            }
+            (void)uring_reap(r, in);
+        }
+    }
+    return result;
+}
+
+#endif /* HAVE_URING */
+
+/* ============================================================================
+ * PUBLIC API
+ * ============================================================================ */
+
+int mobi_ingest_uring_available(void) {
+#if HAVE_URING
+    uring_t r;
+
+    if (uring_setup(&r, 1) != 0) {
+        return 0;
+    }
+    uring_free(&r);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+mobi_error_t mobi_ingest(const char *path, const mobi_ingest_opts_t *opts,
+                         mobi_ingest_fn fn, void *ctx) {
+    static const mobi_ingest_opts_t defaults = { 0, 0, 0, 0, 0, 0 };
+    mobi_error_t result;
+    ingest_t in;
+    struct stat st;
+    uint64_t size, length;
+    int use_uring = 0;
+    int i;
+#if HAVE_URING
+    uring_t ring;
+#endif
+
+    if (path == NULL || fn == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (opts == NULL) {
+        opts = &defaults;
+    }
+
+    memset(&in, 0, sizeof(in));
+    in.fn = fn;
+    in.ctx = ctx;
+    in.threads = opts->threads;
+    in.buf_size = opts->buffer_size > 0 ? opts->buffer_size : DEFAULT_BUFFER;
+    in.buf_size -= in.buf_size % MOBI_PUBKEY_LEN;
+    if (in.buf_size == 0) {
+        in.buf_size = MOBI_PUBKEY_LEN;
+    }
+    in.depth = opts->depth > 0 ? opts->depth : DEFAULT_DEPTH;
+    if (in.depth > MAX_DEPTH) {
+        in.depth = MAX_DEPTH;
+    }
+
+    in.fd = open(path, O_RDONLY);
+    if (in.fd < 0) {
+        return MOBI_ERR_IO;
+    }
+    if (fstat(in.fd, &st) != 0) {
+        close(in.fd);
+        return MOBI_ERR_IO;
+    }
+    size = (uint64_t)st.st_size;
+    if (opts->offset > size) {
+        close(in.fd);
+        return MOBI_ERR_INVALID_LEN;
+    }
+    length = opts->length > 0 ? opts->length : size - opts->offset;
+    if (length % MOBI_PUBKEY_LEN != 0 || length > size - opts->offset) {
+        close(in.fd);
+        return MOBI_ERR_INVALID_LEN;
+    }
+    in.start = in.next = opts->offset;
+    in.end = opts->offset + length;
+
+    /* Resolve dispatch before derivation threads read the kernel pointers */
+    (void)mobi_cpu_features();
+
+#if HAVE_URING
+    if (!(opts->flags & MOBI_INGEST_PREAD) && in.depth > 1) {
+        use_uring = uring_setup(&ring, (unsigned)in.depth) == 0;
+    }
+#endif
+    if (!use_uring) {
+        in.depth = 1;
+    }
+
+    /* Page-aligned so the same buffers would also suit O_DIRECT */
+    result = MOBI_OK;
+    for (i = 0; i < in.depth; i++) {
+        void *p = NULL;
+        if (posix_memalign(&p, 4096, in.buf_size) != 0) {
+            result = MOBI_ERR_NOMEM;
+            break;
+        }
+        in.slots[i].buf = (uint8_t *)p;
+    }
+    in.bins = calloc(in.buf_size / MOBI_PUBKEY_LEN, sizeof(mobi_bin_t));
+    if (in.bins == NULL) {
+        result = MOBI_ERR_NOMEM;
+    }
+
+    if (result == MOBI_OK) {
+#if HAVE_URING
+        if (use_uring) {
+            result = run_uring(&in, &ring);
+            if (result != MOBI_OK && ring.refused && !ring.stranded) {
+                /* The kernel has a ring but not these reads; nothing was delivered yet */
+                in.next = in.start;
+                result = run_pread(&in);
+            }
+        } else
+#endif
+        {
+            result = run_pread(&in);
+        }
+    }
+
+#if HAVE_URING
+    if (use_uring) {
+        uring_free(&ring);
+    }
+#endif
+    for (i = 0; i < in.depth; i++) {
+        free(in.slots[i].buf);
+    }
+    free(in.bins);
+    close(in.fd);
+    return result;
+}
@@ -0,0 +1,215 @@
+/*
+ * Mobi Protocol v21.0.0 - Internal Interfaces
+ *
+ * Shared between the library translation units. Not installed, not part
+ * of the public API: everything here may change without notice.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#ifndef MOBI_INTERNAL_H
+#define MOBI_INTERNAL_H
+
+#include "mobi.h"
+#include <stdio.h>
+
+/* ============================================================================
+ * PLATFORM
+ * ============================================================================ */
+
+/*
+ * x86 kernels are compiled with per-function target attributes, so the
+ * library itself is still built with the baseline CFLAGS and only takes
+ * the accelerated paths after CPUID says they are safe.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define MOBI_X86 1
+#else
+#define MOBI_X86 0
+#endif
+
+/* ============================================================================
+ * SHA-256 (mobi.c)
+ * ============================================================================ */
+
+/* FIPS 180-4 round constants and initial hash value */
+extern const uint32_t mobi_sha256_k[64];
+extern const uint32_t mobi_sha256_iv[8];
+
+/*
+ * Maximum rejection sampling rounds before giving up.
+ * Probability of reaching this: (1 - 0.212)^256 ≈ 10^-25
+ */
+#define MOBI_MAX_ROUNDS 256
+
+/*
+ * mobi_accept_digest: Rejection test plus output for one round
+ *
+ * @param digest  First 3 big-endian words of a round's SHA-256 digest
+ *                (the 9-byte prefix is words 0-1 and the top of word 2)
+ * @param out     Filled with every form if the round is accepted
+ * @return        1 if value < 10^21 (accepted), 0 if the round is rejected
+ */
+int mobi_accept_digest(const uint32_t digest[3], mobi_t *out);
+
+/* mobi_accept_digest producing the binary form only */
+int mobi_accept_bin(const uint32_t digest[3], mobi_bin_t *out);
+
+/*
+ * Multi-buffer one-block SHA-256. Each lane hashes its own 64-byte block,
+ * already padded and decoded into big-endian words.
+ *
+ *   w    16 x lanes words, word-major: w[i * lanes + lane] is W[i]
+ *   out  3 x lanes words, word-major: the first 12 digest bytes per lane,
+ *        which is all the 9-byte rejection prefix needs
+ *
+ * mobi_sha256_x8 / mobi_sha256_x16 are NULL unless dispatch found a kernel
+ * of that width.
+ */
+typedef void (*mobi_sha256_lanes_fn)(const uint32_t *w, uint32_t *out);
+
+extern mobi_sha256_lanes_fn mobi_sha256_x8;
+extern mobi_sha256_lanes_fn mobi_sha256_x16;
+
+/*
+ * mobi_hex_decode32: Decode and validate exactly 64 hex characters
+ *
+ * Reads all 64 bytes at hex (no terminator needed). Upper and lower case
+ * are accepted. out is left unspecified on failure.
+ *
+ * @return  0 on success, -1 if any character is not a hex digit
+ */
+int mobi_hex_decode32(const char *hex, uint8_t out[32]);
+
+/* ============================================================================
+ * DIRECTORY (mobi_dir.c)
+ * ============================================================================ */
+
+/* Entries per block of the directory search layer */
+#define MOBI_DIR_BLOCK 16
+
+/* Search layer nodes for a directory of count entries (one per block) */
+size_t mobi_dir_index_count(size_t count);
+
+/* The shortest level (12/15/18/21) at which two sorted neighbours differ */
+uint8_t mobi_split_level(const mobi_entry_t *a, const mobi_entry_t *b);
+
+/* ============================================================================
+ * SORTED SEARCH (mobi_search.c)
+ * ============================================================================ */
+
+/* Interpolation lower bound at any size; MOBI_SEARCH_INTERPOLATE bisects small arrays */
+size_t mobi_interp_lower_bound(const mobi_bin_t *a, size_t count, const mobi_bin_t *m);
+
+/* ============================================================================
+ * FILE REPLACEMENT (mobi_file.c)
+ * ============================================================================ */
+
+/*
+ * How every file writer replaces path atomically. Directory, filter,
+ * perfect hash and corpus files are served through MAP_SHARED mappings,
+ * so rewriting one in place would change (or, once truncated, SIGBUS)
+ * pages under its readers. The new file is written beside path under a
+ * unique mkstemp name, path.XXXXXX, and renamed over it once complete and
+ * synced: readers of the old file keep their mapping of the old inode,
+ * anyone opening path sees either the old file or the whole new one, and
+ * concurrent writers of one path never share a temporary file (the last
+ * rename wins). It keeps the permissions of the file it replaces.
+ *
+ * Write through file; then either commit or abort, which also close it.
+ */
+typedef struct {
+    FILE *file;
+    char *path;
+    char *tmp;
+} mobi_replace_t;
+
+/* mobi_replace_open: Create path.XXXXXX; MOBI_OK, MOBI_ERR_NOMEM or MOBI_ERR_IO */
+mobi_error_t mobi_replace_open(mobi_replace_t *r, const char *path);
+
+/*
+ * mobi_replace_commit: Flush, fsync and close the file, rename it over path
+ * and fsync the directory. On failure path is left as it was and the
+ * temporary file is removed.
+ *
+ * @return  MOBI_OK or MOBI_ERR_IO
+ */
+mobi_error_t mobi_replace_commit(mobi_replace_t *r);
+
+/* mobi_replace_abort: Close and remove the temporary file, leaving path as it was */
+void mobi_replace_abort(mobi_replace_t *r);
+
+/* ============================================================================
+ * CPU DISPATCH (mobi_x86.c)
+ * ============================================================================ */
+
+/*
+ * mobi_cpu_detect: Query CPUID (and XGETBV where needed) once
+ *
+ * @return  Bitmask of mobi_cpu_t features usable on this host
+ */
+unsigned mobi_cpu_detect(void);
+
+/* ============================================================================
+ * THREAD POOL (mobi_pool.c)
+ * ============================================================================ */
+
+/*
+ * One unit of parallel work: process items [begin, end). worker is the
+ * index of the calling worker (0 is the thread that called
+ * mobi_parallel_for), for callers that keep per-worker scratch.
+ * A nonzero return is reported back as the result of the whole run.
+ */
+typedef int (*mobi_task_fn)(void *ctx, size_t begin, size_t end, int worker);
+
+/*
+ * mobi_pool_threads: Resolve a requested thread count
+ *
+ * @param requested  Thread count, or <= 0 for one per online CPU
+ * @return           Effective number of workers (at least 1)
+ */
+int mobi_pool_threads(int requested);
+
+/*
+ * mobi_parallel_for: Run fn over [0, count) in chunks on a work-stealing pool
+ *
+ * Blocks until every item is done. The calling thread takes part as
+ * worker 0. fn never sees more than chunk items at once, so it may keep
+ * chunk-sized scratch on its stack.
+ *
+ * @param count    Number of work items
+ * @param chunk    Items per chunk handed to fn (the unit of stealing)
+ * @param threads  Worker count, or <= 0 for one per online CPU
+ * @param fn       Work function; must be safe to call concurrently
+ * @param ctx      Passed through to fn
+ * @return         0, or the first nonzero value returned by fn
+ */
+int mobi_parallel_for(size_t count, size_t chunk, int threads,
+                      mobi_task_fn fn, void *ctx);
+
+#if MOBI_X86
+/*
+ * One-block SHA-256 from the IV using the SHA extensions. block is the
+ * padded message as 16 big-endian words; out gets digest words 0-2.
+ */
+void mobi_sha256_block_shani(const uint32_t *block, uint32_t out[3]);
+
+/*
+ * Same as mobi_sha256_block_shani, but starting from mid, the working
+ * state after rounds 0-7 of this block, and running only rounds 8-63.
+ */
+void mobi_sha256_resume_shani(const uint32_t mid[8], const uint32_t *block, uint32_t out[3]);
+
+/* 8 lanes of one-block SHA-256 in AVX2 registers (mobi_sha256_lanes_fn) */
+void mobi_sha256_x8_avx2(const uint32_t *w, uint32_t *out);
+
+/* 16 lanes of one-block SHA-256 in AVX-512 registers (mobi_sha256_lanes_fn) */
+void mobi_sha256_x16_avx512(const uint32_t *w, uint32_t *out);
+
+/* mobi_hex_decode32 with 16- and 32-byte vectors */
+int mobi_hex_decode32_sse41(const char *hex, uint8_t out[32]);
+int mobi_hex_decode32_avx2(const char *hex, uint8_t out[32]);
+#endif
+
+#endif /* MOBI_INTERNAL_H */
@@ -0,0 +1,826 @@
+/*
+ * Mobi Protocol v21.0.0 - Perfect Hash
+ *
+ * A minimal perfect hash over a static set of full mobis, in the style of
+ * PTHash (Pibiri & Trani, 2021): every key hashes to a bucket, and each
+ * bucket stores a small "pilot" chosen at build time so that
+ *
+ *   slot = fastrange(mix(hash2(key) + mix(pilot)), table size)
+ *
+ * sends its keys to slots nobody else took. Buckets are placed largest
+ * first, while the table is still empty. Keys are skewed so that 60% of
+ * them land in 30% of the buckets, which keeps most pilots small.
+ *
+ * The table has about 1.6% more slots than keys, so the last buckets
+ * still find free slots quickly. Keys that land past the end are sent to
+ * the holes below it through a small remap array, which makes the
+ * function minimal: n keys, slots 0..n-1.
+ *
+ * Keys are split by hash into independent partitions of ~2^14 keys, each
+ * with its own table, buckets and remap entries, and its pilots stored at
+ * the bit width of its largest one: about 3 bits per key in all.
+ * Partitions are built in parallel.
+ *
+ * Slots are verified: the serialized form stores each slot's packed mobi
+ * and the index it had in the build input, so a lookup of a non-member
+ * is rejected rather than answered with someone else's record.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+
+#include "mobi_internal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Keys per partition, on average */
+#define PART_KEYS 16384
+
+/* Buckets per partition: 3.5 * n / log2(n), i.e. BUCKET_C / 2 */
+#define BUCKET_C 7
+
+/* One extra slot per this many keys */
+#define SLACK 64
+
+/* 60% of the keys go to the first 30% of the buckets */
+#define DENSE_SHARE 0x99999999ULL      /* 0.6 * 2^32 */
+
+/* A pilot search that runs this long starts over with a new seed */
+#define MAX_PILOT (1u << 20)
+
+/* Seeds tried before giving up */
+#define MAX_ATTEMPTS 16
+
+/* Items per chunk of the parallel passes; packing chunks own whole bytes */
+#define PACK_CHUNK 65536
+#define KEY_CHUNK 65536
+
+/*
+ * Per partition: first slot, bucket and remap entry, and where its pilots
+ * start (low 56 bits, a byte offset) with their width (top 8 bits)
+ */
+#define PART_RECORD 32
+#define PILOT_OFFSET ((1ULL << 56) - 1)
+
+/* Why a parallel pass stopped (task return values) */
+#define FAIL_RANGE     1
+#define FAIL_SEED      2
+#define FAIL_DUPLICATE 3
+#define FAIL_NOMEM     4
+
+static void put_le(uint8_t *p, uint64_t v, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        p[i] = (uint8_t)(v >> (i * 8));
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int n) {
+    uint64_t v = 0;
+    while (n-- > 0) {
+        v = (v << 8) | p[n];
+    }
+    return v;
+}
+
+/* Eight little-endian bytes; compilers turn this into one load */
+static uint64_t load64(const uint8_t *p) {
+    return (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+           (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+           (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+}
+
+/* ============================================================================
+ * HASHING AND LAYOUT
+ * ============================================================================ */
+
+static uint64_t mix(uint64_t x, uint64_t seed) {
+    uint64_t h = x + seed;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/*
+ * Two hashes of a mobi: h[0] picks the partition and bucket, h[1] the
+ * slot. Distinct mobis agreeing on both is a ~2^-128 event.
+ */
+static void key_hash(const mobi_bin_t *m, uint64_t seed, uint64_t h[2]) {
+    h[0] = mix(m->hi, mix(m->lo, seed));
+    h[1] = mix(m->lo, mix(m->hi, ~seed));
+}
+
+/* Partition of a bucket hash; *u is the hash's uniform position inside it */
+static uint32_t part_of(uint64_t h0, uint32_t partitions, uint32_t *u) {
+    uint64_t x = (h0 >> 32) * partitions;
+
+    *u = (uint32_t)x;
+    return (uint32_t)(x >> 32);
+}
+
+/* Skewed and monotone in u, so keys sorted by hash are grouped by bucket */
+static uint64_t bucket_of(uint32_t u, uint64_t buckets) {
+    uint64_t dense = buckets * 3 / 10;
+
+    if (u < DENSE_SHARE) {
+        return (uint64_t)u * dense / DENSE_SHARE;
+    }
+    return dense + (uint64_t)(u - DENSE_SHARE) * (buckets - dense) /
+                   ((1ULL << 32) - DENSE_SHARE);
+}
+
+/*
+ * Slot in a table of size slots (below 2^32). Mixed again after the pilot
+ * is applied: with a plain h1 ^ mix(pilot), two keys whose hashes are
+ * close would stay close, and collide, under every pilot.
+ */
+static uint64_t slot_of(uint64_t h1, uint32_t pilot, uint64_t seed, uint64_t slots) {
+    return ((mix(h1, mix(pilot, seed)) >> 32) * slots) >> 32;
+}
+
+static int bit_width(uint64_t v) {
+    int bits = 1;
+
+    while (bits < 64 && (v >> bits) != 0) {
+        bits++;
+    }
+    return bits;
+}
+
+static uint64_t part_buckets(uint64_t keys) {
+    uint64_t log2 = (uint64_t)bit_width(keys);
+
+    return keys == 0 ? 0 : (BUCKET_C * keys + 2 * log2 - 1) / (2 * log2);
+}
+
+/* Fixed-width fields, LSB first; widths up to 32 bits */
+static uint64_t bits_get(const uint8_t *base, uint64_t index, int width) {
+    uint64_t pos = index * (uint64_t)width;
+
+    return (load64(base + pos / 8) >> (pos % 8)) & ((1ULL << width) - 1);
+}
+
+static void bits_put(uint8_t *base, uint64_t index, int width, uint64_t v) {
+    uint64_t pos = index * (uint64_t)width;
+    uint8_t *p = base + pos / 8;
+    int shift = (int)(pos % 8), i;
+
+    v <<= shift;
+    for (i = 0; i < (shift + width + 7) / 8; i++) {
+        p[i] |= (uint8_t)(v >> (8 * i));
+    }
+}
+
+/* Bytes for count fields of width bits, plus a word so loads never overrun */
+static size_t bits_bytes(uint64_t count, int width) {
+    return (size_t)((count * (uint64_t)width + 63) / 64 + 1) * 8;
+}
+
+/* Offsets of the sections after the header, from its fields */
+static void section_offsets(const mobi_mphf_t *f, size_t off[5], size_t *total) {
+    off[0] = MOBI_MPHF_HEADER_LEN;
+    off[1] = off[0] + ((size_t)f->partitions + 1) * PART_RECORD;
+    off[2] = off[1] + (size_t)(f->pilot_bytes + 7) / 8 * 8 + 8;
+    off[3] = off[2] + bits_bytes(f->remaps, f->remap_bits);
+    off[4] = off[3] + ((size_t)f->count * 9 + 7) / 8 * 8;
+    *total = off[4] + (size_t)f->count * 4;
+}
+
+static uint64_t part_field(const mobi_mphf_t *f, uint32_t part, int field) {
+    return load64(f->parts + (size_t)part * PART_RECORD + (size_t)field * 8);
+}
+
+/* The slot of m, or count if its partition is empty */
+static uint64_t mphf_slot(const mobi_mphf_t *f, const mobi_bin_t *m) {
+    uint64_t h[2], first, keys, buckets, slots, pilots, pilot, slot;
+    uint32_t u, part;
+
+    if (f->count == 0) {
+        return 0;
+    }
+    key_hash(m, f->seed, h);
+    part = part_of(h[0], f->partitions, &u);
+    first = part_field(f, part, 0);
+    keys = part_field(f, part + 1, 0) - first;
+    if (keys == 0) {
+        return f->count;
+    }
+    buckets = part_field(f, part + 1, 1) - part_field(f, part, 1);
+    slots = keys + part_field(f, part + 1, 2) - part_field(f, part, 2);
+    pilots = part_field(f, part, 3);
+
+    pilot = bits_get(f->pilots + (pilots & PILOT_OFFSET), bucket_of(u, buckets),
+                     (int)(pilots >> 56));
+    slot = slot_of(h[1], (uint32_t)pilot, f->seed, slots);
+    if (slot >= keys) {
+        slot = bits_get(f->remap, part_field(f, part, 2) + slot - keys, f->remap_bits);
+        if (slot >= keys) {
+            return f->count;    /* only in a damaged file */
+        }
+    }
+    return first + slot;
+}
+
+/* ============================================================================
+ * CONSTRUCTION
+ * ============================================================================ */
+
+typedef struct {
+    const mobi_bin_t *mobis;
+    size_t count;
+    uint64_t seed;
+    uint32_t partitions;
+    mobi_entry_t *entries;      /* top 40 bits of h[0] and input index, sorted */
+    uint64_t *key_first;        /* per partition, + 1 */
+    uint64_t *bucket_first;
+    uint64_t *remap_first;
+    uint64_t *pilot_first;      /* byte offset and width, as serialized */
+    uint32_t *pilots;           /* one per bucket, unpacked */
+    uint32_t *remap;            /* one per remap entry, unpacked */
+    mobi_mphf_t *f;             /* packing and fill passes: the finished function */
+} mphf_job;
+
+static int hash_task(void *ctx, size_t begin, size_t end, int worker) {
+    mphf_job *job = (mphf_job *)ctx;
+    uint64_t h[2];
+    size_t i;
+
+    (void)worker;
+    for (i = begin; i < end; i++) {
+        const mobi_bin_t *m = &job->mobis[i];
+
+        if (m->hi >= 1000000000000ULL || m->lo >= 1000000000u) {
+            return FAIL_RANGE;
+        }
+        key_hash(m, job->seed, h);
+        job->entries[i].hi = h[0] >> 24;
+        job->entries[i].lo = 0;
+        job->entries[i].id = (uint32_t)i;
+    }
+    return 0;
+}
+
+static uint32_t entry_part(const mphf_job *job, size_t i) {
+    uint32_t u;
+
+    return part_of(job->entries[i].hi << 24, job->partitions, &u);
+}
+
+/* Where each partition starts among the sorted entries */
+static int bounds_task(void *ctx, size_t begin, size_t end, int worker) {
+    mphf_job *job = (mphf_job *)ctx;
+    size_t i;
+
+    (void)worker;
+    for (i = begin; i < end; i++) {
+        uint32_t p = entry_part(job, i), q = i == 0 ? 0 : entry_part(job, i - 1) + 1;
+
+        for (; q <= p; q++) {
+            job->key_first[q] = i;
+        }
+        if (i == job->count - 1) {
+            for (q = p + 1; q <= job->partitions; q++) {
+                job->key_first[q] = job->count;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Pilots for one partition, buckets largest first */
+static int place_partition(mphf_job *job, uint32_t part) {
+    uint64_t first = job->key_first[part], keys = job->key_first[part + 1] - first;
+    uint64_t buckets = job->bucket_first[part + 1] - job->bucket_first[part];
+    uint64_t slots = keys + job->remap_first[part + 1] - job->remap_first[part];
+    uint64_t *h1, *taken, *pos;
+    uint32_t *start, *order, *by_size;
+    size_t b, i, j, largest = 0;
+    uint64_t hole, end;
+    int err = 0;
+
+    if (keys == 0) {
+        return 0;
+    }
+    h1 = malloc(keys * sizeof(uint64_t));
+    start = calloc(buckets + 1, sizeof(uint32_t));
+    order = malloc(buckets * sizeof(uint32_t));
+    taken = calloc((slots + 63) / 64, sizeof(uint64_t));
+    pos = malloc(keys * sizeof(uint64_t));
+    by_size = NULL;
+    if (h1 == NULL || start == NULL || order == NULL || taken == NULL || pos == NULL) {
+        err = FAIL_NOMEM;
+        goto done;
+    }
+
+    /* Slot hashes and bucket boundaries, in sorted (bucket) order */
+    for (i = 0; i < keys; i++) {
+        const mobi_entry_t *e = &job->entries[first + i];
+        uint64_t h[2];
+        uint32_t u;
+
+        key_hash(&job->mobis[e->id], job->seed, h);
+        h1[i] = h[1];
+        part_of(h[0], job->partitions, &u);
+        start[bucket_of(u, buckets) + 1]++;
+    }
+    for (b = 0; b < buckets; b++) {
+        size_t size = start[b + 1];
+
+        start[b + 1] += start[b];
+        largest = size > largest ? size : largest;
+    }
+
+    /* Buckets by decreasing size (counting sort) */
+    by_size = calloc(largest + 2, sizeof(uint32_t));
+    if (by_size == NULL) {
+        err = FAIL_NOMEM;
+        goto done;
+    }
+    for (b = 0; b < buckets; b++) {
+        by_size[largest - (start[b + 1] - start[b]) + 1]++;
+    }
+    for (i = 0; i <= largest; i++) {
+        by_size[i + 1] += by_size[i];
+    }
+    for (b = 0; b < buckets; b++) {
+        order[by_size[largest - (start[b + 1] - start[b])]++] = (uint32_t)b;
+    }
+
+    for (b = 0; b < buckets && err == 0; b++) {
+        uint32_t k = order[b], pilot;
+        size_t lo = start[k], hi = start[k + 1];
+
+        if (lo == hi) {
+            break;      /* only empty buckets left */
+        }
+        /* The same slot hash twice in a bucket: a repeated mobi, or a new seed */
+        for (i = lo; i < hi && err == 0; i++) {
+            for (j = lo; j < i; j++) {
+                if (h1[i] == h1[j]) {
+                    const mobi_bin_t *x = &job->mobis[job->entries[first + i].id];
+                    const mobi_bin_t *y = &job->mobis[job->entries[first + j].id];
+
+                    err = x->hi == y->hi && x->lo == y->lo ? FAIL_DUPLICATE : FAIL_SEED;
+                    break;
+                }
+            }
+        }
+        for (pilot = 0; err == 0; pilot++) {
+            if (pilot == MAX_PILOT) {
+                err = FAIL_SEED;
+                break;
+            }
+            for (i = lo; i < hi; i++) {
+                uint64_t s = slot_of(h1[i], pilot, job->seed, slots);
+
+                if (taken[s / 64] >> (s % 64) & 1) {
+                    break;
+                }
+                taken[s / 64] |= 1ULL << (s % 64);
+                pos[i] = s;
+            }
+            if (i == hi) {
+                job->pilots[job->bucket_first[part] + k] = pilot;
+                break;
+            }
+            for (j = lo; j < i; j++) {
+                taken[pos[j] / 64] &= ~(1ULL << (pos[j] % 64));
+            }
+        }
+    }
+
+    /* Slots past the end, in order, take the holes below it in order */
+    hole = 0;
+    for (end = keys; end < slots && err == 0; end++) {
+        uint32_t *r = &job->remap[job->remap_first[part] + end - keys];
+
+        *r = 0;
+        if (taken[end / 64] >> (end % 64) & 1) {
+            while (taken[hole / 64] >> (hole % 64) & 1) {
+                hole++;
+            }
+            *r = (uint32_t)hole++;
+        }
+    }
+
+done:
+    free(h1);
+    free(start);
+    free(order);
+    free(taken);
+    free(pos);
+    free(by_size);
+    return err;
+}
+
+static int place_task(void *ctx, size_t begin, size_t end, int worker) {
+    size_t p;
+
+    (void)worker;
+    for (p = begin; p < end; p++) {
+        int err = place_partition((mphf_job *)ctx, (uint32_t)p);
+
+        if (err != 0) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+/* Pilots of each partition at its own width; partitions start on a byte */
+static int pack_pilots_task(void *ctx, size_t begin, size_t end, int worker) {
+    mphf_job *job = (mphf_job *)ctx;
+    uint8_t *pilots = (uint8_t *)(uintptr_t)job->f->pilots;
+    size_t p, b;
+
+    (void)worker;
+    for (p = begin; p < end; p++) {
+        uint64_t at = job->pilot_first[p];
+        uint64_t first = job->bucket_first[p], buckets = job->bucket_first[p + 1] - first;
+
+        for (b = 0; b < buckets; b++) {
+            bits_put(pilots + (at & PILOT_OFFSET), b, (int)(at >> 56), job->pilots[first + b]);
+        }
+    }
+    return 0;
+}
+
+static int pack_remap_task(void *ctx, size_t begin, size_t end, int worker) {
+    mphf_job *job = (mphf_job *)ctx;
+    mobi_mphf_t *f = job->f;
+    size_t i;
+
+    (void)worker;
+    for (i = begin; i < end; i++) {
+        bits_put((uint8_t *)(uintptr_t)f->remap, i, f->remap_bits, job->remap[i]);
+    }
+    return 0;
+}
+
+/* Every key to its slot, with its input index */
+static int fill_task(void *ctx, size_t begin, size_t end, int worker) {
+    mphf_job *job = (mphf_job *)ctx;
+    mobi_mphf_t *f = job->f;
+    size_t i;
+
+    (void)worker;
+    for (i = begin; i < end; i++) {
+        uint64_t slot = mphf_slot(f, &job->mobis[i]);
+
+        mobi_bin_pack(&job->mobis[i], (uint8_t *)(uintptr_t)f->keys + slot * 9);
+        put_le((uint8_t *)(uintptr_t)f->ids + slot * 4, i, 4);
+    }
+    return 0;
+}
+
+static void job_free(mphf_job *job) {
+    free(job->entries);
+    free(job->key_first);
+    free(job->bucket_first);
+    free(job->remap_first);
+    free(job->pilot_first);
+    free(job->pilots);
+    free(job->remap);
+    job->entries = NULL;
+    job->key_first = job->bucket_first = job->remap_first = job->pilot_first = NULL;
+    job->pilots = job->remap = NULL;
+}
+
+/* Hash, group by partition and place every partition at job->seed */
+static int build_attempt(mphf_job *job, int threads) {
+    uint32_t p;
+    int err;
+
+    job->entries = malloc(job->count * sizeof(mobi_entry_t));
+    job->key_first = malloc(((size_t)job->partitions + 1) * sizeof(uint64_t));
+    job->bucket_first = malloc(((size_t)job->partitions + 1) * sizeof(uint64_t));
+    job->remap_first = malloc(((size_t)job->partitions + 1) * sizeof(uint64_t));
+    job->pilot_first = malloc(((size_t)job->partitions + 1) * sizeof(uint64_t));
+    if (job->entries == NULL || job->key_first == NULL || job->bucket_first == NULL ||
+        job->remap_first == NULL || job->pilot_first == NULL) {
+        return FAIL_NOMEM;
+    }
+    err = mobi_parallel_for(job->count, KEY_CHUNK, threads, hash_task, job);
+    if (err != 0) {
+        return err;
+    }
+    if (mobi_sort_entries(job->entries, NULL, job->count, threads) != MOBI_OK) {
+        return FAIL_NOMEM;
+    }
+    mobi_parallel_for(job->count, KEY_CHUNK, threads, bounds_task, job);
+
+    job->bucket_first[0] = 0;
+    job->remap_first[0] = 0;
+    for (p = 0; p < job->partitions; p++) {
+        uint64_t keys = job->key_first[p + 1] - job->key_first[p];
+
+        job->bucket_first[p + 1] = job->bucket_first[p] + part_buckets(keys);
+        job->remap_first[p + 1] = job->remap_first[p] + keys / SLACK;
+    }
+    job->pilots = calloc(job->bucket_first[job->partitions] + 1, sizeof(uint32_t));
+    job->remap = calloc(job->remap_first[job->partitions] + 1, sizeof(uint32_t));
+    if (job->pilots == NULL || job->remap == NULL) {
+        return FAIL_NOMEM;
+    }
+    return mobi_parallel_for(job->partitions, 1, threads, place_task, job);
+}
+
+mobi_error_t mobi_mphf_build(mobi_mphf_t *f, const mobi_bin_t *mobis, size_t count,
+                             int threads) {
+    mphf_job job;
+    uint64_t largest, largest_keys = 0, seed = 0x6870686d69626f6dULL;
+    size_t off[5], total, i;
+    uint32_t p;
+    uint8_t *data;
+    int attempt, err = FAIL_SEED;
+
+    if (f == NULL || (mobis == NULL && count > 0)) {
+        return MOBI_ERR_NULL;
+    }
+    memset(f, 0, sizeof(*f));
+    if ((uint64_t)count > UINT32_MAX) {
+        return MOBI_ERR_INVALID_LEN;    /* input indices are 32-bit */
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.mobis = mobis;
+    job.count = count;
+    job.partitions = (uint32_t)((count + PART_KEYS - 1) / PART_KEYS);
+    if (job.partitions == 0) {
+        job.partitions = 1;
+    }
+    for (attempt = 0; count > 0 && attempt < MAX_ATTEMPTS && err == FAIL_SEED; attempt++) {
+        seed = mix(seed, 0x9e3779b97f4a7c15ULL);
+        job.seed = seed;
+        err = build_attempt(&job, threads);
+        if (err != 0) {
+            job_free(&job);
+        }
+    }
+    if (count == 0) {
+        job.key_first = calloc(2, sizeof(uint64_t));
+        job.bucket_first = calloc(2, sizeof(uint64_t));
+        job.remap_first = calloc(2, sizeof(uint64_t));
+        job.pilot_first = calloc(2, sizeof(uint64_t));
+        err = job.key_first == NULL || job.bucket_first == NULL || job.remap_first == NULL ||
+              job.pilot_first == NULL ? FAIL_NOMEM : 0;
+    }
+    if (err != 0) {
+        job_free(&job);
+        return err == FAIL_RANGE ? MOBI_ERR_RANGE : err == FAIL_DUPLICATE ? MOBI_ERR_EXISTS :
+               err == FAIL_NOMEM ? MOBI_ERR_NOMEM : MOBI_ERR_INVALID_LEN;
+    }
+    free(job.entries);
+    job.entries = NULL;
+
+    f->count = count;
+    f->seed = job.seed;
+    f->partitions = job.partitions;
+    f->buckets = job.bucket_first[job.partitions];
+    f->remaps = job.remap_first[job.partitions];
+
+    /* Each partition's pilots at the width of its largest one */
+    for (p = 0; p < job.partitions; p++) {
+        uint64_t first = job.bucket_first[p], buckets = job.bucket_first[p + 1] - first;
+        uint64_t keys = job.key_first[p + 1] - job.key_first[p];
+        int width;
+
+        for (i = 0, largest = 0; i < buckets; i++) {
+            largest = job.pilots[first + i] > largest ? job.pilots[first + i] : largest;
+        }
+        width = bit_width(largest);
+        job.pilot_first[p] = f->pilot_bytes | (uint64_t)width << 56;
+        f->pilot_bytes += (buckets * (uint64_t)width + 7) / 8;
+        largest_keys = keys > largest_keys ? keys : largest_keys;
+    }
+    job.pilot_first[job.partitions] = f->pilot_bytes;
+    f->remap_bits = (uint8_t)bit_width(largest_keys);
+
+    section_offsets(f, off, &total);
+    data = calloc(1, total);
+    if (data == NULL) {
+        job_free(&job);
+        memset(f, 0, sizeof(*f));
+        return MOBI_ERR_NOMEM;
+    }
+    memcpy(data, MOBI_MPHF_MAGIC, 8);
+    put_le(data + 8, MOBI_MPHF_VERSION, 4);
+    put_le(data + 12, f->partitions, 4);
+    put_le(data + 16, f->count, 8);
+    put_le(data + 24, f->seed, 8);
+    put_le(data + 32, f->buckets, 8);
+    put_le(data + 40, f->remaps, 8);
+    put_le(data + 48, f->pilot_bytes, 8);
+    data[56] = f->remap_bits;
+    for (i = 0; i <= job.partitions; i++) {
+        uint8_t *rec = data + off[0] + i * PART_RECORD;
+
+        put_le(rec, job.key_first[i], 8);
+        put_le(rec + 8, job.bucket_first[i], 8);
+        put_le(rec + 16, job.remap_first[i], 8);
+        put_le(rec + 24, job.pilot_first[i], 8);
+    }
+    f->parts = data + off[0];
+    f->pilots = data + off[1];
+    f->remap = data + off[2];
+    f->keys = data + off[3];
+    f->ids = data + off[4];
+    f->data = data;
+    f->data_len = total;
+    f->owned = 1;
+
+    job.f = f;
+    mobi_parallel_for(job.partitions, 16, threads, pack_pilots_task, &job);
+    mobi_parallel_for(f->remaps, PACK_CHUNK, threads, pack_remap_task, &job);
+    mobi_parallel_for(count, KEY_CHUNK, threads, fill_task, &job);
+    job_free(&job);
+    return MOBI_OK;
+}
+
+/* ============================================================================
+ * QUERIES AND SERIALIZED FORM
+ * ============================================================================ */
+
+uint64_t mobi_mphf_slot(const mobi_mphf_t *f, const mobi_bin_t *m) {
+    if (f == NULL || m == NULL || f->count == 0) {
+        return 0;
+    }
+    return mphf_slot(f, m);
+}
+
+mobi_error_t mobi_mphf_lookup(const mobi_mphf_t *f, const mobi_bin_t *m, uint64_t *slot,
+                              uint32_t *id) {
+    uint8_t packed[9];
+    uint64_t s;
+
+    if (f == NULL || m == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (m->hi >= 1000000000000ULL || m->lo >= 1000000000u) {
+        return MOBI_ERR_RANGE;
+    }
+    if (f->count == 0) {
+        return MOBI_ERR_NOT_FOUND;
+    }
+    s = mphf_slot(f, m);
+    if (s == f->count) {
+        return MOBI_ERR_NOT_FOUND;
+    }
+    mobi_bin_pack(m, packed);
+    if (memcmp(f->keys + s * 9, packed, 9) != 0) {
+        return MOBI_ERR_NOT_FOUND;
+    }
+    if (slot != NULL) {
+        *slot = s;
+    }
+    if (id != NULL) {
+        *id = (uint32_t)get_le(f->ids + s * 4, 4);
+    }
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_mphf_view(mobi_mphf_t *f, const uint8_t *data, size_t len) {
+    size_t off[5], total;
+    uint32_t p;
+
+    if (f == NULL || data == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    memset(f, 0, sizeof(*f));
+    if (len < MOBI_MPHF_HEADER_LEN || memcmp(data, MOBI_MPHF_MAGIC, 8) != 0 ||
+        get_le(data + 8, 4) != MOBI_MPHF_VERSION) {
+        return MOBI_ERR_FORMAT;
+    }
+    f->partitions = (uint32_t)get_le(data + 12, 4);
+    f->count = get_le(data + 16, 8);
+    f->seed = get_le(data + 24, 8);
+    f->buckets = get_le(data + 32, 8);
+    f->remaps = get_le(data + 40, 8);
+    f->pilot_bytes = get_le(data + 48, 8);
+    f->remap_bits = data[56];
+    if (f->partitions == 0 || f->count > UINT32_MAX || f->buckets > len ||
+        f->remaps > f->count || f->pilot_bytes > len || f->remap_bits < 1 ||
+        f->remap_bits > 32 || (uint64_t)f->partitions > len / PART_RECORD) {
+        memset(f, 0, sizeof(*f));
+        return MOBI_ERR_FORMAT;
+    }
+    section_offsets(f, off, &total);
+    if (len < total) {
+        memset(f, 0, sizeof(*f));
+        return MOBI_ERR_FORMAT;
+    }
+
+    /* Partitions must be laid out as the builder would, or lookups read out of bounds */
+    f->parts = data + off[0];
+    for (p = 0; p < f->partitions; p++) {
+        uint64_t k = part_field(f, p, 0), b = part_field(f, p, 1), r = part_field(f, p, 2);
+        uint64_t keys = part_field(f, p + 1, 0) - k, buckets = part_field(f, p + 1, 1) - b;
+        uint64_t at = part_field(f, p, 3), width = at >> 56;
+
+        if ((p == 0 && (k | b | r | (at & PILOT_OFFSET)) != 0) ||
+            part_field(f, p + 1, 0) < k || part_field(f, p + 1, 1) < b ||
+            part_field(f, p + 1, 2) < r || buckets != part_buckets(keys) ||
+            part_field(f, p + 1, 2) - r != keys / SLACK || width < 1 || width > 32 ||
+            (part_field(f, p + 1, 3) & PILOT_OFFSET) !=
+                (at & PILOT_OFFSET) + (buckets * width + 7) / 8) {
+            memset(f, 0, sizeof(*f));
+            return MOBI_ERR_FORMAT;
+        }
+    }
+    if (part_field(f, f->partitions, 0) != f->count ||
+        part_field(f, f->partitions, 1) != f->buckets ||
+        part_field(f, f->partitions, 2) != f->remaps ||
+        part_field(f, f->partitions, 3) != f->pilot_bytes) {
+        memset(f, 0, sizeof(*f));
+        return MOBI_ERR_FORMAT;
+    }
+
+    f->pilots = data + off[1];
+    f->remap = data + off[2];
+    f->keys = data + off[3];
+    f->ids = data + off[4];
+    f->data = (void *)(uintptr_t)data;
+    f->data_len = total;
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_mphf_write(const mobi_mphf_t *f, const char *path) {
+    mobi_replace_t out;
+    mobi_error_t err;
+
+    if (f == NULL || path == NULL || f->data == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    /* Readers may have the old file mapped: build the new one beside it */
+    err = mobi_replace_open(&out, path);
+    if (err != MOBI_OK) {
+        return err;
+    }
+    if (fwrite(f->data, 1, f->data_len, out.file) != f->data_len) {
+        mobi_replace_abort(&out);
+        return MOBI_ERR_IO;
+    }
+    return mobi_replace_commit(&out);
+}
+
+mobi_error_t mobi_mphf_open(mobi_mphf_t *f, const char *path) {
+    struct stat st;
+    mobi_error_t err;
+    void *map;
+    int fd;
+
+    if (f == NULL || path == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    memset(f, 0, sizeof(*f));
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return MOBI_ERR_IO;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return MOBI_ERR_IO;
+    }
+    if ((uint64_t)st.st_size < MOBI_MPHF_HEADER_LEN || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return MOBI_ERR_FORMAT;
+    }
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  /* The mapping keeps the file alive */
+    if (map == MAP_FAILED) {
+        return MOBI_ERR_IO;
+    }
+
+    err = mobi_mphf_view(f, (const uint8_t *)map, (size_t)st.st_size);
+    if (err != MOBI_OK) {
+        munmap(map, (size_t)st.st_size);
+        return err;
+    }
+    posix_madvise(map, (size_t)st.st_size, POSIX_MADV_RANDOM);
+    f->map_len = (size_t)st.st_size;
+    return MOBI_OK;
+}
+
+void mobi_mphf_free(mobi_mphf_t *f) {
+    if (f == NULL) {
+        return;
+    }
+    if (f->owned) {
+        free(f->data);
+    } else if (f->map_len > 0) {
+        munmap(f->data, f->map_len);
+    }
+    memset(f, 0, sizeof(*f));
+}
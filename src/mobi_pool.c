@@ -0,0 +1,255 @@
+/*
+ * Mobi Protocol v21.0.0 - Work-Stealing Thread Pool
+ *
+ * Runs a range of independent work items across POSIX threads. The range
+ * is cut into chunks and every worker starts out owning an equal, contiguous
+ * share of them. A worker takes chunks from the front of its own share;
+ * once that is empty it steals the back half of the largest remaining share.
+ *
+ * Derivation cost per key varies (1 round for 21% of keys, a dozen for a
+ * few), so a static split leaves threads idle at the tail; stealing evens
+ * that out while keeping each worker on contiguous memory most of the time.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mobi_internal.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Upper bound on workers, whatever the caller or sysconf asks for */
+#define POOL_MAX_THREADS 1024
+
+typedef struct {
+    pthread_mutex_t lock;
+    size_t next;                /* first chunk not yet taken */
+    size_t end;                 /* one past the last chunk of this share */
+} pool_share;
+
+typedef struct {
+    mobi_task_fn fn;
+    void *ctx;
+    size_t count;               /* work items */
+    size_t chunk;               /* items per chunk */
+    int workers;
+    pool_share *shares;
+    pthread_mutex_t error_lock;
+    int error;                  /* first nonzero task result */
+} pool_t;
+
+typedef struct {
+    pool_t *pool;
+    int id;
+} pool_worker;
+
+/* Take the front chunk of a share; returns 0 if it is empty */
+static int share_pop(pool_share *s, size_t *chunk) {
+    int ok = 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->next < s->end) {
+        *chunk = s->next++;
+        ok = 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+/* Move the back half of the fullest other share into ours */
+static int pool_steal(pool_t *pool, int self) {
+    pool_share *mine = &pool->shares[self];
+    size_t best_left = 0;
+    int victim = -1;
+    int i;
+
+    for (i = 0; i < pool->workers; i++) {
+        pool_share *s = &pool->shares[i];
+        size_t left;
+
+        if (i == self) {
+            continue;
+        }
+        /* Only picks the victim; the share may shrink before we lock it */
+        pthread_mutex_lock(&s->lock);
+        left = s->end > s->next ? s->end - s->next : 0;
+        pthread_mutex_unlock(&s->lock);
+        if (left > best_left) {
+            best_left = left;
+            victim = i;
+        }
+    }
+    if (victim < 0) {
+        return 0;
+    }
+
+    {
+        pool_share *s = &pool->shares[victim];
+        size_t left, take, from = 0;
+
+        pthread_mutex_lock(&s->lock);
+        left = s->end > s->next ? s->end - s->next : 0;
+        take = (left + 1) / 2;
+        if (take > 0) {
+            s->end -= take;
+            from = s->end;
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        if (take == 0) {
+            return 1;   /* Raced with the owner; look again */
+        }
+
+        pthread_mutex_lock(&mine->lock);
+        mine->next = from;
+        mine->end = from + take;
+        pthread_mutex_unlock(&mine->lock);
+    }
+    return 1;
+}
+
+static void *pool_run(void *arg) {
+    pool_worker *w = (pool_worker *)arg;
+    pool_t *pool = w->pool;
+    size_t chunk;
+
+    for (;;) {
+        while (share_pop(&pool->shares[w->id], &chunk)) {
+            size_t begin = chunk * pool->chunk;
+            size_t end = begin + pool->chunk;
+            int err;
+
+            if (end > pool->count) {
+                end = pool->count;
+            }
+            err = pool->fn(pool->ctx, begin, end, w->id);
+            if (err != 0) {
+                pthread_mutex_lock(&pool->error_lock);
+                if (pool->error == 0) {
+                    pool->error = err;
+                }
+                pthread_mutex_unlock(&pool->error_lock);
+            }
+        }
+        if (!pool_steal(pool, w->id)) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Every chunk in order on the calling thread */
+static int run_inline(size_t count, size_t chunk, mobi_task_fn fn, void *ctx) {
+    size_t begin;
+    int result = 0;
+
+    for (begin = 0; begin < count; begin += chunk) {
+        size_t end = count - begin < chunk ? count : begin + chunk;
+        int err = fn(ctx, begin, end, 0);
+        if (err != 0 && result == 0) {
+            result = err;
+        }
+    }
+    return result;
+}
+
+int mobi_pool_threads(int requested) {
+    long n = requested;
+
+    if (n <= 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (n < 1) {
+        n = 1;
+    }
+    if (n > POOL_MAX_THREADS) {
+        n = POOL_MAX_THREADS;
+    }
+    return (int)n;
+}
+
+int mobi_parallel_for(size_t count, size_t chunk, int threads,
+                      mobi_task_fn fn, void *ctx) {
+    pool_t pool;
+    pool_worker *workers;
+    pthread_t *tids;
+    size_t chunks, per, extra, at;
+    int started = 0;
+    int i;
+
+    if (count == 0) {
+        return 0;
+    }
+    if (chunk == 0) {
+        chunk = 1;
+    }
+    chunks = (count + chunk - 1) / chunk;
+
+    threads = mobi_pool_threads(threads);
+    if ((size_t)threads > chunks) {
+        threads = (int)chunks;
+    }
+
+    /* One worker: no threads, no locks */
+    if (threads == 1) {
+        return run_inline(count, chunk, fn, ctx);
+    }
+
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pool.count = count;
+    pool.chunk = chunk;
+    pool.workers = threads;
+    pool.error = 0;
+    pool.shares = malloc((size_t)threads * sizeof(pool_share));
+    workers = malloc((size_t)threads * sizeof(pool_worker));
+    tids = malloc((size_t)threads * sizeof(pthread_t));
+    if (pool.shares == NULL || workers == NULL || tids == NULL) {
+        free(pool.shares);
+        free(workers);
+        free(tids);
+        return run_inline(count, chunk, fn, ctx);
+    }
+    pthread_mutex_init(&pool.error_lock, NULL);
+
+    /* Equal contiguous shares of chunks */
+    per = chunks / (size_t)threads;
+    extra = chunks % (size_t)threads;
+    at = 0;
+    for (i = 0; i < threads; i++) {
+        size_t n = per + ((size_t)i < extra ? 1 : 0);
+        pthread_mutex_init(&pool.shares[i].lock, NULL);
+        pool.shares[i].next = at;
+        pool.shares[i].end = at + n;
+        at += n;
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+
+    /*
+     * The caller is worker 0. If a thread fails to start its share is
+     * simply stolen by the others, so there is nothing to unwind.
+     */
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&tids[i], NULL, pool_run, &workers[i]) != 0) {
+            break;
+        }
+        started = i;
+    }
+    pool_run(&workers[0]);
+    for (i = 1; i <= started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    for (i = 0; i < threads; i++) {
+        pthread_mutex_destroy(&pool.shares[i].lock);
+    }
+    pthread_mutex_destroy(&pool.error_lock);
+    free(pool.shares);
+    free(workers);
+    free(tids);
+    return pool.error;
+}
@@ -0,0 +1,250 @@
+/*
+ * Mobi Protocol v21.0.0 - Registry
+ *
+ * A mutable user set kept in mobi order by a skip list. A user's display
+ * level depends only on its two neighbours in that order, so a
+ * registration or removal changes the level of at most the user itself
+ * and the users on either side. Those are recomputed in place; nothing
+ * else is touched.
+ *
+ * Node heights are geometric with p = 1/4, so a search visits about
+ * 1.33 * log2(n) nodes. The bottom level is doubly linked, which gives
+ * every node its predecessor for free.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#include "mobi_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Enough for 2^64 users at p = 1/4 */
+#define MAX_HEIGHT 32
+
+typedef struct reg_node {
+    mobi_entry_t e;
+    uint8_t level;
+    uint8_t height;
+    struct reg_node *prev;      /* bottom level; NULL for the first user */
+    struct reg_node *next[];    /* height forward links */
+} reg_node;
+
+/* Ordered by mobi, then by id */
+static int node_below(const reg_node *n, uint64_t hi, uint32_t lo, uint32_t id) {
+    if (n->e.hi != hi) {
+        return n->e.hi < hi;
+    }
+    if (n->e.lo != lo) {
+        return n->e.lo < lo;
+    }
+    return n->e.id < id;
+}
+
+static int random_height(mobi_registry_t *reg) {
+    uint64_t r;
+    int h = 1;
+
+    /* xorshift64 */
+    reg->rng ^= reg->rng << 13;
+    reg->rng ^= reg->rng >> 7;
+    reg->rng ^= reg->rng << 17;
+    for (r = reg->rng; (r & 3) == 0 && h < MAX_HEIGHT; r >>= 2) {
+        h++;
+    }
+    return h;
+}
+
+/*
+ * The last node below the key on every level, from the top down. Returns
+ * the first node not below it (the match, if the key is present).
+ */
+static reg_node *find(const mobi_registry_t *reg, const mobi_bin_t *m, uint32_t id,
+                      reg_node **update) {
+    reg_node *x = (reg_node *)reg->head;
+    int l;
+
+    for (l = reg->height - 1; l >= 0; l--) {
+        while (x->next[l] != NULL && node_below(x->next[l], m->hi, m->lo, id)) {
+            x = x->next[l];
+        }
+        if (update != NULL) {
+            update[l] = x;
+        }
+    }
+    return x->next[0];
+}
+
+static int is_match(const reg_node *n, const mobi_bin_t *m, uint32_t id) {
+    return n != NULL && n->e.hi == m->hi && n->e.lo == m->lo && n->e.id == id;
+}
+
+/* Recompute a user's level; records it in changes if it moved */
+static void relevel(reg_node *n, mobi_level_change_t *changes, size_t *changed) {
+    uint8_t level = MOBI_DISPLAY_LEN;
+
+    if (n->prev != NULL) {
+        level = mobi_split_level(&n->prev->e, &n->e);
+    }
+    if (n->next[0] != NULL) {
+        uint8_t next = mobi_split_level(&n->e, &n->next[0]->e);
+        level = next > level ? next : level;
+    }
+    if (level != n->level) {
+        n->level = level;
+        if (changes != NULL) {
+            changes[*changed].id = n->e.id;
+            changes[*changed].level = level;
+        }
+        (*changed)++;
+    }
+}
+
+mobi_error_t mobi_registry_init(mobi_registry_t *reg) {
+    reg_node *head;
+
+    if (reg == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    memset(reg, 0, sizeof(*reg));
+    head = calloc(1, sizeof(reg_node) + MAX_HEIGHT * sizeof(reg_node *));
+    if (head == NULL) {
+        return MOBI_ERR_NOMEM;
+    }
+    head->height = MAX_HEIGHT;
+    reg->head = head;
+    reg->height = 1;
+    reg->rng = 0x9e3779b97f4a7c15ULL;
+    return MOBI_OK;
+}
+
+void mobi_registry_free(mobi_registry_t *reg) {
+    reg_node *x;
+
+    if (reg == NULL || reg->head == NULL) {
+        return;
+    }
+    x = (reg_node *)reg->head;
+    while (x != NULL) {
+        reg_node *next = x->next[0];
+        free(x);
+        x = next;
+    }
+    memset(reg, 0, sizeof(*reg));
+}
+
+mobi_error_t mobi_registry_insert(mobi_registry_t *reg, const mobi_bin_t *m, uint32_t id,
+                                  mobi_level_change_t changes[3], size_t *changed) {
+    reg_node *update[MAX_HEIGHT];
+    reg_node *n, *head;
+    size_t moved = 0;
+    int height, l;
+
+    if (reg == NULL || reg->head == NULL || m == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (m->hi >= 1000000000000ULL || m->lo >= 1000000000u) {
+        return MOBI_ERR_RANGE;
+    }
+    if (is_match(find(reg, m, id, update), m, id)) {
+        return MOBI_ERR_EXISTS;
+    }
+
+    height = random_height(reg);
+    n = malloc(sizeof(reg_node) + (size_t)height * sizeof(reg_node *));
+    if (n == NULL) {
+        return MOBI_ERR_NOMEM;
+    }
+    head = (reg_node *)reg->head;
+    for (l = reg->height; l < height; l++) {
+        update[l] = head;
+    }
+    if (height > reg->height) {
+        reg->height = height;
+    }
+
+    n->e.hi = m->hi;
+    n->e.lo = m->lo;
+    n->e.id = id;
+    n->level = 0;               /* always reported as a change */
+    n->height = (uint8_t)height;
+    for (l = 0; l < height; l++) {
+        n->next[l] = update[l]->next[l];
+        update[l]->next[l] = n;
+    }
+    n->prev = update[0] == head ? NULL : update[0];
+    if (n->next[0] != NULL) {
+        n->next[0]->prev = n;
+    }
+    reg->count++;
+
+    relevel(n, changes, &moved);
+    if (n->prev != NULL) {
+        relevel(n->prev, changes, &moved);
+    }
+    if (n->next[0] != NULL) {
+        relevel(n->next[0], changes, &moved);
+    }
+    if (changed != NULL) {
+        *changed = moved;
+    }
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_registry_remove(mobi_registry_t *reg, const mobi_bin_t *m, uint32_t id,
+                                  mobi_level_change_t changes[2], size_t *changed) {
+    reg_node *update[MAX_HEIGHT];
+    reg_node *n, *prev, *next, *head;
+    size_t moved = 0;
+    int l;
+
+    if (reg == NULL || reg->head == NULL || m == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    n = find(reg, m, id, update);
+    if (!is_match(n, m, id)) {
+        return MOBI_ERR_NOT_FOUND;
+    }
+
+    for (l = 0; l < n->height; l++) {
+        update[l]->next[l] = n->next[l];
+    }
+    prev = n->prev;
+    next = n->next[0];
+    if (next != NULL) {
+        next->prev = prev;
+    }
+    free(n);
+    reg->count--;
+
+    head = (reg_node *)reg->head;
+    while (reg->height > 1 && head->next[reg->height - 1] == NULL) {
+        reg->height--;
+    }
+
+    if (prev != NULL) {
+        relevel(prev, changes, &moved);
+    }
+    if (next != NULL) {
+        relevel(next, changes, &moved);
+    }
+    if (changed != NULL) {
+        *changed = moved;
+    }
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_registry_level(const mobi_registry_t *reg, const mobi_bin_t *m,
+                                 uint32_t id, uint8_t *level) {
+    const reg_node *n;
+
+    if (reg == NULL || reg->head == NULL || m == NULL || level == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    n = find(reg, m, id, NULL);
+    if (!is_match(n, m, id)) {
+        return MOBI_ERR_NOT_FOUND;
+    }
+    *level = n->level;
+    return MOBI_OK;
+}
@@ -0,0 +1,168 @@
+/*
+ * Mobi Protocol v21.0.0 - Sorted Array Search
+ *
+ * Lower bound over a sorted mobi_bin_t array. Binary search halves the
+ * range with every probe: ~27 dependent cache misses at 10^8 mobis. Mobis
+ * are uniform over [0, 10^21) (PROTOCOL.md), so a value predicts its own
+ * position, n * v / 10^21, and a random set misses that by about
+ * sqrt(n) / 2 entries.
+ *
+ * Interpolation mode probes the predicted position and a guard one
+ * sqrt(window) beyond it on the side the answer lies, which usually
+ * brackets the answer in a window of ~sqrt(n) entries. It then repeats
+ * inside that window, n -> n^(1/2) -> n^(1/4) ..., until two cache lines
+ * remain; those are scanned. A round that fails to halve the window is
+ * followed by a plain bisection, so arrays that are not uniform still take
+ * O(log n) probes.
+ *
+ * Each round's probes depend on the last round, so every lookup pays a few
+ * cold misses, while bisection's first levels stay cached. Measured with
+ * bench_mobi, bisection matched or beat interpolation up to 10M mobis and
+ * lost by a third at 100M; the two cross near 2^24 mobis (256 MB), and
+ * interpolation mode bisects below that.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#include "mobi_internal.h"
+
+#if defined(__GNUC__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)0)
+#endif
+
+/* Windows this small (two cache lines of mobi_bin_t) are scanned */
+#define SCAN 8
+
+/* Fewest mobis interpolation mode interpolates over */
+#define INTERP_MIN ((size_t)1 << 24)
+
+static int bin_below(const mobi_bin_t *a, const mobi_bin_t *m) {
+    return a->hi < m->hi || (a->hi == m->hi && a->lo < m->lo);
+}
+
+/* hi * 10^9 + lo; 53 bits are plenty for a position estimate */
+static double bin_value(const mobi_bin_t *m) {
+    return (double)m->hi * 1e9 + (double)m->lo;
+}
+
+/* Roughly sqrt(n): 2^(bits(n) / 2) */
+static size_t rough_root(size_t n) {
+    int bits = 0;
+
+    while (bits < 64 && (n >> bits) != 0) {
+        bits++;
+    }
+    return (size_t)1 << (bits / 2);
+}
+
+static size_t binary_lower_bound(const mobi_bin_t *a, size_t count, const mobi_bin_t *m) {
+    size_t first = 0;
+
+    while (count > 0) {
+        size_t half = count / 2;
+
+        if (bin_below(&a[first + half], m)) {
+            first += half + 1;
+            count -= half + 1;
+        } else {
+            count = half;
+        }
+    }
+    return first;
+}
+
+size_t mobi_interp_lower_bound(const mobi_bin_t *a, size_t count, const mobi_bin_t *m) {
+    /* The answer is in [left, right]: a[left - 1] is below m, a[right] is not */
+    size_t left = 0, right = count;
+    double key = bin_value(m), lv = 0.0, rv = 1e21;
+    int bisect = 0;
+
+    while (right - left > SCAN) {
+        size_t width = right - left, d = rough_root(width), g;
+
+        if (bisect || rv <= lv) {
+            g = left + width / 2;
+        } else {
+            double at = (key - lv) / (rv - lv) * (double)width;
+
+            g = at <= 0.0 ? left : at >= (double)(width - 1) ? right - 1 : left + (size_t)at;
+
+            /* Either guard may be next: fetch both alongside the probe */
+            if (g + d < right) {
+                PREFETCH(&a[g + d]);
+            }
+            if (g >= left + d) {
+                PREFETCH(&a[g - d]);
+            }
+        }
+
+        if (bin_below(&a[g], m)) {
+            left = g + 1;
+            lv = bin_value(&a[g]);
+            g += d;
+            if (!bisect && g < right) {
+                if (bin_below(&a[g], m)) {
+                    left = g + 1;
+                    lv = bin_value(&a[g]);
+                } else {
+                    right = g;
+                    rv = bin_value(&a[g]);
+                }
+            }
+        } else {
+            right = g;
+            rv = bin_value(&a[g]);
+            if (!bisect && g >= left + d) {
+                g -= d;
+                if (bin_below(&a[g], m)) {
+                    left = g + 1;
+                    lv = bin_value(&a[g]);
+                } else {
+                    right = g;
+                    rv = bin_value(&a[g]);
+                }
+            }
+        }
+        bisect = !bisect && right - left > width / 2;
+    }
+
+    while (left < right && bin_below(&a[left], m)) {
+        left++;
+    }
+    return left;
+}
+
+size_t mobi_bin_lower_bound(const mobi_bin_t *sorted, size_t count, const mobi_bin_t *m,
+                            mobi_search_t mode) {
+    if (sorted == NULL || m == NULL) {
+        return 0;
+    }
+    if (mode == MOBI_SEARCH_INTERPOLATE && count >= INTERP_MIN) {
+        return mobi_interp_lower_bound(sorted, count, m);
+    }
+    return binary_lower_bound(sorted, count, m);
+}
+
+mobi_error_t mobi_bin_lookup(const mobi_bin_t *sorted, size_t count, const char *digits,
+                             size_t len, mobi_search_t mode, size_t *first, size_t *matches) {
+    mobi_bin_t start, end;
+    mobi_error_t err;
+    size_t a, b;
+
+    if ((sorted == NULL && count > 0) || first == NULL || matches == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    err = mobi_prefix_range(digits, len, &start, &end);
+    if (err != MOBI_OK) {
+        return err;
+    }
+
+    a = mobi_bin_lower_bound(sorted, count, &start, mode);
+    b = mobi_bin_lower_bound(sorted, count, &end, mode);
+    *first = a;
+    *matches = b - a;
+    return MOBI_OK;
+}
@@ -0,0 +1,252 @@
+/*
+ * Mobi Protocol v21.0.0 - Radix Sort
+ *
+ * Stable LSD radix sort of mobi_entry_t by (hi, lo) with 11-bit digits:
+ * three passes over the 30 bits of lo, then four over the 40 bits of hi.
+ *
+ * Each pass cuts the array into one contiguous block per worker. Workers
+ * count digits in their own block, a serial prefix sum gives every
+ * (block, digit) pair its output position, and workers scatter their
+ * block in order, so ties keep their input order.
+ *
+ * With 2048 buckets a plain scatter touches a different cache line (and
+ * often a different page) on every store. Instead each worker collects
+ * entries per bucket in a small buffer and writes a bucket out a cache
+ * line at a time. Mobis are uniform below 10^21, so every bucket fills at
+ * the same rate and the buffers drain evenly.
+ *
+ * Passes whose digit is the same for every entry move nothing and are
+ * skipped. With a single block the digit counts do not depend on the
+ * order of the entries, so all seven histograms come from one read.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#include "mobi_internal.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RADIX_BITS 11
+#define RADIX (1u << RADIX_BITS)
+#define PASSES 7
+
+/* Entries buffered per bucket before they are written: two cache lines */
+#define WC_ENTRIES 8
+
+/* Below this many entries per worker, threads cost more than they save */
+#define MIN_PER_BLOCK 65536
+
+/* Entries per unit of work when copying the result back */
+#define COPY_CHUNK 65536
+
+/* Digit position of each pass, least significant first */
+static const struct {
+    int hi;                 /* taken from hi (else from lo) */
+    int shift;
+} PASS[PASSES] = {
+    { 0, 0 }, { 0, 11 }, { 0, 22 },
+    { 1, 0 }, { 1, 11 }, { 1, 22 }, { 1, 33 }
+};
+
+/* A worker's write-combining buffers */
+typedef struct {
+    mobi_entry_t buf[RADIX][WC_ENTRIES];
+    uint8_t fill[RADIX];
+} sort_wc;
+
+typedef struct {
+    const mobi_entry_t *src;
+    mobi_entry_t *dst;
+    size_t count;
+    size_t blocks;
+    int pass;
+    size_t *offsets;        /* blocks x RADIX: counts, then output positions */
+    sort_wc *wc;            /* one per worker */
+} sort_job;
+
+static unsigned entry_digit(const mobi_entry_t *e, int pass) {
+    uint64_t field = PASS[pass].hi ? e->hi : e->lo;
+    return (unsigned)(field >> PASS[pass].shift) & (RADIX - 1);
+}
+
+static void block_range(const sort_job *job, size_t block, size_t *begin, size_t *end) {
+    *begin = job->count / job->blocks * block;
+    *end = block + 1 == job->blocks ? job->count : *begin + job->count / job->blocks;
+}
+
+static int count_task(void *ctx, size_t begin, size_t end, int worker) {
+    sort_job *job = (sort_job *)ctx;
+    size_t block;
+
+    (void)worker;
+    for (block = begin; block < end; block++) {
+        size_t *hist = job->offsets + block * RADIX;
+        size_t i, first, last;
+
+        memset(hist, 0, RADIX * sizeof(size_t));
+        block_range(job, block, &first, &last);
+        for (i = first; i < last; i++) {
+            hist[entry_digit(&job->src[i], job->pass)]++;
+        }
+    }
+    return 0;
+}
+
+static int scatter_task(void *ctx, size_t begin, size_t end, int worker) {
+    sort_job *job = (sort_job *)ctx;
+    sort_wc *wc = &job->wc[worker];
+    size_t block;
+
+    for (block = begin; block < end; block++) {
+        size_t *pos = job->offsets + block * RADIX;
+        size_t i, first, last;
+        unsigned d;
+
+        memset(wc->fill, 0, sizeof(wc->fill));
+        block_range(job, block, &first, &last);
+        for (i = first; i < last; i++) {
+            const mobi_entry_t *e = &job->src[i];
+            unsigned digit = entry_digit(e, job->pass);
+            unsigned n = wc->fill[digit];
+
+            wc->buf[digit][n++] = *e;
+            if (n == WC_ENTRIES) {
+                memcpy(&job->dst[pos[digit]], wc->buf[digit], sizeof(wc->buf[digit]));
+                pos[digit] += WC_ENTRIES;
+                n = 0;
+            }
+            wc->fill[digit] = (uint8_t)n;
+        }
+        for (d = 0; d < RADIX; d++) {
+            memcpy(&job->dst[pos[d]], wc->buf[d], wc->fill[d] * sizeof(mobi_entry_t));
+        }
+    }
+    return 0;
+}
+
+static int copy_task(void *ctx, size_t begin, size_t end, int worker) {
+    sort_job *job = (sort_job *)ctx;
+
+    (void)worker;
+    memcpy(job->dst + begin, job->src + begin, (end - begin) * sizeof(mobi_entry_t));
+    return 0;
+}
+
+/*
+ * Turn per-block counts into output positions: digit-major, then block.
+ * Returns 0 if every entry has the same digit, so the pass can be skipped.
+ */
+static int prefix_sum(sort_job *job) {
+    size_t at = 0;
+    unsigned d;
+    size_t b;
+
+    for (d = 0; d < RADIX; d++) {
+        size_t start = at;
+
+        for (b = 0; b < job->blocks; b++) {
+            size_t n = job->offsets[b * RADIX + d];
+            job->offsets[b * RADIX + d] = at;
+            at += n;
+        }
+        if (at - start == job->count) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Single block: every pass's histogram from one read of the input */
+static void count_all(const mobi_entry_t *e, size_t count, size_t *hist) {
+    size_t i;
+    int p;
+
+    memset(hist, 0, PASSES * RADIX * sizeof(size_t));
+    for (i = 0; i < count; i++) {
+        for (p = 0; p < PASSES; p++) {
+            hist[p * RADIX + entry_digit(&e[i], p)]++;
+        }
+    }
+}
+
+mobi_error_t mobi_sort_entries(mobi_entry_t *entries, mobi_entry_t *scratch, size_t count,
+                               int threads) {
+    sort_job job;
+    mobi_entry_t *tmp = scratch;
+    size_t *all = NULL;     /* single block: the histograms of every pass */
+    size_t workers;
+    int p;
+
+    if (entries == NULL && count > 0) {
+        return MOBI_ERR_NULL;
+    }
+    if (count < 2) {
+        return MOBI_OK;
+    }
+
+    workers = (size_t)mobi_pool_threads(threads);
+    if (workers > count / MIN_PER_BLOCK) {
+        workers = count / MIN_PER_BLOCK;
+    }
+    if (workers < 1) {
+        workers = 1;
+    }
+
+    if (tmp == NULL) {
+        tmp = malloc(count * sizeof(mobi_entry_t));
+    }
+    job.count = count;
+    job.blocks = workers;
+    job.offsets = malloc(workers * RADIX * sizeof(size_t));
+    job.wc = malloc(workers * sizeof(sort_wc));
+    if (workers == 1) {
+        all = malloc(PASSES * RADIX * sizeof(size_t));
+    }
+    if (tmp == NULL || job.offsets == NULL || job.wc == NULL || (workers == 1 && all == NULL)) {
+        if (tmp != scratch) {
+            free(tmp);
+        }
+        free(job.offsets);
+        free(job.wc);
+        free(all);
+        return MOBI_ERR_NOMEM;
+    }
+
+    if (all != NULL) {
+        count_all(entries, count, all);
+    }
+
+    job.src = entries;
+    job.dst = tmp;
+    for (p = 0; p < PASSES; p++) {
+        job.pass = p;
+        if (all != NULL) {
+            memcpy(job.offsets, all + (size_t)p * RADIX, RADIX * sizeof(size_t));
+        } else {
+            mobi_parallel_for(job.blocks, 1, (int)workers, count_task, &job);
+        }
+        if (!prefix_sum(&job)) {
+            continue;
+        }
+        mobi_parallel_for(job.blocks, 1, (int)workers, scatter_task, &job);
+
+        /* The output of this pass is the input of the next */
+        job.src = job.dst;
+        job.dst = job.dst == tmp ? entries : tmp;
+    }
+
+    /* After an odd number of passes the result is in tmp */
+    if (job.src != entries) {
+        job.dst = entries;
+        mobi_parallel_for(count, COPY_CHUNK, threads, copy_task, &job);
+    }
+
+    if (tmp != scratch) {
+        free(tmp);
+    }
+    free(job.offsets);
+    free(job.wc);
+    free(all);
+    return MOBI_OK;
+}
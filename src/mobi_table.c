@@ -0,0 +1,506 @@
+/*
+ * Mobi Protocol v21.0.0 - Concurrent Display Table
+ *
+ * Open addressing with linear probing, keyed by the 12-digit display
+ * (mobi_bin_t.hi, under 2^40). Users sharing a display are separate slots
+ * on the same probe chain, so one lookup returns all of them.
+ *
+ * A slot is 16 bytes: a 64-bit tag and the rest of the user (lo, id). The
+ * tag packs the slot state, the display and a version:
+ *
+ *   bits  0-1   EMPTY, BUSY (being written), DEAD (removed) or LIVE
+ *   bits  2-41  display
+ *   bits 42-62  version, bumped whenever a writer claims the slot
+ *   bit  63     FROZEN: the slot array is being rebuilt
+ *
+ * Writers claim a slot with one CAS on its tag (EMPTY or DEAD to BUSY),
+ * fill it in and publish it LIVE; removal is a CAS from LIVE to DEAD.
+ * Inserts of one display also hold one of WRITER_STRIPES mutexes, so the
+ * duplicate check and the claim cannot interleave with another insert of
+ * the same user. Readers take no locks and never wait for a writer: each
+ * slot is read as a seqlock, tag, fields, tag again, and retried only if a
+ * writer changed it in between. A BUSY slot is not yet an answer, so
+ * readers step over it. Probing stops at the first EMPTY slot; DEAD slots
+ * are reused by later inserts on the same chain.
+ *
+ * DEAD slots still lengthen every probe that crosses them, so claims of
+ * EMPTY slots are counted, and once live plus DEAD slots reach halfway
+ * from limit to a full table, the inserting writer rebuilds: it freezes
+ * every slot of the array (waiting out BUSY ones), copies the LIVE slots
+ * into a fresh array and publishes that. Writers that meet a frozen slot
+ * wait for the rebuild and retry on the new array. Readers keep reading
+ * the frozen array, which stays valid; every reader and writer pins the
+ * array it uses in one of two counter sets (by epoch parity), and the
+ * rebuild flips the epoch and frees the old array only once the old
+ * parity has drained.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mobi_internal.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ST_EMPTY 0u
+#define ST_BUSY  1u
+#define ST_DEAD  2u
+#define ST_LIVE  3u
+
+#define TAG_FROZEN      (1ULL << 63)
+#define TAG_STATE(t)    ((unsigned)((t) & 3u))
+#define TAG_DISPLAY(t)  (((t) >> 2) & ((1ULL << 40) - 1))
+#define TAG_VERSION(t)  (((t) >> 42) & ((1ULL << 21) - 1))
+#define TAG(ver, display, state) \
+    (((uint64_t)(ver) << 42) | ((uint64_t)(display) << 2) | (uint64_t)(state))
+
+/* Slots share cache lines four at a time */
+#define SLOT_ALIGN 64
+
+/* Fewest slots in a table */
+#define MIN_SLOTS 16
+
+/* Pin counters per epoch parity, one cache line each */
+#define PIN_STRIPES 16
+
+/* Insert locks, by display */
+#define WRITER_STRIPES 64
+
+typedef struct {
+    uint64_t tag;
+    uint32_t lo;
+    uint32_t id;
+} table_slot;
+
+typedef struct {
+    size_t used;        /* slots claimed from EMPTY: live, BUSY or DEAD */
+    char pad[SLOT_ALIGN - sizeof(size_t)];
+    table_slot slots[];
+} table_array;
+
+typedef struct {
+    size_t n;
+    char pad[SLOT_ALIGN - sizeof(size_t)];
+} pin_count;
+
+typedef struct {
+    pin_count pins[2][PIN_STRIPES];
+    table_array *array;     /* current slots */
+    unsigned epoch;         /* bumped by every rebuild */
+    size_t cap;             /* rebuild before used passes this */
+    pthread_mutex_t rebuild;
+    pthread_mutex_t writers[WRITER_STRIPES];
+} table_state;
+
+/* Outcomes of one attempt on one array */
+enum { TRY_DONE, TRY_FROZEN, TRY_FULL };
+
+static uint64_t display_hash(uint64_t display) {
+    mobi_bin_t key;
+
+    key.hi = display;
+    key.lo = 0;
+    return mobi_bin_hash(&key);
+}
+
+/*
+ * A consistent snapshot of a slot: its tag, and for a LIVE slot the
+ * fields that go with it. Retries only while a writer is changing it.
+ */
+static uint64_t slot_read(const table_slot *s, uint32_t *lo, uint32_t *id) {
+    for (;;) {
+        uint64_t before = __atomic_load_n(&s->tag, __ATOMIC_ACQUIRE);
+        uint64_t after;
+
+        if (TAG_STATE(before) != ST_LIVE) {
+            return before;
+        }
+        *lo = __atomic_load_n(&s->lo, __ATOMIC_RELAXED);
+        *id = __atomic_load_n(&s->id, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&s->tag, __ATOMIC_RELAXED);
+        if (after == before) {
+            return before;
+        }
+    }
+}
+
+/*
+ * Pin the current array: count ourselves in the current epoch's parity,
+ * then check the epoch did not move in between. A rebuild that flips the
+ * epoch after that check waits for us; one that flipped before it made
+ * us retry, and we then see its new array.
+ */
+static table_array *pin(table_state *st, uint64_t h, size_t **count) {
+    size_t stripe = (size_t)(h >> 40) % PIN_STRIPES;
+
+    for (;;) {
+        unsigned epoch = __atomic_load_n(&st->epoch, __ATOMIC_SEQ_CST);
+        size_t *n = &st->pins[epoch & 1][stripe].n;
+
+        __atomic_fetch_add(n, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&st->epoch, __ATOMIC_SEQ_CST) == epoch) {
+            *count = n;
+            return __atomic_load_n(&st->array, __ATOMIC_SEQ_CST);
+        }
+        __atomic_fetch_sub(n, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void unpin(size_t *count) {
+    __atomic_fetch_sub(count, 1, __ATOMIC_RELEASE);
+}
+
+static table_array *array_alloc(size_t slots) {
+    void *mem;
+
+    if (posix_memalign(&mem, SLOT_ALIGN, sizeof(table_array) + slots * sizeof(table_slot))
+        != 0) {
+        return NULL;
+    }
+    memset(mem, 0, sizeof(table_array) + slots * sizeof(table_slot));
+    return (table_array *)mem;
+}
+
+/* A writer met a frozen slot: the rebuild holds its mutex until it publishes */
+static void wait_rebuild(table_state *st) {
+    pthread_mutex_lock(&st->rebuild);
+    pthread_mutex_unlock(&st->rebuild);
+}
+
+/*
+ * Replace old (if it is still current) with a copy holding only its LIVE
+ * slots. The caller must not have an array pinned.
+ */
+static mobi_error_t rebuild(mobi_table_t *t, table_array *old) {
+    table_state *st = (table_state *)t->state;
+    table_array *fresh;
+    unsigned epoch;
+    size_t i, s, copied = 0;
+
+    pthread_mutex_lock(&st->rebuild);
+    if (__atomic_load_n(&st->array, __ATOMIC_ACQUIRE) != old) {
+        pthread_mutex_unlock(&st->rebuild);
+        return MOBI_OK;
+    }
+    fresh = array_alloc(t->mask + 1);
+    if (fresh == NULL) {
+        pthread_mutex_unlock(&st->rebuild);
+        return MOBI_ERR_NOMEM;
+    }
+
+    for (i = 0; i <= t->mask; i++) {
+        table_slot *slot = &old->slots[i];
+        uint64_t tag = __atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE);
+
+        /* BUSY slots belong to a writer about to publish them: wait it out */
+        while (TAG_STATE(tag) == ST_BUSY ||
+               !__atomic_compare_exchange_n(&slot->tag, &tag, tag | TAG_FROZEN, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            if (TAG_STATE(tag) == ST_BUSY) {
+                sched_yield();
+                tag = __atomic_load_n(&slot->tag, __ATOMIC_ACQUIRE);
+            }
+        }
+        if (TAG_STATE(tag) != ST_LIVE) {
+            continue;
+        }
+        s = (size_t)display_hash(TAG_DISPLAY(tag)) & t->mask;
+        while (fresh->slots[s].tag != 0) {
+            s = (s + 1) & t->mask;
+        }
+        fresh->slots[s].tag = tag;
+        fresh->slots[s].lo = slot->lo;
+        fresh->slots[s].id = slot->id;
+        copied++;
+    }
+    fresh->used = copied;
+
+    /* Publish, then wait until nothing can still be reading old */
+    __atomic_store_n(&st->array, fresh, __ATOMIC_SEQ_CST);
+    epoch = __atomic_load_n(&st->epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&st->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    for (s = 0; s < PIN_STRIPES; s++) {
+        while (__atomic_load_n(&st->pins[epoch & 1][s].n, __ATOMIC_SEQ_CST) != 0) {
+            sched_yield();
+        }
+    }
+    free(old);
+    pthread_mutex_unlock(&st->rebuild);
+    return MOBI_OK;
+}
+
+mobi_error_t mobi_table_init(mobi_table_t *t, size_t max_users) {
+    size_t slots = MIN_SLOTS, i;
+    table_state *st;
+    void *mem;
+
+    if (t == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    memset(t, 0, sizeof(*t));
+
+    /* At most 3/4 full */
+    while (slots / 4 * 3 < max_users) {
+        if (slots > (SIZE_MAX - sizeof(table_array)) / 2 / sizeof(table_slot)) {
+            return MOBI_ERR_NOMEM;
+        }
+        slots *= 2;
+    }
+    if (posix_memalign(&mem, SLOT_ALIGN, sizeof(table_state)) != 0) {
+        return MOBI_ERR_NOMEM;
+    }
+    st = (table_state *)mem;
+    memset(st, 0, sizeof(*st));
+    st->array = array_alloc(slots);
+    if (st->array == NULL) {
+        free(st);
+        return MOBI_ERR_NOMEM;
+    }
+    st->cap = max_users + (slots - max_users) / 2;
+    pthread_mutex_init(&st->rebuild, NULL);
+    for (i = 0; i < WRITER_STRIPES; i++) {
+        pthread_mutex_init(&st->writers[i], NULL);
+    }
+
+    t->state = st;
+    t->mask = slots - 1;
+    t->limit = max_users;
+    return MOBI_OK;
+}
+
+void mobi_table_free(mobi_table_t *t) {
+    table_state *st;
+    size_t i;
+
+    if (t == NULL || t->state == NULL) {
+        return;
+    }
+    st = (table_state *)t->state;
+    pthread_mutex_destroy(&st->rebuild);
+    for (i = 0; i < WRITER_STRIPES; i++) {
+        pthread_mutex_destroy(&st->writers[i]);
+    }
+    free(st->array);
+    free(st);
+    memset(t, 0, sizeof(*t));
+}
+
+/* One insert attempt on a pinned array; *err is set when it returns TRY_DONE */
+static int insert_into(mobi_table_t *t, table_array *a, size_t cap, uint64_t h,
+                       const mobi_bin_t *m, uint32_t id, mobi_error_t *err) {
+    for (;;) {
+        table_slot *target = NULL;
+        uint64_t expected = 0, version;
+        size_t i = (size_t)h & t->mask, probes;
+        int fresh;
+
+        /* Walk the whole chain: the user may be further along */
+        for (probes = 0; probes <= t->mask; probes++, i = (i + 1) & t->mask) {
+            uint32_t lo = 0, sid = 0;
+            uint64_t tag = slot_read(&a->slots[i], &lo, &sid);
+            unsigned state = TAG_STATE(tag);
+
+            if (state == ST_LIVE && TAG_DISPLAY(tag) == m->hi && lo == m->lo && sid == id) {
+                *err = MOBI_ERR_EXISTS;
+                return TRY_DONE;
+            }
+            if (tag & TAG_FROZEN) {
+                return TRY_FROZEN;
+            }
+            if (state == ST_EMPTY) {
+                if (target == NULL) {
+                    target = &a->slots[i];
+                    expected = tag;
+                }
+                break;
+            }
+            if (state == ST_DEAD && target == NULL) {
+                target = &a->slots[i];
+                expected = tag;
+            }
+        }
+        if (target == NULL) {
+            /* Only BUSY and LIVE slots: other writers hold them all */
+            *err = MOBI_ERR_NOMEM;
+            return TRY_DONE;
+        }
+        /* Not a duplicate: reserve room for one more user, and an EMPTY slot */
+        if (__atomic_fetch_add(&t->count, 1, __ATOMIC_RELAXED) >= t->limit) {
+            __atomic_fetch_sub(&t->count, 1, __ATOMIC_RELAXED);
+            *err = MOBI_ERR_NOMEM;
+            return TRY_DONE;
+        }
+        fresh = TAG_STATE(expected) == ST_EMPTY;
+        if (fresh && __atomic_fetch_add(&a->used, 1, __ATOMIC_RELAXED) >= cap) {
+            __atomic_fetch_sub(&a->used, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_sub(&t->count, 1, __ATOMIC_RELAXED);
+            return TRY_FULL;
+        }
+
+        /* Claim it; if another writer got there first, look again */
+        version = (TAG_VERSION(expected) + 1) & ((1ULL << 21) - 1);
+        if (!__atomic_compare_exchange_n(&target->tag, &expected, TAG(version, m->hi, ST_BUSY),
+                                         0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            if (fresh) {
+                __atomic_fetch_sub(&a->used, 1, __ATOMIC_RELAXED);
+            }
+            __atomic_fetch_sub(&t->count, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&target->lo, m->lo, __ATOMIC_RELAXED);
+        __atomic_store_n(&target->id, id, __ATOMIC_RELAXED);
+        __atomic_store_n(&target->tag, TAG(version, m->hi, ST_LIVE), __ATOMIC_RELEASE);
+        *err = MOBI_OK;
+        return TRY_DONE;
+    }
+}
+
+mobi_error_t mobi_table_insert(mobi_table_t *t, const mobi_bin_t *m, uint32_t id) {
+    table_state *st;
+    pthread_mutex_t *lock;
+    mobi_error_t err = MOBI_OK;
+    uint64_t h;
+
+    if (t == NULL || t->state == NULL || m == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    if (m->hi >= 1000000000000ULL || m->lo >= 1000000000u) {
+        return MOBI_ERR_RANGE;
+    }
+    st = (table_state *)t->state;
+    h = display_hash(m->hi);
+    lock = &st->writers[(h >> 32) % WRITER_STRIPES];
+
+    pthread_mutex_lock(lock);
+    for (;;) {
+        size_t *pinned;
+        table_array *a = pin(st, h, &pinned);
+        int outcome = insert_into(t, a, st->cap, h, m, id, &err);
+
+        unpin(pinned);
+        if (outcome == TRY_DONE) {
+            break;
+        }
+        if (outcome == TRY_FROZEN) {
+            wait_rebuild(st);
+        } else if ((err = rebuild(t, a)) != MOBI_OK) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(lock);
+    return err;
+}
+
+/* One remove attempt on a pinned array */
+static int remove_from(mobi_table_t *t, table_array *a, uint64_t h, const mobi_bin_t *m,
+                       uint32_t id, mobi_error_t *err) {
+    size_t i = (size_t)h & t->mask, probes;
+
+    for (probes = 0; probes <= t->mask; ) {
+        uint32_t lo = 0, sid = 0;
+        uint64_t tag = slot_read(&a->slots[i], &lo, &sid);
+
+        if (TAG_STATE(tag) == ST_EMPTY) {
+            break;
+        }
+        if (TAG_STATE(tag) == ST_LIVE && TAG_DISPLAY(tag) == m->hi && lo == m->lo &&
+            sid == id) {
+            uint64_t dead = (tag & ~(uint64_t)3) | ST_DEAD;
+
+            if (tag & TAG_FROZEN) {
+                return TRY_FROZEN;
+            }
+            if (__atomic_compare_exchange_n(&a->slots[i].tag, &tag, dead, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+                __atomic_fetch_sub(&t->count, 1, __ATOMIC_RELAXED);
+                *err = MOBI_OK;
+                return TRY_DONE;
+            }
+            continue;   /* changed under us: read the slot again */
+        }
+        probes++;
+        i = (i + 1) & t->mask;
+    }
+    *err = MOBI_ERR_NOT_FOUND;
+    return TRY_DONE;
+}
+
+mobi_error_t mobi_table_remove(mobi_table_t *t, const mobi_bin_t *m, uint32_t id) {
+    table_state *st;
+    mobi_error_t err = MOBI_OK;
+    uint64_t h;
+
+    if (t == NULL || t->state == NULL || m == NULL) {
+        return MOBI_ERR_NULL;
+    }
+    st = (table_state *)t->state;
+    h = display_hash(m->hi);
+
+    for (;;) {
+        size_t *pinned;
+        table_array *a = pin(st, h, &pinned);
+        int outcome = remove_from(t, a, h, m, id, &err);
+
+        unpin(pinned);
+        if (outcome == TRY_DONE) {
+            return err;
+        }
+        wait_rebuild(st);
+    }
+}
+
+/* Users with this display, and how many slots the walk took */
+static size_t scan(const mobi_table_t *t, uint64_t display, mobi_entry_t *out, size_t max,
+                   size_t *probed) {
+    table_state *st = (table_state *)t->state;
+    uint64_t h = display_hash(display);
+    size_t *pinned;
+    const table_array *a = pin(st, h, &pinned);
+    size_t i = (size_t)h & t->mask, probes, found = 0;
+
+    for (probes = 0; probes <= t->mask; probes++, i = (i + 1) & t->mask) {
+        uint32_t lo = 0, id = 0;
+        uint64_t tag = slot_read(&a->slots[i], &lo, &id);
+
+        if (TAG_STATE(tag) == ST_EMPTY) {
+            break;
+        }
+        if (TAG_STATE(tag) == ST_LIVE && TAG_DISPLAY(tag) == display) {
+            if (found < max) {
+                out[found].hi = display;
+                out[found].lo = lo;
+                out[found].id = id;
+            }
+            found++;
+        }
+    }
+    unpin(pinned);
+    *probed = probes;
+    return found;
+}
+
+size_t mobi_table_find(const mobi_table_t *t, uint64_t display, mobi_entry_t *out,
+                       size_t max) {
+    size_t probed;
+
+    if (t == NULL || t->state == NULL || (out == NULL && max > 0)) {
+        return 0;
+    }
+    return scan(t, display, out, max, &probed);
+}
+
+size_t mobi_table_probes(const mobi_table_t *t, uint64_t display) {
+    size_t probed;
+
+    if (t == NULL || t->state == NULL) {
+        return 0;
+    }
+    (void)scan(t, display, NULL, 0, &probed);
+    return probed;
+}
@@ -0,0 +1,363 @@
+/*
+ * Mobi Protocol v21.0.0 - x86 Acceleration
+ *
+ * CPU feature detection, SHA-256 and hex decoding kernels for x86 hosts.
+ * Every kernel carries its own target attribute, so this file builds with
+ * the same baseline CFLAGS as the rest of the library; mobi.c only calls
+ * into it once mobi_cpu_detect() has confirmed the instructions exist.
+ *
+ * Copyright (c) 2024-2025 OBIVERSE LLC
+ * Licensed under MIT OR Apache-2.0
+ */
+
+#include "mobi_internal.h"
+
+#if MOBI_X86
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* ============================================================================
+ * CPU FEATURE DETECTION
+ * ============================================================================ */
+
+/* XCR0: which register files the OS saves on context switch */
+static uint64_t read_xcr0(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+unsigned mobi_cpu_detect(void) {
+    unsigned int eax, ebx, ecx, edx;
+    unsigned features = 0;
+    int sse41, ssse3, ymm_os = 0, zmm_os = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    ssse3 = (ecx >> 9) & 1;
+    sse41 = (ecx >> 19) & 1;
+
+    /* OSXSAVE, then XMM and YMM state enabled in XCR0 */
+    if ((ecx >> 27) & 1) {
+        uint64_t xcr0 = read_xcr0();
+        ymm_os = (xcr0 & 0x6) == 0x6;
+        zmm_os = ymm_os && (xcr0 & 0xE0) == 0xE0;  /* opmask, ZMM0-15 hi, ZMM16-31 */
+    }
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+
+    /* SHA-NI: CPUID.(EAX=7,ECX=0):EBX[29], plus the SSE it is built on */
+    if (((ebx >> 29) & 1) && ssse3 && sse41) {
+        features |= MOBI_CPU_SHANI;
+    }
+
+    /* SSE4.1 (with the SSSE3 it implies in practice) for hex decoding */
+    if (ssse3 && sse41) {
+        features |= MOBI_CPU_SSE41;
+    }
+
+    /* AVX2: CPUID.(EAX=7,ECX=0):EBX[5] */
+    if (((ebx >> 5) & 1) && ymm_os) {
+        features |= MOBI_CPU_AVX2;
+    }
+
+    /* AVX-512F: CPUID.(EAX=7,ECX=0):EBX[16] */
+    if (((ebx >> 16) & 1) && zmm_os) {
+        features |= MOBI_CPU_AVX512;
+    }
+
+    return features;
+}
+
+/* ============================================================================
+ * SHA-NI COMPRESSION
+ * ============================================================================ */
+
+/*
+ * The SHA extensions keep the working state as two registers, ABEF and
+ * CDGH, and consume the message four words at a time. msg[] is a ring of
+ * the last four message groups; group g+4 is expanded into the slot of
+ * group g once g has been consumed. Blocks arrive as words, so no byte
+ * swap is needed on load.
+ */
+
+/* a b c d / e f g h -> ABEF / CDGH */
+__attribute__((target("sha,sse4.1")))
+static void shani_load_state(const uint32_t st[8], __m128i *abef, __m128i *cdgh) {
+    __m128i tmp, s1;
+
+    tmp = _mm_loadu_si128((const __m128i *)&st[0]);
+    s1 = _mm_loadu_si128((const __m128i *)&st[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    s1 = _mm_shuffle_epi32(s1, 0x1B);
+    *abef = _mm_alignr_epi8(tmp, s1, 8);
+    *cdgh = _mm_blend_epi16(s1, tmp, 0xF0);
+}
+
+/* Runs 4-round groups first..15 from state s0/s1, writes digest words 0-2 */
+__attribute__((target("sha,sse4.1")))
+static void shani_finish(__m128i s0, __m128i s1, const uint32_t *block,
+                         int first, uint32_t out[3]) {
+    __m128i iv0, iv1, tmp, k;
+    __m128i msg[4];
+    int g;
+
+    for (g = 0; g < 4; g++) {
+        msg[g] = _mm_loadu_si128((const __m128i *)(block + g * 4));
+    }
+
+    for (g = 0; g < 16; g++) {
+        if (g >= first) {
+            k = _mm_add_epi32(msg[g & 3],
+                              _mm_loadu_si128((const __m128i *)&mobi_sha256_k[g * 4]));
+            s1 = _mm_sha256rnds2_epu32(s1, s0, k);
+            k = _mm_shuffle_epi32(k, 0x0E);
+            s0 = _mm_sha256rnds2_epu32(s0, s1, k);
+        }
+
+        if (g < 12) {
+            tmp = _mm_sha256msg1_epu32(msg[g & 3], msg[(g + 1) & 3]);
+            tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(msg[(g + 3) & 3],
+                                                     msg[(g + 2) & 3], 4));
+            msg[g & 3] = _mm_sha256msg2_epu32(tmp, msg[(g + 3) & 3]);
+        }
+    }
+
+    /* ABEF holds a, b in its top lanes; CDGH holds c */
+    shani_load_state(mobi_sha256_iv, &iv0, &iv1);
+    s0 = _mm_add_epi32(s0, iv0);
+    s1 = _mm_add_epi32(s1, iv1);
+    out[0] = (uint32_t)_mm_extract_epi32(s0, 3);
+    out[1] = (uint32_t)_mm_extract_epi32(s0, 2);
+    out[2] = (uint32_t)_mm_extract_epi32(s1, 3);
+}
+
+__attribute__((target("sha,sse4.1")))
+void mobi_sha256_block_shani(const uint32_t *block, uint32_t out[3]) {
+    __m128i s0, s1;
+
+    shani_load_state(mobi_sha256_iv, &s0, &s1);
+    shani_finish(s0, s1, block, 0, out);
+}
+
+__attribute__((target("sha,sse4.1")))
+void mobi_sha256_resume_shani(const uint32_t mid[8], const uint32_t *block, uint32_t out[3]) {
+    __m128i s0, s1;
+
+    /* Rounds 0-7 are groups 0 and 1 */
+    shani_load_state(mid, &s0, &s1);
+    shani_finish(s0, s1, block, 2, out);
+}
+
+/* ============================================================================
+ * AVX2 MULTI-BUFFER (8 LANES)
+ * ============================================================================ */
+
+/*
+ * Straight transliteration of the FIPS 180-4 round into 8-wide vectors:
+ * lane j of every register belongs to message j. AVX2 has no vector
+ * rotate, so ROTR is a shift pair. The schedule lives in a 16-entry ring.
+ */
+#define X8_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32((x), (n)), \
+                                      _mm256_slli_epi32((x), 32 - (n)))
+#define X8_XOR3(a, b, c) _mm256_xor_si256(_mm256_xor_si256((a), (b)), (c))
+#define X8_EP0(x)  X8_XOR3(X8_ROTR(x, 2), X8_ROTR(x, 13), X8_ROTR(x, 22))
+#define X8_EP1(x)  X8_XOR3(X8_ROTR(x, 6), X8_ROTR(x, 11), X8_ROTR(x, 25))
+#define X8_SIG0(x) X8_XOR3(X8_ROTR(x, 7), X8_ROTR(x, 18), _mm256_srli_epi32((x), 3))
+#define X8_SIG1(x) X8_XOR3(X8_ROTR(x, 17), X8_ROTR(x, 19), _mm256_srli_epi32((x), 10))
+#define X8_CH(x, y, z)  _mm256_xor_si256(_mm256_and_si256((x), (y)), \
+                                         _mm256_andnot_si256((x), (z)))
+#define X8_MAJ(x, y, z) _mm256_or_si256(_mm256_and_si256((x), (y)), \
+                        _mm256_and_si256((z), _mm256_or_si256((x), (y))))
+
+__attribute__((target("avx2")))
+void mobi_sha256_x8_avx2(const uint32_t *win, uint32_t *out) {
+    __m256i w[16];
+    __m256i a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = _mm256_loadu_si256((const __m256i *)(win + i * 8));
+    }
+
+    a = _mm256_set1_epi32((int)mobi_sha256_iv[0]);
+    b = _mm256_set1_epi32((int)mobi_sha256_iv[1]);
+    c = _mm256_set1_epi32((int)mobi_sha256_iv[2]);
+    d = _mm256_set1_epi32((int)mobi_sha256_iv[3]);
+    e = _mm256_set1_epi32((int)mobi_sha256_iv[4]);
+    f = _mm256_set1_epi32((int)mobi_sha256_iv[5]);
+    g = _mm256_set1_epi32((int)mobi_sha256_iv[6]);
+    h = _mm256_set1_epi32((int)mobi_sha256_iv[7]);
+
+    for (i = 0; i < 64; i++) {
+        if (i >= 16) {
+            w[i & 15] = _mm256_add_epi32(
+                _mm256_add_epi32(X8_SIG1(w[(i - 2) & 15]), w[(i - 7) & 15]),
+                _mm256_add_epi32(X8_SIG0(w[(i - 15) & 15]), w[i & 15]));
+        }
+        t1 = _mm256_add_epi32(
+            _mm256_add_epi32(h, X8_EP1(e)),
+            _mm256_add_epi32(X8_CH(e, f, g),
+                _mm256_add_epi32(_mm256_set1_epi32((int)mobi_sha256_k[i]), w[i & 15])));
+        t2 = _mm256_add_epi32(X8_EP0(a), X8_MAJ(a, b, c));
+        h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+        d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+    }
+
+    _mm256_storeu_si256((__m256i *)(out + 0),
+        _mm256_add_epi32(a, _mm256_set1_epi32((int)mobi_sha256_iv[0])));
+    _mm256_storeu_si256((__m256i *)(out + 8),
+        _mm256_add_epi32(b, _mm256_set1_epi32((int)mobi_sha256_iv[1])));
+    _mm256_storeu_si256((__m256i *)(out + 16),
+        _mm256_add_epi32(c, _mm256_set1_epi32((int)mobi_sha256_iv[2])));
+}
+
+/* ============================================================================
+ * AVX-512 MULTI-BUFFER (16 LANES)
+ * ============================================================================ */
+
+/*
+ * Same round as the AVX2 kernel at twice the width, using what AVX-512F
+ * adds: vprord is a real rotate, and vpternlogd evaluates Ch, Maj and the
+ * three-way XORs of the Sigma functions in a single instruction each.
+ * Ternary-logic immediates: 0x96 = a^b^c, 0xCA = a?b:c, 0xE8 = majority.
+ */
+#define X16_XOR3(a, b, c) _mm512_ternarylogic_epi32((a), (b), (c), 0x96)
+#define X16_EP0(x)  X16_XOR3(_mm512_ror_epi32((x), 2), _mm512_ror_epi32((x), 13), \
+                             _mm512_ror_epi32((x), 22))
+#define X16_EP1(x)  X16_XOR3(_mm512_ror_epi32((x), 6), _mm512_ror_epi32((x), 11), \
+                             _mm512_ror_epi32((x), 25))
+#define X16_SIG0(x) X16_XOR3(_mm512_ror_epi32((x), 7), _mm512_ror_epi32((x), 18), \
+                             _mm512_srli_epi32((x), 3))
+#define X16_SIG1(x) X16_XOR3(_mm512_ror_epi32((x), 17), _mm512_ror_epi32((x), 19), \
+                             _mm512_srli_epi32((x), 10))
+#define X16_CH(x, y, z)  _mm512_ternarylogic_epi32((x), (y), (z), 0xCA)
+#define X16_MAJ(x, y, z) _mm512_ternarylogic_epi32((x), (y), (z), 0xE8)
+
+__attribute__((target("avx512f")))
+void mobi_sha256_x16_avx512(const uint32_t *win, uint32_t *out) {
+    __m512i w[16];
+    __m512i a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = _mm512_loadu_si512((const void *)(win + i * 16));
+    }
+
+    a = _mm512_set1_epi32((int)mobi_sha256_iv[0]);
+    b = _mm512_set1_epi32((int)mobi_sha256_iv[1]);
+    c = _mm512_set1_epi32((int)mobi_sha256_iv[2]);
+    d = _mm512_set1_epi32((int)mobi_sha256_iv[3]);
+    e = _mm512_set1_epi32((int)mobi_sha256_iv[4]);
+    f = _mm512_set1_epi32((int)mobi_sha256_iv[5]);
+    g = _mm512_set1_epi32((int)mobi_sha256_iv[6]);
+    h = _mm512_set1_epi32((int)mobi_sha256_iv[7]);
+
+    for (i = 0; i < 64; i++) {
+        if (i >= 16) {
+            w[i & 15] = _mm512_add_epi32(
+                _mm512_add_epi32(X16_SIG1(w[(i - 2) & 15]), w[(i - 7) & 15]),
+                _mm512_add_epi32(X16_SIG0(w[(i - 15) & 15]), w[i & 15]));
+        }
+        t1 = _mm512_add_epi32(
+            _mm512_add_epi32(h, X16_EP1(e)),
+            _mm512_add_epi32(X16_CH(e, f, g),
+                _mm512_add_epi32(_mm512_set1_epi32((int)mobi_sha256_k[i]), w[i & 15])));
+        t2 = _mm512_add_epi32(X16_EP0(a), X16_MAJ(a, b, c));
+        h = g; g = f; f = e; e = _mm512_add_epi32(d, t1);
+        d = c; c = b; b = a; a = _mm512_add_epi32(t1, t2);
+    }
+
+    _mm512_storeu_si512((void *)(out + 0),
+        _mm512_add_epi32(a, _mm512_set1_epi32((int)mobi_sha256_iv[0])));
+    _mm512_storeu_si512((void *)(out + 16),
+        _mm512_add_epi32(b, _mm512_set1_epi32((int)mobi_sha256_iv[1])));
+    _mm512_storeu_si512((void *)(out + 32),
+        _mm512_add_epi32(c, _mm512_set1_epi32((int)mobi_sha256_iv[2])));
+}
+
+/* ============================================================================
+ * HEX DECODING
+ * ============================================================================ */
+
+/*
+ * Per character c (as an unsigned byte):
+ *   digit: d = c - '0'          is a nibble iff d <= 9
+ *   alpha: a = (c | 0x20) - 'a' is a nibble iff a <= 5 (folds A-F onto a-f)
+ * Anything else is invalid. Adjacent nibbles n0, n1 then combine to
+ * n0 * 16 + n1 with one multiply-add against the bytes {16, 1}, and the
+ * 16-bit results pack down to bytes.
+ */
+
+__attribute__((target("sse4.1")))
+static __m128i hex_nibbles_sse41(__m128i c, __m128i *ok) {
+    __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i a = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    __m128i is_d = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i is_a = _mm_cmpeq_epi8(_mm_min_epu8(a, _mm_set1_epi8(5)), a);
+
+    *ok = _mm_and_si128(*ok, _mm_or_si128(is_d, is_a));
+    return _mm_blendv_epi8(_mm_add_epi8(a, _mm_set1_epi8(10)), d, is_d);
+}
+
+__attribute__((target("sse4.1")))
+int mobi_hex_decode32_sse41(const char *hex, uint8_t out[32]) {
+    const __m128i weights = _mm_set1_epi16(0x0110);    /* bytes {16, 1} */
+    __m128i ok = _mm_set1_epi8(-1);
+    __m128i v[4];
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(const void *)(hex + i * 16));
+        v[i] = _mm_maddubs_epi16(hex_nibbles_sse41(c, &ok), weights);
+    }
+    if (_mm_movemask_epi8(ok) != 0xFFFF) {
+        return -1;
+    }
+    _mm_storeu_si128((__m128i *)(void *)out, _mm_packus_epi16(v[0], v[1]));
+    _mm_storeu_si128((__m128i *)(void *)(out + 16), _mm_packus_epi16(v[2], v[3]));
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static __m256i hex_nibbles_avx2(__m256i c, __m256i *ok) {
+    __m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+    __m256i a = _mm256_sub_epi8(_mm256_or_si256(c, _mm256_set1_epi8(0x20)),
+                                _mm256_set1_epi8('a'));
+    __m256i is_d = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+    __m256i is_a = _mm256_cmpeq_epi8(_mm256_min_epu8(a, _mm256_set1_epi8(5)), a);
+
+    *ok = _mm256_and_si256(*ok, _mm256_or_si256(is_d, is_a));
+    return _mm256_blendv_epi8(_mm256_add_epi8(a, _mm256_set1_epi8(10)), d, is_d);
+}
+
+__attribute__((target("avx2")))
+int mobi_hex_decode32_avx2(const char *hex, uint8_t out[32]) {
+    const __m256i weights = _mm256_set1_epi16(0x0110);  /* bytes {16, 1} */
+    __m256i ok = _mm256_set1_epi8(-1);
+    __m256i c0 = _mm256_loadu_si256((const __m256i *)(const void *)hex);
+    __m256i c1 = _mm256_loadu_si256((const __m256i *)(const void *)(hex + 32));
+    __m256i v0 = _mm256_maddubs_epi16(hex_nibbles_avx2(c0, &ok), weights);
+    __m256i v1 = _mm256_maddubs_epi16(hex_nibbles_avx2(c1, &ok), weights);
+    __m256i packed;
+
+    if (_mm256_movemask_epi8(ok) != -1) {
+        return -1;
+    }
+    /* packus works per 128-bit half: restore quadword order 0, 2, 1, 3 */
+    packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v0, v1), 0xD8);
+    _mm256_storeu_si256((__m256i *)(void *)out, packed);
+    return 0;
+}
+
+#else /* !MOBI_X86 */
+
+unsigned mobi_cpu_detect(void) {
+    return 0;
+}
+
+#endif /* MOBI_X86 */
@@ -0,0 +1,114 @@
+#!/bin/sh
+#
+# Mobi Protocol - Command-Line Deriver Tests
+# Copyright (c) 2024-2025 OBIVERSE LLC
+#
+# Usage: test_cli.sh <mobi binary> <vectors.json>
+#
+# Pipes the canonical vectors through the CLI in each input and output
+# format and compares every line with the expected record.
+
+MOBI=$1
+VECTORS=$2
+TMP=$(mktemp -d) || exit 2
+trap 'rm -rf "$TMP"' EXIT
+
+run=0
+passed=0
+
+# pubkey_hex full display full_formatted display_formatted, one vector a line
+awk -F'"' '
+    $2 == "pubkey_hex"        { hex = $4 }
+    $2 == "full"              { full = $4 }
+    $2 == "display"           { display = $4 }
+    $2 == "display_formatted" { dfmt = $4 }
+    $2 == "full_formatted"    { print hex, full, display, $4, dfmt }
+' "$VECTORS" > "$TMP/vectors"
+
+while read -r hex full display ffmt dfmt; do
+    printf '%s\n' "$hex" >> "$TMP/keys.hex"
+    printf '%s\t%s\t%s\n' "$hex" "$full" "$display" >> "$TMP/expect.tsv"
+    printf '%s\t%s\t%s\n' "$hex" "$ffmt" "$dfmt" >> "$TMP/expect.hyphens"
+    printf '{"pubkey":"%s","full":"%s","display":"%s"}\n' "$hex" "$full" "$display" \
+        >> "$TMP/expect.ndjson"
+    # The same key as a raw 32-byte record
+    pairs=$(printf '%s' "$hex" | sed 's/../& /g')
+    for pair in $pairs; do
+        printf "\\$(printf '%03o' "$((0x$pair))")"
+    done >> "$TMP/keys.raw"
+done < "$TMP/vectors"
+
+# check <name> <expected status> <expected output file> <command...>
+check() {
+    name=$1
+    status=$2
+    expect=$3
+    shift 3
+    run=$((run + 1))
+    printf '  %s ... ' "$name"
+    "$@" > "$TMP/out" 2> "$TMP/err"
+    got=$?
+    if [ "$got" -ne "$status" ]; then
+        echo "FAIL: exit status $got, expected $status"
+        sed 's/^/    /' "$TMP/err"
+    elif ! cmp -s "$TMP/out" "$expect"; then
+        echo "FAIL: output differs"
+        diff "$expect" "$TMP/out" | sed 's/^/    /'
+    else
+        echo "PASS"
+        passed=$((passed + 1))
+    fi
+}
+
+echo "Command-line deriver tests:"
+[ -s "$TMP/vectors" ] || { echo "  no vectors in $VECTORS"; exit 1; }
+
+check "hex lines to TSV" 0 "$TMP/expect.tsv" \
+    sh -c '"$0" < "$1"' "$MOBI" "$TMP/keys.hex"
+check "hex lines to NDJSON" 0 "$TMP/expect.ndjson" \
+    sh -c '"$0" -o ndjson < "$1"' "$MOBI" "$TMP/keys.hex"
+check "-H hyphenates" 0 "$TMP/expect.hyphens" \
+    sh -c '"$0" -H < "$1"' "$MOBI" "$TMP/keys.hex"
+
+# CRLF endings, surrounding blanks, blank lines, and a last key with no newline
+{
+    while read -r hex; do
+        printf '\r\n  %s \t\r\n\n' "$hex"
+    done < "$TMP/keys.hex"
+    printf '%s' "$(tail -n 1 "$TMP/keys.hex")"
+} > "$TMP/keys.crlf"
+cat "$TMP/expect.tsv" > "$TMP/expect.crlf"
+tail -n 1 "$TMP/expect.tsv" >> "$TMP/expect.crlf"
+check "CRLF, blanks and blank lines" 0 "$TMP/expect.crlf" \
+    sh -c '"$0" < "$1"' "$MOBI" "$TMP/keys.crlf"
+
+check "raw records from stdin" 0 "$TMP/expect.tsv" \
+    sh -c '"$0" -i raw < "$1"' "$MOBI" "$TMP/keys.raw"
+check "raw record file" 0 "$TMP/expect.tsv" "$MOBI" -i raw "$TMP/keys.raw"
+check "raw record file with pread" 0 "$TMP/expect.tsv" "$MOBI" -i raw -P "$TMP/keys.raw"
+
+# A partial record at the end: every whole one still comes out
+cp "$TMP/keys.raw" "$TMP/keys.partial"
+printf 'abc' >> "$TMP/keys.partial"
+check "raw file with a partial record" 1 "$TMP/expect.tsv" "$MOBI" -i raw "$TMP/keys.partial"
+
+# An invalid line is reported and skipped; the others still come out
+{ head -n 2 "$TMP/keys.hex"; echo "not a key"; tail -n +3 "$TMP/keys.hex"; } \
+    > "$TMP/keys.bad"
+check "invalid line exits 1" 1 "$TMP/expect.tsv" \
+    sh -c '"$0" < "$1"' "$MOBI" "$TMP/keys.bad"
+run=$((run + 1))
+printf '  invalid line reported on stderr ... '
+if grep -q 'line 3' "$TMP/err"; then
+    echo "PASS"
+    passed=$((passed + 1))
+else
+    echo "FAIL: stderr does not name line 3"
+fi
+
+check "unknown option exits 2" 2 /dev/null "$MOBI" -o xml
+
+echo ""
+echo "=========================="
+echo "Results: $passed/$run tests passed"
+[ "$passed" -eq "$run" ]
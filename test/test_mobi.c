@@ -3,10 +3,17 @@
  * Copyright (c) 2024-2025 OBIVERSE LLC
  */
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "mobi.h"
+#include "mobi_internal.h"
 
 static int tests_run = 0;
 static int tests_passed = 0;
@@ -40,6 +47,34 @@ static int tests_passed = 0;
 #define ASSERT_EQ(a, b, msg) ASSERT((a) == (b), msg)
 #define ASSERT_STR_EQ(a, b, msg) ASSERT(strcmp(a, b) == 0, msg)
 
+/* ============================================================================
+ * TEST DATA
+ * ============================================================================ */
+
+/* Mirrors test/vectors.json */
+static const struct {
+    const char *pubkey_hex;
+    const char *full;
+} canonical_vectors[] = {
+    { "0000000000000000000000000000000000000000000000000000000000000000", "587135537154686717107" },
+    { "17162c921dc4d2518f9a101db33695df1afb56ab82f5ff3e5da6eec3ca5cd917", "879044656584686196443" },
+    { "ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff", "212465100827220971331" },
+    { "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f", "466028911786694108954" },
+};
+
+#define NUM_CANONICAL_VECTORS (sizeof(canonical_vectors) / sizeof(canonical_vectors[0]))
+
+/* Deterministic pseudo-random pubkeys (xorshift64) */
+static void fill_pubkeys(uint8_t *out, size_t count, uint64_t seed) {
+    size_t i;
+    for (i = 0; i < count * 32; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        out[i] = (uint8_t)(seed >> 24);
+    }
+}
+
 /* ============================================================================
  * DERIVATION TESTS
  * ============================================================================ */
@@ -148,6 +183,35 @@ static void test_derive_invalid_length(void) {
     PASS();
 }
 
+static void test_derive_hex_n(void) {
+    TEST("derive_hex_n reads exactly len characters");
+
+    /* Canonical key followed by junk: no terminator where the key ends */
+    char buf[MOBI_PUBKEY_HEX_LEN + 8];
+    mobi_t a, b;
+    size_t i;
+
+    memcpy(buf, canonical_vectors[1].pubkey_hex, MOBI_PUBKEY_HEX_LEN);
+    memcpy(buf + MOBI_PUBKEY_HEX_LEN, "\",zz\"}\n", 8);
+
+    ASSERT_EQ(mobi_derive_hex_n(buf, MOBI_PUBKEY_HEX_LEN, &a), MOBI_OK, "derive failed");
+    ASSERT_STR_EQ(a.full, canonical_vectors[1].full, "canonical vector mismatch");
+
+    /* Upper case decodes to the same key */
+    for (i = 0; i < MOBI_PUBKEY_HEX_LEN; i++) {
+        if (buf[i] >= 'a' && buf[i] <= 'f') buf[i] = (char)(buf[i] - 'a' + 'A');
+    }
+    ASSERT_EQ(mobi_derive_hex_n(buf, MOBI_PUBKEY_HEX_LEN, &b), MOBI_OK, "derive failed");
+    ASSERT(memcmp(&a, &b, sizeof(a)) == 0, "upper case differs");
+
+    ASSERT_EQ(mobi_derive_hex_n(buf, MOBI_PUBKEY_HEX_LEN + 1, &b), MOBI_ERR_INVALID_LEN,
+              "should reject wrong length");
+    ASSERT_EQ(mobi_derive_hex_n(NULL, MOBI_PUBKEY_HEX_LEN, &b), MOBI_ERR_NULL,
+              "should reject null pubkey");
+
+    PASS();
+}
+
 static void test_derive_null_ptr(void) {
     TEST("derive handles null pointers");
 
@@ -218,6 +282,73 @@ static void test_format_full(void) {
     PASS();
 }
 
+static void test_format_canonical(void) {
+    TEST("format canonical vector in every form");
+
+    const char *pubkey = "17162c921dc4d2518f9a101db33695df1afb56ab82f5ff3e5da6eec3ca5cd917";
+    mobi_t m;
+    char formatted[32];
+
+    mobi_derive(pubkey, &m);
+
+    mobi_format_display(&m, formatted);
+    ASSERT_STR_EQ(formatted, "879-044-656-584", "display_formatted mismatch");
+    mobi_format_extended(&m, formatted);
+    ASSERT_STR_EQ(formatted, "879-044-656-584-686", "extended mismatch");
+    mobi_format_full(&m, formatted);
+    ASSERT_STR_EQ(formatted, "879-044-656-584-686-196-443", "full_formatted mismatch");
+
+    PASS();
+}
+
+static void test_format_bin(void) {
+    TEST("binary formatter matches mobi_format_*");
+
+    enum { N = 200 };
+    static uint8_t keys[N * 32];
+    static mobi_bin_t bins[N];
+    static char batch[N * (MOBI_FULL_FMT_LEN + 1)];
+    char a[32], b[32];
+    mobi_t m;
+    size_t i, written;
+
+    fill_pubkeys(keys, N, 0x77aa77aa77aa77aaULL);
+    mobi_derive_batch_bin(keys, N, bins);
+
+    written = mobi_bin_format_batch(bins, N, 21, 1, '\n', batch);
+    ASSERT_EQ(written, (size_t)N * (MOBI_FULL_FMT_LEN + 1), "batch length");
+
+    for (i = 0; i < N; i++) {
+        mobi_bin_to_mobi(&bins[i], &m);
+
+        mobi_format_display(&m, a);
+        ASSERT_EQ(mobi_bin_format(&bins[i], 12, b), MOBI_OK, "format failed");
+        ASSERT_STR_EQ(a, b, "display differs");
+
+        mobi_format_extended(&m, a);
+        mobi_bin_format(&bins[i], 15, b);
+        ASSERT_STR_EQ(a, b, "extended differs");
+
+        mobi_format_full(&m, a);
+        mobi_bin_format(&bins[i], 21, b);
+        ASSERT_STR_EQ(a, b, "full differs");
+
+        ASSERT(memcmp(batch + i * (MOBI_FULL_FMT_LEN + 1), a, MOBI_FULL_FMT_LEN) == 0,
+               "batch record differs");
+        ASSERT_EQ(batch[i * (MOBI_FULL_FMT_LEN + 1) + MOBI_FULL_FMT_LEN], '\n', "separator");
+    }
+
+    written = mobi_bin_format_batch(bins, N, 12, 0, '\0', batch);
+    ASSERT_EQ(written, (size_t)N * 13, "plain batch length");
+    mobi_bin_to_mobi(&bins[N - 1], &m);
+    ASSERT_STR_EQ(batch + (N - 1) * 13, m.display, "plain batch record");
+
+    ASSERT_EQ(mobi_bin_format(&bins[0], 20, b), MOBI_ERR_INVALID_LEN, "should reject 20");
+    ASSERT_EQ(mobi_bin_format_batch(bins, N, 20, 1, '\n', batch), 0, "should reject 20");
+
+    PASS();
+}
+
 /* ============================================================================
  * NORMALIZATION TESTS
  * ============================================================================ */
@@ -363,11 +494,1968 @@ static void test_strerror(void) {
     ASSERT(strlen(mobi_strerror(MOBI_ERR_NULL)) > 0, "NULL should have message");
     ASSERT(strlen(mobi_strerror(MOBI_ERR_INVALID_HEX)) > 0, "INVALID_HEX should have message");
     ASSERT(strlen(mobi_strerror(MOBI_ERR_INVALID_LEN)) > 0, "INVALID_LEN should have message");
+    ASSERT(strlen(mobi_strerror(MOBI_ERR_IO)) > 0, "IO should have message");
+    ASSERT(strlen(mobi_strerror(MOBI_ERR_FORMAT)) > 0, "FORMAT should have message");
+    ASSERT(strlen(mobi_strerror(MOBI_ERR_NOMEM)) > 0, "NOMEM should have message");
+    ASSERT(strlen(mobi_strerror(MOBI_ERR_EXISTS)) > 0, "EXISTS should have message");
+    ASSERT(strlen(mobi_strerror(MOBI_ERR_NOT_FOUND)) > 0, "NOT_FOUND should have message");
     ASSERT(strlen(mobi_strerror(-99)) > 0, "unknown should have message");
 
     PASS();
 }
 
+/* ============================================================================
+ * BACKEND TESTS
+ * ============================================================================ */
+
+static void test_backend_vectors(void) {
+    TEST("canonical vectors on every backend");
+
+    unsigned all = mobi_cpu_features();
+    unsigned masks[2];
+    size_t i, j;
+    mobi_t m;
+
+    masks[0] = 0;
+    masks[1] = all;
+
+    for (j = 0; j < 2; j++) {
+        mobi_cpu_restrict(masks[j]);
+        for (i = 0; i < NUM_CANONICAL_VECTORS; i++) {
+            if (mobi_derive(canonical_vectors[i].pubkey_hex, &m) != MOBI_OK ||
+                strcmp(m.full, canonical_vectors[i].full) != 0) {
+                mobi_cpu_restrict(~0u);
+                FAIL("backend disagrees with canonical vector");
+                return;
+            }
+        }
+    }
+    mobi_cpu_restrict(~0u);
+
+    printf("(features 0x%x) ", all);
+    PASS();
+}
+
+static void test_backend_random(void) {
+    TEST("accelerated backend matches portable C on random keys");
+
+    enum { N = 2000 };
+    static uint8_t keys[N * 32];
+    static mobi_t ref[N];
+    mobi_t m;
+    size_t i;
+
+    fill_pubkeys(keys, N, 0x9e3779b97f4a7c15ULL);
+
+    mobi_cpu_restrict(0);
+    for (i = 0; i < N; i++) {
+        mobi_derive_bytes(keys + i * 32, &ref[i]);
+    }
+    mobi_cpu_restrict(~0u);
+
+    for (i = 0; i < N; i++) {
+        mobi_derive_bytes(keys + i * 32, &m);
+        ASSERT(memcmp(&m, &ref[i], sizeof(m)) == 0, "backend output differs");
+    }
+
+    PASS();
+}
+
+/* ============================================================================
+ * BINARY TESTS
+ * ============================================================================ */
+
+static void test_bin_canonical(void) {
+    TEST("binary form of canonical vector");
+
+    uint8_t key[32] = {0};
+    mobi_bin_t b;
+    char buf[22];
+
+    ASSERT_EQ(mobi_derive_bin(key, &b), MOBI_OK, "derive failed");
+    ASSERT_EQ(b.hi, 587135537154ULL, "hi should be the display value");
+    ASSERT_EQ(b.lo, 686717107u, "lo should be the trailing 9 digits");
+
+    ASSERT_EQ(mobi_bin_to_string(&b, 21, buf), MOBI_OK, "render failed");
+    ASSERT_STR_EQ(buf, "587135537154686717107", "full mismatch");
+    ASSERT_EQ(mobi_bin_to_string(&b, 12, buf), MOBI_OK, "render failed");
+    ASSERT_STR_EQ(buf, "587135537154", "display mismatch");
+    ASSERT_EQ(mobi_bin_to_string(&b, 15, buf), MOBI_OK, "render failed");
+    ASSERT_STR_EQ(buf, "587135537154686", "extended mismatch");
+    ASSERT_EQ(mobi_bin_to_string(&b, 18, buf), MOBI_OK, "render failed");
+    ASSERT_STR_EQ(buf, "587135537154686717", "long mismatch");
+    ASSERT_EQ(mobi_bin_to_string(&b, 13, buf), MOBI_ERR_INVALID_LEN, "should reject 13");
+
+    ASSERT_EQ(mobi_bin_prefix(&b, 12), 587135537154ULL, "12-digit prefix");
+    ASSERT_EQ(mobi_bin_prefix(&b, 15), 587135537154686ULL, "15-digit prefix");
+    ASSERT_EQ(mobi_bin_prefix(&b, 18), 587135537154686717ULL, "18-digit prefix");
+    ASSERT_EQ(mobi_bin_prefix(&b, 21), UINT64_MAX, "21 digits do not fit");
+
+    PASS();
+}
+
+static void test_bin_matches_strings(void) {
+    TEST("binary derive, compare and parse agree with strings");
+
+    enum { N = 300 };
+    static uint8_t keys[N * 32];
+    static mobi_bin_t bins[N];
+    static mobi_bin_t batch[N];
+    mobi_t m, r;
+    mobi_bin_t p;
+    size_t i;
+
+    fill_pubkeys(keys, N, 0x5555aaaa5555aaaaULL);
+    ASSERT_EQ(mobi_derive_batch_bin(keys, N, batch), MOBI_OK, "batch failed");
+
+    for (i = 0; i < N; i++) {
+        mobi_derive_bytes(keys + i * 32, &m);
+        ASSERT_EQ(mobi_derive_bin(keys + i * 32, &bins[i]), MOBI_OK, "derive failed");
+        ASSERT(mobi_bin_compare(&bins[i], &batch[i]) == 0, "batch_bin differs");
+
+        mobi_bin_to_mobi(&bins[i], &r);
+        ASSERT(memcmp(&m, &r, sizeof(m)) == 0, "rendered mobi_t differs");
+
+        ASSERT_EQ(mobi_bin_parse(m.full, &p), MOBI_OK, "parse failed");
+        ASSERT(p.hi == bins[i].hi && p.lo == bins[i].lo, "parse round trip");
+
+        if (i > 0) {
+            mobi_t prev;
+            int c = mobi_bin_compare(&bins[i - 1], &bins[i]);
+            int sc;
+            mobi_bin_to_mobi(&bins[i - 1], &prev);
+            sc = strcmp(prev.full, m.full);
+            ASSERT((c < 0) == (sc < 0) && (c > 0) == (sc > 0), "order differs from strcmp");
+            ASSERT(mobi_bin_hash(&bins[i - 1]) != mobi_bin_hash(&bins[i]), "hash collision");
+        }
+    }
+
+    ASSERT_EQ(mobi_bin_parse("58713553715468671710", &p), MOBI_ERR_INVALID_LEN, "20 digits");
+    ASSERT_EQ(mobi_bin_parse("5871355371546867171070", &p), MOBI_ERR_INVALID_LEN, "22 digits");
+    ASSERT_EQ(mobi_bin_parse("58713553715468671710x", &p), MOBI_ERR_INVALID_CHAR, "bad char");
+
+    PASS();
+}
+
+static void test_bin_pack(void) {
+    TEST("binary pack/unpack is the 72-bit value");
+
+    /* 999999999999999999999 = 0x36_35C9ADC5DE9FFFFF, the largest mobi */
+    const uint8_t max[9] = { 0x36, 0x35, 0xC9, 0xAD, 0xC5, 0xDE, 0x9F, 0xFF, 0xFF };
+    const uint8_t ten21[9] = { 0x36, 0x35, 0xC9, 0xAD, 0xC5, 0xDE, 0xA0, 0x00, 0x00 };
+    uint8_t packed[9];
+    mobi_bin_t b;
+    char buf[22];
+
+    ASSERT_EQ(mobi_bin_unpack(max, &b), MOBI_OK, "max should unpack");
+    mobi_bin_to_string(&b, 21, buf);
+    ASSERT_STR_EQ(buf, "999999999999999999999", "max value");
+    mobi_bin_pack(&b, packed);
+    ASSERT(memcmp(packed, max, 9) == 0, "pack round trip");
+
+    ASSERT_EQ(mobi_bin_unpack(ten21, &b), MOBI_ERR_RANGE, "10^21 is out of range");
+
+    mobi_bin_parse("587135537154686717107", &b);
+    mobi_bin_pack(&b, packed);
+    ASSERT_EQ(mobi_bin_unpack(packed, &b), MOBI_OK, "unpack failed");
+    ASSERT(b.hi == 587135537154ULL && b.lo == 686717107u, "round trip");
+
+    PASS();
+}
+
+/* ============================================================================
+ * BATCH TESTS
+ * ============================================================================ */
+
+static void test_batch_vectors(void) {
+    TEST("batch derive reproduces canonical vectors");
+
+    uint8_t keys[NUM_CANONICAL_VECTORS * 32];
+    mobi_t out[NUM_CANONICAL_VECTORS];
+    size_t i, j;
+
+    for (i = 0; i < NUM_CANONICAL_VECTORS; i++) {
+        for (j = 0; j < 32; j++) {
+            unsigned int byte;
+            sscanf(canonical_vectors[i].pubkey_hex + j * 2, "%2x", &byte);
+            keys[i * 32 + j] = (uint8_t)byte;
+        }
+    }
+
+    ASSERT_EQ(mobi_derive_batch(keys, NUM_CANONICAL_VECTORS, out), MOBI_OK, "batch failed");
+    for (i = 0; i < NUM_CANONICAL_VECTORS; i++) {
+        ASSERT_STR_EQ(out[i].full, canonical_vectors[i].full, "batch full mismatch");
+    }
+
+    PASS();
+}
+
+static void test_batch_matches_single(void) {
+    TEST("batch derive matches mobi_derive_bytes");
+
+    /* Odd count so the final lanes run partly idle */
+    enum { N = 1003 };
+    static uint8_t keys[N * 32];
+    static mobi_t batch[N];
+    unsigned masks[3];
+    mobi_t m;
+    size_t i, j;
+
+    fill_pubkeys(keys, N, 0x1234567887654321ULL);
+    masks[0] = 0;                   /* scalar loop */
+    masks[1] = MOBI_CPU_AVX2;       /* 8 lanes */
+    masks[2] = ~0u;                 /* widest available */
+
+    for (j = 0; j < 3; j++) {
+        mobi_cpu_restrict(masks[j]);
+        memset(batch, 0, sizeof(batch));
+        ASSERT_EQ(mobi_derive_batch(keys, N, batch), MOBI_OK, "batch failed");
+        for (i = 0; i < N; i++) {
+            mobi_derive_bytes(keys + i * 32, &m);
+            ASSERT(memcmp(&m, &batch[i], sizeof(m)) == 0, "batch differs from single");
+        }
+    }
+    mobi_cpu_restrict(~0u);
+
+    PASS();
+}
+
+static void test_batch_edge_cases(void) {
+    TEST("batch derive handles empty and null input");
+
+    mobi_t m;
+    uint8_t key[32] = {0};
+
+    ASSERT_EQ(mobi_derive_batch(NULL, 0, NULL), MOBI_OK, "empty batch should succeed");
+    ASSERT_EQ(mobi_derive_batch(NULL, 1, &m), MOBI_ERR_NULL, "should reject null keys");
+    ASSERT_EQ(mobi_derive_batch(key, 1, NULL), MOBI_ERR_NULL, "should reject null output");
+
+    PASS();
+}
+
+static void test_speculative_matches_single(void) {
+    TEST("speculative derive matches mobi_derive_bytes");
+
+    enum { N = 500 };
+    static uint8_t keys[N * 32];
+    unsigned masks[4];
+    mobi_t a, b;
+    size_t i, j;
+
+    fill_pubkeys(keys, N, 0x0badc0ffee0ddf00ULL);
+    memset(keys, 0, 32);    /* all-zero canonical vector, accepted in round 1 */
+    masks[0] = 0;
+    masks[1] = MOBI_CPU_AVX2;
+    masks[2] = MOBI_CPU_AVX2 | MOBI_CPU_AVX512;     /* lanes even with SHA-NI */
+    masks[3] = ~0u;
+
+    for (j = 0; j < 4; j++) {
+        mobi_cpu_restrict(masks[j]);
+        ASSERT_EQ(mobi_derive_bytes_speculative(keys, &b), MOBI_OK, "derive failed");
+        ASSERT_STR_EQ(b.full, canonical_vectors[0].full, "canonical vector mismatch");
+        for (i = 0; i < N; i++) {
+            mobi_derive_bytes(keys + i * 32, &a);
+            ASSERT_EQ(mobi_derive_bytes_speculative(keys + i * 32, &b), MOBI_OK, "derive failed");
+            ASSERT(memcmp(&a, &b, sizeof(a)) == 0, "speculative differs from sequential");
+        }
+    }
+    mobi_cpu_restrict(~0u);
+
+    ASSERT_EQ(mobi_derive_bytes_speculative(NULL, &a), MOBI_ERR_NULL, "should reject null key");
+
+    PASS();
+}
+
+static void test_batch_mt_matches_single(void) {
+    TEST("multithreaded batch matches single-threaded batch");
+
+    /* Several chunks, the last one partial */
+    enum { N = 3 * 4096 + 77 };
+    static uint8_t keys[N * 32];
+    static mobi_t ref[N], mt[N];
+    static mobi_bin_t ref_bin[N], mt_bin[N];
+    int threads[4];
+    size_t i;
+
+    fill_pubkeys(keys, N, 0x5eed5eed5eed5eedULL);
+    ASSERT_EQ(mobi_derive_batch(keys, N, ref), MOBI_OK, "batch failed");
+    ASSERT_EQ(mobi_derive_batch_bin(keys, N, ref_bin), MOBI_OK, "batch failed");
+
+    threads[0] = 0;     /* one per CPU */
+    threads[1] = 1;
+    threads[2] = 3;
+    threads[3] = 8;     /* more workers than cores */
+    for (i = 0; i < 4; i++) {
+        memset(mt, 0, sizeof(mt));
+        memset(mt_bin, 0, sizeof(mt_bin));
+        ASSERT_EQ(mobi_derive_batch_mt(keys, N, mt, threads[i]), MOBI_OK, "mt batch failed");
+        ASSERT_EQ(mobi_derive_batch_bin_mt(keys, N, mt_bin, threads[i]), MOBI_OK,
+                  "mt batch failed");
+        ASSERT(memcmp(ref, mt, sizeof(ref)) == 0, "mt batch differs");
+        ASSERT(memcmp(ref_bin, mt_bin, sizeof(ref_bin)) == 0, "mt bin batch differs");
+    }
+
+    ASSERT_EQ(mobi_derive_batch_mt(NULL, 0, NULL, 4), MOBI_OK, "empty batch should succeed");
+    ASSERT_EQ(mobi_derive_batch_mt(NULL, 1, mt, 4), MOBI_ERR_NULL, "should reject null keys");
+    ASSERT_EQ(mobi_derive_batch_bin_mt(keys, 1, NULL, 4), MOBI_ERR_NULL,
+              "should reject null output");
+
+    PASS();
+}
+
+static void test_hex_decode_batch(void) {
+    TEST("hex batch decode matches bytes and rejects non-hex on every backend");
+
+    enum { N = 64, STRIDE = MOBI_PUBKEY_HEX_LEN + 1 };
+    static const char digits[] = "0123456789abcdef0123456789ABCDEF";
+    static uint8_t keys[N * 32];
+    static uint8_t decoded[N * 32];
+    static char text[N * STRIDE];
+    unsigned masks[3];
+    size_t i, j, m;
+
+    fill_pubkeys(keys, N, 0x0123456789abcdefULL);
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < 32; j++) {
+            /* Alternate case by key so both paths see both */
+            int upper = (int)((i + j) & 1) * 16;
+            text[i * STRIDE + j * 2] = digits[(keys[i * 32 + j] >> 4) + upper];
+            text[i * STRIDE + j * 2 + 1] = digits[(keys[i * 32 + j] & 0xF) + upper];
+        }
+        text[i * STRIDE + MOBI_PUBKEY_HEX_LEN] = '\n';
+    }
+
+    masks[0] = 0;                   /* table lookup */
+    masks[1] = MOBI_CPU_SSE41;
+    masks[2] = MOBI_CPU_AVX2;
+
+    for (m = 0; m < 3; m++) {
+        int c;
+
+        mobi_cpu_restrict(masks[m]);
+        memset(decoded, 0xAA, sizeof(decoded));
+        ASSERT_EQ(mobi_hex_decode_batch(text, N, STRIDE, decoded), MOBI_OK, "decode failed");
+        ASSERT(memcmp(keys, decoded, sizeof(keys)) == 0, "decoded bytes differ");
+
+        /* Every byte value at the first, a middle and the last position */
+        for (c = 0; c < 256; c++) {
+            int valid = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+                        (c >= 'A' && c <= 'F');
+            size_t pos[3];
+
+            pos[0] = 0;
+            pos[1] = 37;
+            pos[2] = MOBI_PUBKEY_HEX_LEN - 1;
+            for (j = 0; j < 3; j++) {
+                char saved = text[pos[j]];
+                mobi_error_t err;
+
+                text[pos[j]] = (char)c;
+                err = mobi_hex_decode_batch(text, 1, 0, decoded);
+                text[pos[j]] = saved;
+                ASSERT_EQ(err, valid ? MOBI_OK : MOBI_ERR_INVALID_HEX, "validity mismatch");
+            }
+        }
+    }
+    mobi_cpu_restrict(~0u);
+
+    /* A bad record is zeroed and reported; its neighbours still decode */
+    text[STRIDE + 5] = 'g';
+    ASSERT_EQ(mobi_hex_decode_batch(text, 3, STRIDE, decoded), MOBI_ERR_INVALID_HEX,
+              "should report bad record");
+    ASSERT(memcmp(decoded, keys, 32) == 0, "record 0 should decode");
+    ASSERT(memcmp(decoded + 64, keys + 64, 32) == 0, "record 2 should decode");
+    for (j = 0; j < 32; j++) {
+        ASSERT_EQ(decoded[32 + j], 0, "bad record should be zeroed");
+    }
+
+    ASSERT_EQ(mobi_hex_decode_batch(text, 1, 63, decoded), MOBI_ERR_INVALID_LEN,
+              "should reject short stride");
+    ASSERT_EQ(mobi_hex_decode_batch(NULL, 1, 0, decoded), MOBI_ERR_NULL,
+              "should reject null input");
+
+    PASS();
+}
+
+/* ============================================================================
+ * CORPUS TESTS
+ * ============================================================================ */
+
+#define CORPUS_TMP "test_corpus.tmp"
+
+/* Temporary files (path.XXXXXX) a writer of path left in this directory */
+static int temps_left(const char *path) {
+    size_t len = strlen(path);
+    DIR *dir = opendir(".");
+    struct dirent *e;
+    int left = 0;
+
+    if (dir == NULL) {
+        return -1;
+    }
+    while ((e = readdir(dir)) != NULL) {
+        if (strlen(e->d_name) == len + 7 && strncmp(e->d_name, path, len) == 0 &&
+            e->d_name[len] == '.') {
+            left++;
+        }
+    }
+    closedir(dir);
+    return left;
+}
+
+static void test_corpus_roundtrip(void) {
+    TEST("corpus write, map, derive and verify");
+
+    enum { N = 10000 };
+    static uint8_t keys[N * 32];
+    static mobi_bin_t ref[N], got[N];
+    mobi_corpus_writer_t w;
+    mobi_corpus_t c;
+    uint64_t bad;
+    uint8_t packed[9];
+    size_t i;
+
+    fill_pubkeys(keys, N, 0xc0c0c0c0deadbeefULL);
+    ASSERT_EQ(mobi_derive_batch_bin(keys, N, ref), MOBI_OK, "batch failed");
+
+    /* Streamed in uneven pieces, with the mobi column */
+    ASSERT_EQ(mobi_corpus_writer_open(&w, CORPUS_TMP), MOBI_OK, "writer open failed");
+    ASSERT_EQ(mobi_corpus_writer_add(&w, keys, 1), MOBI_OK, "add failed");
+    ASSERT_EQ(mobi_corpus_writer_add(&w, keys + 32, N - 1), MOBI_OK, "add failed");
+    ASSERT_EQ(mobi_corpus_writer_close(&w, MOBI_CORPUS_MOBIS, 2), MOBI_OK, "close failed");
+
+    ASSERT_EQ(mobi_corpus_open(CORPUS_TMP, &c), MOBI_OK, "open failed");
+    ASSERT_EQ(c.count, N, "wrong count");
+    ASSERT(c.mobis != NULL, "mobi column missing");
+    ASSERT(memcmp(c.keys, keys, sizeof(keys)) == 0, "key column differs");
+    for (i = 0; i < N; i++) {
+        mobi_bin_pack(&ref[i], packed);
+        ASSERT(memcmp(c.mobis + i * 9, packed, 9) == 0, "mobi column differs");
+    }
+
+    ASSERT_EQ(mobi_corpus_derive(&c, 0, N, got, 0), MOBI_OK, "derive failed");
+    ASSERT(memcmp(ref, got, sizeof(ref)) == 0, "derived mobis differ");
+    ASSERT_EQ(mobi_corpus_derive(&c, N - 10, 10, got, 1), MOBI_OK, "tail derive failed");
+    ASSERT(memcmp(&ref[N - 10], got, 10 * sizeof(mobi_bin_t)) == 0, "tail differs");
+    ASSERT_EQ(mobi_corpus_derive(&c, N - 10, 11, got, 1), MOBI_ERR_INVALID_LEN,
+              "should reject range past the end");
+
+    ASSERT_EQ(mobi_corpus_verify(&c, 3, &bad), MOBI_OK, "verify failed");
+    ASSERT_EQ(bad, 0, "fresh corpus should verify");
+    mobi_corpus_close(&c);
+
+    /* Flip the last byte of one stored mobi */
+    {
+        long at = MOBI_CORPUS_HEADER_LEN + N * 32L + 1234 * 9L + 8;
+        FILE *f = fopen(CORPUS_TMP, "r+b");
+        int byte;
+
+        ASSERT(f != NULL, "reopen failed");
+        fseek(f, at, SEEK_SET);
+        byte = fgetc(f);
+        fseek(f, at, SEEK_SET);
+        fputc(byte ^ 0xFF, f);
+        fclose(f);
+    }
+    ASSERT_EQ(mobi_corpus_open(CORPUS_TMP, &c), MOBI_OK, "open failed");
+    ASSERT_EQ(mobi_corpus_verify(&c, 0, &bad), MOBI_OK, "verify failed");
+    ASSERT_EQ(bad, 1, "should find the corrupted mobi");
+
+    /* Keys only, replacing the corpus c still maps */
+    ASSERT_EQ(mobi_corpus_writer_open(&w, CORPUS_TMP), MOBI_OK, "writer open failed");
+    ASSERT_EQ(mobi_corpus_writer_add(&w, keys, 100), MOBI_OK, "add failed");
+    {
+        mobi_corpus_t before;
+
+        ASSERT_EQ(mobi_corpus_open(CORPUS_TMP, &before), MOBI_OK, "open while writing");
+        ASSERT_EQ(before.count, N, "old corpus in place until close");
+        mobi_corpus_close(&before);
+    }
+    ASSERT_EQ(mobi_corpus_writer_close(&w, 0, 0), MOBI_OK, "close failed");
+    ASSERT_EQ(mobi_corpus_verify(&c, 0, &bad), MOBI_OK, "old mapping verify failed");
+    ASSERT_EQ(bad, 1, "old mapping still serves");
+    mobi_corpus_close(&c);
+    ASSERT_EQ(mobi_corpus_open(CORPUS_TMP, &c), MOBI_OK, "open failed");
+    ASSERT_EQ(c.count, 100, "wrong count");
+    ASSERT(c.mobis == NULL, "unexpected mobi column");
+    ASSERT_EQ(mobi_corpus_verify(&c, 0, &bad), MOBI_ERR_FORMAT, "nothing to verify");
+    mobi_corpus_close(&c);
+    ASSERT_EQ(temps_left(CORPUS_TMP), 0, "temporary file left behind");
+
+    remove(CORPUS_TMP);
+    PASS();
+}
+
+static void test_corpus_writers_apart(void) {
+    TEST("corpus writers of one path keep their own temporary files");
+
+    static uint8_t keys[300 * 32];
+    mobi_corpus_writer_t a, b;
+    mobi_corpus_t c;
+    FILE *stray;
+
+    fill_pubkeys(keys, 300, 0xa5a5a5a5b6b6b6b6ULL);
+
+    /* Someone else's file that merely looks like a temporary name */
+    stray = fopen(CORPUS_TMP ".tmp", "wb");
+    ASSERT(stray != NULL, "stray file");
+    fputs("mine", stray);
+    fclose(stray);
+
+    /* Interleaved: each writer's file is whole, and the last close wins */
+    ASSERT_EQ(mobi_corpus_writer_open(&a, CORPUS_TMP), MOBI_OK, "writer a open failed");
+    ASSERT_EQ(mobi_corpus_writer_open(&b, CORPUS_TMP), MOBI_OK, "writer b open failed");
+    ASSERT_EQ(temps_left(CORPUS_TMP), 2, "one temporary file per writer");
+    ASSERT_EQ(mobi_corpus_writer_add(&a, keys, 100), MOBI_OK, "add a failed");
+    ASSERT_EQ(mobi_corpus_writer_add(&b, keys, 300), MOBI_OK, "add b failed");
+    ASSERT_EQ(mobi_corpus_writer_close(&a, MOBI_CORPUS_MOBIS, 1), MOBI_OK, "close a failed");
+    ASSERT_EQ(mobi_corpus_open(CORPUS_TMP, &c), MOBI_OK, "open a");
+    ASSERT_EQ(c.count, 100, "writer a's corpus");
+    mobi_corpus_close(&c);
+    ASSERT_EQ(mobi_corpus_writer_close(&b, MOBI_CORPUS_MOBIS, 1), MOBI_OK, "close b failed");
+    ASSERT_EQ(mobi_corpus_open(CORPUS_TMP, &c), MOBI_OK, "open b");
+    ASSERT_EQ(c.count, 300, "writer b's corpus");
+    mobi_corpus_close(&c);
+    ASSERT_EQ(temps_left(CORPUS_TMP), 0, "temporary file left behind");
+
+    stray = fopen(CORPUS_TMP ".tmp", "rb");
+    ASSERT(stray != NULL, "stray file destroyed");
+    fclose(stray);
+
+    remove(CORPUS_TMP ".tmp");
+    remove(CORPUS_TMP);
+    PASS();
+}
+
+static void test_corpus_rejects_bad_files(void) {
+    TEST("corpus open rejects bad and truncated files");
+
+    uint8_t keys[4 * 32] = {0};
+    mobi_corpus_writer_t w;
+    mobi_corpus_t c;
+    FILE *f;
+
+    ASSERT_EQ(mobi_corpus_open("/nonexistent/corpus", &c), MOBI_ERR_IO, "missing file");
+
+    /* Not a corpus */
+    f = fopen(CORPUS_TMP, "wb");
+    ASSERT(f != NULL, "create failed");
+    fputs("{\"pubkey\":\"not a corpus, but long enough to hold a header......\"}\n", f);
+    fclose(f);
+    ASSERT_EQ(mobi_corpus_open(CORPUS_TMP, &c), MOBI_ERR_FORMAT, "bad magic");
+
+    /* Header claims more keys than the file holds */
+    ASSERT_EQ(mobi_corpus_writer_open(&w, CORPUS_TMP), MOBI_OK, "writer open failed");
+    ASSERT_EQ(mobi_corpus_writer_add(&w, keys, 4), MOBI_OK, "add failed");
+    w.count = 5;
+    ASSERT_EQ(mobi_corpus_writer_close(&w, 0, 0), MOBI_OK, "close failed");
+    ASSERT_EQ(mobi_corpus_open(CORPUS_TMP, &c), MOBI_ERR_FORMAT, "truncated keys");
+
+    remove(CORPUS_TMP);
+    PASS();
+}
+
+typedef struct {
+    mobi_bin_t *out;
+    uint64_t expect;        /* next index, to check file order */
+    int in_order;
+    size_t calls;
+    size_t stop_after;      /* 0 = never stop */
+} ingest_sink;
+
+static int ingest_collect(void *ctx, const uint8_t *keys, const mobi_bin_t *mobis,
+                          size_t count, uint64_t first) {
+    ingest_sink *sink = (ingest_sink *)ctx;
+
+    (void)keys;
+    if (first != sink->expect) {
+        sink->in_order = 0;
+    }
+    memcpy(sink->out + first, mobis, count * sizeof(mobi_bin_t));
+    sink->expect = first + count;
+    sink->calls++;
+    return sink->stop_after != 0 && sink->calls == sink->stop_after;
+}
+
+static void test_ingest(void) {
+    TEST("ingest derives a file region in order with io_uring and pread");
+
+    enum { N = 5000 };
+    static uint8_t keys[N * 32];
+    static mobi_bin_t ref[N], got[N];
+    mobi_corpus_writer_t w;
+    mobi_ingest_opts_t opts;
+    ingest_sink sink;
+    unsigned flags[2];
+    size_t i;
+
+    fill_pubkeys(keys, N, 0x1d1d1d1d2e2e2e2eULL);
+    ASSERT_EQ(mobi_derive_batch_bin(keys, N, ref), MOBI_OK, "batch failed");
+
+    /* The key column of a corpus: a region that starts past a header */
+    ASSERT_EQ(mobi_corpus_writer_open(&w, CORPUS_TMP), MOBI_OK, "writer open failed");
+    ASSERT_EQ(mobi_corpus_writer_add(&w, keys, N), MOBI_OK, "add failed");
+    ASSERT_EQ(mobi_corpus_writer_close(&w, MOBI_CORPUS_MOBIS, 0), MOBI_OK, "close failed");
+
+    flags[0] = 0;                   /* io_uring where the kernel allows it */
+    flags[1] = MOBI_INGEST_PREAD;
+    for (i = 0; i < 2; i++) {
+        memset(&opts, 0, sizeof(opts));
+        opts.offset = MOBI_CORPUS_HEADER_LEN;
+        opts.length = N * 32;
+        opts.buffer_size = 1000;    /* 31 keys: many refills of each buffer */
+        opts.depth = 4;
+        opts.threads = 1;
+        opts.flags = flags[i];
+
+        memset(got, 0, sizeof(got));
+        memset(&sink, 0, sizeof(sink));
+        sink.out = got;
+        sink.in_order = 1;
+        ASSERT_EQ(mobi_ingest(CORPUS_TMP, &opts, ingest_collect, &sink), MOBI_OK,
+                  "ingest failed");
+        ASSERT(sink.in_order, "buffers out of file order");
+        ASSERT_EQ(sink.expect, N, "not every key was delivered");
+        ASSERT(memcmp(ref, got, sizeof(ref)) == 0, "ingested mobis differ");
+
+        /* Stopping early leaves nothing in flight behind */
+        memset(&sink, 0, sizeof(sink));
+        sink.out = got;
+        sink.in_order = 1;
+        sink.stop_after = 3;
+        ASSERT_EQ(mobi_ingest(CORPUS_TMP, &opts, ingest_collect, &sink), MOBI_OK,
+                  "ingest failed");
+        ASSERT_EQ(sink.calls, 3, "should stop when asked");
+    }
+
+    /* The whole file is header + keys + 9-byte mobis: not whole keys */
+    ASSERT_EQ(mobi_ingest(CORPUS_TMP, NULL, ingest_collect, &sink), MOBI_ERR_INVALID_LEN,
+              "should reject partial keys");
+    memset(&opts, 0, sizeof(opts));
+    opts.offset = MOBI_CORPUS_HEADER_LEN;
+    opts.length = (N + 2000) * 32;     /* beyond the keys and the mobi column */
+    ASSERT_EQ(mobi_ingest(CORPUS_TMP, &opts, ingest_collect, &sink), MOBI_ERR_INVALID_LEN,
+              "should reject region past end of file");
+    ASSERT_EQ(mobi_ingest("/nonexistent/keys", NULL, ingest_collect, &sink), MOBI_ERR_IO,
+              "missing file");
+
+    remove(CORPUS_TMP);
+    PASS();
+}
+
+/* Point every io_uring descriptor of the process at /dev/null */
+static int ingest_break_ring(void *ctx, const uint8_t *keys, const mobi_bin_t *mobis,
+                             size_t count, uint64_t first) {
+    int *broken = (int *)ctx;
+    char link[64], target[64];
+    int fd, null = open("/dev/null", O_RDONLY);
+
+    (void)keys;
+    (void)mobis;
+    (void)count;
+    (void)first;
+    for (fd = 3; fd < 1024 && null >= 0; fd++) {
+        ssize_t len;
+
+        snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+        len = readlink(link, target, sizeof(target) - 1);
+        if (len > 0) {
+            target[len] = '\0';
+            if (strcmp(target, "anon_inode:[io_uring]") == 0 && dup2(null, fd) == fd) {
+                (*broken)++;
+            }
+        }
+    }
+    if (null >= 0) {
+        close(null);
+    }
+    return 0;
+}
+
+static void test_ingest_ring_failure(void) {
+    TEST("ingest gives up on a ring it cannot wait on");
+
+    enum { N = 1000 };
+    static uint8_t keys[N * 32];
+    mobi_corpus_writer_t w;
+    mobi_ingest_opts_t opts;
+    int broken = 0;
+
+    if (!mobi_ingest_uring_available()) {
+        PASS();     /* Nothing to break: ingest reads with pread */
+        return;
+    }
+    fill_pubkeys(keys, N, 0x5151515162626262ULL);
+    ASSERT_EQ(mobi_corpus_writer_open(&w, CORPUS_TMP), MOBI_OK, "writer open failed");
+    ASSERT_EQ(mobi_corpus_writer_add(&w, keys, N), MOBI_OK, "add failed");
+    ASSERT_EQ(mobi_corpus_writer_close(&w, 0, 0), MOBI_OK, "close failed");
+
+    /*
+     * After the first buffer the ring refuses every call: the refill cannot
+     * be submitted, and the reads still queued cannot be waited for.
+     */
+    memset(&opts, 0, sizeof(opts));
+    opts.offset = MOBI_CORPUS_HEADER_LEN;
+    opts.length = N * 32;
+    opts.buffer_size = 1024;
+    opts.depth = 4;
+    opts.threads = 1;
+    ASSERT_EQ(mobi_ingest(CORPUS_TMP, &opts, ingest_break_ring, &broken), MOBI_ERR_IO,
+              "a dead ring is an I/O error");
+    ASSERT_EQ(broken, 1, "the ring was not found");
+
+    remove(CORPUS_TMP);
+    PASS();
+}
+
+/* ============================================================================
+ * ARROW EXPORT TESTS
+ * ============================================================================ */
+
+#define ARROW_TMP "test_arrow.tmp"
+
+static uint64_t le_bytes(const uint8_t *p, int n) {
+    uint64_t v = 0;
+    while (n-- > 0) {
+        v = (v << 8) | p[n];
+    }
+    return v;
+}
+
+static void test_arrow_export(void) {
+    TEST("arrow export writes one aligned record batch per add");
+
+    enum { N = 300, SPLIT = 100 };
+    static uint8_t keys[N * 32];
+    static mobi_bin_t bins[N];
+    static uint8_t file[64 * 1024];
+    mobi_arrow_writer_t w;
+    size_t len, at, row, batch;
+    FILE *f;
+
+    fill_pubkeys(keys, N, 0x5a5a5a5a3c3c3c3cULL);
+    ASSERT_EQ(mobi_derive_batch_bin(keys, N, bins), MOBI_OK, "batch failed");
+
+    ASSERT_EQ(mobi_arrow_writer_open(&w, ARROW_TMP), MOBI_OK, "open failed");
+    ASSERT_EQ(mobi_arrow_writer_add(&w, keys, bins, SPLIT), MOBI_OK, "add failed");
+    ASSERT_EQ(mobi_arrow_writer_add(&w, keys, bins, 0), MOBI_OK, "empty add failed");
+    ASSERT_EQ(mobi_arrow_writer_add(&w, keys + SPLIT * 32, bins + SPLIT, N - SPLIT), MOBI_OK,
+              "add failed");
+    ASSERT_EQ(w.batches, 2, "an empty add should write no batch");
+    ASSERT_EQ(w.rows, N, "row count");
+    ASSERT_EQ(mobi_arrow_writer_close(&w), MOBI_OK, "close failed");
+
+    f = fopen(ARROW_TMP, "rb");
+    ASSERT(f != NULL, "file missing");
+    len = fread(file, 1, sizeof(file), f);
+    fclose(f);
+    remove(ARROW_TMP);
+
+    ASSERT(len > 16 && len < sizeof(file), "unexpected file size");
+    ASSERT(memcmp(file, "ARROW1\0\0", 8) == 0, "leading magic");
+    ASSERT(memcmp(file + len - 6, "ARROW1", 6) == 0, "trailing magic");
+
+    /* Schema message, then the batches: prefix, metadata, then the body */
+    at = 8 + 8 + le_bytes(file + 12, 4);
+    row = 0;
+    for (batch = 0; batch < 2; batch++) {
+        size_t n = batch == 0 ? SPLIT : N - SPLIT;
+        const uint8_t *body;
+        size_t i;
+
+        ASSERT_EQ(le_bytes(file + at, 4), 0xFFFFFFFFu, "continuation marker");
+        ASSERT_EQ(le_bytes(file + at + 4, 4) % 8, 0, "metadata not padded");
+        body = file + at + 8 + le_bytes(file + at + 4, 4);
+        ASSERT_EQ((size_t)(body - file) % 8, 0, "body not aligned");
+
+        /* pubkey[32] x n, decimal128 x n, uint64 x n */
+        ASSERT(memcmp(body, keys + row * 32, n * 32) == 0, "pubkey column");
+        for (i = 0; i < n; i++) {
+            const uint8_t *full = body + n * 32 + i * 16;
+            uint8_t packed[9];
+            int j;
+
+            mobi_bin_pack(&bins[row + i], packed);
+            for (j = 0; j < 9; j++) {
+                ASSERT_EQ(full[j], packed[8 - j], "full column");
+            }
+            ASSERT_EQ(le_bytes(full + 9, 7), 0, "full column high bytes");
+            ASSERT_EQ(le_bytes(body + n * 48 + i * 8, 8), bins[row + i].hi, "display column");
+        }
+        at = (size_t)(body - file) + n * 56;
+        row += n;
+    }
+
+    /* End-of-stream marker, footer, footer length, magic */
+    ASSERT_EQ(le_bytes(file + at, 8), 0xFFFFFFFFu, "end-of-stream marker");
+    ASSERT_EQ(at + 8 + le_bytes(file + len - 10, 4) + 10, len, "footer length");
+
+    ASSERT_EQ(mobi_arrow_writer_open(&w, "/nonexistent/out.arrow"), MOBI_ERR_IO,
+              "unwritable path");
+    PASS();
+}
+
+/* ============================================================================
+ * DIRECTORY TESTS
+ * ============================================================================ */
+
+/* Entries of a sorted set matching a prefix, by string comparison */
+static size_t count_prefix(const mobi_bin_t *m, size_t n, const char *prefix, size_t len) {
+    char full[MOBI_FULL_LEN + 1];
+    size_t i, hits = 0;
+
+    for (i = 0; i < n; i++) {
+        mobi_bin_to_string(&m[i], MOBI_FULL_LEN, full);
+        hits += memcmp(full, prefix, len) == 0;
+    }
+    return hits;
+}
+
+static void test_dir_lookup(void) {
+    TEST("directory prefix lookup matches a linear scan");
+
+    enum { N = 2000 };
+    static const int levels[4] = { 12, 15, 18, 21 };
+    static uint8_t keys[N * 32];
+    static mobi_bin_t bins[N];
+    static int seen[N];
+    char full[MOBI_FULL_LEN + 1];
+    mobi_bin_t start, end;
+    mobi_dir_t dir;
+    size_t i, first, count;
+    int l;
+
+    fill_pubkeys(keys, N, 0x0123456789abcdefULL);
+    ASSERT_EQ(mobi_derive_batch_bin(keys, N, bins), MOBI_OK, "batch failed");
+
+    /* Collisions at every level: copies that share 12, 15 and 18 digits */
+    bins[1].hi = bins[0].hi;
+    bins[2].hi = bins[0].hi;
+    bins[2].lo = bins[0].lo / 1000000 * 1000000 + 1;
+    bins[3].hi = bins[0].hi;
+    bins[3].lo = bins[0].lo / 1000 * 1000 + (bins[0].lo + 1) % 1000;
+    bins[4] = bins[0];
+
+    ASSERT_EQ(mobi_dir_build(&dir, bins, N), MOBI_OK, "build failed");
+    ASSERT_EQ(dir.count, N, "count");
+    for (i = 0; i < N; i++) {
+        const mobi_entry_t *e = &dir.entries[i];
+        ASSERT(e->id < N && !seen[e->id], "ids are not a permutation");
+        seen[e->id] = 1;
+        ASSERT(e->hi == bins[e->id].hi && e->lo == bins[e->id].lo, "entry lost its mobi");
+        if (i > 0) {
+            const mobi_entry_t *p = &dir.entries[i - 1];
+            ASSERT(p->hi < e->hi || (p->hi == e->hi && p->lo <= e->lo), "not sorted");
+        }
+    }
+
+    for (i = 0; i < 200; i++) {
+        mobi_bin_to_string(&bins[i], MOBI_FULL_LEN, full);
+        for (l = 0; l < 4; l++) {
+            size_t j;
+
+            ASSERT_EQ(mobi_lookup(&dir, full, (size_t)levels[l], &first, &count), MOBI_OK,
+                      "lookup failed");
+            ASSERT_EQ(count, count_prefix(bins, N, full, (size_t)levels[l]), "range size");
+            for (j = first; j < first + count; j++) {
+                mobi_bin_t m;
+                char got[MOBI_FULL_LEN + 1];
+
+                m.hi = dir.entries[j].hi;
+                m.lo = dir.entries[j].lo;
+                mobi_bin_to_string(&m, MOBI_FULL_LEN, got);
+                ASSERT(memcmp(got, full, (size_t)levels[l]) == 0, "entry outside prefix");
+            }
+        }
+    }
+    mobi_bin_to_string(&bins[0], MOBI_FULL_LEN, full);
+    ASSERT_EQ(mobi_lookup(&dir, full, 12, &first, &count), MOBI_OK, "lookup failed");
+    ASSERT(count >= 5, "display collisions");
+    ASSERT_EQ(mobi_lookup(&dir, full, 21, &first, &count), MOBI_OK, "lookup failed");
+    ASSERT_EQ(count, 2, "duplicate full mobi");
+    ASSERT(dir.entries[first].id == 0 && dir.entries[first + 1].id == 4, "input order of ties");
+
+    /* Short prefixes, the top of the range and bad input */
+    ASSERT_EQ(mobi_lookup(&dir, "5", 1, &first, &count), MOBI_OK, "lookup failed");
+    ASSERT_EQ(count, count_prefix(bins, N, "5", 1), "one-digit prefix");
+    ASSERT_EQ(mobi_prefix_range("999999999999999999999", 21, &start, &end), MOBI_OK, "range");
+    ASSERT(end.hi == 1000000000000ULL && end.lo == 0, "end of range is 10^21");
+    ASSERT_EQ(mobi_prefix_range("1234567890123", 13, &start, &end), MOBI_OK, "range");
+    ASSERT(start.hi == 123456789012ULL && start.lo == 300000000, "13-digit start");
+    ASSERT(end.hi == 123456789012ULL && end.lo == 400000000, "13-digit end");
+    ASSERT_EQ(mobi_lookup(&dir, "12a", 3, &first, &count), MOBI_ERR_INVALID_CHAR, "bad digit");
+    ASSERT_EQ(mobi_lookup(&dir, full, 0, &first, &count), MOBI_ERR_INVALID_LEN, "empty prefix");
+    ASSERT_EQ(mobi_lookup(&dir, full, 22, &first, &count), MOBI_ERR_INVALID_LEN, "too long");
+
+    mobi_dir_free(&dir);
+    ASSERT_EQ(mobi_dir_build(&dir, bins, 0), MOBI_OK, "empty build");
+    ASSERT_EQ(mobi_lookup(&dir, "1", 1, &first, &count), MOBI_OK, "empty lookup");
+    ASSERT_EQ(count, 0, "empty directory has no matches");
+    mobi_dir_free(&dir);
+    PASS();
+}
+
+/* Shortest of 12/15/18/21 digits no other member shares, by brute force */
+static int brute_level(const mobi_bin_t *m, size_t n, size_t i) {
+    static const int levels[4] = { 12, 15, 18, 21 };
+    char a[MOBI_FULL_LEN + 1], b[MOBI_FULL_LEN + 1];
+    int need = 0;
+    size_t j;
+
+    mobi_bin_to_string(&m[i], MOBI_FULL_LEN, a);
+    for (j = 0; j < n; j++) {
+        int l = 0;
+        if (j == i) {
+            continue;
+        }
+        mobi_bin_to_string(&m[j], MOBI_FULL_LEN, b);
+        while (l < 3 && memcmp(a, b, (size_t)levels[l]) == 0) {
+            l++;
+        }
+        need = l > need ? l : need;
+    }
+    return levels[need];
+}
+
+/* Random mobis below 10^21, with every fourth one close to an earlier one */
+static void fill_colliding(mobi_bin_t *m, size_t n, uint64_t seed) {
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        m[i].hi = (seed >> 16) % 1000000000000ULL;
+        m[i].lo = (uint32_t)((seed >> 8) % 1000000000u);
+        if (i >= 4 && i % 4 == 0) {
+            /* Shares 12, 15, 18 or all 21 digits with an earlier mobi */
+            static const uint32_t unit[4] = { 1000000000u, 1000000, 1000, 1 };
+            const mobi_bin_t *near = &m[(seed >> 40) % i];
+            uint32_t u = unit[(seed >> 3) & 3];
+
+            m[i].hi = near->hi;
+            m[i].lo = near->lo / u * u + m[i].lo % u;
+        }
+    }
+}
+
+static void test_resolve_levels(void) {
+    TEST("resolve levels gives each user its shortest unique form");
+
+    enum { SMALL = 1500, LARGE = 300000 };
+    static mobi_bin_t bins[LARGE];
+    static uint8_t levels[LARGE], again[LARGE];
+    size_t i, hist[22];
+
+    fill_colliding(bins, SMALL, 0x1234);
+    ASSERT_EQ(mobi_resolve_levels(bins, SMALL, levels, 1), MOBI_OK, "resolve failed");
+    for (i = 0; i < SMALL; i++) {
+        ASSERT_EQ(levels[i], brute_level(bins, SMALL, i), "level differs from brute force");
+    }
+
+    /* Enough users for a multi-block parallel sort: same answer */
+    fill_colliding(bins, LARGE, 0x5678);
+    ASSERT_EQ(mobi_resolve_levels(bins, LARGE, levels, 1), MOBI_OK, "resolve failed");
+    ASSERT_EQ(mobi_resolve_levels(bins, LARGE, again, 4), MOBI_OK, "resolve failed");
+    ASSERT(memcmp(levels, again, LARGE) == 0, "thread count changed the levels");
+    memset(hist, 0, sizeof(hist));
+    for (i = 0; i < LARGE; i++) {
+        ASSERT(levels[i] == 12 || levels[i] == 15 || levels[i] == 18 || levels[i] == 21,
+               "not a protocol level");
+        hist[levels[i]]++;
+    }
+    ASSERT(hist[12] > 0 && hist[15] > 0 && hist[18] > 0 && hist[21] > 0,
+           "every level should occur");
+
+    ASSERT_EQ(mobi_resolve_levels(bins, 0, NULL, 0), MOBI_OK, "empty set");
+    ASSERT_EQ(mobi_resolve_levels(NULL, 5, levels, 0), MOBI_ERR_NULL, "null input");
+    PASS();
+}
+
+static int entry_order(const void *a, const void *b) {
+    const mobi_entry_t *x = (const mobi_entry_t *)a;
+    const mobi_entry_t *y = (const mobi_entry_t *)b;
+
+    if (x->hi != y->hi) {
+        return x->hi < y->hi ? -1 : 1;
+    }
+    if (x->lo != y->lo) {
+        return x->lo < y->lo ? -1 : 1;
+    }
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+
+static void test_sort_entries(void) {
+    TEST("radix sort is stable and matches qsort");
+
+    enum { N = 200000 };
+    static const size_t sizes[4] = { 2, 1000, 140000, N };
+    static mobi_bin_t bins[N];
+    static mobi_entry_t a[N], b[N], scratch[N];
+    size_t i, s;
+    int threads;
+
+    fill_colliding(bins, N, 0x9abc);
+    for (s = 0; s < 4; s++) {
+        for (threads = 1; threads <= 4; threads += 3) {
+            for (i = 0; i < sizes[s]; i++) {
+                a[i].hi = bins[i].hi;
+                a[i].lo = bins[i].lo;
+                a[i].id = (uint32_t)i;
+            }
+            memcpy(b, a, sizes[s] * sizeof(mobi_entry_t));
+            qsort(b, sizes[s], sizeof(mobi_entry_t), entry_order);
+            ASSERT_EQ(mobi_sort_entries(a, threads == 1 ? NULL : scratch, sizes[s], threads),
+                      MOBI_OK, "sort failed");
+            ASSERT(memcmp(a, b, sizes[s] * sizeof(mobi_entry_t)) == 0, "order differs");
+        }
+    }
+
+    /* Digits shared by every entry are skipped passes: still sorted */
+    for (i = 0; i < N; i++) {
+        a[i].hi = 123456789012ULL + (i * 7919) % 5;
+        a[i].lo = 42;
+        a[i].id = (uint32_t)i;
+    }
+    memcpy(b, a, sizeof(a));
+    qsort(b, N, sizeof(mobi_entry_t), entry_order);
+    ASSERT_EQ(mobi_sort_entries(a, NULL, N, 4), MOBI_OK, "sort failed");
+    ASSERT(memcmp(a, b, sizeof(a)) == 0, "order differs with shared digits");
+
+    ASSERT_EQ(mobi_sort_entries(NULL, NULL, 0, 0), MOBI_OK, "empty sort");
+    ASSERT_EQ(mobi_sort_entries(NULL, NULL, 3, 0), MOBI_ERR_NULL, "null entries");
+    PASS();
+}
+
+/* Entries below (hi, lo), by a scan */
+static size_t count_below(const mobi_entry_t *e, size_t n, const mobi_bin_t *m) {
+    size_t i, below = 0;
+
+    for (i = 0; i < n; i++) {
+        below += e[i].hi < m->hi || (e[i].hi == m->hi && e[i].lo < m->lo);
+    }
+    return below;
+}
+
+static void test_dir_search_layer(void) {
+    TEST("search layer agrees with a scan at every size");
+
+    enum { MAX = 4099 };
+    static const size_t sizes[9] = { 1, 2, 15, 16, 17, 33, 255, 1024, MAX };
+    static mobi_bin_t bins[MAX];
+    char full[MOBI_FULL_LEN + 1];
+    mobi_bin_t start, end;
+    mobi_dir_t dir;
+    size_t s, i, first, count;
+
+    fill_colliding(bins, MAX, 0x5eed);
+    for (s = 0; s < 9; s++) {
+        size_t n = sizes[s];
+
+        ASSERT_EQ(mobi_dir_build(&dir, bins, n), MOBI_OK, "build failed");
+        ASSERT_EQ(dir.index_count, (n + 15) / 16, "search layer size");
+        /* Members, their neighbours' prefixes and mobis that are not there */
+        for (i = 0; i < 2 * n + 64; i++) {
+            static const size_t lens[6] = { 1, 4, 12, 15, 18, 21 };
+            mobi_bin_t m = bins[i % n];
+            size_t len = lens[i % 6];
+
+            if (i >= n) {
+                m.hi = (m.hi + i * 7919) % 1000000000000ULL;
+            }
+            mobi_bin_to_string(&m, MOBI_FULL_LEN, full);
+            ASSERT_EQ(mobi_lookup(&dir, full, len, &first, &count), MOBI_OK, "lookup failed");
+            ASSERT_EQ(mobi_prefix_range(full, len, &start, &end), MOBI_OK, "range failed");
+            ASSERT_EQ(first, count_below(dir.entries, n, &start), "first match");
+            ASSERT_EQ(first + count, count_below(dir.entries, n, &end), "end of matches");
+        }
+        mobi_dir_free(&dir);
+    }
+    PASS();
+}
+
+#define DIR_TMP "test_dir.tmp"
+
+static void test_dir_file(void) {
+    TEST("directory file roundtrip serves the same lookups");
+
+    enum { N = 5003 };
+    static const unsigned open_flags[2] = { 0, MOBI_DIR_POPULATE | MOBI_DIR_HUGEPAGES };
+    static uint8_t keys[N * 32];
+    static mobi_bin_t bins[N];
+    char full[MOBI_FULL_LEN + 1];
+    mobi_dir_t dir, mapped;
+    size_t i, first, count, mfirst, mcount;
+    int f;
+
+    fill_pubkeys(keys, N, 0xfeedfacecafebeefULL);
+    ASSERT_EQ(mobi_derive_batch_bin(keys, N, bins), MOBI_OK, "batch failed");
+    bins[7] = bins[3];
+    bins[8].hi = bins[3].hi;
+    ASSERT_EQ(mobi_dir_build(&dir, bins, N), MOBI_OK, "build failed");
+    ASSERT_EQ(mobi_dir_write(&dir, keys, DIR_TMP), MOBI_OK, "write failed");
+
+    for (f = 0; f < 2; f++) {
+        ASSERT_EQ(mobi_dir_open(&mapped, DIR_TMP, open_flags[f]), MOBI_OK, "open failed");
+        ASSERT_EQ(mapped.count, N, "count");
+        ASSERT_EQ(mapped.index_count, dir.index_count, "search layer size");
+        ASSERT(memcmp(mapped.entries, dir.entries, N * sizeof(mobi_entry_t)) == 0, "entries");
+        ASSERT(memcmp(mapped.index + 1, dir.index + 1,
+                      dir.index_count * sizeof(mobi_entry_t)) == 0, "search layer");
+        ASSERT(mapped.pubkeys != NULL, "pubkey column");
+        for (i = 0; i < N; i++) {
+            ASSERT(memcmp(mapped.pubkeys + i * 32, keys + mapped.entries[i].id * 32, 32) == 0,
+                   "pubkey not in entry order");
+        }
+        for (i = 0; i < N; i += 7) {
+            mobi_bin_to_string(&bins[i], MOBI_FULL_LEN, full);
+            mobi_lookup(&dir, full, 12 + 3 * (i % 4), &first, &count);
+            ASSERT_EQ(mobi_lookup(&mapped, full, 12 + 3 * (i % 4), &mfirst, &mcount), MOBI_OK,
+                      "lookup failed");
+            ASSERT(mfirst == first && mcount == count, "lookup differs from memory");
+        }
+        mobi_dir_free(&mapped);
+        ASSERT(mapped.map == NULL && mapped.entries == NULL, "free clears the directory");
+    }
+
+    /* Rewritten (smaller, without the pubkey column) while still mapped */
+    ASSERT_EQ(mobi_dir_open(&mapped, DIR_TMP, 0), MOBI_OK, "open failed");
+    ASSERT_EQ(mobi_dir_write(&dir, NULL, DIR_TMP), MOBI_OK, "write failed");
+    ASSERT_EQ(temps_left(DIR_TMP), 0, "temporary file left behind");
+    ASSERT(memcmp(mapped.pubkeys + (N - 1) * 32, keys + mapped.entries[N - 1].id * 32, 32)
+           == 0, "old mapping still serves");
+    mobi_dir_free(&mapped);
+    ASSERT_EQ(mobi_dir_open(&mapped, DIR_TMP, 0), MOBI_OK, "open failed");
+    ASSERT(mapped.pubkeys == NULL && mapped.count == N, "no pubkey column");
+    mobi_dir_free(&mapped);
+    mobi_dir_free(&dir);
+    ASSERT_EQ(mobi_dir_build(&dir, bins, 0), MOBI_OK, "empty build");
+    ASSERT_EQ(mobi_dir_write(&dir, keys, DIR_TMP), MOBI_OK, "empty write");
+    ASSERT_EQ(mobi_dir_open(&mapped, DIR_TMP, 0), MOBI_OK, "empty open");
+    ASSERT_EQ(mobi_lookup(&mapped, "1", 1, &first, &count), MOBI_OK, "empty lookup");
+    ASSERT_EQ(count, 0, "empty directory has no matches");
+    mobi_dir_free(&mapped);
+
+    remove(DIR_TMP);
+    PASS();
+}
+
+static void test_dir_file_rejects_bad_files(void) {
+    TEST("directory open rejects bad and truncated files");
+
+    static uint8_t keys[100 * 32];
+    static uint8_t buf[64 * 1024];
+    mobi_bin_t bins[100];
+    mobi_dir_t dir;
+    size_t len;
+    FILE *f;
+
+    ASSERT_EQ(mobi_dir_open(&dir, "/nonexistent/dir", 0), MOBI_ERR_IO, "missing file");
+    ASSERT_EQ(mobi_dir_open(NULL, DIR_TMP, 0), MOBI_ERR_NULL, "null directory");
+
+    fill_pubkeys(keys, 100, 42);
+    ASSERT_EQ(mobi_derive_batch_bin(keys, 100, bins), MOBI_OK, "batch failed");
+    ASSERT_EQ(mobi_dir_build(&dir, bins, 100), MOBI_OK, "build failed");
+    ASSERT_EQ(mobi_dir_write(&dir, keys, DIR_TMP), MOBI_OK, "write failed");
+    mobi_dir_free(&dir);
+
+    f = fopen(DIR_TMP, "rb");
+    ASSERT(f != NULL, "reopen failed");
+    len = fread(buf, 1, sizeof(buf), f);
+    fclose(f);
+    ASSERT(len > 3 * 4096 && len < sizeof(buf), "file size");
+
+    /* Last pubkey cut short */
+    f = fopen(DIR_TMP, "wb");
+    fwrite(buf, 1, len - 1, f);
+    fclose(f);
+    ASSERT_EQ(mobi_dir_open(&dir, DIR_TMP, 0), MOBI_ERR_FORMAT, "truncated");
+
+    /* Wrong magic, then a search layer that is not where it should be */
+    buf[0] ^= 1;
+    f = fopen(DIR_TMP, "wb");
+    fwrite(buf, 1, len, f);
+    fclose(f);
+    ASSERT_EQ(mobi_dir_open(&dir, DIR_TMP, 0), MOBI_ERR_FORMAT, "bad magic");
+    buf[0] ^= 1;
+    buf[40] ^= 0x10;
+    f = fopen(DIR_TMP, "wb");
+    fwrite(buf, 1, len, f);
+    fclose(f);
+    ASSERT_EQ(mobi_dir_open(&dir, DIR_TMP, 0), MOBI_ERR_FORMAT, "bad offset");
+    ASSERT(dir.map == NULL && dir.count == 0, "failed open leaves nothing to free");
+
+    remove(DIR_TMP);
+    PASS();
+}
+
+/* ============================================================================
+ * REGISTRY TESTS
+ * ============================================================================ */
+
+/* Registry levels, as tracked from reported changes, against the batch resolver */
+static int registry_agrees(const mobi_registry_t *reg, const mobi_bin_t *bins,
+                           const int *present, const uint8_t *tracked, size_t n) {
+    static mobi_bin_t set[3000];
+    static uint32_t ids[3000];
+    static uint8_t want[3000];
+    size_t i, k = 0;
+
+    for (i = 0; i < n; i++) {
+        if (present[i]) {
+            set[k] = bins[i];
+            ids[k++] = (uint32_t)i;
+        }
+    }
+    if (k != reg->count || mobi_resolve_levels(set, k, want, 1) != MOBI_OK) {
+        return 0;
+    }
+    for (i = 0; i < k; i++) {
+        uint8_t level = 0;
+
+        if (mobi_registry_level(reg, &set[i], ids[i], &level) != MOBI_OK ||
+            level != want[i] || tracked[ids[i]] != want[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void test_registry(void) {
+    TEST("registry keeps levels current through inserts and removes");
+
+    enum { N = 3000 };
+    static mobi_bin_t bins[N];
+    static int present[N];
+    static uint8_t tracked[N];
+    mobi_level_change_t changes[3];
+    mobi_registry_t reg;
+    mobi_bin_t a, b, bad;
+    size_t i, j, changed;
+    uint8_t level;
+
+    /* B collides with A at 12 digits: both move to 15, and back on removal */
+    a.hi = 123456789012ULL;
+    a.lo = 345000000;
+    b.hi = a.hi;
+    b.lo = 999000000;
+    ASSERT_EQ(mobi_registry_init(&reg), MOBI_OK, "init failed");
+    ASSERT_EQ(mobi_registry_insert(&reg, &a, 1, changes, &changed), MOBI_OK, "insert A");
+    ASSERT(changed == 1 && changes[0].id == 1 && changes[0].level == 12, "A alone is 12");
+    ASSERT_EQ(mobi_registry_insert(&reg, &b, 2, changes, &changed), MOBI_OK, "insert B");
+    ASSERT_EQ(changed, 2, "B and A change");
+    ASSERT(changes[0].id == 2 && changes[0].level == 15, "B is 15");
+    ASSERT(changes[1].id == 1 && changes[1].level == 15, "A moves to 15");
+    ASSERT_EQ(mobi_registry_level(&reg, &a, 1, &level), MOBI_OK, "level of A");
+    ASSERT_EQ(level, 15, "A reads 15");
+    ASSERT_EQ(mobi_registry_insert(&reg, &b, 2, NULL, NULL), MOBI_ERR_EXISTS, "twice");
+    ASSERT_EQ(mobi_registry_insert(&reg, &b, 3, NULL, &changed), MOBI_OK, "same mobi, new id");
+    ASSERT_EQ(mobi_registry_level(&reg, &b, 3, &level), MOBI_OK, "level of copy");
+    ASSERT_EQ(level, 21, "identical mobis need all 21 digits");
+    ASSERT_EQ(mobi_registry_remove(&reg, &b, 3, changes, &changed), MOBI_OK, "remove copy");
+    ASSERT(changed == 1 && changes[0].id == 2 && changes[0].level == 15, "B back to 15");
+    ASSERT_EQ(mobi_registry_remove(&reg, &b, 2, changes, &changed), MOBI_OK, "remove B");
+    ASSERT(changed == 1 && changes[0].id == 1 && changes[0].level == 12, "A back to 12");
+    ASSERT_EQ(mobi_registry_remove(&reg, &b, 2, NULL, NULL), MOBI_ERR_NOT_FOUND, "gone");
+    ASSERT_EQ(mobi_registry_level(&reg, &b, 2, &level), MOBI_ERR_NOT_FOUND, "no level");
+    bad.hi = 1000000000000ULL;
+    bad.lo = 0;
+    ASSERT_EQ(mobi_registry_insert(&reg, &bad, 9, NULL, NULL), MOBI_ERR_RANGE, "above 10^21");
+    mobi_registry_free(&reg);
+
+    /* Random traffic: the reported changes alone keep every level right */
+    fill_colliding(bins, N, 0x7e61);
+    ASSERT_EQ(mobi_registry_init(&reg), MOBI_OK, "init failed");
+    for (i = 0; i < 2 * N; i++) {
+        size_t u = i < N ? i : (i * 7919) % N;
+
+        if (!present[u]) {
+            ASSERT_EQ(mobi_registry_insert(&reg, &bins[u], (uint32_t)u, changes, &changed),
+                      MOBI_OK, "insert failed");
+            ASSERT(changed >= 1 && changed <= 3 && changes[0].id == u, "insert changes");
+        } else {
+            ASSERT_EQ(mobi_registry_remove(&reg, &bins[u], (uint32_t)u, changes, &changed),
+                      MOBI_OK, "remove failed");
+            ASSERT(changed <= 2, "remove changes");
+        }
+        present[u] = !present[u];
+        for (j = 0; j < changed; j++) {
+            tracked[changes[j].id] = changes[j].level;
+        }
+        if (i % 500 == 499) {
+            ASSERT(registry_agrees(&reg, bins, present, tracked, N), "levels differ");
+        }
+    }
+    mobi_registry_free(&reg);
+    PASS();
+}
+
+/* ============================================================================
+ * DISPLAY TABLE TESTS
+ * ============================================================================ */
+
+static int table_has(const mobi_table_t *t, const mobi_bin_t *m, uint32_t id) {
+    mobi_entry_t out[64];
+    size_t i, n = mobi_table_find(t, m->hi, out, 64);
+
+    for (i = 0; i < n && i < 64; i++) {
+        if (out[i].hi == m->hi && out[i].lo == m->lo && out[i].id == id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void test_table(void) {
+    TEST("display table maps a display to every user showing it");
+
+    enum { N = 5000 };
+    static mobi_bin_t bins[N];
+    mobi_entry_t out[4];
+    mobi_table_t t;
+    mobi_bin_t a, b, bad;
+    size_t i, round, probes;
+
+    a.hi = 587135537154ULL;
+    a.lo = 123456789;
+    b.hi = a.hi;
+    b.lo = 987654321;
+    ASSERT_EQ(mobi_table_init(&t, 100), MOBI_OK, "init failed");
+    ASSERT_EQ(mobi_table_find(&t, a.hi, out, 4), 0, "empty table");
+    ASSERT_EQ(mobi_table_insert(&t, &a, 1), MOBI_OK, "insert A");
+    ASSERT_EQ(mobi_table_insert(&t, &b, 2), MOBI_OK, "insert B");
+    ASSERT_EQ(mobi_table_insert(&t, &a, 1), MOBI_ERR_EXISTS, "A twice");
+    ASSERT_EQ(mobi_table_find(&t, a.hi, out, 4), 2, "both share the display");
+    ASSERT(out[0].id + out[1].id == 3 && out[0].lo + out[1].lo == a.lo + b.lo, "both users");
+    ASSERT_EQ(mobi_table_find(&t, a.hi, out, 1), 2, "count beyond max");
+    ASSERT_EQ(mobi_table_find(&t, a.hi + 1, out, 4), 0, "other display");
+    ASSERT_EQ(mobi_table_remove(&t, &a, 1), MOBI_OK, "remove A");
+    ASSERT_EQ(mobi_table_remove(&t, &a, 1), MOBI_ERR_NOT_FOUND, "A gone");
+    ASSERT_EQ(mobi_table_find(&t, a.hi, out, 4), 1, "B remains");
+    ASSERT(out[0].id == 2 && out[0].lo == b.lo, "B itself");
+    bad.hi = 1000000000000ULL;
+    bad.lo = 0;
+    ASSERT_EQ(mobi_table_insert(&t, &bad, 3), MOBI_ERR_RANGE, "above 10^21");
+    mobi_table_free(&t);
+
+    /* Full at the limit; removed slots are reused through heavy churn */
+    fill_colliding(bins, N, 0x7ab1e);
+    ASSERT_EQ(mobi_table_init(&t, N / 2), MOBI_OK, "init failed");
+    for (i = 0; i < N / 2; i++) {
+        ASSERT_EQ(mobi_table_insert(&t, &bins[i], (uint32_t)i), MOBI_OK, "insert failed");
+    }
+    ASSERT_EQ(mobi_table_insert(&t, &bins[N / 2], N / 2), MOBI_ERR_NOMEM, "over the limit");
+    for (round = 0; round < 20; round++) {
+        for (i = 0; i < N / 2; i++) {
+            size_t out_id = (round * (N / 2) + i) % N, in_id = (out_id + N / 2) % N;
+
+            ASSERT_EQ(mobi_table_remove(&t, &bins[out_id], (uint32_t)out_id), MOBI_OK,
+                      "churn remove");
+            ASSERT_EQ(mobi_table_insert(&t, &bins[in_id], (uint32_t)in_id), MOBI_OK,
+                      "churn insert");
+        }
+    }
+    ASSERT_EQ(t.count, N / 2, "count");
+    for (i = 0; i < N; i++) {
+        /* After 20 half-turns the first half is back in */
+        ASSERT_EQ(table_has(&t, &bins[i], (uint32_t)i), i < N / 2, "membership");
+    }
+    mobi_table_free(&t);
+
+    /* Insert/remove churn must not wear the table down to chains of removed slots */
+    ASSERT_EQ(mobi_table_init(&t, 1000), MOBI_OK, "init failed");
+    for (round = 0; round < 200000; round++) {
+        i = round % N;
+        ASSERT_EQ(mobi_table_insert(&t, &bins[i], (uint32_t)i), MOBI_OK, "churn insert");
+        ASSERT_EQ(mobi_table_remove(&t, &bins[i], (uint32_t)i), MOBI_OK, "churn remove");
+    }
+    ASSERT_EQ(t.count, 0, "empty after churn");
+    probes = 0;
+    for (i = 0; i < N; i++) {
+        probes += mobi_table_probes(&t, bins[i].hi);
+    }
+    ASSERT(probes / N < 16, "short probes after churn");
+    ASSERT(mobi_table_probes(&t, bins[0].hi) < t.mask, "a miss stops at an empty slot");
+    for (i = 0; i < 1000; i++) {
+        ASSERT_EQ(mobi_table_insert(&t, &bins[i], (uint32_t)i), MOBI_OK, "refill");
+    }
+    for (i = 0; i < N; i++) {
+        ASSERT_EQ(table_has(&t, &bins[i], (uint32_t)i), i < 1000, "membership after churn");
+    }
+    mobi_table_free(&t);
+    PASS();
+}
+
+typedef struct {
+    mobi_table_t *t;
+    const mobi_bin_t *bins;
+    size_t n;
+    int stop;
+    size_t torn;        /* readers: entries that do not match their id */
+    size_t lookups;
+} table_race;
+
+static void *table_reader(void *arg) {
+    table_race *r = (table_race *)arg;
+    mobi_entry_t out[16];
+    size_t i = 0;
+
+    while (!__atomic_load_n(&r->stop, __ATOMIC_RELAXED)) {
+        const mobi_bin_t *m = &r->bins[i];
+        size_t j, n = mobi_table_find(r->t, m->hi, out, 16);
+
+        for (j = 0; j < n && j < 16; j++) {
+            const mobi_bin_t *want = &r->bins[out[j].id];
+            if (out[j].id >= r->n || out[j].hi != want->hi || out[j].lo != want->lo) {
+                r->torn++;
+            }
+        }
+        __atomic_store_n(&r->lookups, r->lookups + 1, __ATOMIC_RELAXED);
+        i = (i + 1) % r->n;
+    }
+    return NULL;
+}
+
+typedef struct {
+    mobi_table_t *t;
+    const mobi_bin_t *bins;
+    size_t n;
+    int *go;
+    size_t added;       /* inserts that returned MOBI_OK */
+    size_t failed;      /* anything but MOBI_OK or MOBI_ERR_EXISTS */
+} table_dup;
+
+/* Every writer inserts the same users in the same order */
+static void *table_dup_writer(void *arg) {
+    table_dup *d = (table_dup *)arg;
+    size_t i;
+
+    while (!__atomic_load_n(d->go, __ATOMIC_ACQUIRE)) {
+        /* start together */
+    }
+    for (i = 0; i < d->n; i++) {
+        mobi_error_t err = mobi_table_insert(d->t, &d->bins[i], (uint32_t)i);
+
+        if (err == MOBI_OK) {
+            d->added++;
+        } else if (err != MOBI_ERR_EXISTS) {
+            d->failed++;
+        }
+    }
+    return NULL;
+}
+
+static void test_table_concurrent(void) {
+    TEST("display table readers see only whole users during writes");
+
+    enum { N = 20000, USERS = 8 * N, READERS = 3, WINDOW = N / 10 };
+    static mobi_bin_t bins[USERS];
+    static int present[USERS];
+    table_race race[READERS];
+    table_dup dup[READERS];
+    pthread_t readers[READERS];
+    mobi_table_t t;
+    size_t i, round, added = 0;
+    int r, go = 0;
+
+    fill_colliding(bins, USERS, 0xc0ffee);
+    ASSERT_EQ(mobi_table_init(&t, N), MOBI_OK, "init failed");
+    for (r = 0; r < READERS; r++) {
+        memset(&race[r], 0, sizeof(race[r]));
+        race[r].t = &t;
+        race[r].bins = bins;
+        race[r].n = USERS;
+        ASSERT(pthread_create(&readers[r], NULL, table_reader, &race[r]) == 0, "thread");
+    }
+    for (r = 0; r < READERS; r++) {
+        while (__atomic_load_n(&race[r].lookups, __ATOMIC_RELAXED) == 0) {
+            /* wait until every reader is running */
+        }
+    }
+
+    /* The writer fills the table, then churns it while the readers run */
+    for (round = 0; round < 8; round++) {
+        for (i = round % 2; i < N; i += 2) {
+            if (present[i]) {
+                ASSERT_EQ(mobi_table_remove(&t, &bins[i], (uint32_t)i), MOBI_OK, "remove");
+            } else {
+                ASSERT_EQ(mobi_table_insert(&t, &bins[i], (uint32_t)i), MOBI_OK, "insert");
+            }
+            present[i] = !present[i];
+        }
+    }
+
+    /* New users passing through: removed slots pile up and force rebuilds */
+    for (i = N; i < USERS; i++) {
+        ASSERT_EQ(mobi_table_insert(&t, &bins[i], (uint32_t)i), MOBI_OK, "window insert");
+        present[i] = 1;
+        if (i >= N + WINDOW) {
+            ASSERT_EQ(mobi_table_remove(&t, &bins[i - WINDOW], (uint32_t)(i - WINDOW)),
+                      MOBI_OK, "window remove");
+            present[i - WINDOW] = 0;
+        }
+    }
+    for (r = 0; r < READERS; r++) {
+        __atomic_store_n(&race[r].stop, 1, __ATOMIC_RELAXED);
+        pthread_join(readers[r], NULL);
+        ASSERT_EQ(race[r].torn, 0, "torn read");
+    }
+    for (i = 0; i < USERS; i++) {
+        ASSERT_EQ(table_has(&t, &bins[i], (uint32_t)i), present[i], "final membership");
+    }
+    mobi_table_free(&t);
+
+    /* Several threads registering the same users: each lands exactly once */
+    ASSERT_EQ(mobi_table_init(&t, N), MOBI_OK, "init failed");
+    for (r = 0; r < READERS; r++) {
+        memset(&dup[r], 0, sizeof(dup[r]));
+        dup[r].t = &t;
+        dup[r].bins = bins;
+        dup[r].n = N;
+        dup[r].go = &go;
+        ASSERT(pthread_create(&readers[r], NULL, table_dup_writer, &dup[r]) == 0, "thread");
+    }
+    __atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+    for (r = 0; r < READERS; r++) {
+        pthread_join(readers[r], NULL);
+        added += dup[r].added;
+        ASSERT_EQ(dup[r].failed, 0, "insert failed");
+    }
+    ASSERT_EQ(added, N, "one insert per user succeeded");
+    ASSERT_EQ(t.count, N, "count");
+    for (i = 0; i < N; i++) {
+        mobi_entry_t out[64];
+        size_t j, copies = 0, n = mobi_table_find(&t, bins[i].hi, out, 64);
+
+        ASSERT(n <= 64, "display shared by too many users");
+        for (j = 0; j < n; j++) {
+            copies += out[j].lo == bins[i].lo && out[j].id == i;
+        }
+        ASSERT_EQ(copies, 1, "user present once");
+    }
+    mobi_table_free(&t);
+    PASS();
+}
+
+/* ============================================================================
+ * DISPLAY FILTER TESTS
+ * ============================================================================ */
+
+#define FILTER_TMP "test_filter.tmp"
+
+static void test_filter(void) {
+    TEST("display filter has no false negatives and under 0.5% false positives");
+
+    enum { N = 200000 };
+    static const size_t sizes[6] = { 0, 1, 2, 3, 10, 100 };
+    static mobi_bin_t bins[2 * N];
+    static uint64_t displays[N];
+    mobi_filter_t f, g;
+    size_t i, s, positives = 0;
+    uint64_t bad = 1000000000000ULL;
+    uint8_t *copy;
+
+    /*
+     * Every fourth mobi repeats an earlier display; the others in the
+     * second half are displays that are not members.
+     */
+    fill_colliding(bins, 2 * N, 0xf17e);
+    for (i = 0; i < N; i++) {
+        displays[i] = bins[i].hi;
+    }
+    ASSERT_EQ(mobi_filter_build(&f, displays, N), MOBI_OK, "build failed");
+    ASSERT(f.count <= N && f.count >= N * 3 / 4, "distinct displays");
+    ASSERT(f.array_length * 8.0 / f.count < 9.6, "about 9 bits per display");
+    for (i = 0; i < N; i++) {
+        ASSERT(mobi_filter_contains(&f, displays[i]), "false negative");
+    }
+    for (i = N; i < 2 * N; i++) {
+        if (i % 4 != 0) {
+            positives += (size_t)mobi_filter_contains(&f, bins[i].hi);
+        }
+    }
+    ASSERT(positives < N * 3 / 4 / 200, "false-positive rate");
+
+    /* Serialized form: as a view of a copy, and through a file */
+    copy = malloc(f.data_len);
+    ASSERT(copy != NULL, "alloc");
+    memcpy(copy, f.data, f.data_len);
+    ASSERT_EQ(mobi_filter_view(&g, copy, f.data_len), MOBI_OK, "view failed");
+    for (i = 0; i < 2 * N; i += 3) {
+        ASSERT_EQ(mobi_filter_contains(&g, bins[i].hi), mobi_filter_contains(&f, bins[i].hi),
+                  "view answers differently");
+    }
+    ASSERT_EQ(mobi_filter_view(&g, copy, f.data_len - 1), MOBI_ERR_FORMAT, "truncated view");
+    copy[32] ^= 1;  /* segment length no longer a power of two */
+    ASSERT_EQ(mobi_filter_view(&g, copy, f.data_len), MOBI_ERR_FORMAT, "bad segment length");
+    free(copy);
+
+    ASSERT_EQ(mobi_filter_write(&f, FILTER_TMP), MOBI_OK, "write failed");
+    ASSERT_EQ(mobi_filter_open(&g, FILTER_TMP), MOBI_OK, "open failed");
+    ASSERT_EQ(g.count, f.count, "count");
+
+    /* Replaced by a much smaller filter while g still maps the old file */
+    {
+        mobi_filter_t small;
+
+        ASSERT_EQ(mobi_filter_build(&small, displays, 10), MOBI_OK, "small build");
+        ASSERT_EQ(mobi_filter_write(&small, FILTER_TMP), MOBI_OK, "rewrite failed");
+        mobi_filter_free(&small);
+    }
+    ASSERT_EQ(temps_left(FILTER_TMP), 0, "temporary file left behind");
+    for (i = 0; i < N; i += 7) {
+        ASSERT(mobi_filter_contains(&g, displays[i]), "false negative after open");
+    }
+    mobi_filter_free(&g);
+    mobi_filter_free(&f);
+    ASSERT_EQ(mobi_filter_open(&g, "/nonexistent/filter"), MOBI_ERR_IO, "missing file");
+    remove(FILTER_TMP);
+
+    /* Small sets, including empty and a single display */
+    for (s = 0; s < 6; s++) {
+        ASSERT_EQ(mobi_filter_build(&f, displays, sizes[s]), MOBI_OK, "small build");
+        for (i = 0; i < sizes[s]; i++) {
+            ASSERT(mobi_filter_contains(&f, displays[i]), "small false negative");
+        }
+        memcpy(&g, &f, sizeof(f));
+        ASSERT_EQ(mobi_filter_view(&g, f.data, f.data_len), MOBI_OK, "small view");
+        mobi_filter_free(&f);
+    }
+    ASSERT_EQ(mobi_filter_contains(NULL, 1), 0, "null filter");
+    ASSERT_EQ(mobi_filter_build(&f, &bad, 1), MOBI_ERR_RANGE, "display above 10^12");
+    PASS();
+}
+
+/* ============================================================================
+ * SUCCINCT DIRECTORY TESTS
+ * ============================================================================ */
+
+/* Sorted mobis below m, by binary search */
+static size_t bin_lower(const mobi_bin_t *sorted, size_t n, const mobi_bin_t *m) {
+    size_t first = 0;
+
+    while (n > 0) {
+        size_t half = n / 2;
+        if (mobi_bin_compare(&sorted[first + half], m) < 0) {
+            first += half + 1;
+            n -= half + 1;
+        } else {
+            n = half;
+        }
+    }
+    return first;
+}
+
+static void test_ef(void) {
+    TEST("Elias-Fano directory agrees with the sorted set");
+
+    enum { N = 100000 };
+    static const int levels[4] = { 12, 15, 18, 21 };
+    static mobi_bin_t bins[N], sorted[N], probes[N];
+    static mobi_entry_t e[N];
+    char full[MOBI_FULL_LEN + 1];
+    mobi_ef_t ef, again;
+    mobi_dir_t dir;
+    mobi_bin_t m, top;
+    size_t i, idx, first, count, dfirst, dcount;
+    int l;
+
+    fill_colliding(bins, N, 0xef);
+    fill_colliding(probes, N, 0xfe);
+    for (i = 0; i < N; i++) {
+        e[i].hi = bins[i].hi;
+        e[i].lo = bins[i].lo;
+        e[i].id = (uint32_t)i;
+    }
+    qsort(e, N, sizeof(mobi_entry_t), entry_order);
+    for (i = 0; i < N; i++) {
+        sorted[i].hi = e[i].hi;
+        sorted[i].lo = e[i].lo;
+    }
+
+    ASSERT_EQ(mobi_ef_build(&ef, bins, N, 0), MOBI_OK, "build failed");
+    ASSERT_EQ(ef.count, N, "count");
+    ASSERT(ef.bytes * 8 < (size_t)(ef.low_bits + 3) * N, "about l + 2 bits per mobi");
+    for (i = 0; i < N; i++) {
+        ASSERT_EQ(mobi_ef_select(&ef, i, &m), MOBI_OK, "select failed");
+        ASSERT(m.hi == sorted[i].hi && m.lo == sorted[i].lo, "select");
+    }
+    ASSERT_EQ(mobi_ef_select(&ef, N, &m), MOBI_ERR_RANGE, "select past the end");
+
+    /* Sorted input is encoded directly, to the same bits */
+    ASSERT_EQ(mobi_ef_build(&again, sorted, N, 1), MOBI_OK, "sorted build failed");
+    ASSERT(again.high_len == ef.high_len &&
+           memcmp(again.high, ef.high, (ef.high_len + 7) / 8) == 0 &&
+           memcmp(again.low, ef.low, (N * (size_t)ef.low_bits + 7) / 8) == 0, "same encoding");
+    mobi_ef_free(&again);
+
+    for (i = 0; i < N; i++) {
+        const mobi_bin_t *p = i % 2 ? &probes[i] : &bins[i];
+        size_t want = bin_lower(sorted, N, p);
+
+        ASSERT_EQ(mobi_ef_rank(&ef, p), want, "rank");
+        if (want < N) {
+            ASSERT_EQ(mobi_ef_successor(&ef, p, &idx, &m), MOBI_OK, "successor failed");
+            ASSERT(idx == want && m.hi == sorted[want].hi && m.lo == sorted[want].lo,
+                   "successor");
+        }
+    }
+    top.hi = 999999999999ULL;
+    top.lo = 999999999;
+    ASSERT_EQ(mobi_ef_successor(&ef, &top, &idx, &m), MOBI_ERR_NOT_FOUND, "no successor");
+
+    /* Prefix ranges match the sorted directory */
+    ASSERT_EQ(mobi_dir_build(&dir, bins, N), MOBI_OK, "dir build failed");
+    for (i = 0; i < 2000; i++) {
+        mobi_bin_to_string(i % 2 ? &probes[i] : &bins[i], MOBI_FULL_LEN, full);
+        for (l = 0; l < 4; l++) {
+            ASSERT_EQ(mobi_ef_lookup(&ef, full, (size_t)levels[l], &first, &count), MOBI_OK,
+                      "lookup failed");
+            mobi_lookup(&dir, full, (size_t)levels[l], &dfirst, &dcount);
+            ASSERT(first == dfirst && count == dcount, "lookup differs from directory");
+        }
+        ASSERT_EQ(mobi_ef_lookup(&ef, full, 1 + i % 11, &first, &count), MOBI_OK, "short");
+        mobi_lookup(&dir, full, 1 + i % 11, &dfirst, &dcount);
+        ASSERT(first == dfirst && count == dcount, "short prefix differs");
+    }
+    mobi_dir_free(&dir);
+    mobi_ef_free(&ef);
+
+    /* Tiny sets (l up to 69) at both ends of the range */
+    sorted[0].hi = 0;
+    sorted[0].lo = 0;
+    sorted[1].hi = 0;
+    sorted[1].lo = 1;
+    sorted[2] = top;
+    for (i = 0; i <= 3; i++) {
+        size_t j;
+
+        ASSERT_EQ(mobi_ef_build(&ef, sorted + 3 - i, i, 0), MOBI_OK, "tiny build");
+        for (j = 0; j < i; j++) {
+            const mobi_bin_t *want = &sorted[3 - i + j];
+            ASSERT_EQ(mobi_ef_select(&ef, j, &m), MOBI_OK, "tiny select");
+            ASSERT(m.hi == want->hi && m.lo == want->lo, "tiny value");
+            ASSERT_EQ(mobi_ef_rank(&ef, want), j, "tiny rank");
+        }
+        ASSERT_EQ(mobi_ef_lookup(&ef, "9", 1, &first, &count), MOBI_OK, "tiny lookup");
+        ASSERT_EQ(count, i >= 1, "top of the range");
+        mobi_ef_free(&ef);
+    }
+    m.hi = 1000000000000ULL;
+    ASSERT_EQ(mobi_ef_build(&ef, &m, 1, 0), MOBI_ERR_RANGE, "above 10^21");
+    PASS();
+}
+
+static void test_bin_search(void) {
+    TEST("interpolation search agrees with binary search");
+
+    enum { N = 100000 };
+    static const int levels[4] = { 12, 15, 18, 21 };
+    static const size_t sizes[6] = { 0, 1, 8, 9, 100, N };
+    static mobi_bin_t bins[N], sorted[N], skewed[N], probes[N];
+    static mobi_entry_t e[N];
+    char full[MOBI_FULL_LEN + 1];
+    mobi_bin_t m;
+    size_t i, s, first, count, bfirst, bcount;
+    int l;
+
+    fill_colliding(bins, N, 0x5e);
+    fill_colliding(probes, N, 0xe5);
+    for (i = 0; i < N; i++) {
+        e[i].hi = bins[i].hi;
+        e[i].lo = bins[i].lo;
+        e[i].id = (uint32_t)i;
+    }
+    qsort(e, N, sizeof(mobi_entry_t), entry_order);
+    for (i = 0; i < N; i++) {
+        sorted[i].hi = e[i].hi;
+        sorted[i].lo = e[i].lo;
+    }
+
+    /* Not uniform: runs of duplicates packed at both ends of the range */
+    for (i = 0; i < N; i++) {
+        skewed[i].hi = i < N / 2 ? i / 5 : 999999999999ULL - (N - 1 - i) / 5;
+        skewed[i].lo = (uint32_t)(i % 5 == 0 ? 0 : 7);
+    }
+
+    for (s = 0; s < 6; s++) {
+        for (i = 0; i < N; i++) {
+            const mobi_bin_t *p = i % 2 || sizes[s] == 0 ? &probes[i]
+                                                         : &sorted[(i * 7919) % sizes[s]];
+
+            ASSERT_EQ(mobi_bin_lower_bound(sorted, sizes[s], p, MOBI_SEARCH_INTERPOLATE),
+                      bin_lower(sorted, sizes[s], p), "uniform lower bound");
+            ASSERT_EQ(mobi_interp_lower_bound(sorted, sizes[s], p),
+                      bin_lower(sorted, sizes[s], p), "interpolated lower bound");
+            ASSERT_EQ(mobi_bin_lower_bound(sorted, sizes[s], p, MOBI_SEARCH_BINARY),
+                      bin_lower(sorted, sizes[s], p), "binary lower bound");
+            m.hi = i % 3 ? skewed[(i * 7919) % N].hi : probes[i].hi;
+            m.lo = (uint32_t)(i % 11);
+            ASSERT_EQ(mobi_bin_lower_bound(skewed, sizes[s], &m, MOBI_SEARCH_INTERPOLATE),
+                      bin_lower(skewed, sizes[s], &m), "skewed lower bound");
+            ASSERT_EQ(mobi_interp_lower_bound(skewed, sizes[s], &m),
+                      bin_lower(skewed, sizes[s], &m), "skewed interpolation");
+        }
+    }
+    m.hi = 1000000000000ULL;    /* 10^21, the end of the last prefix range */
+    m.lo = 0;
+    ASSERT_EQ(mobi_bin_lower_bound(sorted, N, &m, MOBI_SEARCH_INTERPOLATE), N, "past the end");
+    ASSERT_EQ(mobi_interp_lower_bound(sorted, N, &m), N, "interpolated past the end");
+    ASSERT_EQ(mobi_bin_lower_bound(NULL, N, &m, MOBI_SEARCH_INTERPOLATE), 0, "NULL array");
+
+    for (i = 0; i < 2000; i++) {
+        mobi_bin_to_string(i % 2 ? &probes[i] : &bins[i], MOBI_FULL_LEN, full);
+        for (l = 0; l < 4; l++) {
+            ASSERT_EQ(mobi_bin_lookup(sorted, N, full, (size_t)levels[l],
+                                      MOBI_SEARCH_INTERPOLATE, &first, &count), MOBI_OK,
+                      "lookup failed");
+            ASSERT_EQ(mobi_bin_lookup(sorted, N, full, (size_t)levels[l], MOBI_SEARCH_BINARY,
+                                      &bfirst, &bcount), MOBI_OK, "binary lookup failed");
+            ASSERT(first == bfirst && count == bcount, "lookup");
+            ASSERT(i % 2 == 1 || count >= 1, "members are found");
+        }
+    }
+    ASSERT_EQ(mobi_bin_lookup(sorted, N, full, 0, MOBI_SEARCH_INTERPOLATE, &first, &count),
+              MOBI_ERR_INVALID_LEN, "empty prefix");
+    ASSERT_EQ(mobi_bin_lookup(NULL, N, full, 12, MOBI_SEARCH_INTERPOLATE, &first, &count),
+              MOBI_ERR_NULL, "NULL array");
+    PASS();
+}
+
+/* ============================================================================
+ * PERFECT HASH TESTS
+ * ============================================================================ */
+
+#define MPHF_TMP "test_mphf.tmp"
+
+static void test_mphf(void) {
+    TEST("perfect hash gives members distinct slots and rejects the rest");
+
+    enum { N = 100000 };
+    static const size_t sizes[5] = { 0, 1, 2, 3, 100 };
+    static mobi_bin_t bins[N], sorted[N], probes[N];
+    static mobi_entry_t e[N];
+    static uint8_t seen[N];
+    mobi_mphf_t f, g;
+    mobi_bin_t bad;
+    size_t i, k, n, s;
+    uint64_t slot;
+    uint32_t id;
+    uint8_t *copy;
+
+    /* Distinct mobis in input order: drop the repeats fill_colliding makes */
+    fill_colliding(bins, N, 0x3f);
+    for (i = 0; i < N; i++) {
+        e[i].hi = bins[i].hi;
+        e[i].lo = bins[i].lo;
+        e[i].id = (uint32_t)i;
+    }
+    qsort(e, N, sizeof(mobi_entry_t), entry_order);
+    for (i = 1; i < N; i++) {
+        if (e[i].hi == e[i - 1].hi && e[i].lo == e[i - 1].lo) {
+            seen[e[i].id] = 1;
+        }
+    }
+    ASSERT_EQ(mobi_mphf_build(&f, bins, N, 0), MOBI_ERR_EXISTS, "repeated mobi");
+    for (i = 0, n = 0; i < N; i++) {
+        if (!seen[i]) {
+            bins[n++] = bins[i];
+        }
+    }
+    ASSERT(n < N && n > N / 2, "some repeats dropped");
+
+    ASSERT_EQ(mobi_mphf_build(&f, bins, n, 4), MOBI_OK, "build failed");
+    ASSERT_EQ(f.count, n, "count");
+    ASSERT(f.pilot_bytes * 8 < n * 4, "under 4 bits per mobi of pilots");
+    memset(seen, 0, sizeof(seen));
+    for (i = 0; i < n; i++) {
+        ASSERT_EQ(mobi_mphf_lookup(&f, &bins[i], &slot, &id), MOBI_OK, "member not found");
+        ASSERT(slot < n && !seen[slot], "slots are distinct");
+        ASSERT_EQ(slot, mobi_mphf_slot(&f, &bins[i]), "unverified slot");
+        ASSERT_EQ(id, i, "input index");
+        seen[slot] = 1;
+    }
+
+    /* Near misses of members and unrelated mobis: only members are found */
+    fill_colliding(probes, N, 0xf3);
+    for (i = 0; i < N; i++) {
+        sorted[i].hi = e[i].hi;
+        sorted[i].lo = e[i].lo;
+    }
+    for (i = 0; i < N; i++) {
+        mobi_bin_t m = i % 2 ? probes[i] : bins[i % n];
+        int member;
+
+        if (i % 2 == 0) {
+            m.lo ^= 1;
+        }
+        k = bin_lower(sorted, N, &m);
+        member = k < N && sorted[k].hi == m.hi && sorted[k].lo == m.lo;
+        ASSERT_EQ(mobi_mphf_lookup(&f, &m, NULL, &id) == MOBI_OK, member, "membership");
+        ASSERT(!member || (bins[id].hi == m.hi && bins[id].lo == m.lo), "wrong record");
+    }
+    bad.hi = 1000000000000ULL;
+    bad.lo = 0;
+    ASSERT_EQ(mobi_mphf_lookup(&f, &bad, NULL, NULL), MOBI_ERR_RANGE, "lookup above 10^21");
+
+    /* Same function on one thread */
+    ASSERT_EQ(mobi_mphf_build(&g, bins, n, 1), MOBI_OK, "single-thread build failed");
+    ASSERT(g.data_len == f.data_len && memcmp(g.data, f.data, f.data_len) == 0,
+           "same serialized form");
+    mobi_mphf_free(&g);
+
+    /* Serialized form: as a view of a copy, and through a file */
+    copy = malloc(f.data_len);
+    ASSERT(copy != NULL, "alloc");
+    memcpy(copy, f.data, f.data_len);
+    ASSERT_EQ(mobi_mphf_view(&g, copy, f.data_len), MOBI_OK, "view failed");
+    for (i = 0; i < n; i += 3) {
+        ASSERT_EQ(mobi_mphf_lookup(&g, &bins[i], NULL, &id), MOBI_OK, "view lookup");
+        ASSERT_EQ(id, i, "view input index");
+    }
+    ASSERT_EQ(mobi_mphf_view(&g, copy, f.data_len - 1), MOBI_ERR_FORMAT, "truncated view");
+    copy[MOBI_MPHF_HEADER_LEN + 32] ^= 1;   /* second partition starts one slot late */
+    ASSERT_EQ(mobi_mphf_view(&g, copy, f.data_len), MOBI_ERR_FORMAT, "bad partition");
+    free(copy);
+
+    ASSERT_EQ(mobi_mphf_write(&f, MPHF_TMP), MOBI_OK, "write failed");
+    ASSERT_EQ(mobi_mphf_open(&g, MPHF_TMP), MOBI_OK, "open failed");
+    ASSERT_EQ(g.count, n, "count after open");
+
+    /* Replaced by a much smaller one while g still maps the old file */
+    {
+        mobi_mphf_t small;
+
+        ASSERT_EQ(mobi_mphf_build(&small, bins, 10, 1), MOBI_OK, "small build");
+        ASSERT_EQ(mobi_mphf_write(&small, MPHF_TMP), MOBI_OK, "rewrite failed");
+        mobi_mphf_free(&small);
+    }
+    ASSERT_EQ(temps_left(MPHF_TMP), 0, "temporary file left behind");
+    for (i = 0; i < n; i += 7) {
+        ASSERT_EQ(mobi_mphf_lookup(&g, &bins[i], NULL, &id), MOBI_OK, "lookup after open");
+        ASSERT_EQ(id, i, "input index after open");
+    }
+    mobi_mphf_free(&g);
+    mobi_mphf_free(&f);
+    ASSERT_EQ(mobi_mphf_open(&g, "/nonexistent/mphf"), MOBI_ERR_IO, "missing file");
+    remove(MPHF_TMP);
+
+    /* Small sets, including empty and a single mobi */
+    for (s = 0; s < 5; s++) {
+        ASSERT_EQ(mobi_mphf_build(&f, bins, sizes[s], 1), MOBI_OK, "small build");
+        memset(seen, 0, sizes[s]);
+        for (i = 0; i < sizes[s]; i++) {
+            ASSERT_EQ(mobi_mphf_lookup(&f, &bins[i], &slot, &id), MOBI_OK, "small lookup");
+            ASSERT(slot < sizes[s] && !seen[slot] && id == i, "small slots");
+            seen[slot] = 1;
+        }
+        ASSERT_EQ(mobi_mphf_lookup(&f, &probes[1], NULL, NULL), MOBI_ERR_NOT_FOUND,
+                  "small non-member");
+        ASSERT_EQ(mobi_mphf_view(&g, f.data, f.data_len), MOBI_OK, "small view");
+        mobi_mphf_free(&f);
+    }
+    ASSERT_EQ(mobi_mphf_build(&f, &bad, 1, 1), MOBI_ERR_RANGE, "mobi above 10^21");
+    PASS();
+}
+
 /* ============================================================================
  * MAIN
  * ============================================================================ */
@@ -383,12 +2471,14 @@ int main(void) {
     test_derive_different_pubkeys();
     test_derive_invalid_hex();
     test_derive_invalid_length();
+    test_derive_hex_n();
     test_derive_null_ptr();
 
     printf("\nFormatting tests:\n");
     test_format_display();
     test_format_extended();
     test_format_full();
+    test_format_canonical();
 
     printf("\nNormalization tests:\n");
     test_normalize_with_hyphens();
@@ -410,6 +2500,61 @@ int main(void) {
     printf("\nUtility tests:\n");
     test_strerror();
 
+    printf("\nBackend tests:\n");
+    test_backend_vectors();
+    test_backend_random();
+
+    printf("\nBinary tests:\n");
+    test_bin_canonical();
+    test_bin_matches_strings();
+    test_bin_pack();
+    test_format_bin();
+
+    printf("\nBatch tests:\n");
+    test_batch_vectors();
+    test_batch_matches_single();
+    test_batch_edge_cases();
+    test_speculative_matches_single();
+    test_batch_mt_matches_single();
+    test_hex_decode_batch();
+
+    printf("\nCorpus tests:\n");
+    test_corpus_roundtrip();
+    test_corpus_writers_apart();
+    test_corpus_rejects_bad_files();
+    test_ingest();
+    test_ingest_ring_failure();
+
+    printf("\nArrow export tests:\n");
+    test_arrow_export();
+
+    printf("\nDirectory tests:\n");
+    test_dir_lookup();
+    test_resolve_levels();
+    test_sort_entries();
+    test_dir_search_layer();
+    test_dir_file();
+    test_dir_file_rejects_bad_files();
+
+    printf("\nRegistry tests:\n");
+    test_registry();
+
+    printf("\nDisplay table tests:\n");
+    test_table();
+    test_table_concurrent();
+
+    printf("\nDisplay filter tests:\n");
+    test_filter();
+
+    printf("\nSuccinct directory tests:\n");
+    test_ef();
+
+    printf("\nSorted search tests:\n");
+    test_bin_search();
+
+    printf("\nPerfect hash tests:\n");
+    test_mphf();
+
     printf("\n==========================\n");
     printf("Results: %d/%d tests passed\n", tests_passed, tests_run);
 